@@ -0,0 +1,140 @@
+#ifndef BENCH_H__
+#define BENCH_H__
+
+/*
+ * bench.h: shared micro-benchmark harness.
+ *
+ * Each benchmark program (see buffer-bench.c and friends) times one
+ * or more scenarios with the BENCH() macro:
+ *
+ *   bench_t b;
+ *   bench_begin(&b, "buf_printf/int", NOPS, 0);
+ *   BENCH(&b) {
+ *     ... one repetition: NOPS operations ...
+ *   }
+ *
+ * BENCH() runs the body a few unrecorded warmup repetitions, then
+ * BENCH_REPS recorded ones, each timed with DIFFTIME_NS from
+ * difftime.h.  bench_report() (called by the macro) sorts the
+ * samples, drops the top and bottom quartile -- scheduler noise and
+ * cache-cold outliers -- and prints the interquartile mean as ns/op,
+ * plus MB/s when the scenario declared a per-op payload size.
+ *
+ * Environment: BENCH_REPS and BENCH_WARMUP override the defaults.
+ *
+ * Output is one line per scenario:
+ *
+ *   buf_printf/int                        312.4 ns/op                (min 301.2)
+ *   buf_write/4k-ring                      88.1 ns/op   44341.2 MB/s (min 87.0)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "difftime.h"
+
+#define BENCH_SAMPLES_MAX       64
+
+#define BENCH_REPS_DEFAULT      9
+#define BENCH_WARMUP_DEFAULT    2
+
+struct bench_ {
+  const char *name;
+  long nops;                    /* operations per repetition */
+  double bytes;                 /* payload bytes per op; 0: no MB/s */
+
+  int warmup;
+  int reps;
+
+  long ns[BENCH_SAMPLES_MAX];
+  int nsamples;
+};
+typedef struct bench_ bench_t;
+
+
+static __inline__ void
+bench_begin(bench_t *b, const char *name, long nops, double bytes_per_op)
+{
+  const char *e;
+
+  b->name = name;
+  b->nops = nops;
+  b->bytes = bytes_per_op;
+  b->nsamples = 0;
+
+  b->reps = (e = getenv("BENCH_REPS")) ? atoi(e) : BENCH_REPS_DEFAULT;
+  if (b->reps < 1)
+    b->reps = 1;
+  if (b->reps > BENCH_SAMPLES_MAX)
+    b->reps = BENCH_SAMPLES_MAX;
+
+  b->warmup = (e = getenv("BENCH_WARMUP")) ? atoi(e) : BENCH_WARMUP_DEFAULT;
+  if (b->warmup < 0)
+    b->warmup = 0;
+}
+
+
+static __inline__ void
+bench_sample(bench_t *b, long ns)
+{
+  if (b->nsamples < BENCH_SAMPLES_MAX)
+    b->ns[b->nsamples++] = ns;
+}
+
+
+static int
+bench_cmp_ns_(const void *lhs, const void *rhs)
+{
+  long l = *(const long *)lhs, r = *(const long *)rhs;
+  return (l > r) - (l < r);
+}
+
+
+/*
+ * Interquartile mean over the recorded samples; with fewer than four
+ * samples, a plain mean.
+ */
+static __inline__ void
+bench_report(bench_t *b)
+{
+  int lo = 0, hi = b->nsamples, i;
+  double sum = 0.0, mean, nsop;
+
+  if (b->nsamples == 0)
+    return;
+
+  qsort(b->ns, b->nsamples, sizeof(b->ns[0]), bench_cmp_ns_);
+
+  if (b->nsamples >= 4) {
+    lo = b->nsamples / 4;
+    hi = b->nsamples - b->nsamples / 4;
+  }
+  for (i = lo; i < hi; i++)
+    sum += (double)b->ns[i];
+  mean = sum / (hi - lo);
+  nsop = mean / b->nops;
+
+  printf("%-36s %10.1f ns/op", b->name, nsop);
+  if (b->bytes > 0)
+    printf(" %10.1f MB/s", b->bytes * b->nops / mean * 1e9 / 1048576.0);
+  else
+    printf("%16s", "");
+  printf("  (min %.1f)\n", (double)b->ns[0] / b->nops);
+}
+
+
+/*
+ * for-loop trick in the spirit of DIFFTIME(); the body runs
+ * warmup + reps times, each repetition wrapped in DIFFTIME_NS, the
+ * warmups discarded, and the report printed when the loop ends.
+ */
+#define BENCH(b)                                                        \
+  for (int b_r__ = 0;                                                   \
+       b_r__ < (b)->warmup + (b)->reps || (bench_report(b), 0);         \
+       b_r__++)                                                         \
+    for (long b_ns__ = 0, b_c__ = 1; b_c__--;                           \
+         ((b_r__ >= (b)->warmup) ? bench_sample((b), b_ns__)            \
+                                 : (void)0))                            \
+      DIFFTIME_NS(b_ns__)
+
+#endif  /* BENCH_H__ */
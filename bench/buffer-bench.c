@@ -0,0 +1,137 @@
+/*
+ * buffer-bench: micro-benchmarks for buffer.c.
+ *
+ * Build:
+ *   $ make buffer-bench
+ * or
+ *   $ gcc -O2 -I.. -o buffer-bench buffer-bench.c ../buffer.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "bench.h"
+
+#define NOPS    100000L
+#define BLK     4096
+
+
+static void
+bench_printf_int(void)
+{
+  bench_t b;
+  long i;
+
+  bench_begin(&b, "buf_printf/int", NOPS, 0);
+  BENCH(&b) {
+    BUFFER *bp = buf_new();
+    for (i = 0; i < NOPS; i++)
+      buf_printf(bp, "%ld:", i);
+    buf_close(bp);
+  }
+}
+
+
+static void
+bench_printf_str(void)
+{
+  bench_t b;
+  long i;
+
+  bench_begin(&b, "buf_printf/str", NOPS, 0);
+  BENCH(&b) {
+    BUFFER *bp = buf_new();
+    for (i = 0; i < NOPS; i++)
+      buf_printf(bp, "key-%08ld=%s\n", i, "some value of typical size");
+    buf_close(bp);
+  }
+}
+
+
+static void
+bench_write_grow(void)
+{
+  static char blk[BLK];
+  bench_t b;
+  long i;
+
+  memset(blk, '*', sizeof(blk));
+
+  bench_begin(&b, "buf_write/4k-grow", NOPS / 10, BLK);
+  BENCH(&b) {
+    BUFFER *bp = buf_new();
+    for (i = 0; i < NOPS / 10; i++)
+      buf_write(blk, 1, sizeof(blk), bp);
+    buf_close(bp);
+  }
+}
+
+
+static void
+bench_write_ring(void)
+{
+  static char blk[BLK];
+  bench_t b;
+  long i;
+
+  /* steady-state ring: each written block is read right back, so the
+   * regions keep wrapping and nothing is ever memmove'd. */
+  bench_begin(&b, "buf_write+read/4k-ring", NOPS / 10, BLK);
+  BENCH(&b) {
+    BUFFER *bp = buf_new_ring();
+    for (i = 0; i < NOPS / 10; i++) {
+      buf_write(blk, 1, sizeof(blk), bp);
+      buf_read(blk, 1, sizeof(blk), bp);
+    }
+    buf_close(bp);
+  }
+}
+
+
+static void
+bench_new_close(void)
+{
+  bench_t b;
+  long i;
+
+  bench_begin(&b, "buf_new+close", NOPS / 10, 0);
+  BENCH(&b) {
+    for (i = 0; i < NOPS / 10; i++) {
+      BUFFER *bp = buf_new();
+      buf_printf(bp, "request %ld", i);
+      buf_close(bp);
+    }
+  }
+}
+
+
+static void
+bench_pool(void)
+{
+  bench_t b;
+  long i;
+
+  bench_begin(&b, "buf_pool_get+put", NOPS / 10, 0);
+  BENCH(&b) {
+    for (i = 0; i < NOPS / 10; i++) {
+      BUFFER *bp = buf_pool_get(0);
+      buf_printf(bp, "request %ld", i);
+      buf_pool_put(bp);
+    }
+  }
+  buf_pool_trim(0);
+}
+
+
+int
+main(void)
+{
+  bench_printf_int();
+  bench_printf_str();
+  bench_write_grow();
+  bench_write_ring();
+  bench_new_close();
+  bench_pool();
+  return 0;
+}
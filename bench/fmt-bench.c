@@ -0,0 +1,91 @@
+/*
+ * fmt-bench: micro-benchmarks for fmt.c.
+ *
+ * Build:
+ *   $ make fmt-bench
+ * or
+ *   $ gcc -O2 -I.. -o fmt-bench fmt-bench.c ../fmt.c ../fakeobs.c
+ */
+#include <string.h>
+
+#include "fmt.h"
+#include "bench.h"
+
+#define NOPS    10000L
+
+static const char *paragraph =
+  "The quick brown fox jumps over the lazy dog.  Pack my box with "
+  "five dozen liquor jugs.  How vexingly quick daft zebras jump!  "
+  "Sphinx of black quartz, judge my vow.  The five boxing wizards "
+  "jump quickly, and amazingly few discotheques provide jukeboxes.  "
+  "Jackdaws love my big sphinx of quartz; the quick onyx goblin "
+  "jumps over the lazy dwarf.";
+
+
+static void
+bench_format(void)
+{
+  bench_t b;
+  long i;
+  double bytes = strlen(paragraph);
+
+  bench_begin(&b, "fmt_format/72col", NOPS, bytes);
+  BENCH(&b) {
+    fmt_t *f = fmt_new(0);
+    fmt_set_width(f, 72);
+    for (i = 0; i < NOPS; i++)
+      fmt_format(f, paragraph);
+    fmt_delete(f);
+  }
+}
+
+
+static void
+bench_vectorize(void)
+{
+  bench_t b;
+  long i;
+  double bytes = strlen(paragraph);
+
+  bench_begin(&b, "fmt_format+vectorize", NOPS, bytes);
+  BENCH(&b) {
+    fmt_t *f = fmt_new(0);
+    fmt_set_width(f, 72);
+    for (i = 0; i < NOPS; i++) {
+      fmt_format(f, paragraph);
+      fmt_vectorize(f);
+    }
+    fmt_delete(f);
+  }
+}
+
+
+static void
+bench_vectorize_arena(void)
+{
+  bench_t b;
+  long i;
+  double bytes = strlen(paragraph);
+
+  bench_begin(&b, "fmt_format+vectorize/arena", NOPS, bytes);
+  BENCH(&b) {
+    fmt_t *f = fmt_new(FF_ARENA);
+    fmt_set_width(f, 72);
+    for (i = 0; i < NOPS; i++) {
+      fmt_format(f, paragraph);
+      fmt_vectorize(f);
+      fmt_arena_free(f);
+    }
+    fmt_delete(f);
+  }
+}
+
+
+int
+main(void)
+{
+  bench_format();
+  bench_vectorize();
+  bench_vectorize_arena();
+  return 0;
+}
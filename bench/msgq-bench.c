@@ -0,0 +1,76 @@
+/*
+ * msgq-bench: micro-benchmarks for msgq.c.
+ *
+ * Build:
+ *   $ make msgq-bench
+ * or
+ *   $ gcc -O2 -I.. -o msgq-bench msgq-bench.c ../msgq.c ../sglob.c \
+ *         -lpthread -lrt
+ *
+ * The two queues live in the same process, so the numbers cover the
+ * full send -> listener thread -> recv path minus any scheduling of a
+ * second process.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "msgq.h"
+#include "bench.h"
+
+#define NOPS            10000L
+
+#define ADDR_A          "/tmp/msgq-bench-a"
+#define ADDR_B          "/tmp/msgq-bench-b"
+
+
+static void
+bench_send_recv(MSGQ *qa, MSGQ *qb, size_t size)
+{
+  char *payload = malloc(size);
+  char name[64];
+  struct msgq_packet *pkt;
+  bench_t b;
+  long i;
+
+  memset(payload, '*', size);
+  snprintf(name, sizeof(name), "msgq send+recv/%lub",
+           (unsigned long)size);
+
+  bench_begin(&b, name, NOPS, size);
+  BENCH(&b) {
+    for (i = 0; i < NOPS; i++) {
+      if (msgq_send(qa, ADDR_B, payload, size) != 0)
+        continue;
+      pkt = msgq_recv_wait(qb);
+      if (pkt)
+        msgq_pkt_delete(pkt);
+    }
+  }
+
+  free(payload);
+}
+
+
+int
+main(void)
+{
+  MSGQ *qa, *qb;
+
+  unlink(ADDR_A);
+  unlink(ADDR_B);
+
+  qa = msgq_open(ADDR_A);
+  qb = msgq_open(ADDR_B);
+  if (!qa || !qb) {
+    fprintf(stderr, "error: msgq_open() failed\n");
+    return 1;
+  }
+
+  bench_send_recv(qa, qb, 64);
+  bench_send_recv(qa, qb, 1024);
+
+  msgq_close(qa);
+  msgq_close(qb);
+  return 0;
+}
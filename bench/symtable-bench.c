@@ -0,0 +1,117 @@
+/*
+ * symtable-bench: micro-benchmarks for symtable.c.
+ *
+ * Not built by default ("make" in bench/ skips it): symtable.c needs
+ * an obstack environment (the OBSTACK_* macro set) that obsutil.h
+ * does not provide in this tree, so the link fails here.  Where that
+ * environment exists:
+ *
+ *   $ make symtable-bench
+ * or
+ *   $ gcc -O2 -I.. -o symtable-bench symtable-bench.c ../symtable.c \
+ *         ../obsutil.c
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "symtable.h"
+#include "bench.h"
+
+#define NSYMS   10000L
+#define NOPS    100000L
+
+
+static char **
+make_names(long n)
+{
+  char **names = malloc(n * sizeof(char *));
+  char buf[32];
+  long i;
+
+  for (i = 0; i < n; i++) {
+    snprintf(buf, sizeof(buf), "sym-%06ld", i);
+    names[i] = strdup(buf);
+  }
+  return names;
+}
+
+
+static void
+bench_register(char **names)
+{
+  bench_t b;
+  long i;
+
+  bench_begin(&b, "symtable_register", NSYMS, 0);
+  BENCH(&b) {
+    symtable_t *st = symtable_new(NSYMS, 4, 0);
+    for (i = 0; i < NSYMS; i++)
+      symtable_register(st, names[i], &i, sizeof(i));
+    symtable_delete(st);
+  }
+}
+
+
+static void
+bench_lookup(char **names)
+{
+  symtable_t *st = symtable_new(NSYMS, 4, 0);
+  bench_t b;
+  long i;
+
+  for (i = 0; i < NSYMS; i++)
+    symtable_register(st, names[i], &i, sizeof(i));
+
+  bench_begin(&b, "symtable_lookup/hit", NOPS, 0);
+  BENCH(&b) {
+    for (i = 0; i < NOPS; i++)
+      symtable_lookup(st, names[i % NSYMS], NULL, 0);
+  }
+
+  bench_begin(&b, "symtable_lookup/miss", NOPS, 0);
+  BENCH(&b) {
+    for (i = 0; i < NOPS; i++)
+      symtable_lookup(st, "no-such-symbol", NULL, 0);
+  }
+
+  symtable_delete(st);
+}
+
+
+static void
+bench_substitute(char **names)
+{
+  symtable_t *st = symtable_new(NSYMS, 4, 0);
+  bench_t b;
+  long i;
+
+  for (i = 0; i < NSYMS; i++)
+    symtable_register(st, names[i], "expansion text", -1);
+
+  bench_begin(&b, "symtable_string_substitute", NOPS / 10, 0);
+  BENCH(&b) {
+    for (i = 0; i < NOPS / 10; i++)
+      symtable_string_substitute(st,
+                                 "prefix ${sym-000001} middle "
+                                 "${sym-000002} suffix");
+  }
+
+  symtable_delete(st);
+}
+
+
+int
+main(void)
+{
+  char **names = make_names(NSYMS);
+  long i;
+
+  bench_register(names);
+  bench_lookup(names);
+  bench_substitute(names);
+
+  for (i = 0; i < NSYMS; i++)
+    free(names[i]);
+  free(names);
+  return 0;
+}
@@ -1,10 +1,12 @@
 #include <assert.h>
+#include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "buffer.h"
+#include "ioprobe.h"
 
 
 BUFFER *
@@ -45,6 +47,9 @@ buf_open(void *data, size_t size, int flags)
   p->lim = p->end;
   p->mark = NULL;
 
+  p->head = 0;
+  p->len = 0;
+
   return p;
 }
 
@@ -56,6 +61,186 @@ buf_new(void)
 }
 
 
+BUFFER *
+buf_new_ring(void)
+{
+  return buf_open(NULL, 0, BF_GROW | BF_FREE | BF_RING);
+}
+
+
+BUFFER *
+buf_new_for_fd(int fd)
+{
+  BUFFER *p = buf_new();
+  int unit;
+
+  if (!p)
+    return NULL;
+
+  unit = ioprobe_best_bufsize(fd);
+  if (unit > 0 && (size_t)unit > p->unit)
+    p->unit = unit;
+
+  return p;
+}
+
+
+/*
+ * BUFFER pool (see buffer.h).  Idle buffers are kept on per-thread
+ * free lists bucketed by chunk capacity; no locking, no sharing
+ * between threads.
+ */
+
+/* bucket B holds chunks of capacity (BUF_POOL_MIN << B) */
+#define BUF_POOL_MIN            4096
+#define BUF_POOL_NBUCKET        9 /* 4K .. 1M */
+
+size_t buf_pool_limit = 4 * 1024 * 1024; /* idle byte(s) kept per thread */
+
+static __thread BUFFER *buf_pool[BUF_POOL_NBUCKET];
+static __thread size_t buf_pool_bytes;
+
+/* idle buffers are linked through their (unused) mark member */
+
+
+static __inline__ int
+buf_pool_bucket(size_t cap)
+{
+  size_t size = BUF_POOL_MIN;
+  int b;
+
+  for (b = 0; b < BUF_POOL_NBUCKET; b++, size <<= 1)
+    if (cap <= size)
+      return b;
+  return -1;                    /* too large to recycle */
+}
+
+
+BUFFER *
+buf_pool_get(size_t hint_size)
+{
+  BUFFER *bp;
+  int b = buf_pool_bucket(hint_size ? hint_size : 1);
+
+  if (b != -1) {
+    /* exact bucket first, then anything bigger */
+    for (; b < BUF_POOL_NBUCKET; b++)
+      if (buf_pool[b]) {
+        bp = buf_pool[b];
+        buf_pool[b] = (BUFFER *)bp->mark;
+        buf_pool_bytes -= bp->end - bp->data;
+
+        bp->flags = BF_GROW | BF_FREE;
+        bp->pos = bp->data;
+        bp->lim = bp->end;
+        bp->mark = NULL;
+        bp->head = 0;
+        bp->len = 0;
+        return bp;
+      }
+  }
+
+  bp = buf_new();
+  if (bp && hint_size)
+    buf_grow(bp, hint_size);
+  return bp;
+}
+
+
+void
+buf_pool_put(BUFFER *bp)
+{
+  int b;
+
+  if (!bp)
+    return;
+
+  if (!BUF_GROW(bp) || !BUF_FREE(bp) || BUF_RING(bp) ||
+      (b = buf_pool_bucket(bp->end - bp->data)) == -1) {
+    buf_close(bp);
+    return;
+  }
+
+  bp->mark = (char *)buf_pool[b];
+  buf_pool[b] = bp;
+  buf_pool_bytes += bp->end - bp->data;
+
+  if (buf_pool_bytes > buf_pool_limit)
+    buf_pool_trim(buf_pool_limit);
+}
+
+
+void
+buf_pool_trim(size_t max)
+{
+  int b;
+
+  /* release the largest idle chunks first */
+  for (b = BUF_POOL_NBUCKET - 1; b >= 0 && buf_pool_bytes > max; b--)
+    while (buf_pool[b] && buf_pool_bytes > max) {
+      BUFFER *bp = buf_pool[b];
+
+      buf_pool[b] = (BUFFER *)bp->mark;
+      buf_pool_bytes -= bp->end - bp->data;
+      free(bp->data);
+      free(bp);
+    }
+}
+
+
+/* Return the capacity of the ring buffer's mem chunk. */
+static size_t
+ring_cap(BUFFER *bp)
+{
+  return bp->end - bp->data;
+}
+
+
+/*
+ * Grow the ring buffer's mem chunk so that it can hold SIZE more
+ * byte(s).  The stored contents are linearized to the front of the
+ * new chunk, which is the only time a ring buffer ever moves bytes.
+ */
+static int
+ring_grow(BUFFER *bp, size_t size)
+{
+  size_t cap = ring_cap(bp);
+  size_t newcap, n1;
+  char *p;
+
+  if (cap - bp->len >= size)
+    return 0;
+
+  if (!BUF_GROW(bp))
+    return -1;
+
+  newcap = ((bp->len + size) / bp->unit + 1) * bp->unit;
+
+  p = malloc(newcap);
+  if (!p)
+    return -1;
+
+  n1 = cap - bp->head;
+  if (n1 > bp->len)
+    n1 = bp->len;
+
+  memcpy(p, bp->data + bp->head, n1);
+  memcpy(p + n1, bp->data, bp->len - n1);
+
+  if (BUF_FREE(bp))
+    free(bp->data);
+
+  bp->data = p;
+  bp->end = p + newcap;
+  bp->pos = bp->lim = p;        /* unused in ring mode */
+  bp->mark = NULL;
+  bp->head = 0;
+  bp->flags |= BF_FREE;
+
+  return 0;
+}
+
+
 void
 buf_close(BUFFER *bp)
 {
@@ -82,6 +267,9 @@ buf_clear(BUFFER *bp)
   bp->pos = bp->data;
   bp->lim = bp->end;
   bp->mark = NULL;
+
+  bp->head = 0;
+  bp->len = 0;
 }
 
 
@@ -137,8 +325,13 @@ buf_vprintf(BUFFER *bp, const char *format, va_list ap)
 {
   int needed;
   int avail, written;
+  va_list aq;
 
-  needed = vsnprintf(bp->pos, 0, format, ap);
+  /* the sizing pass must not consume AP -- on x86-64 a va_list is
+   * modified by the callee */
+  va_copy(aq, ap);
+  needed = vsnprintf(bp->pos, 0, format, aq);
+  va_end(aq);
 
   avail = bp->end - bp->pos;
 
@@ -196,6 +389,29 @@ buf_write(const void *ptr, size_t size, size_t nmemb, BUFFER *bp)
   size_t needed = size * nmemb;
   size_t avail = bp->end - bp->pos;
 
+  if (BUF_RING(bp)) {
+    size_t cap, tail, n1;
+
+    ring_grow(bp, needed);
+
+    cap = ring_cap(bp);
+    avail = cap - bp->len;
+
+    if (needed > avail)
+      needed = avail / size * size;
+
+    tail = (bp->head + bp->len) % cap;
+    n1 = cap - tail;
+    if (n1 > needed)
+      n1 = needed;
+
+    memcpy(bp->data + tail, ptr, n1);
+    memcpy(bp->data, (const char *)ptr + n1, needed - n1);
+    bp->len += needed;
+
+    return needed / size;
+  }
+
   if (avail < needed) {
     buf_grow(bp, needed);
   }
@@ -220,6 +436,26 @@ buf_read(void *ptr, size_t size, size_t nmemb, BUFFER *bp)
   size_t needed = size * nmemb;
   size_t avail;
 
+  if (BUF_RING(bp)) {
+    size_t cap = ring_cap(bp);
+    size_t n1;
+
+    if (needed > bp->len)
+      needed = bp->len / size * size;
+
+    n1 = cap - bp->head;
+    if (n1 > needed)
+      n1 = needed;
+
+    memcpy(ptr, bp->data + bp->head, n1);
+    memcpy((char *)ptr + n1, bp->data, needed - n1);
+
+    bp->head = (bp->head + needed) % cap;
+    bp->len -= needed;
+
+    return needed / size;
+  }
+
   if (bp->pos < bp->lim) {
     avail = bp->lim - bp->pos;
 
@@ -235,6 +471,128 @@ buf_read(void *ptr, size_t size, size_t nmemb, BUFFER *bp)
 }
 
 
+int
+buf_iov(BUFFER *bp, struct iovec *iov, int maxiov)
+{
+  if (maxiov < 1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (BUF_RING(bp)) {
+    size_t cap = ring_cap(bp);
+    size_t n1 = cap - bp->head;
+
+    if (bp->len == 0)
+      return 0;
+
+    if (n1 >= bp->len) {
+      iov[0].iov_base = bp->data + bp->head;
+      iov[0].iov_len = bp->len;
+      return 1;
+    }
+
+    if (maxiov < 2) {
+      errno = EINVAL;
+      return -1;
+    }
+
+    iov[0].iov_base = bp->data + bp->head;
+    iov[0].iov_len = n1;
+    iov[1].iov_base = bp->data;
+    iov[1].iov_len = bp->len - n1;
+    return 2;
+  }
+
+  if (bp->pos >= bp->lim)
+    return 0;
+
+  iov[0].iov_base = bp->pos;
+  iov[0].iov_len = bp->lim - bp->pos;
+
+  return 1;
+}
+
+
+ssize_t
+buf_writev(int fd, BUFFER *bp)
+{
+  struct iovec iov[2];
+  int niov;
+  ssize_t written;
+
+  niov = buf_iov(bp, iov, 2);
+  if (niov <= 0)
+    return niov;
+
+  written = writev(fd, iov, niov);
+  if (written > 0) {
+    if (BUF_RING(bp)) {
+      bp->head = (bp->head + written) % ring_cap(bp);
+      bp->len -= written;
+    }
+    else
+      bp->pos += written;
+  }
+
+  return written;
+}
+
+
+ssize_t
+buf_readv(int fd, BUFFER *bp)
+{
+  struct iovec iov[2];
+  int niov;
+  ssize_t readch;
+
+  if (BUF_RING(bp)) {
+    size_t cap, tail;
+
+    if (bp->len >= ring_cap(bp) &&
+        ring_grow(bp, bp->unit ? bp->unit : 1) < 0)
+      return 0;
+
+    cap = ring_cap(bp);
+    tail = (bp->head + bp->len) % cap;
+
+    if (tail >= bp->head && bp->len < cap) {
+      iov[0].iov_base = bp->data + tail;
+      iov[0].iov_len = cap - tail;
+      niov = 1;
+      if (bp->head > 0) {
+        iov[1].iov_base = bp->data;
+        iov[1].iov_len = bp->head;
+        niov = 2;
+      }
+    }
+    else {
+      iov[0].iov_base = bp->data + tail;
+      iov[0].iov_len = bp->head - tail;
+      niov = 1;
+    }
+
+    readch = readv(fd, iov, niov);
+    if (readch > 0)
+      bp->len += readch;
+
+    return readch;
+  }
+
+  if (bp->pos >= bp->end && buf_grow(bp, bp->unit ? bp->unit : 1) < 0)
+    return 0;
+
+  iov[0].iov_base = bp->pos;
+  iov[0].iov_len = bp->end - bp->pos;
+
+  readch = readv(fd, iov, 1);
+  if (readch > 0)
+    bp->pos += readch;
+
+  return readch;
+}
+
+
 int
 buf_flush(BUFFER *bp)
 {
@@ -468,6 +826,32 @@ main(int argc, char *argv[])
 
   buf_close(bp);
 
+  {
+    char tmp[8], out[64];
+    size_t n, total = 0;
+
+    bp = buf_open(malloc(8), 8, BF_FREE | BF_RING);
+
+    /* drive the read position past the middle, then wrap */
+    buf_write("0123456", 1, 7, bp);
+    buf_read(tmp, 1, 5, bp);
+    buf_write("789abcd", 1, 7, bp);   /* only 6 fit; wraps around */
+
+    while ((n = buf_read(out + total, 1, sizeof(out) - total, bp)) > 0)
+      total += n;
+    out[total] = '\0';
+    printf("ring read: %s\n", out);   /* expects 56789abc */
+
+    buf_close(bp);
+  }
+
+  bp = buf_new();
+  buf_puts("hello there via writev\n", bp);
+  buf_flip(bp);
+  while (buf_writev(STDOUT_FILENO, bp) > 0)
+    ;
+  buf_close(bp);
+
   return 0;
 }
 #endif  /* _TEST_BUFFER */
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdarg.h>
+#include <sys/uio.h>
 
 /*
  * This module provides BUFFER type and related functions and macros.
@@ -36,6 +37,9 @@ struct buffer {
   //char free;                     /* nonzero if DATA should be freed */
 
   size_t unit;
+
+  size_t head;                  /* ring mode: index of the oldest byte */
+  size_t len;                   /* ring mode: number of stored byte(s) */
 };
 
 
@@ -43,9 +47,11 @@ typedef struct buffer BUFFER;
 
 #define BF_GROW 0x01
 #define BF_FREE 0x02
+#define BF_RING 0x04
 
 #define BUF_GROW(buf)   ((buf)->flags & BF_GROW)
 #define BUF_FREE(buf)   ((buf)->flags & BF_FREE)
+#define BUF_RING(buf)   ((buf)->flags & BF_RING)
 
 /*
  * Create new BUFFER.
@@ -73,6 +79,65 @@ BUFFER *buf_new(void);
  */
 BUFFER *buf_open(void *data, size_t size, int flags);
 
+/*
+ * Create new BUFFER in circular (ring) mode.
+ *
+ * A ring buffer keeps a read region and a write region that wrap
+ * around the end of the mem chunk, so a partially-consumed buffer is
+ * never compacted with memmove; long-lived streaming sessions can
+ * interleave buf_write()/buf_read() (or buf_readv()/buf_writev())
+ * indefinitely without moving bytes.
+ *
+ * No buf_flip() is needed in ring mode; written byte(s) become
+ * readable immediately.  Only buf_read(), buf_write(), buf_iov(),
+ * buf_readv(), buf_writev() and buf_clear() understand ring mode;
+ * the position-based functions (buf_seek, buf_printf, buf_putc,
+ * etc.) must not be used on a ring buffer.
+ *
+ * You can also pass BF_RING to buf_open() to wrap an existing chunk.
+ */
+BUFFER *buf_new_ring(void);
+
+/*
+ * Create new BUFFER like buf_new(), but with the grow unit sized for
+ * I/O against the file descriptor FD.
+ *
+ * The grow unit is taken from ioprobe_best_bufsize() (see ioprobe.h),
+ * so a buffer that shuttles data to/from FD via buf_readv() and
+ * buf_writev() grows in the transfer size the fd's backing store
+ * prefers rather than in page-size steps.  FD is only probed; the
+ * BUFFER does not keep it.
+ */
+BUFFER *buf_new_for_fd(int fd);
+
+/*
+ * Pooled BUFFERs for request-scoped use.
+ *
+ * A server that creates and destroys one BUFFER per request pays
+ * malloc/free of the struct and its mem chunk on every request even
+ * though the sizes are stable.  buf_pool_get()/buf_pool_put() recycle
+ * whole BUFFERs through per-thread free lists bucketed by chunk
+ * capacity, so steady-state request handling allocates nothing.
+ *
+ * buf_pool_get() returns a growable BUFFER whose chunk can hold at
+ * least HINT_SIZE byte(s) (pass 0 if you don't care), either recycled
+ * or freshly created.  buf_pool_put() returns a BUFFER to the
+ * caller's pool instead of destroying it; buffers that cannot be
+ * recycled (non-growable, ring mode, or oversized chunks) are
+ * buf_close()d instead, so buf_pool_put() is always a safe drop-in
+ * for buf_close().
+ *
+ * Each thread keeps at most buf_pool_limit byte(s) of idle chunks
+ * (assign it before first use to change the high-water mark);
+ * buf_pool_trim(max) releases idle buffers until at most MAX byte(s)
+ * remain, so buf_pool_trim(0) frees everything.
+ */
+BUFFER *buf_pool_get(size_t hint_size);
+void buf_pool_put(BUFFER *bp);
+void buf_pool_trim(size_t max);
+
+extern size_t buf_pool_limit;
+
 void buf_close(BUFFER *bp);
 
 /*
@@ -137,6 +202,42 @@ char *buf_region_string(BUFFER *bp);
 size_t buf_read(void *ptr, size_t size, size_t nmemb, BUFFER *bp);
 size_t buf_write(const void *ptr, size_t size, size_t nmemb, BUFFER *bp);
 
+/*
+ * Export the readable region(s) of the buffer, BP as iovec(s).
+ *
+ * At most MAXIOV entries of IOV are filled, and the number of filled
+ * entries is returned.  It returns zero if there is nothing to read,
+ * or -1 (with EINVAL) if MAXIOV is too small to describe the buffer.
+ *
+ * The entries point into the internal mem chunk; any writing
+ * operation on BP may invalidate them.
+ */
+int buf_iov(BUFFER *bp, struct iovec *iov, int maxiov);
+
+/*
+ * Write the readable contents (between BP->pos and BP->lim) to the
+ * file descriptor FD via writev(2), without copying them into a
+ * separate chunk.  Like buf_read(), the caller should call
+ * buf_flip() beforehand if the buffer was in writing phase.
+ *
+ * On success, the buffer position is advanced by the number of
+ * byte(s) actually written, and that number is returned.  On error,
+ * it returns -1 with errno set by writev(2).
+ */
+ssize_t buf_writev(int fd, BUFFER *bp);
+
+/*
+ * Read from the file descriptor FD directly into the buffer's
+ * writable region via readv(2), without an intermediate copy.
+ *
+ * If the buffer is growable and full, the mem chunk is grown first.
+ * On success, the buffer position is advanced by the number of
+ * byte(s) actually read, and that number is returned.  It returns
+ * zero on EOF (or if a non-growable buffer is full), or -1 with
+ * errno set by readv(2).
+ */
+ssize_t buf_readv(int fd, BUFFER *bp);
+
 /*
  * Grow or shrink the mem chunk.
  *
@@ -1,13 +1,29 @@
+/*
+ * closewait: CLOSE_WAIT load/repro tool.
+ *
+ * The server side accepts and immediately closes; the client side
+ * connects and never closes, so every finished handshake leaves one
+ * socket in CLOSE_WAIT on the client.  The client is an epoll-driven
+ * non-blocking engine: `--rate' connects per second are launched with
+ * thousands in flight, and the per-state counters (SYN-sent,
+ * established, CLOSE_WAIT, failed) are printed every `--stats'
+ * seconds, so tens of thousands of half-closed sockets accumulate in
+ * seconds instead of one per connect timeout.
+ */
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <limits.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <pthread.h>
 #include <signal.h>
 #include <getopt.h>
@@ -17,11 +33,26 @@ pthread_t child_thread;
 int server_port = 19999;
 int try_count = -1;
 int block_term = 0;
+int conn_rate = 1000;           /* connects per second */
+int stats_interval = 1;         /* seconds between counter lines */
+
+/* per-fd connection state, indexed by fd */
+#define CS_FREE         0
+#define CS_SYN          1       /* connect(2) in flight */
+#define CS_EST          2       /* established, waiting for peer close */
+#define CS_CLOSEWAIT    3       /* peer closed; we hold the fd forever */
+
+static unsigned char *conn_state;
+static int conn_state_max;
+
+static long n_syn, n_est, n_closewait, n_failed, n_launched;
 
 struct option longopts[] = {
   { "count", required_argument, 0, 'c' },
   { "port", required_argument, 0, 'p' },
   { "block", no_argument, 0, 'b' },
+  { "rate", required_argument, 0, 'r' },
+  { "stats", required_argument, 0, 's' },
   { 0, 0, 0, 0, },
 };
 
@@ -37,7 +68,7 @@ main(int argc, char *argv[])
   char buf[LINE_MAX];
   int opt;
 
-  while ((opt = getopt_long(argc, argv, "c:p:b", longopts, NULL)) != -1) {
+  while ((opt = getopt_long(argc, argv, "c:p:r:s:b", longopts, NULL)) != -1) {
     switch (opt) {
     case 'p':
       server_port = atoi(optarg);
@@ -48,8 +79,27 @@ main(int argc, char *argv[])
     case 'b':
       block_term = 1;
       break;
+    case 'r':
+      conn_rate = atoi(optarg);
+      if (conn_rate < 1)
+        conn_rate = 1;
+      break;
+    case 's':
+      stats_interval = atoi(optarg);
+      if (stats_interval < 1)
+        stats_interval = 1;
+      break;
     default:
-      xerror(1, 0, "Usage: %s -p PORT -c COUNT", argv[0]);
+      xerror(1, 0, "Usage: %s -p PORT -c COUNT -r RATE -s SEC", argv[0]);
+    }
+  }
+
+  /* tens of thousands of held-open sockets need the headroom */
+  {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+      rl.rlim_cur = rl.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &rl);
     }
   }
 
@@ -88,7 +138,7 @@ main(int argc, char *argv[])
   if (bind(sfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
     xerror(1, errno, "bind() failed");
 
-  if (listen(sfd, 5) < 0)
+  if (listen(sfd, SOMAXCONN) < 0)
     xerror(1, errno, "listen() failed");
 
   {
@@ -109,7 +159,8 @@ main(int argc, char *argv[])
       write(STDOUT_FILENO, buf, readch);
     }
 #endif  /* 0 */
-    usleep(1000000);
+    /* closing right away is what parks the peer in CLOSE_WAIT; any
+     * delay here caps the whole tool at one connection per delay */
     close(fd);
   }
 
@@ -126,34 +177,196 @@ main(int argc, char *argv[])
 
 
 
+static long long
+now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static void
+set_state(int fd, int state)
+{
+  if (fd < 0 || fd >= conn_state_max)
+    return;
+
+  switch (conn_state[fd]) {
+  case CS_SYN:        n_syn--;       break;
+  case CS_EST:        n_est--;       break;
+  case CS_CLOSEWAIT:  n_closewait--; break;
+  }
+  switch (state) {
+  case CS_SYN:        n_syn++;       break;
+  case CS_EST:        n_est++;       break;
+  case CS_CLOSEWAIT:  n_closewait++; break;
+  }
+  conn_state[fd] = state;
+}
+
+
+/*
+ * Launch one non-blocking connect.  Returns 0 when the connect is in
+ * flight (or already done), -1 when fd/port exhaustion should pause
+ * the launcher for a while.
+ */
+static int
+launch_connect(int epfd)
+{
+  struct sockaddr_in addr;
+  struct epoll_event ev;
+  int fd;
+
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd == -1) {
+    if (errno == EMFILE || errno == ENFILE)
+      return -1;
+    xerror(0, errno, "child: socket(2) failed");
+    return -1;
+  }
+  if (fd >= conn_state_max) {   /* beyond our state table; give up on it */
+    close(fd);
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(server_port);
+
+  n_launched++;
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    if (errno != EINPROGRESS) {
+      n_failed++;
+      close(fd);
+      if (errno == EADDRNOTAVAIL)       /* ephemeral ports exhausted */
+        return -1;
+      return 0;
+    }
+
+    set_state(fd, CS_SYN);
+    ev.events = EPOLLOUT;
+    ev.data.fd = fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    return 0;
+  }
+
+  /* immediate success (loopback): wait for the peer's close */
+  set_state(fd, CS_EST);
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.fd = fd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+  return 0;
+}
+
+
 static void *
 child_main(void *arg)
 {
-  int fd;
-  int i;
-  struct sockaddr_in addr;
+  struct epoll_event events[256];
+  struct rlimit rl;
+  int epfd;
+  long long t0, last_stats;
+  long quota = 0;               /* launches owed by the rate so far */
+  int nev, i;
+
+  usleep(1000000);              /* let the accept loop come up */
 
-  usleep(5000000);
+  if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+    xerror(1, errno, "child: getrlimit(2) failed");
+  conn_state_max = rl.rlim_cur;
+  conn_state = calloc(conn_state_max, 1);
+  if (!conn_state)
+    xerror(1, errno, "child: calloc() failed");
 
-  for (i = 0; try_count == -1 || i < try_count; i++) {
-    fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd == -1) {
-      xerror(0, errno, "child: socket(2) failed");
-      continue;
+  epfd = epoll_create1(0);
+  if (epfd == -1)
+    xerror(1, errno, "child: epoll_create1(2) failed");
+
+  t0 = last_stats = now_ms();
+
+  while (1) {
+    long long now = now_ms();
+    long due = (now - t0) * conn_rate / 1000 - (n_launched - quota);
+
+    /* launch everything the rate owes us, unless done or out of fds */
+    while (due > 0 && (try_count == -1 || n_launched < try_count)) {
+      if (launch_connect(epfd) == -1) {
+        quota += due;           /* exhausted; forgive the backlog */
+        break;
+      }
+      due--;
     }
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(server_port);
 
-    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
-      xerror(0, errno, "child: connect(2) failed");
-      close(fd);
-      continue;
+    nev = epoll_wait(epfd, events, 256, 10);
+    if (nev == -1) {
+      if (errno == EINTR)
+        continue;
+      xerror(1, errno, "child: epoll_wait(2) failed");
     }
 
-    usleep(5000000);
+    for (i = 0; i < nev; i++) {
+      int fd = events[i].data.fd;
+
+      if (conn_state[fd] == CS_SYN) {
+        int soerr = 0;
+        socklen_t len = sizeof(soerr);
+
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &soerr, &len) == -1 ||
+            soerr != 0) {
+          n_failed++;
+          set_state(fd, CS_FREE);
+          epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+          close(fd);
+          continue;
+        }
+
+        set_state(fd, CS_EST);
+        events[i].events = EPOLLIN | EPOLLRDHUP;
+        events[i].data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &events[i]);
+      }
+      else if (conn_state[fd] == CS_EST) {
+        char buf[512];
+        ssize_t rd = read(fd, buf, sizeof(buf));
+
+        if (rd == 0 || (events[i].events & EPOLLRDHUP)) {
+          /* the peer closed; we never will -- that is the point.
+           * Drop the fd from epoll and hold it in CLOSE_WAIT. */
+          set_state(fd, CS_CLOSEWAIT);
+          epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+        }
+        else if (rd == -1 && errno != EAGAIN && errno != EINTR) {
+          n_failed++;
+          set_state(fd, CS_FREE);
+          epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+          close(fd);
+        }
+      }
+    }
+
+    if (now - last_stats >= (long long)stats_interval * 1000) {
+      fprintf(stderr,
+              "closewait: launched=%ld syn-sent=%ld established=%ld"
+              " close-wait=%ld failed=%ld\n",
+              n_launched, n_syn, n_est, n_closewait, n_failed);
+      last_stats = now;
+    }
+
+    if (try_count != -1 && n_launched >= try_count &&
+        n_syn == 0 && n_est == 0)
+      break;                    /* everything settled; keep holding */
   }
 
+  fprintf(stderr,
+          "closewait: done: launched=%ld close-wait=%ld failed=%ld\n",
+          n_launched, n_closewait, n_failed);
+
+  /* Hold the CLOSE_WAIT population until the process is killed. */
+  while (n_closewait > 0)
+    sleep(60);
+
   return 0;
 }
@@ -20,9 +20,15 @@
 #include <ctype.h>
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <obstack.h>
 
 #include "conf.h"
@@ -37,6 +43,7 @@
 
 struct confent {
   int type;
+  int dirty;                    /* CF_SECT: modified since last save */
 
   char *key;
   char *value;
@@ -47,13 +54,25 @@ struct confent {
 };
 
 
+/* Sections pruned since the last save; the journal needs a record
+ * for them even though they are gone from the table. */
+struct deadsect {
+  char *name;
+  struct deadsect *next;
+};
+
+
 struct conf_ {
   char *pathname;
 
   struct confent *sections;
   int dirty;
+  struct deadsect *dead;        /* see struct deadsect */
   unsigned flags;
 
+  const void *map;              /* binary snapshot mapped read-only, or NULL */
+  size_t map_size;
+
   size_t num_entries;
   size_t num_sections;
 
@@ -61,7 +80,14 @@ struct conf_ {
   int errno;
 
   size_t table_size;
-  struct confent *table[1];
+  struct confent **table;
+
+  /* Incremental rehashing: while OLD_TABLE is non-NULL a grow is in
+   * progress; buckets below OLD_MOVED are already migrated into TABLE,
+   * the rest still hold their chains.  See get_hash(). */
+  struct confent **old_table;
+  size_t old_table_size;
+  size_t old_moved;
 };
 
 
@@ -83,6 +109,13 @@ static char *cur_section(CONF *cf);
 static int parse_section(CONF *cf, char *line);
 
 static int conf_save_stream(CONF *cf, FILE *fp, const char *headers[]);
+static void write_pair(FILE *fp, const char *key, const char *value);
+static char *journal_path(const char *pathname);
+static int load_journal(CONF *cf, const char *pathname);
+static void clear_section(CONF *cf, const char *name);
+static void mark_dead(CONF *cf, const char *name);
+static void clear_dirty(CONF *cf);
+static void free_dead(CONF *cf);
 
 static struct confent *find_sect(CONF *cf, const char *sect);
 static struct confent *find_sect_create(CONF *cf, const char *sect);
@@ -103,6 +136,11 @@ static void delete_entry(CONF *cf, struct confent *ent);
 
 static void add_hash(CONF *cf, int index, struct confent *ent);
 
+static void rehash_start(CONF *cf);
+static void rehash_step(CONF *cf);
+static void rehash_finish(CONF *cf);
+static unsigned get_hash(CONF *cf, const char *s);
+
 static int blankline(const char *line);
 static int eol(FILE *fp, int ch);
 static char *getline(FILE *fp, int lookahead, int *lineno);
@@ -124,24 +162,98 @@ static struct obstack gl_stack_;
 #define IS_OVERWRITE(cf)        ((cf)->flags & CF_OVERWRITE)
 #define IS_PRUNE(cf)            ((cf)->flags & CF_PRUNE)
 
-#define GET_HASH(cf, s) (string_hash(s) % (cf)->table_size)
+#define GET_HASH(cf, s) get_hash((cf), (s))
+
+/*
+ * Binary snapshot layout (see conf_save_binary):
+ *
+ *   struct binhdr
+ *   uint32_t bucket[table_size]    -- offset of the first chain record
+ *   struct binent records
+ *   string data (null-terminated)
+ *
+ * Every cross reference is an offset from the beginning of the file,
+ * so the image is position independent and can be mapped anywhere.
+ * Offset zero (the header) means NULL.
+ */
+
+#define BIN_MAGIC       "CONF"
+#define BIN_VERSION     2       /* 2: string_hash() switched to FNV-1a */
+
+struct binhdr {
+  char magic[4];
+  uint32_t version;
+  uint32_t table_size;
+  uint32_t num_sections;
+  uint32_t num_entries;
+  uint32_t sections;            /* offset of the first section record */
+  uint64_t source_mtime;        /* st_mtime of the text file */
+};
+
+struct binent {
+  uint32_t type;
+  uint32_t key;                 /* string offset */
+  uint32_t value;               /* string offset, 0 for sections */
+  uint32_t next;                /* next record in the hash chain */
+  uint32_t sect;                /* like confent.sect */
+  uint32_t sibling;             /* like confent.sibling */
+};
+
+#define BIN_HDR(cf)     ((const struct binhdr *)(cf)->map)
+
+static int load_binary(CONF *cf, const char *pathname);
+
+static __inline__ const struct binent *
+bin_ent(CONF *cf, uint32_t off)
+{
+  return off ? (const struct binent *)((const char *)cf->map + off) : NULL;
+}
+
+static __inline__ const char *
+bin_str(CONF *cf, uint32_t off)
+{
+  return (const char *)cf->map + off;
+}
+
+static const struct binent *
+bin_find_sect(CONF *cf, const char *sect)
+{
+  const struct binhdr *hdr = BIN_HDR(cf);
+  const uint32_t *bucket = (const uint32_t *)(hdr + 1);
+  const struct binent *p;
+  uint32_t off = bucket[string_hash(sect) % hdr->table_size];
+
+  for (p = bin_ent(cf, off); p != NULL; p = bin_ent(cf, p->next))
+    if (p->type == CF_SECT && strcmp(bin_str(cf, p->key), sect) == 0)
+      return p;
+
+  return NULL;
+}
 
 
 CONF *
 conf_new(int size_hint)
 {
   CONF *cf;
-  int i;
 
   size_hint = get_nearest_prime(size_hint, 0);
-  cf = malloc(sizeof(*cf) + sizeof(struct confent *) * (size_hint - 1));
+  cf = malloc(sizeof(*cf));
   if (!cf)
     return NULL;
 
+  cf->table = calloc(size_hint, sizeof(*cf->table));
+  if (!cf->table) {
+    free(cf);
+    return NULL;
+  }
+
   cf->pathname = NULL;
   cf->sections = NULL;
+  cf->map = NULL;
+  cf->map_size = 0;
   cf->table_size = size_hint;
   cf->dirty = 0;
+  cf->dead = NULL;
   cf->flags = 0;
 
   cf->num_entries = 0;
@@ -150,8 +262,8 @@ conf_new(int size_hint)
   cf->cur_section = 0;
   cf->errno = 0;
 
-  for (i = 0; i < cf->table_size; i++)
-    cf->table[i] = NULL;
+  cf->old_table = NULL;
+  cf->old_table_size = cf->old_moved = 0;
 
   return cf;
 }
@@ -170,6 +282,23 @@ conf_load(CONF *cf, const char *pathname, int size_hint)
   if (!p)
     return -1;
 
+  {
+    /* An outstanding journal means the snapshot is stale. */
+    struct stat st;
+    char *jnl = journal_path(pathname);
+    int have_jnl = jnl && stat(jnl, &st) == 0 && st.st_size > 0;
+
+    free(jnl);
+
+    /* Fast path: map a fresh binary snapshot if one is around. */
+    if (!have_jnl && load_binary(cf, pathname) == 0) {
+      if (cf->pathname)
+        free(cf->pathname);
+      cf->pathname = p;
+      return 0;
+    }
+  }
+
   fp = fopen(pathname, "r");
   if (!fp) {
     free(p);
@@ -186,6 +315,10 @@ conf_load(CONF *cf, const char *pathname, int size_hint)
     if (cf->pathname)
       free(cf->pathname);
     cf->pathname = p;
+
+    load_journal(cf, pathname);
+    clear_dirty(cf);
+    free_dead(cf);
   }
 
   fclose(fp);
@@ -204,6 +337,8 @@ conf_close(CONF *cf)
     /* TODO: save */
   }
 
+  rehash_finish(cf);
+
   for (i = 0; i < cf->table_size; i++) {
     if (!cf->table[i])
       continue;
@@ -223,9 +358,14 @@ conf_close(CONF *cf)
     }
   }
 
+  if (cf->map)
+    munmap((void *)cf->map, cf->map_size);
+
   if (cf->pathname)
     free(cf->pathname);
 
+  free_dead(cf);
+  free(cf->table);
   free(cf);
   return 0;
 }
@@ -236,6 +376,9 @@ conf_add(CONF *cf, const char *sect, const char *key, const char *value)
 {
   struct confent *s;
 
+  if (cf->map || conf_frozen(cf)) /* read-only; see conf_clone() */
+    return -1;
+
   s = find_sect_create(cf, sect);
   if (!s)
     return -1;
@@ -243,6 +386,7 @@ conf_add(CONF *cf, const char *sect, const char *key, const char *value)
   if (add_entry(cf, s, key, value) == 0)
     return -1;
 
+  s->dirty = 1;
   cf->dirty = 1;
   return 0;
 }
@@ -251,10 +395,19 @@ conf_add(CONF *cf, const char *sect, const char *key, const char *value)
 int
 conf_remove(CONF *cf, const char *sect, const char *key)
 {
-  struct confent *ent = del_entry(cf, sect, key);
+  struct confent *ent;
+
+  if (cf->map || conf_frozen(cf)) /* read-only; see conf_clone() */
+    return -1;
+
+  ent = del_entry(cf, sect, key);
+  ent->sect->dirty = 1;
   sect_unref(cf, ent->sect);
   delete_entry(cf, ent);
 
+  if (!find_sect(cf, sect))     /* pruned; the journal needs a record */
+    mark_dead(cf, sect);
+
   cf->dirty = 1;
   return 0;
 }
@@ -266,6 +419,17 @@ conf_enum_section(CONF *cf, conf_enum_proc proc, void *data)
   struct confent *p;
   int index;
 
+  if (cf->map) {
+    const struct binent *b;
+
+    for (index = 0, b = bin_ent(cf, BIN_HDR(cf)->sections); b != NULL;
+         b = bin_ent(cf, b->sibling), index++) {
+      if (proc(bin_str(cf, b->key), 0, 0, index, data) < 0)
+        break;
+    }
+    return index;
+  }
+
   for (index = 0, p = cf->sections; p != 0; p = p->sibling, index++) {
     if (proc(p->key, 0, 0, index, data) < 0)
       break;
@@ -281,6 +445,31 @@ conf_enum(CONF *cf, const char *section, conf_enum_proc proc, void *data)
   struct confent *sect, *p;
   int index = 0;
 
+  if (cf->map) {
+    const struct binent *bs, *b;
+
+    if (section) {
+      bs = bin_find_sect(cf, section);
+      if (!bs)
+        return -1;
+
+      for (b = bin_ent(cf, bs->sect); b != NULL; b = bin_ent(cf, b->sibling))
+        if (proc(bin_str(cf, bs->key), bin_str(cf, b->key),
+                 bin_str(cf, b->value), index++, data) < 0)
+          break;
+    }
+    else {
+      for (bs = bin_ent(cf, BIN_HDR(cf)->sections); bs != NULL;
+           bs = bin_ent(cf, bs->sibling)) {
+        for (b = bin_ent(cf, bs->sect); b != NULL; b = bin_ent(cf, b->sibling))
+          if (proc(bin_str(cf, bs->key), bin_str(cf, b->key),
+                   bin_str(cf, b->value), index++, data) < 0)
+            break;
+      }
+    }
+    return index;
+  }
+
   if (section) {
     sect = find_sect(cf, section);
     if (!sect)
@@ -305,7 +494,144 @@ conf_enum(CONF *cf, const char *section, conf_enum_proc proc, void *data)
 void
 conf_set_dirty(CONF *cf, int dirty)
 {
+  struct confent *p;
+
   cf->dirty = dirty;
+  for (p = cf->sections; p != NULL; p = p->sibling)
+    p->dirty = dirty ? 1 : 0;
+}
+
+
+void
+conf_freeze(CONF *cf)
+{
+  cf->flags |= CF_FROZEN;
+}
+
+
+int
+conf_frozen(CONF *cf)
+{
+  return (cf->flags & CF_FROZEN) != 0;
+}
+
+
+CONF *
+conf_current(CONF **slot)
+{
+  return __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+}
+
+
+CONF *
+conf_publish(CONF **slot, CONF *cf)
+{
+  return __atomic_exchange_n(slot, cf, __ATOMIC_ACQ_REL);
+}
+
+
+/*
+ * Copy the entries of section SECT (given as NKEYS (key, value)
+ * pairs, in enumeration order) into NCF.  conf_add() prepends to the
+ * sibling list, so the pairs are added in reverse to preserve the
+ * original order.
+ */
+static int
+clone_pairs(CONF *ncf, const char *sect, const char **kv, size_t nkeys)
+{
+  while (nkeys--)
+    if (conf_add(ncf, sect, kv[nkeys * 2], kv[nkeys * 2 + 1]) < 0)
+      return -1;
+  return 0;
+}
+
+
+CONF *
+conf_clone(CONF *cf)
+{
+  CONF *ncf;
+  const char **kv = NULL;
+  size_t n, i;
+  int failed = 0;
+
+  ncf = conf_new(cf->map ? BIN_HDR(cf)->table_size : cf->table_size);
+  if (!ncf)
+    return NULL;
+
+  ncf->flags = cf->flags & ~CF_FROZEN;
+
+  if (cf->pathname) {
+    ncf->pathname = strdup(cf->pathname);
+    if (!ncf->pathname)
+      failed = 1;
+  }
+
+  if (cf->map) {
+    const struct binent *bs, *b;
+
+    for (bs = bin_ent(cf, BIN_HDR(cf)->sections); bs != NULL && !failed;
+         bs = bin_ent(cf, bs->sibling)) {
+      if (!find_sect_create(ncf, bin_str(cf, bs->key))) {
+        failed = 1;
+        break;
+      }
+
+      for (n = 0, b = bin_ent(cf, bs->sect); b != NULL;
+           b = bin_ent(cf, b->sibling))
+        n++;
+
+      kv = malloc(sizeof(*kv) * 2 * (n ? n : 1));
+      if (!kv) {
+        failed = 1;
+        break;
+      }
+      for (i = 0, b = bin_ent(cf, bs->sect); b != NULL;
+           b = bin_ent(cf, b->sibling), i++) {
+        kv[i * 2] = bin_str(cf, b->key);
+        kv[i * 2 + 1] = bin_str(cf, b->value);
+      }
+
+      failed = clone_pairs(ncf, bin_str(cf, bs->key), kv, n) < 0;
+      free(kv);
+    }
+  }
+  else {
+    struct confent *s, *e;
+
+    for (s = cf->sections; s != NULL && !failed; s = s->sibling) {
+      if (!find_sect_create(ncf, s->key)) {
+        failed = 1;
+        break;
+      }
+
+      for (n = 0, e = s->sect; e != NULL; e = e->sibling)
+        n++;
+
+      kv = malloc(sizeof(*kv) * 2 * (n ? n : 1));
+      if (!kv) {
+        failed = 1;
+        break;
+      }
+      for (i = 0, e = s->sect; e != NULL; e = e->sibling, i++) {
+        kv[i * 2] = e->key;
+        kv[i * 2 + 1] = e->value;
+      }
+
+      failed = clone_pairs(ncf, s->key, kv, n) < 0;
+      free(kv);
+    }
+  }
+
+  if (failed) {
+    conf_close(ncf);
+    return NULL;
+  }
+
+  ncf->dirty = cf->dirty;       /* conf_add() above marked it dirty */
+  if (!ncf->dirty)
+    clear_dirty(ncf);
+
+  return ncf;
 }
 
 
@@ -313,6 +639,10 @@ int
 conf_save_as(CONF *cf, const char *pathname, const char *headers[])
 {
   char *p;
+
+  if (cf->map)                  /* snapshot-backed CONF is read-only */
+    return -1;
+
   p = strdup(pathname);
   if (!p)
     return -1;
@@ -333,6 +663,9 @@ conf_save(CONF *cf, const char *headers[])
   FILE *fp;
   int ret;
 
+  if (cf->map)                  /* snapshot-backed CONF is read-only */
+    return -1;
+
   if (!cf->dirty)
     return 0;
 
@@ -350,6 +683,15 @@ conf_save(CONF *cf, const char *headers[])
   }
 
   fclose(fp);
+
+  {
+    /* a full save makes any outstanding journal obsolete */
+    char *jnl = journal_path(cf->pathname);
+    if (jnl) {
+      unlink(jnl);
+      free(jnl);
+    }
+  }
   return 0;
 }
 
@@ -381,25 +723,444 @@ conf_save_stream(CONF *cf, FILE *fp, const char *headers[])
   for (p = cf->sections; p != NULL; p = p->sibling) {
     fprintf(fp, "[%s]\n", p->key);
 
-    for (q = p->sect; q != NULL; q = q->sibling) {
-      if (strpbrk(q->key, " \t\b\r\n\v"))
-        fprintf(fp, "\"%s\"", q->key);
-      else
-        fprintf(fp, "%s", q->key);
+    for (q = p->sect; q != NULL; q = q->sibling)
+      write_pair(fp, q->key, q->value);
+    fprintf(fp, "\n");
+  }
 
-      fprintf(fp, " = ");
+  cf->dirty = 0;
+  clear_dirty(cf);
+  free_dead(cf);
 
-      if (strpbrk(q->value, " \t\b\r\n\v"))
-        fprintf(fp, "\"%s\"", q->value);
-      else
-        fprintf(fp, "%s", q->value);
+  return 0;
+}
 
-      fprintf(fp, "\n");
+
+static void
+write_pair(FILE *fp, const char *key, const char *value)
+{
+  if (strpbrk(key, " \t\b\r\n\v"))
+    fprintf(fp, "\"%s\"", key);
+  else
+    fprintf(fp, "%s", key);
+
+  fprintf(fp, " = ");
+
+  if (strpbrk(value, " \t\b\r\n\v"))
+    fprintf(fp, "\"%s\"", value);
+  else
+    fprintf(fp, "%s", value);
+
+  fprintf(fp, "\n");
+}
+
+
+static char *
+journal_path(const char *pathname)
+{
+  char *p;
+
+  if (!pathname)
+    return NULL;
+
+  p = malloc(strlen(pathname) + sizeof(".jnl"));
+  if (p)
+    sprintf(p, "%s.jnl", pathname);
+  return p;
+}
+
+
+static void
+clear_dirty(CONF *cf)
+{
+  struct confent *p;
+
+  for (p = cf->sections; p != NULL; p = p->sibling)
+    p->dirty = 0;
+}
+
+
+static void
+free_dead(CONF *cf)
+{
+  struct deadsect *d;
+
+  while ((d = cf->dead) != NULL) {
+    cf->dead = d->next;
+    free(d->name);
+    free(d);
+  }
+}
+
+
+static void
+mark_dead(CONF *cf, const char *name)
+{
+  struct deadsect *d;
+
+  for (d = cf->dead; d != NULL; d = d->next)
+    if (strcmp(d->name, name) == 0)
+      return;
+
+  d = malloc(sizeof(*d));
+  if (!d)
+    return;                     /* worst case: full save catches it */
+  d->name = strdup(name);
+  if (!d->name) {
+    free(d);
+    return;
+  }
+  d->next = cf->dead;
+  cf->dead = d;
+}
+
+
+/* Remove every entry of section NAME (replace-record semantics). */
+static void
+clear_section(CONF *cf, const char *name)
+{
+  struct confent *s;
+
+  while ((s = find_sect(cf, name)) != NULL && s->sect != NULL)
+    conf_remove(cf, name, s->sect->key);
+}
+
+
+/*
+ * Replay "<pathname>.jnl" on top of the parsed text file.  Each
+ * section record replaces the section's previous contents, so the
+ * last record for a section wins.
+ */
+static int
+load_journal(CONF *cf, const char *pathname)
+{
+  char *jnlpath, *line, *key, *value;
+  FILE *fp;
+  int lineno = 0;
+
+  jnlpath = journal_path(pathname);
+  if (!jnlpath)
+    return -1;
+
+  fp = fopen(jnlpath, "r");
+  free(jnlpath);
+  if (!fp)
+    return 0;                   /* no journal; nothing to replay */
+
+  while ((line = getline(fp, EOF, &lineno)) != NULL) {
+    if (strlen(line) == 0 || blankline(line)) {
+      free(line);
+      continue;
+    }
+    if (line[0] == '#' || line[0] == '!' || line[0] == ';') {
+      free(line);
+      continue;
+    }
+    if (parse_section(cf, line) == 0) {
+      clear_section(cf, cur_section(cf));
+      free(line);
+      continue;
+    }
+    if (get_pair(line, &key, &value) == 0)
+      conf_add(cf, cur_section(cf), key, value);
+    free(line);
+  }
+
+  fclose(fp);
+  return 0;
+}
+
+
+#ifndef CF_JOURNAL_LIMIT
+#define CF_JOURNAL_LIMIT        (1024 * 1024)
+#endif
+
+int
+conf_save_journal(CONF *cf, long compact_limit)
+{
+  struct confent *p, *q;
+  struct deadsect *d;
+  struct stat st;
+  char *jnlpath;
+  FILE *fp;
+  long size = 0;
+
+  if (cf->map)                  /* snapshot-backed CONF is read-only */
+    return -1;
+
+  if (!cf->pathname)
+    return -1;
+
+  if (compact_limit <= 0)
+    compact_limit = CF_JOURNAL_LIMIT;
+
+  jnlpath = journal_path(cf->pathname);
+  if (!jnlpath)
+    return -1;
+
+  if (stat(jnlpath, &st) == 0)
+    size = st.st_size;
+
+  if (size >= compact_limit) {
+    /* compact: fold the journal into the text file */
+    fp = fopen(cf->pathname, "w");
+    if (!fp) {
+      free(jnlpath);
+      return -1;
+    }
+    if (conf_save_stream(cf, fp, NULL) < 0) {
+      fclose(fp);
+      free(jnlpath);
+      return -1;
     }
+    fclose(fp);
+    unlink(jnlpath);
+    free(jnlpath);
+    return 0;
+  }
+
+  if (!cf->dirty && !cf->dead) {
+    free(jnlpath);
+    return 0;                   /* nothing changed */
+  }
+
+  fp = fopen(jnlpath, "a");
+  free(jnlpath);
+  if (!fp)
+    return -1;
+
+  /* a record with no entries clears the section on replay */
+  for (d = cf->dead; d != NULL; d = d->next)
+    fprintf(fp, "[%s]\n\n", d->name);
+
+  for (p = cf->sections; p != NULL; p = p->sibling) {
+    if (!p->dirty)
+      continue;
+
+    fprintf(fp, "[%s]\n", p->key);
+    for (q = p->sect; q != NULL; q = q->sibling)
+      write_pair(fp, q->key, q->value);
     fprintf(fp, "\n");
   }
 
+  if (fclose(fp) != 0)
+    return -1;
+
   cf->dirty = 0;
+  clear_dirty(cf);
+  free_dead(cf);
+
+  return 0;
+}
+
+
+/* pointer -> file offset mapping used while writing the snapshot */
+struct binref {
+  const struct confent *ent;
+  uint32_t off;
+};
+
+static int
+binref_cmp(const void *a, const void *b)
+{
+  const struct confent *x = ((const struct binref *)a)->ent;
+  const struct confent *y = ((const struct binref *)b)->ent;
+
+  if (x < y)
+    return -1;
+  return x > y;
+}
+
+static uint32_t
+binref_off(const struct binref *refs, size_t nrefs, const struct confent *ent)
+{
+  struct binref key, *found;
+
+  if (!ent)
+    return 0;
+
+  key.ent = ent;
+  found = bsearch(&key, refs, nrefs, sizeof(key), binref_cmp);
+  assert(found != NULL);
+  return found->off;
+}
+
+
+int
+conf_save_binary(CONF *cf, const char *pathname)
+{
+  struct binhdr hdr;
+  struct binref *refs;
+  struct binent bent;
+  struct confent *p;
+  struct stat st;
+  char *binpath = NULL;
+  FILE *fp = NULL;
+  size_t nrefs, n;
+  uint32_t off, stroff;
+  int i;
+
+  if (cf->map)
+    return -1;
+
+  rehash_finish(cf);            /* lay out one coherent table */
+
+  if (!pathname) {
+    if (!cf->pathname)
+      return -1;
+    binpath = malloc(strlen(cf->pathname) + sizeof(".bin"));
+    if (!binpath)
+      return -1;
+    sprintf(binpath, "%s.bin", cf->pathname);
+    pathname = binpath;
+  }
+
+  nrefs = cf->num_sections + cf->num_entries;
+  refs = malloc(sizeof(*refs) * (nrefs ? nrefs : 1));
+  if (!refs) {
+    free(binpath);
+    return -1;
+  }
+
+  /* First pass: lay out the records in bucket/chain order. */
+  off = sizeof(hdr) + cf->table_size * sizeof(uint32_t);
+  n = 0;
+  for (i = 0; i < cf->table_size; i++)
+    for (p = cf->table[i]; p != NULL; p = p->next) {
+      assert(n < nrefs);
+      refs[n].ent = p;
+      refs[n].off = off;
+      off += sizeof(struct binent);
+      n++;
+    }
+  assert(n == nrefs);
+
+  qsort(refs, nrefs, sizeof(*refs), binref_cmp);
+
+  memcpy(hdr.magic, BIN_MAGIC, 4);
+  hdr.version = BIN_VERSION;
+  hdr.table_size = cf->table_size;
+  hdr.num_sections = cf->num_sections;
+  hdr.num_entries = cf->num_entries;
+  hdr.sections = binref_off(refs, nrefs, cf->sections);
+  hdr.source_mtime = 0;
+  if (cf->pathname && stat(cf->pathname, &st) == 0)
+    hdr.source_mtime = st.st_mtime;
+
+  fp = fopen(pathname, "wb");
+  if (!fp)
+    goto err;
+
+  if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+    goto err;
+
+  /* bucket array */
+  for (i = 0; i < cf->table_size; i++) {
+    uint32_t b = binref_off(refs, nrefs, cf->table[i]);
+    if (fwrite(&b, sizeof(b), 1, fp) != 1)
+      goto err;
+  }
+
+  /* records; string offsets are assigned sequentially after OFF */
+  stroff = off;
+  for (i = 0; i < cf->table_size; i++)
+    for (p = cf->table[i]; p != NULL; p = p->next) {
+      bent.type = p->type;
+      bent.key = stroff;
+      stroff += strlen(p->key) + 1;
+      if (p->type == CF_ENTRY && p->value) {
+        bent.value = stroff;
+        stroff += strlen(p->value) + 1;
+      }
+      else
+        bent.value = 0;
+      bent.next = binref_off(refs, nrefs, p->next);
+      bent.sect = binref_off(refs, nrefs, p->sect);
+      bent.sibling = binref_off(refs, nrefs, p->sibling);
+
+      if (fwrite(&bent, sizeof(bent), 1, fp) != 1)
+        goto err;
+    }
+
+  /* string data, in the same order the offsets were assigned */
+  for (i = 0; i < cf->table_size; i++)
+    for (p = cf->table[i]; p != NULL; p = p->next) {
+      if (fwrite(p->key, strlen(p->key) + 1, 1, fp) != 1)
+        goto err;
+      if (p->type == CF_ENTRY && p->value)
+        if (fwrite(p->value, strlen(p->value) + 1, 1, fp) != 1)
+          goto err;
+    }
+
+  if (fclose(fp) != 0) {
+    fp = NULL;
+    goto err;
+  }
+
+  free(refs);
+  free(binpath);
+  return 0;
+
+ err:
+  if (fp)
+    fclose(fp);
+  free(refs);
+  free(binpath);
+  return -1;
+}
+
+
+/*
+ * Map "<pathname>.bin" read-only into CF if it exists, validates, and
+ * is not older than the text file at PATHNAME.  Returns 0 on success.
+ */
+static int
+load_binary(CONF *cf, const char *pathname)
+{
+  struct stat st_text, st_bin;
+  const struct binhdr *hdr;
+  char *binpath;
+  void *map;
+  int fd;
+
+  if (cf->map)                  /* already backed by a snapshot */
+    return -1;
+
+  if (stat(pathname, &st_text) < 0)
+    return -1;
+
+  binpath = malloc(strlen(pathname) + sizeof(".bin"));
+  if (!binpath)
+    return -1;
+  sprintf(binpath, "%s.bin", pathname);
+
+  fd = open(binpath, O_RDONLY);
+  free(binpath);
+  if (fd < 0)
+    return -1;
+
+  if (fstat(fd, &st_bin) < 0 || st_bin.st_size < sizeof(struct binhdr)) {
+    close(fd);
+    return -1;
+  }
+
+  map = mmap(NULL, st_bin.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+
+  hdr = (const struct binhdr *)map;
+  if (memcmp(hdr->magic, BIN_MAGIC, 4) != 0 ||
+      hdr->version != BIN_VERSION ||
+      hdr->source_mtime != (uint64_t)st_text.st_mtime) {
+    munmap(map, st_bin.st_size);
+    return -1;
+  }
+
+  cf->map = map;
+  cf->map_size = st_bin.st_size;
+  cf->num_sections = hdr->num_sections;
+  cf->num_entries = hdr->num_entries;
 
   return 0;
 }
@@ -689,6 +1450,7 @@ new_entry(int type, const char *key, const char *value)
 
   p->next = p->sect = p->sibling = NULL;
   p->type = type;
+  p->dirty = 0;
 
   return p;
 
@@ -720,6 +1482,101 @@ delete_entry(CONF *cf, struct confent *ent)
 }
 
 
+/*
+ * The table grows automatically; once the chains average REHASH_LOAD
+ * entries, add_hash() allocates a larger table and the old one is
+ * drained a few buckets per operation (from get_hash()), so no single
+ * call pays for rehashing everything at once.
+ */
+#define REHASH_LOAD     2
+#define REHASH_STEP     8
+
+static void
+rehash_start(CONF *cf)
+{
+  struct confent **ntable;
+  size_t nsize = get_nearest_prime(cf->table_size * 2, 0);
+
+  if (nsize <= cf->table_size)  /* already at the largest prime */
+    return;
+
+  ntable = calloc(nsize, sizeof(*ntable));
+  if (!ntable)                  /* no memory; live with the long chains */
+    return;
+
+  cf->old_table = cf->table;
+  cf->old_table_size = cf->table_size;
+  cf->old_moved = 0;
+
+  cf->table = ntable;
+  cf->table_size = nsize;
+}
+
+
+static void
+rehash_bucket(CONF *cf, size_t index)
+{
+  struct confent *p, *next;
+  size_t i;
+
+  for (p = cf->old_table[index]; p != NULL; p = next) {
+    next = p->next;
+    i = string_hash(p->key) % cf->table_size;
+    p->next = cf->table[i];
+    cf->table[i] = p;
+  }
+  cf->old_table[index] = NULL;
+}
+
+
+static void
+rehash_step(CONF *cf)
+{
+  int n = REHASH_STEP;
+
+  while (n-- > 0 && cf->old_moved < cf->old_table_size)
+    rehash_bucket(cf, cf->old_moved++);
+
+  if (cf->old_moved >= cf->old_table_size) {
+    free(cf->old_table);
+    cf->old_table = NULL;
+    cf->old_table_size = cf->old_moved = 0;
+  }
+}
+
+
+/* Complete a pending rehash; anything that walks the whole table
+ * (saving, closing) needs one coherent table to iterate. */
+static void
+rehash_finish(CONF *cf)
+{
+  while (cf->old_table)
+    rehash_step(cf);
+}
+
+
+/*
+ * All bucket indices come from here.  During a rehash the bucket S
+ * would land in is migrated first, so the caller always finds S's
+ * whole chain in the current table and never needs to look at the old
+ * one; then a few more buckets are drained to keep the rehash moving.
+ */
+static unsigned
+get_hash(CONF *cf, const char *s)
+{
+  unsigned long h = string_hash(s);
+
+  if (cf->old_table) {
+    size_t i = h % cf->old_table_size;
+
+    if (i >= cf->old_moved)
+      rehash_bucket(cf, i);
+    rehash_step(cf);
+  }
+  return h % cf->table_size;
+}
+
+
 static void
 add_hash(CONF *cf, int index, struct confent *ent)
 {
@@ -730,6 +1587,10 @@ add_hash(CONF *cf, int index, struct confent *ent)
 
   ent->next = cf->table[index];
   cf->table[index] = ent;
+
+  if (!cf->old_table &&
+      cf->num_entries + cf->num_sections > cf->table_size * REHASH_LOAD)
+    rehash_start(cf);
 }
 
 
@@ -757,7 +1618,6 @@ find_entry(CONF *cf, const char *sect, const char *key, struct confent **prev)
           *prev = q;
         return p;
       }
-      return NULL;
     }
     else if (strcmp(p->key, key) == 0) {
       if (prev)
@@ -831,7 +1691,7 @@ del_entry(CONF *cf, const char *sect, const char *key)
   }
   /* TODO: Can P be NULL?  */
   if (p == ent->sect->sect)
-    ent->sect = p->sibling;
+    ent->sect->sect = p->sibling;
   else
     prev->sibling = p->sibling;
   p->sibling = 0;
@@ -869,14 +1729,18 @@ sect_unref(CONF *cf, struct confent *ent)
 static unsigned long
 string_hash(const char *s)
 {
-  /* Stealed from GNU glib, g_string_hash function */
-  const char *p = s;
-  int len = strlen(s);
-  unsigned long h = 0;
-
-  while (len--) {
-    h = (h << 5) - h + *p;
-    p++;
+  /* 32-bit FNV-1a.  The old glib-style shift-add hash clustered badly
+   * on keys sharing a common prefix, which our section names do; this
+   * one mixes every byte into the whole word for the same cost.
+   *
+   * The binary snapshot stores chains laid out with this function, so
+   * changing it requires bumping BIN_VERSION. */
+  const unsigned char *p = (const unsigned char *)s;
+  unsigned long h = 2166136261UL;
+
+  while (*p) {
+    h ^= *p++;
+    h *= 16777619UL;
   }
 
   return h;
@@ -1136,6 +2000,9 @@ conf_dump(CONF *cf, FILE *fp)
   fprintf(fp, "  num_entries: %zu\n", cf->num_entries);
   fprintf(fp, "  num_sections: %zu\n", cf->num_sections);
   fprintf(fp, "  table_size: %zu\n", cf->table_size);
+  if (cf->old_table)
+    fprintf(fp, "  rehash: %zu/%zu bucket(s) moved\n",
+            cf->old_moved, cf->old_table_size);
 
   fprintf(fp, "  sections: %p\n", cf->sections);
   if (cf->sections)
@@ -1172,11 +2039,15 @@ main(int argc, char *argv[])
   CONF *cf;
   cf = conf_new(64);
 
-  if (argc == 2) {
+  if (argc >= 2) {
     //conf_dump(cf, stdout);
     if (conf_load(cf, argv[1], 32) < 0) {
       fprintf(stderr, "conf_load() failed");
     }
+    if (argc == 3 && strcmp(argv[2], "-b") == 0) {
+      if (conf_save_binary(cf, NULL) < 0)
+        fprintf(stderr, "conf_save_binary() failed");
+    }
   }
 #if 1
   puts("\n\n-- enum_section -----------------------------------------");
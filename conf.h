@@ -39,15 +39,56 @@ BEGIN_C_DECLS
 #define CF_OVERWRITE    0x0001
 #define CF_PRUNE        0x0002
 #define CF_VERBOSE      0x0004
+#define CF_FROZEN       0x0008
 
 struct conf_;
 typedef struct conf_ CONF;
 
+/* HASH_SIZE is only the initial bucket count; the table grows
+ * automatically (with incremental rehashing) as entries are added, so
+ * a small guess costs nothing but a few early rehash steps. */
 extern CONF *conf_new(int hash_size);
 extern int conf_load(CONF *cf, const char *pathname, int hash_size);
 extern int conf_save(CONF *cf, const char *headers[]);
 extern int conf_save_as(CONF *cf, const char *pathname, const char *headers[]);
 
+/*
+ * Save a binary snapshot of CF into PATHNAME.
+ *
+ * The snapshot is a relocatable, mmap-friendly image of the whole
+ * section/entry hash table; all cross references are file offsets.
+ * If PATHNAME is NULL, "<textfile>.bin" is used.
+ *
+ * conf_load() transparently prefers "<textfile>.bin" when it exists
+ * and is not older than the text file (the snapshot records the text
+ * file's mtime), in which case the image is mapped read-only and no
+ * parsing or table building happens.  The text file remains the
+ * source of truth; a stale snapshot is silently ignored.
+ *
+ * A CONF backed by a snapshot is read-only: conf_add(), conf_remove()
+ * and the save functions fail with -1 on it.
+ */
+extern int conf_save_binary(CONF *cf, const char *pathname);
+
+/*
+ * Append-journal save.
+ *
+ * Dirtiness is tracked per section; conf_save_journal() appends a
+ * record for each section modified since the last save (its current
+ * entries, replacing the previous contents on replay) to
+ * "<textfile>.jnl", so a steady-state checkpoint costs only the
+ * change set instead of rewriting the whole file.  conf_load()
+ * replays the journal on top of the text file transparently.
+ *
+ * When the journal grows beyond COMPACT_LIMIT bytes (pass 0 for the
+ * default, 1 MB), the text file is rewritten in full and the journal
+ * is removed.  conf_save()/conf_save_as() also leave the journal
+ * obsolete, so they remove it as well.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+extern int conf_save_journal(CONF *cf, long compact_limit);
+
 //extern CONF *conf_open(const char *pathname, int size_hint);
 extern int conf_close(CONF *cf);
 
@@ -61,6 +102,29 @@ extern int conf_remove(CONF *cf, const char *sect, const char *key);
 
 extern void conf_set_dirty(CONF *cf, int dirty);
 
+/*
+ * Read-mostly (concurrent reader) mode.
+ *
+ * After loading, call conf_freeze() to mark CF immutable.  A frozen
+ * CONF rejects conf_add()/conf_remove() (-1), and since none of the
+ * lookup or enumeration functions modify the table, any number of
+ * threads may then call conf_section_count(), conf_entry_count(),
+ * conf_enum_section() and conf_enum() concurrently without locks.
+ *
+ * The rare update goes through copy-on-write: conf_clone() builds an
+ * unfrozen deep copy (works for snapshot-backed CONFs, too), the
+ * writer applies conf_add()/conf_remove() to the copy, freezes it,
+ * and atomically publishes it with conf_publish().  Readers obtain
+ * the current table with conf_current().  The previous CONF returned
+ * by conf_publish() must be conf_close()d only after every reader
+ * that may still hold it is done with it.
+ */
+extern void conf_freeze(CONF *cf);
+extern int conf_frozen(CONF *cf);
+extern CONF *conf_clone(CONF *cf);
+extern CONF *conf_publish(CONF **slot, CONF *cf);
+extern CONF *conf_current(CONF **slot);
+
 typedef int (*conf_enum_proc)(const char *section,
                               const char *key, const char *value,
                               int index, void *data);
@@ -22,16 +22,122 @@
 #include <cstdio>
 #include <cstdarg>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <map>
 #include "df.hpp"
 
+#ifdef _PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef _PTHREAD
+//
+// Bookkeeping for update_batch().
+//
+// Each mount has a vfsjob holding its last statvfs result; the jobs
+// double as the TTL cache.  A worker thread runs one statvfs(2) per
+// dispatched job and may outlive both the deadline and the DiskFree
+// itself (a hung NFS server can pin it for minutes), so the whole
+// structure is reference counted: the DiskFree holds one reference,
+// every running worker another, and whoever drops the last one frees
+// it.
+//
+struct vfsjob {
+  std::string path;
+  struct statvfs vfs;
+  time_t updated;               // 0 = no result yet
+  int error;                    // errno of the last failed statvfs
+  bool pending;                 // a worker is out for this job
+  struct vfsshared *shared;
+};
+
+struct vfsshared {
+  pthread_mutex_t lck;
+  pthread_cond_t cond;
+  int refs;
+  int npending;
+  std::map<std::string, vfsjob *> jobs;
+};
+
+static vfsshared *
+vfsshared_new()
+{
+  vfsshared *sh = new vfsshared;
+
+  pthread_mutex_init(&sh->lck, 0);
+  pthread_cond_init(&sh->cond, 0);
+  sh->refs = 1;
+  sh->npending = 0;
+  return sh;
+}
+
+// Call with SH->lck held; unlocks it.
+static void
+vfsshared_release(vfsshared *sh)
+{
+  int refs = --sh->refs;
+
+  pthread_mutex_unlock(&sh->lck);
+  if (refs > 0)
+    return;
+
+  for (std::map<std::string, vfsjob *>::iterator i = sh->jobs.begin();
+       i != sh->jobs.end(); ++i)
+    delete i->second;
+  pthread_mutex_destroy(&sh->lck);
+  pthread_cond_destroy(&sh->cond);
+  delete sh;
+}
+
+static void *
+vfsjob_main(void *arg)
+{
+  vfsjob *job = static_cast<vfsjob *>(arg);
+  vfsshared *sh = job->shared;
+  struct statvfs vfs;
+  int ret, err;
+
+  ret = statvfs(job->path.c_str(), &vfs); // may block indefinitely
+  err = errno;
+
+  pthread_mutex_lock(&sh->lck);
+  if (ret == 0) {
+    job->vfs = vfs;
+    job->updated = time(0);
+    job->error = 0;
+  }
+  else
+    job->error = err;
+  job->pending = false;
+  sh->npending--;
+  pthread_cond_broadcast(&sh->cond);
+  vfsshared_release(sh);        // unlocks
+
+  return 0;
+}
+#endif  // _PTHREAD
+
+
 DiskFree::DiskFree(bool call_update)
-  : mtab_path("/etc/mtab"), failbit_(false)
+  : mtab_path("/etc/mtab"), failbit_(false), ttl_(0), shared_(0)
 {
   if (call_update)
     update();
 }
 
 
+DiskFree::~DiskFree()
+{
+#ifdef _PTHREAD
+  if (shared_) {
+    pthread_mutex_lock(&shared_->lck);
+    vfsshared_release(shared_); // workers still out keep it alive
+  }
+#endif
+}
+
+
 bool
 DiskFree::push_back(const char *path, const char *fs)
 {
@@ -46,6 +152,8 @@ DiskFree::push_back(const char *path, const char *fs)
   val.mounted = path;
   if (fs)
     val.device = fs;
+  val.updated = time(0);
+  val.stale = false;
   container_.push_back(val);
   return true;
 }
@@ -172,6 +280,129 @@ DiskFree::update()
 }
 
 
+bool
+DiskFree::update_batch(unsigned deadline_ms)
+{
+#ifndef _PTHREAD
+  (void)deadline_ms;
+  return update();
+#else
+  std::vector<std::pair<std::string, std::string> > mounts;
+  FILE *mtab = setmntent(mtab_path, "r");
+  mntent ent;
+  char *buf = 0;
+  size_t bufsize = 0;
+  size_t i;
+
+  reset();
+
+  if (!mtab) {
+    failbit_ = true;
+    return false;
+  }
+  while (xgetmntent(mtab, &ent, &buf, &bufsize) != 0)
+    mounts.push_back(std::make_pair(std::string(ent.mnt_dir),
+                                    std::string(ent.mnt_fsname)));
+  endmntent(mtab);
+
+  if (!shared_)
+    shared_ = vfsshared_new();
+  vfsshared *sh = shared_;
+  time_t now = time(0);
+
+  pthread_mutex_lock(&sh->lck);
+
+  // dispatch a worker for every mount that is out of TTL and not
+  // already being refreshed by an earlier call.
+  for (i = 0; i < mounts.size(); i++) {
+    vfsjob *&job = sh->jobs[mounts[i].first];
+
+    if (!job) {
+      job = new vfsjob;
+      job->path = mounts[i].first;
+      std::memset(&job->vfs, 0, sizeof(job->vfs));
+      job->updated = 0;
+      job->error = 0;
+      job->pending = false;
+      job->shared = sh;
+    }
+    if (job->pending)
+      continue;
+    if (job->updated && now - job->updated < static_cast<time_t>(ttl_))
+      continue;                 // TTL cache hit
+
+    pthread_t th;
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    job->pending = true;
+    sh->npending++;
+    sh->refs++;
+    if (pthread_create(&th, &attr, vfsjob_main, job) != 0) {
+      job->pending = false;
+      sh->npending--;
+      sh->refs--;
+      failbit_ = true;
+    }
+    pthread_attr_destroy(&attr);
+  }
+
+  // wait for the workers, but never past the deadline.
+  {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += deadline_ms / 1000;
+    ts.tv_nsec += (deadline_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
+    }
+    while (sh->npending > 0)
+      if (pthread_cond_timedwait(&sh->cond, &sh->lck, &ts) != 0)
+        break;                  // deadline; leave the stragglers behind
+  }
+
+  // publish what we have, in mtab order.
+  for (i = 0; i < mounts.size(); i++) {
+    vfsjob *job = sh->jobs[mounts[i].first];
+    value_type val;
+
+    if (!job->pending && job->updated == 0) {
+      failbit_ = true;          // statvfs itself failed; as update()
+      continue;
+    }
+    val.mounted = mounts[i].first;
+    val.device = mounts[i].second;
+    val.vfs = job->vfs;
+    val.updated = job->updated;
+    val.stale = job->pending || job->error != 0;
+    container_.push_back(val);
+  }
+
+  // drop cache entries of mounts that went away (unless a worker is
+  // still out for them).
+  {
+    std::map<std::string, std::string> alive(mounts.begin(), mounts.end());
+    std::map<std::string, vfsjob *>::iterator j = sh->jobs.begin();
+
+    while (j != sh->jobs.end()) {
+      if (!j->second->pending && alive.find(j->first) == alive.end()) {
+        delete j->second;
+        sh->jobs.erase(j++);
+      }
+      else
+        ++j;
+    }
+  }
+
+  pthread_mutex_unlock(&sh->lck);
+  return !failbit_;
+#endif  // _PTHREAD
+}
+
+
 bool
 DiskFree::update(int argc, const char *argv[])
 {
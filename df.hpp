@@ -24,6 +24,7 @@
 
 #include <vector>
 #include <string>
+#include <ctime>
 #include <sys/statvfs.h>
 
 // TODO: failbit_ operation is not fully tested.
@@ -35,6 +36,8 @@ public:
     std::string mounted;
     std::string device;
     struct statvfs vfs;
+    time_t updated;             // when VFS was obtained; 0 = never
+    bool stale;                 // VFS missed the update_batch() deadline
   } value_type;
 
   typedef std::vector<value_type> container_type;
@@ -58,17 +61,37 @@ public:
   const char * const mtab_path;
 
   explicit DiskFree(bool call_update = false);
+  ~DiskFree();
 
   bool update();
   bool update(const char *fs_path, ...);
   bool update(int argc, const char *argv[]);
 
+  // update_batch() is the polling-friendly variant of update(): a
+  // mount whose cached statvfs is younger than the TTL (see
+  // set_ttl()) is served from the cache, the rest are refreshed by
+  // concurrent statvfs(2) calls, and after DEADLINE_MS milliseconds
+  // the call returns no matter what.  A mount whose statvfs has not
+  // landed by then keeps its previous figures with `stale' set (and
+  // `updated' telling how old they are); the straggler keeps running
+  // and its result is picked up by a later call, so one hung NFS
+  // server never blocks the loop.  A mount seen for the first time
+  // that misses the deadline appears with a zeroed `vfs'.
+  //
+  // Compile with -D_PTHREAD and link with -lpthread to get the
+  // concurrency; without it, update_batch() degrades to update().
+  bool update_batch(unsigned deadline_ms = 200);
+
+  // Entries younger than SECONDS are not re-stat'ed by update_batch().
+  void set_ttl(unsigned seconds) { ttl_ = seconds; }
+  unsigned ttl() const           { return ttl_; }
+
   operator void *() const {
     return failbit_ ? 0 : const_cast<DiskFree *>(this);
   }
 
   bool fail() const { return failbit_; }
-  void reset() { failbit_ = false; container_.empty(); }
+  void reset() { failbit_ = false; container_.clear(); }
 
   size_type size() const { return container_.size(); }
 
@@ -93,7 +116,13 @@ private:
   inline unsigned long scale(unsigned long blocks,
                              unsigned long blocksize) const;
 
+  // not copyable; shared_ holds state referenced by worker threads.
+  DiskFree(const DiskFree &);
+  DiskFree &operator=(const DiskFree &);
+
   bool failbit_;
+  unsigned ttl_;
+  struct vfsshared *shared_;    // update_batch() bookkeeping, lazily made
   container_type container_;
 };
 
@@ -129,6 +129,139 @@ dc__gettime__(void)
                               c_k__.cont--; (store) = clock() - c_k__.clk)
 #endif
 
+#if defined(__cplusplus) || \
+  (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199900L)
+
+/*
+ * Nanosecond-resolution variant for sub-microsecond sections:
+ *
+ *   long long ns;
+ *   DIFFTIME_NS(ns) {
+ *     your_code;
+ *   }
+ *   printf("elapsed: %lld ns\n", ns);
+ *
+ * On x86 with an invariant TSC this reads the cycle counter directly
+ * (about 20 cycles per measurement) and converts cycles to
+ * nanoseconds with a ratio calibrated against CLOCK_MONOTONIC_RAW on
+ * first use.  Elsewhere it falls back to clock_gettime(2), which
+ * still beats gettimeofday(2)'s microsecond granularity.
+ */
+
+#ifndef DIFFTIME_CLOCK_RAW
+# ifdef CLOCK_MONOTONIC_RAW
+#  define DIFFTIME_CLOCK_RAW CLOCK_MONOTONIC_RAW
+# else
+#  define DIFFTIME_CLOCK_RAW CLOCK_MONOTONIC
+# endif
+#endif
+
+static double dn_ns_per_tick__;
+static int dn_mode__;           /* 0: uncalibrated, 1: tsc, -1: clock */
+
+static __inline__ unsigned long long
+dn_rawns__(void)
+{
+  struct timespec ts;
+  clock_gettime(DIFFTIME_CLOCK_RAW, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static __inline__ unsigned long long
+dn_rdtsc__(void)
+{
+  unsigned int lo, hi;
+  __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((unsigned long long)hi << 32) | lo;
+}
+
+static __inline__ int
+dn_invariant_tsc__(void)
+{
+  unsigned int ax, bx, cx, dx;
+
+  /* CPUID leaf 0x80000007, EDX bit 8: TSC runs at a constant rate
+   * regardless of P/C-states, so it is usable as a wall clock. */
+  __asm__ __volatile__ ("cpuid"
+                        : "=a" (ax), "=b" (bx), "=c" (cx), "=d" (dx)
+                        : "a" (0x80000000u));
+  if (ax < 0x80000007u)
+    return 0;
+  __asm__ __volatile__ ("cpuid"
+                        : "=a" (ax), "=b" (bx), "=c" (cx), "=d" (dx)
+                        : "a" (0x80000007u));
+  return (dx >> 8) & 1;
+}
+#endif  /* __x86_64__ || __i386__ */
+
+/*
+ * One-time calibration; safe to race since every thread computes the
+ * same ratio and the mode flag is written last.
+ */
+static __inline__ void
+dn_calibrate__(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  if (dn_invariant_tsc__()) {
+    struct timespec req = { 0, 5000000 }; /* 5 msec */
+    unsigned long long t0, t1, n0, n1;
+
+    n0 = dn_rawns__();
+    t0 = dn_rdtsc__();
+    nanosleep(&req, 0);
+    n1 = dn_rawns__();
+    t1 = dn_rdtsc__();
+
+    if (t1 > t0) {
+      dn_ns_per_tick__ = (double)(n1 - n0) / (double)(t1 - t0);
+      dn_mode__ = 1;
+      return;
+    }
+  }
+#endif
+  dn_mode__ = -1;
+}
+
+static __inline__ unsigned long long
+dn_now__(void)
+{
+  if (dn_mode__ == 0)
+    dn_calibrate__();
+#if defined(__x86_64__) || defined(__i386__)
+  if (dn_mode__ > 0)
+    return dn_rdtsc__();
+#endif
+  return dn_rawns__();
+}
+
+static __inline__ long long
+dn_diff__(unsigned long long now, unsigned long long old)
+{
+  if (dn_mode__ > 0)
+    return (long long)((now - old) * dn_ns_per_tick__);
+  return (long long)(now - old);
+}
+
+struct dn__ {
+  unsigned long long tick;
+  int cont;
+};
+
+static __inline__ struct dn__
+dn__gettime__(void)
+{
+  struct dn__ dn;
+  dn.tick = dn_now__();
+  dn.cont = 1;
+  return dn;
+}
+
+#define DIFFTIME_NS(store) for (struct dn__ t_k__ = dn__gettime__();    \
+                                t_k__.cont--;                           \
+                                (store) = dn_diff__(dn_now__(), t_k__.tick))
+#endif
+
 END_C_DECLS
 
 
@@ -17,6 +17,10 @@
 
 #include <libgen.h>
 #include <getopt.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #ifdef __APPLE__
 #include <err.h>
@@ -39,6 +43,13 @@
 
 #define SIGBUF_MAX      64
 
+#ifndef MIN
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#endif
+
+#define SPLICE_BLOCK_DEFAULT    (1024 * 1024)
+#define SPLICE_PROBE_MAX        4096
+
 #define VERSION_STRING  "0.1"
 
 static struct option longopts[] = {
@@ -47,6 +58,11 @@ static struct option longopts[] = {
   { "out-template", required_argument, NULL, 'O' },
   { "err-template", required_argument, NULL, 'E' },
   { "input", required_argument, NULL, 'i' },
+  { "block-lines", required_argument, NULL, 'B' },
+  { "splice", optional_argument, NULL, 'S' },
+  { "daemon", required_argument, NULL, 'd' },
+  { "client", required_argument, NULL, 'c' },
+  { "ordered", no_argument, NULL, 'k' },
   { "help", no_argument, NULL, 1 },
   { "version", no_argument, NULL, 2 },
   { NULL, 0, NULL, 0 },
@@ -60,6 +76,15 @@ struct proc {
                                  * [1] for child STDOUT if redirected,
                                  * [2] for child STDERR if redirected.
                                  */
+
+  char *blk;                    /* block being fed to this child */
+  size_t blk_cap;
+  size_t blk_len;
+  size_t blk_off;               /* bytes of BLK already written */
+
+  off_t sp_start;               /* splice mode: assigned file region */
+  off_t sp_off;                 /* next file offset to splice from */
+  size_t sp_len;                /* bytes of the region not yet spliced */
 };
 
 
@@ -79,6 +104,15 @@ struct {
 
   int sig_fds[2];
   int njobs;
+  int block_lines;              /* lines per dispatched block */
+  int active;                   /* children still being fed */
+
+  int ordered;                  /* emit output in input-block order */
+  int splice_mode;              /* forward blocks with splice(2) */
+  size_t splice_block;          /* block size in bytes for splice mode */
+  int sp_fd;                    /* the input file, as a raw fd */
+  off_t sp_next;                /* first input offset not yet assigned */
+  off_t sp_size;                /* size of the input file */
 
   struct proc *procs;
 
@@ -116,6 +150,15 @@ static void init_env(void);
 static void set_poll_errmask();
 static void reap_children(int wait);
 static int has_valid_fd(struct pollfd *fds, nfds_t nfds);
+static int grow_block(struct proc *child, size_t need);
+static int take_orphan(struct proc *child);
+static int fill_block(struct proc *child);
+static void save_block(struct proc *child);
+#ifdef __linux__
+static int fill_chunk(struct proc *child);
+static void save_chunk(struct proc *child);
+#endif
+static void drop_child(int i);
 static int start_server(void);
 static int cleanup_server(void);
 static void prepare_signals(void);
@@ -123,6 +166,9 @@ static struct proc *spawn_children(size_t nproc, int argc, char *argv[]);
 static struct pollfd *prepare_poll(size_t *nfds, int sigfd,
                                    struct proc *procs, size_t njobs);
 static void child_main(int argc, char *argv[]);
+static int daemon_main(const char *sockpath, int argc, char *argv[]);
+static int client_main(const char *sockpath);
+static int ordered_main(int argc, char *argv[]);
 static void version_and_exit();
 static void usage(void);
 
@@ -131,13 +177,18 @@ int
 main(int argc, char *argv[])
 {
   int opt;
+  const char *daemon_sock = NULL;
+  const char *client_sock = NULL;
 
   //program_name = basename(argv[0]);
   set_poll_errmask();
 
   init_env();
 
-  while ((opt = getopt_long(argc, argv, "j:i:O:E:vD", longopts, NULL)) != -1) {
+  /* "+": stop at the first non-option so the filter command's own
+   * flags (e.g. `sh -c ...') are never parsed as ours */
+  while ((opt = getopt_long(argc, argv, "+j:i:O:E:B:S::d:c:kvD",
+                            longopts, NULL)) != -1) {
     switch (opt) {
     case 1:
       usage();
@@ -176,6 +227,37 @@ main(int argc, char *argv[])
       env.njobs = atoi(optarg);
       break;
 
+    case 'B':
+      env.block_lines = atoi(optarg);
+      if (env.block_lines < 1)
+        env.block_lines = 1;
+      break;
+
+    case 'S':
+#ifdef __linux__
+      env.splice_mode = TRUE;
+      if (optarg) {
+        env.splice_block = strtoul(optarg, NULL, 10);
+        if (env.splice_block < PIPE_BUF)
+          env.splice_block = PIPE_BUF;
+      }
+#else
+      error(1, 0, "--splice is only supported on Linux");
+#endif
+      break;
+
+    case 'd':
+      daemon_sock = optarg;
+      break;
+
+    case 'c':
+      client_sock = optarg;
+      break;
+
+    case 'k':
+      env.ordered = TRUE;
+      break;
+
     default:
       printf("Try `--help' for more.\n");
       exit(1);
@@ -184,6 +266,41 @@ main(int argc, char *argv[])
   argc -= optind;
   argv += optind;
 
+  if (client_sock)
+    return client_main(client_sock);
+
+  if (daemon_sock) {
+    if (argc < 1)
+      error(1, 0, "daemon mode needs a filter command");
+    return daemon_main(daemon_sock, argc, argv);
+  }
+
+  if (env.ordered) {
+    if (env.splice_mode)
+      error(1, 0, "--ordered and --splice are mutually exclusive");
+    if (env.redirect_out)
+      error(1, 0, "--ordered writes ordered output to stdout;"
+            " --out-template makes no sense");
+    if (argc < 1)
+      error(1, 0, "ordered mode needs a filter command");
+
+    prepare_signals();
+    message(0, "using %d job process(s), ordered output", env.njobs);
+    return ordered_main(argc, argv);
+  }
+
+  if (env.splice_mode) {
+    struct stat st;
+
+    env.sp_fd = fileno(env.in);
+    if (fstat(env.sp_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+      message(0, "input is not a regular file; --splice ignored");
+      env.splice_mode = FALSE;
+    }
+    else
+      env.sp_size = st.st_size;
+  }
+
   prepare_signals();
 
   message(0, "using %d job process(s)", env.njobs);
@@ -211,6 +328,15 @@ init_env(void)
   env.redirect_err = FALSE;
 
   env.njobs = getncores();
+  env.block_lines = 1;
+  env.active = 0;
+  env.ordered = FALSE;
+
+  env.splice_mode = FALSE;
+  env.splice_block = SPLICE_BLOCK_DEFAULT;
+  env.sp_fd = -1;
+  env.sp_next = 0;
+  env.sp_size = 0;
   env.procs = NULL;
   env.fds = NULL;
   env.nfds = 0;
@@ -269,10 +395,19 @@ reap_children(int wait)
         error(0, 0, "child terminated: unknown");
       }
 
-      for (j = 0; j < 3; j++) {
-        env.fds[1 + i + j * env.njobs].fd = -1;
+      save_block(&env.procs[i]); /* whatever it did not read, re-queue */
+#ifdef __linux__
+      if (env.splice_mode)
+        save_chunk(&env.procs[i]);
+#endif
+
+      if (env.procs[i].fds[STDIN_FILENO] != -1)
+        env.active--;
+      env.fds[1 + i].fd = -1;
 
-        close(env.procs[i].fds[j]);
+      for (j = 0; j < 3; j++) {
+        if (env.procs[i].fds[j] != -1)
+          close(env.procs[i].fds[j]);
         env.procs[i].fds[j] = -1;
       }
     }
@@ -302,23 +437,280 @@ cleanup_server(void)
 }
 
 
+/*
+ * Dispatching is demand driven: a worker receives the next block of
+ * input only when poll(2) reports its stdin pipe writable again, so a
+ * slow worker simply stops pulling blocks while the fast ones keep
+ * going.  `--block-lines' controls how many lines make up one block;
+ * larger blocks mean fewer poll(2)/write(2) round trips per line.
+ */
+
+/* lines taken from the input but never delivered (their child died
+ * mid-block); served again before any new input is consumed. */
+static char *orphan = NULL;
+static size_t orphan_len = 0;
+
+
+static int
+grow_block(struct proc *child, size_t need)
+{
+  char *p;
+  size_t cap = child->blk_cap ? child->blk_cap : LINE_MAX;
+
+  if (need <= child->blk_cap)
+    return 0;
+
+  while (cap < need)
+    cap *= 2;
+
+  p = realloc(child->blk, cap);
+  if (!p)
+    return -1;
+
+  child->blk = p;
+  child->blk_cap = cap;
+  return 0;
+}
+
+
+/*
+ * Move the re-queued lines of a dead child, if any, into CHILD's
+ * block.  Returns -1 if there were none, otherwise returns zero.
+ */
+static int
+take_orphan(struct proc *child)
+{
+  if (orphan_len == 0)
+    return -1;
+
+  if (grow_block(child, orphan_len) == -1)
+    error(1, errno, "out of memory");
+
+  memcpy(child->blk, orphan, orphan_len);
+  child->blk_len = orphan_len;
+  child->blk_off = 0;
+  orphan_len = 0;
+  return 0;
+}
+
+
+/*
+ * Fill CHILD's block with up to `env.block_lines' input lines, or
+ * with the re-queued lines of a dead child if there are any.
+ *
+ * Returns -1 if the input is exhausted and nothing was collected,
+ * otherwise returns zero.
+ */
+static int
+fill_block(struct proc *child)
+{
+  static char *line = NULL;
+  static size_t linecap = 0;
+  ssize_t linelen;
+  int n;
+
+  child->blk_len = child->blk_off = 0;
+
+  if (take_orphan(child) == 0)
+    return 0;
+
+  if (!env.in)
+    return -1;
+
+  for (n = 0; n < env.block_lines; n++) {
+    linelen = getline(&line, &linecap, env.in);
+    if (linelen <= 0)           /* ran out of input. */
+      break;
+
+    if (grow_block(child, child->blk_len + linelen) == -1)
+      error(1, errno, "out of memory");
+
+    memcpy(child->blk + child->blk_len, line, linelen);
+    child->blk_len += linelen;
+  }
+
+  return (child->blk_len > 0) ? 0 : -1;
+}
+
+
+/*
+ * Re-queue the undelivered part of CHILD's block so that another
+ * child can pick it up.  If CHILD got a partial line, the rest of
+ * that line is dropped; re-sending it would hand a headless record
+ * to the next child.
+ */
+static void
+save_block(struct proc *child)
+{
+  size_t resume = child->blk_off;
+  char *p;
+
+  if (resume > 0 && resume < child->blk_len &&
+      child->blk[resume - 1] != '\n') {
+    p = memchr(child->blk + resume, '\n', child->blk_len - resume);
+    resume = p ? (size_t)(p - child->blk) + 1 : child->blk_len;
+  }
+
+  if (resume < child->blk_len) {
+    p = realloc(orphan, orphan_len + child->blk_len - resume);
+    if (!p)
+      error(1, errno, "out of memory");
+    orphan = p;
+    memcpy(orphan + orphan_len, child->blk + resume,
+           child->blk_len - resume);
+    orphan_len += child->blk_len - resume;
+  }
+
+  child->blk_len = child->blk_off = 0;
+}
+
+
+#ifdef __linux__
+/*
+ * Assign the next newline-aligned region of the input file to CHILD,
+ * to be spliced into its pipe.  The block boundary is moved back to
+ * the last newline inside the block -- found with small pread(2)
+ * probes, so the payload itself never passes through userspace -- or
+ * moved forward to the end of the line when a single line is longer
+ * than the whole block.
+ *
+ * Returns -1 if the input is exhausted, otherwise returns zero.
+ */
+static int
+fill_chunk(struct proc *child)
+{
+  char buf[SPLICE_PROBE_MAX];
+  off_t beg = env.sp_next;
+  off_t end, lo, base;
+  ssize_t n;
+  char *p;
+
+  if (beg >= env.sp_size)
+    return -1;
+
+  end = beg + env.splice_block;
+  if (end >= env.sp_size)
+    end = env.sp_size;          /* EOF closes the last line */
+  else {
+    /* probe backward, window by window, for the last newline */
+    for (lo = end; lo > beg; lo = base) {
+      base = lo - MIN((off_t)sizeof(buf), lo - beg);
+      n = pread(env.sp_fd, buf, lo - base, base);
+      if (n <= 0) {
+        error(0, errno, "pread(2) failed on the input file");
+        return -1;
+      }
+      p = memrchr(buf, '\n', n);
+      if (p) {
+        end = base + (p - buf) + 1;
+        goto aligned;
+      }
+    }
+    /* no newline in the whole block: extend to the end of the line */
+    for (end = beg + env.splice_block; end < env.sp_size; end += n) {
+      n = pread(env.sp_fd, buf, sizeof(buf), end);
+      if (n <= 0) {
+        end = env.sp_size;
+        break;
+      }
+      p = memchr(buf, '\n', n);
+      if (p) {
+        end += p - buf + 1;
+        break;
+      }
+    }
+    if (end > env.sp_size)
+      end = env.sp_size;
+  }
+
+ aligned:
+  child->sp_start = child->sp_off = beg;
+  child->sp_len = end - beg;
+  env.sp_next = end;
+
+  debug(0, "chunk [%ld, %ld) assigned to child %u",
+        (long)beg, (long)end, (unsigned)child->pid);
+  return 0;
+}
+
+
+/*
+ * Re-queue the unspliced part of CHILD's file region by reading it
+ * back into the orphan buffer.  Like save_block(), the tail of a
+ * line the child already got the head of is dropped.
+ */
+static void
+save_chunk(struct proc *child)
+{
+  ssize_t n;
+  char c;
+  char *p;
+
+  if (child->sp_len == 0)
+    return;
+
+  if (grow_block(child, child->sp_len) == -1)
+    error(1, errno, "out of memory");
+
+  n = pread(env.sp_fd, child->blk, child->sp_len, child->sp_off);
+  if (n <= 0) {
+    child->sp_len = 0;
+    return;
+  }
+
+  child->blk_len = n;
+  child->blk_off = 0;
+
+  if (child->sp_off > child->sp_start &&
+      pread(env.sp_fd, &c, 1, child->sp_off - 1) == 1 && c != '\n') {
+    p = memchr(child->blk, '\n', n);
+    child->blk_off = p ? (size_t)(p - child->blk) + 1 : (size_t)n;
+  }
+
+  child->sp_len = 0;
+  save_block(child);
+}
+#endif  /* __linux__ */
+
+
+/* stop feeding the (I - 1)-th child; its stdin pipe is closed so
+ * that the child sees EOF once it drained the pipe. */
+static void
+drop_child(int i)
+{
+  struct proc *child = &env.procs[i - 1];
+
+  if (child->fds[STDIN_FILENO] != -1) {
+    close(child->fds[STDIN_FILENO]);
+    child->fds[STDIN_FILENO] = -1;
+    env.active--;
+  }
+  env.fds[i].fd = -1;
+}
+
+
 static int
 start_server(void)
 {
   int nevents;
   char buf[PIPE_BUF];
 
-  int use_oldline = FALSE;
-  char *line = NULL;
-  size_t linecap = 0;
-  ssize_t linelen;
-
   int i;
-  int written;
+  ssize_t written;
+  struct proc *child;
 
   env.fds = prepare_poll(&env.nfds, env.sig_fds[P_READ], env.procs, env.njobs);
 
+  env.active = 0;
+  for (i = 0; i < env.njobs; i++)
+    if (env.procs[i].fds[STDIN_FILENO] != -1)
+      env.active++;
+
   while (TRUE) {
+    if (env.active <= 0) {
+      debug(0, "no child left to feed, break the main loop");
+      break;
+    }
     if (!has_valid_fd(env.fds, env.nfds)) {
       debug(0, "all FDs are invalid, break the main loop");
       break;
@@ -347,35 +739,79 @@ start_server(void)
       if (nevents <= 0)
         break;
 
+      child = &env.procs[i - 1];
+
       if (env.fds[i].revents & POLLOUT) {
         nevents--;
 
-        if (!use_oldline)
-          linelen = getline(&line, &linecap, env.in);
-
-        if (linelen <= 0)       /* ran out of input. */
-          goto end;
+#ifdef __linux__
+        if (env.splice_mode && child->blk_off >= child->blk_len) {
+          /* re-queued leftovers of a dead child are byte-copied
+           * through BLK below; everything else goes straight from
+           * the input file into the pipe. */
+          if (take_orphan(child) == -1) {
+            if (child->sp_len == 0 && fill_chunk(child) == -1) {
+              drop_child(i);
+              continue;
+            }
+
+            written = splice(env.sp_fd, &child->sp_off, env.fds[i].fd,
+                             NULL, child->sp_len,
+                             SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+            if (written == -1) {
+              if (errno == EAGAIN || errno == EINTR)
+                continue;
+              error(0, errno, "can't splice to the child %u", child->pid);
+              save_chunk(child);
+              drop_child(i);
+              continue;
+            }
+            child->sp_len -= written;
+            continue;
+          }
+        }
+#endif  /* __linux__ */
+
+        if (child->blk_off >= child->blk_len) {
+          /* the pipe drained; this child pulls the next block */
+          if (fill_block(child) == -1) {
+            drop_child(i);
+            continue;
+          }
+        }
 
-        written = write(env.fds[i].fd, line, linelen);
+        written = write(env.fds[i].fd, child->blk + child->blk_off,
+                        child->blk_len - child->blk_off);
         if (written == -1) {
-          error(0, errno, "can't write to the child %u",
-                env.procs[(i - 1) % env.njobs].pid);
-          env.fds[i].fd = -1;
-          use_oldline = TRUE;
+          if (errno == EAGAIN || errno == EINTR)
+            continue;
+          error(0, errno, "can't write to the child %u", child->pid);
+          save_block(child);
+#ifdef __linux__
+          if (env.splice_mode)
+            save_chunk(child);
+#endif
+          drop_child(i);
+          continue;
         }
-        else
-          use_oldline = FALSE;
+        child->blk_off += written;
       }
       if (env.fds[i].revents & env.poll_errmask) {
-        error(0, errno, "poll error for the child %u",
-              env.procs[(i - 1) % env.njobs].pid);
-        env.fds[i].fd = -1;
+        error(0, errno, "poll error for the child %u", child->pid);
+        save_block(child);
+#ifdef __linux__
+        if (env.splice_mode)
+          save_chunk(child);
+#endif
+        drop_child(i);
       }
     }
   }
- end:
-  fclose(env.in);
-  env.in = NULL;
+
+  if (env.in) {
+    fclose(env.in);
+    env.in = NULL;
+  }
 
   /* TODO:  */
   return 0;
@@ -433,6 +869,12 @@ spawn_children(size_t nproc, int argc, char *argv[])
   for (i = 0; i < nproc; i++) {
     p[i].pid = -1;
     p[i].fds[0] = p[i].fds[1] = p[i].fds[2] = -1;
+
+    p[i].blk = NULL;
+    p[i].blk_cap = p[i].blk_len = p[i].blk_off = 0;
+
+    p[i].sp_start = p[i].sp_off = 0;
+    p[i].sp_len = 0;
   }
 
   for (i = 0; i < nproc; i++) {
@@ -514,6 +956,10 @@ spawn_children(size_t nproc, int argc, char *argv[])
         close(p[i].fds[STDERR_FILENO]);
       }
 
+      /* a full pipe must not stall the server; poll(2) tells us when
+       * the child drained it enough to accept the rest. */
+      set_nonblock(p_in[P_WRITE]);
+
       p[i].fds[STDIN_FILENO] = p_in[P_WRITE];
     }
   }
@@ -578,6 +1024,10 @@ prepare_signals(void)
   if (sigaction(SIGCHLD, &act, NULL) == -1)
     error(1, errno, "cannot register SIGCHLD handler");
 
+  /* a worker exiting mid-feed must surface as EPIPE from
+   * write(2)/splice(2), not kill the server. */
+  signal(SIGPIPE, SIG_IGN);
+
   sigemptyset(&env.sigmask);
   sigemptyset(&env.poll_sigmask);
 
@@ -750,6 +1200,698 @@ error(int status, int ecode, const char *fmt, ...)
 #endif  /* MACOS */
 
 
+/*
+ * Ordered mode -- `--ordered COMMAND [ARG...]'.
+ *
+ * The normal engine feeds persistent workers and lets their output
+ * interleave; getting input order back means sorting the per-worker
+ * files afterwards, which often costs more than the parallel run
+ * saved.  In ordered mode every dispatched block carries a sequence
+ * number and runs through its own instance of the filter, up to
+ * `--jobs' at a time; the parent collects each block's output into a
+ * reorder slot and writes slots to stdout strictly in sequence.  The
+ * reorder buffer is bounded: at most `--jobs' blocks are ever
+ * outstanding, so a slow early block throttles dispatch instead of
+ * growing memory.
+ *
+ * One filter process per block is the price of exact ordering -- a
+ * streaming worker's output has no block boundaries to merge on.
+ * Use `--block-lines' to make blocks big enough that the exec cost
+ * disappears into the work.
+ */
+struct oslot {
+  long seq;                     /* block sequence number; -1 if free */
+  pid_t pid;
+
+  int in;                       /* filter stdin; -1 once fed */
+  int out;                      /* filter stdout; -1 at EOF */
+
+  char *blk;                    /* the input block */
+  size_t blk_len;
+  size_t blk_off;
+
+  char *res;                    /* collected output, pending emission */
+  size_t res_len;
+  size_t res_cap;
+
+  int done;                     /* filter finished; RES is complete */
+};
+
+
+/*
+ * Read one block (`--block-lines' lines) from env.in.  Returns the
+ * number of bytes placed in *BUF, 0 at EOF.
+ */
+static size_t
+ordered_read_block(char **buf, size_t *cap)
+{
+  static char *line = NULL;
+  static size_t line_cap = 0;
+
+  size_t len = 0;
+  ssize_t rd;
+  int n;
+
+  for (n = 0; n < env.block_lines; n++) {
+    rd = getline(&line, &line_cap, env.in);
+    if (rd == -1)
+      break;
+
+    if (len + rd > *cap) {
+      *cap = (len + rd) * 2;
+      *buf = realloc(*buf, *cap);
+      if (!*buf)
+        error(1, errno, "out of memory");
+    }
+    memcpy(*buf + len, line, rd);
+    len += rd;
+  }
+  return len;
+}
+
+
+static void
+oslot_spawn(struct oslot *s, long seq, char *blk, size_t blk_len,
+            int argc, char *argv[])
+{
+  int p_in[2], p_out[2];
+
+  if (pipe(p_in) == -1 || pipe(p_out) == -1)
+    error(1, errno, "cannot create pipe");
+
+  s->pid = fork();
+  if (s->pid == -1)
+    error(1, errno, "fork(2) failed");
+
+  if (s->pid == 0) {            /* filter */
+    close(p_in[P_WRITE]);
+    close(p_out[P_READ]);
+    dup2(p_in[P_READ], STDIN_FILENO);
+    dup2(p_out[P_WRITE], STDOUT_FILENO);
+    close(p_in[P_READ]);
+    close(p_out[P_WRITE]);
+
+    child_main(argc, argv);
+    exit(1);                    /* not reached */
+  }
+
+  close(p_in[P_READ]);
+  close(p_out[P_WRITE]);
+  set_nonblock(p_in[P_WRITE]);
+
+  s->seq = seq;
+  s->in = p_in[P_WRITE];
+  s->out = p_out[P_READ];
+  s->blk = blk;
+  s->blk_len = blk_len;
+  s->blk_off = 0;
+  s->res_len = 0;
+  s->done = FALSE;
+}
+
+
+static int
+ordered_main(int argc, char *argv[])
+{
+  struct oslot *slots;
+  struct pollfd *fds;
+  char rbuf[PIPE_BUF];
+  char *blk = NULL;
+  size_t blk_cap = 0, blk_len = 0;
+  long next_seq = 0, emit_seq = 0;
+  int in_eof = FALSE;
+  int nbusy = 0;
+  int i;
+
+  signal(SIGPIPE, SIG_IGN);
+
+  slots = calloc(env.njobs, sizeof(*slots));
+  fds = malloc(sizeof(*fds) * env.njobs * 2);
+  if (!slots || !fds)
+    error(1, errno, "out of memory");
+
+  for (i = 0; i < env.njobs; i++)
+    slots[i].seq = -1;
+
+  for (;;) {
+    /* keep every free slot busy while input remains */
+    for (i = 0; i < env.njobs && !in_eof; i++) {
+      if (slots[i].seq != -1)
+        continue;
+
+      blk_len = ordered_read_block(&blk, &blk_cap);
+      if (blk_len == 0) {
+        in_eof = TRUE;
+        break;
+      }
+      oslot_spawn(&slots[i], next_seq++, blk, blk_len, argc, argv);
+      blk = NULL;               /* ownership moved to the slot */
+      blk_cap = 0;
+      nbusy++;
+    }
+
+    if (nbusy == 0 && in_eof)
+      break;
+
+    for (i = 0; i < env.njobs; i++) {
+      struct oslot *s = slots + i;
+
+      fds[i].fd = (s->seq != -1 && s->in != -1 &&
+                   s->blk_off < s->blk_len) ? s->in : -1;
+      fds[i].events = POLLOUT;
+      fds[i].revents = 0;
+
+      if (s->seq != -1 && s->in != -1 && s->blk_off >= s->blk_len) {
+        close(s->in);           /* block delivered; let it finish */
+        s->in = -1;
+      }
+
+      fds[env.njobs + i].fd = (s->seq != -1) ? s->out : -1;
+      fds[env.njobs + i].events = POLLIN;
+      fds[env.njobs + i].revents = 0;
+    }
+
+    if (poll(fds, env.njobs * 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      error(1, errno, "poll(2) failed");
+    }
+
+    for (i = 0; i < env.njobs; i++) {
+      struct oslot *s = slots + i;
+
+      if (fds[i].revents & (POLLOUT | env.poll_errmask)) {
+        ssize_t wr = write(s->in, s->blk + s->blk_off,
+                           s->blk_len - s->blk_off);
+        if (wr > 0)
+          s->blk_off += wr;
+        else if (wr == -1 && errno != EAGAIN && errno != EINTR)
+          s->blk_off = s->blk_len; /* filter died; its output ends */
+      }
+
+      if (fds[env.njobs + i].revents & (POLLIN | env.poll_errmask)) {
+        ssize_t rd = read(s->out, rbuf, sizeof(rbuf));
+        if (rd > 0) {
+          if (s->res_len + rd > s->res_cap) {
+            s->res_cap = (s->res_len + rd) * 2;
+            s->res = realloc(s->res, s->res_cap);
+            if (!s->res)
+              error(1, errno, "out of memory");
+          }
+          memcpy(s->res + s->res_len, rbuf, rd);
+          s->res_len += rd;
+        }
+        else if (rd == 0 || (rd == -1 && errno != EAGAIN &&
+                             errno != EINTR)) {
+          int status;
+
+          close(s->out);
+          s->out = -1;
+          if (s->in != -1) {
+            close(s->in);
+            s->in = -1;
+          }
+          if (waitpid(s->pid, &status, 0) == -1)
+            error(0, errno, "waitpid failed for the process %u",
+                  (unsigned)s->pid);
+          else if (WIFSIGNALED(status))
+            message(0, "child terminated: signal(%d)", WTERMSIG(status));
+          s->done = TRUE;
+        }
+      }
+    }
+
+    /* emit every completed block that is next in line */
+    for (;;) {
+      struct oslot *s = NULL;
+
+      for (i = 0; i < env.njobs; i++)
+        if (slots[i].seq == emit_seq) {
+          s = slots + i;
+          break;
+        }
+      if (!s || !s->done)
+        break;
+
+      if (s->res_len > 0 &&
+          fwrite(s->res, 1, s->res_len, stdout) != s->res_len)
+        error(1, errno, "write to stdout failed");
+
+      free(s->blk);
+      s->blk = NULL;
+      s->seq = -1;
+      s->done = FALSE;
+      emit_seq++;
+      nbusy--;
+    }
+  }
+  fflush(stdout);
+
+  free(blk);
+  for (i = 0; i < env.njobs; i++)
+    free(slots[i].res);
+  free(slots);
+  free(fds);
+
+  return 0;
+}
+
+
+/*
+ * Daemon mode -- `--daemon=SOCK COMMAND [ARG...]'.
+ *
+ * Pipelines that invoke distribute hundreds of times on small inputs
+ * pay fork+exec and pipeline spin-up on every run.  In daemon mode
+ * the process persists and listens on a unix stream socket; a client
+ * run (`--client=SOCK') just connects, streams stdin over and copies
+ * the response to stdout -- milliseconds instead of a full start-up.
+ *
+ * The daemon keeps a pool of already-forked workers waiting on their
+ * stdin pipes.  A request is dispatched to that warm pool in
+ * `--block-lines' blocks, round robin; worker stdins are then closed
+ * so the filters flush and finish, and their output streams back to
+ * the client as it appears.  The pool is respawned immediately after
+ * the response, between requests, so the next client never waits for
+ * an exec.
+ *
+ * Wire format, both directions: length-prefixed frames (host-order
+ * uint32_t, then the payload), terminated by a zero-length frame.
+ * (A unix datagram queue like msgq.c caps the message size; filter
+ * I/O needs arbitrary-size streaming, hence the framed stream
+ * socket.)
+ */
+struct dworker {
+  pid_t pid;
+  int in;                       /* write end of the worker's stdin */
+  int out;                      /* read end of the worker's stdout */
+
+  char *buf;                    /* request bytes assigned to this worker */
+  size_t len;
+  size_t off;                   /* bytes of BUF already written */
+  size_t cap;
+};
+
+
+static int
+unix_listen(const char *path)
+{
+  struct sockaddr_un sun;
+  int fd;
+
+  if (strlen(path) >= sizeof(sun.sun_path))
+    error(1, 0, "socket pathname too long: %s", path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    error(1, errno, "socket(2) failed");
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  strcpy(sun.sun_path, path);
+
+  unlink(path);                 /* stale socket from a previous daemon */
+
+  if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+    error(1, errno, "cannot bind to %s", path);
+  if (listen(fd, 8) == -1)
+    error(1, errno, "listen(2) failed");
+
+  return fd;
+}
+
+
+static int
+unix_connect(const char *path)
+{
+  struct sockaddr_un sun;
+  int fd;
+
+  if (strlen(path) >= sizeof(sun.sun_path))
+    error(1, 0, "socket pathname too long: %s", path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    error(1, errno, "socket(2) failed");
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  strcpy(sun.sun_path, path);
+
+  if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+    error(1, errno, "cannot connect to %s (daemon not running?)", path);
+
+  return fd;
+}
+
+
+static int
+write_all(int fd, const void *data, size_t size)
+{
+  const char *p = data;
+  ssize_t wr;
+
+  while (size > 0) {
+    wr = write(fd, p, size);
+    if (wr == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += wr;
+    size -= wr;
+  }
+  return 0;
+}
+
+
+static int
+send_frame(int fd, const void *data, uint32_t size)
+{
+  if (write_all(fd, &size, sizeof(size)) == -1)
+    return -1;
+  if (size > 0 && write_all(fd, data, size) == -1)
+    return -1;
+  return 0;
+}
+
+
+static int
+read_all(int fd, void *data, size_t size)
+{
+  char *p = data;
+  ssize_t rd;
+
+  while (size > 0) {
+    rd = read(fd, p, size);
+    if (rd == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (rd == 0)
+      return -1;                /* peer went away mid-frame */
+    p += rd;
+    size -= rd;
+  }
+  return 0;
+}
+
+
+/*
+ * Receive one frame into *BUF (grown as needed).  Returns the
+ * payload length, 0 on the terminating frame, -1 on error.
+ */
+static ssize_t
+recv_frame(int fd, char **buf, size_t *cap)
+{
+  uint32_t size;
+
+  if (read_all(fd, &size, sizeof(size)) == -1)
+    return -1;
+  if (size == 0)
+    return 0;
+
+  if (*cap < size) {
+    char *p = realloc(*buf, size);
+    if (!p)
+      return -1;
+    *buf = p;
+    *cap = size;
+  }
+  if (read_all(fd, *buf, size) == -1)
+    return -1;
+
+  return size;
+}
+
+
+static void
+dworker_spawn(struct dworker *w, int argc, char *argv[])
+{
+  int p_in[2], p_out[2];
+
+  if (pipe(p_in) == -1 || pipe(p_out) == -1)
+    error(1, errno, "cannot create pipe");
+
+  w->pid = fork();
+  if (w->pid == -1)
+    error(1, errno, "fork(2) failed");
+
+  if (w->pid == 0) {            /* worker */
+    close(p_in[P_WRITE]);
+    close(p_out[P_READ]);
+    dup2(p_in[P_READ], STDIN_FILENO);
+    dup2(p_out[P_WRITE], STDOUT_FILENO);
+    close(p_in[P_READ]);
+    close(p_out[P_WRITE]);
+
+    child_main(argc, argv);
+    exit(1);                    /* not reached */
+  }
+
+  close(p_in[P_READ]);
+  close(p_out[P_WRITE]);
+  set_closexec(p_in[P_WRITE]);
+  set_closexec(p_out[P_READ]);
+  set_nonblock(p_in[P_WRITE]);
+
+  w->in = p_in[P_WRITE];
+  w->out = p_out[P_READ];
+  w->len = w->off = 0;
+}
+
+
+/*
+ * Split REQ into blocks of `--block-lines' lines, assigned round
+ * robin over NW workers.  A trailing chunk without a newline goes to
+ * the last block.
+ */
+static void
+daemon_assign(struct dworker *pool, int nw,
+              const char *req, size_t reqlen)
+{
+  const char *p = req, *end = req + reqlen;
+  const char *blk = req;
+  int line = 0, turn = 0;
+  struct dworker *w;
+
+  while (p < end) {
+    const char *nl = memchr(p, '\n', end - p);
+    p = nl ? nl + 1 : end;
+
+    if (++line >= env.block_lines || p >= end) {
+      w = pool + (turn++ % nw);
+      if (w->len + (p - blk) > w->cap) {
+        w->cap = (w->len + (p - blk)) * 2;
+        w->buf = realloc(w->buf, w->cap);
+        if (!w->buf)
+          error(1, errno, "out of memory");
+      }
+      memcpy(w->buf + w->len, blk, p - blk);
+      w->len += p - blk;
+      blk = p;
+      line = 0;
+    }
+  }
+}
+
+
+/*
+ * Serve one request on CFD with the (already running) pool: read the
+ * framed input, dispatch it, close worker stdins, and stream the
+ * workers' output back as frames.  The pool is consumed -- every
+ * worker has exited when this returns.
+ */
+static void
+daemon_request(int cfd, struct dworker *pool, int nw)
+{
+  static char *req = NULL;      /* request buffer, reused across requests */
+  static size_t req_cap = 0;
+  static char *frame = NULL;
+  static size_t frame_cap = 0;
+
+  size_t req_len = 0;
+  ssize_t len;
+  struct pollfd *fds;
+  char rbuf[PIPE_BUF];
+  int i, nopen;
+
+  for (;;) {
+    len = recv_frame(cfd, &frame, &frame_cap);
+    if (len == -1) {
+      message(0, "client went away mid-request");
+      return;
+    }
+    if (len == 0)
+      break;
+
+    if (req_len + len > req_cap) {
+      req_cap = (req_len + len) * 2;
+      req = realloc(req, req_cap);
+      if (!req)
+        error(1, errno, "out of memory");
+    }
+    memcpy(req + req_len, frame, len);
+    req_len += len;
+  }
+
+  daemon_assign(pool, nw, req, req_len);
+
+  fds = malloc(sizeof(*fds) * nw * 2);
+  if (!fds)
+    error(1, errno, "out of memory");
+
+  /* feed stdins and drain stdouts in one poll loop; a slow worker
+   * blocks neither its siblings nor the response stream */
+  for (nopen = nw; nopen > 0; ) {
+    for (i = 0; i < nw; i++) {
+      fds[i].fd = (pool[i].off < pool[i].len) ? pool[i].in : -1;
+      fds[i].events = POLLOUT;
+      fds[i].revents = 0;
+
+      if (pool[i].in != -1 && pool[i].off >= pool[i].len) {
+        close(pool[i].in);      /* all fed; let the filter finish */
+        pool[i].in = -1;
+      }
+
+      fds[nw + i].fd = pool[i].out;
+      fds[nw + i].events = POLLIN;
+      fds[nw + i].revents = 0;
+    }
+
+    if (poll(fds, nw * 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      error(1, errno, "poll(2) failed");
+    }
+
+    for (i = 0; i < nw; i++) {
+      if (fds[i].revents & (POLLOUT | env.poll_errmask)) {
+        ssize_t wr = write(pool[i].in, pool[i].buf + pool[i].off,
+                           pool[i].len - pool[i].off);
+        if (wr > 0)
+          pool[i].off += wr;
+        else if (wr == -1 && errno != EAGAIN && errno != EINTR)
+          pool[i].off = pool[i].len; /* worker died; drop its share */
+      }
+
+      if (fds[nw + i].revents & (POLLIN | env.poll_errmask)) {
+        ssize_t rd = read(pool[i].out, rbuf, sizeof(rbuf));
+        if (rd > 0) {
+          if (send_frame(cfd, rbuf, rd) == -1)
+            message(0, "client went away mid-response");
+        }
+        else if (rd == 0 || (rd == -1 && errno != EAGAIN &&
+                             errno != EINTR)) {
+          close(pool[i].out);
+          pool[i].out = -1;
+          nopen--;
+        }
+      }
+    }
+  }
+  free(fds);
+
+  send_frame(cfd, NULL, 0);
+
+  for (i = 0; i < nw; i++) {
+    int status;
+
+    if (pool[i].in != -1) {
+      close(pool[i].in);
+      pool[i].in = -1;
+    }
+    if (waitpid(pool[i].pid, &status, 0) == -1)
+      error(0, errno, "waitpid failed for the process %u",
+            (unsigned)pool[i].pid);
+    else if (WIFSIGNALED(status))
+      message(0, "worker terminated: signal(%d)", WTERMSIG(status));
+    pool[i].pid = -1;
+    pool[i].len = pool[i].off = 0;
+  }
+}
+
+
+static int
+daemon_main(const char *sockpath, int argc, char *argv[])
+{
+  struct dworker *pool;
+  int lfd, cfd;
+  int i;
+
+  signal(SIGPIPE, SIG_IGN);
+
+  pool = calloc(env.njobs, sizeof(*pool));
+  if (!pool)
+    error(1, errno, "out of memory");
+
+  lfd = unix_listen(sockpath);
+  message(0, "daemon: listening on %s, %d warm worker(s)",
+          sockpath, env.njobs);
+
+  /* warm the pool before the first client shows up */
+  for (i = 0; i < env.njobs; i++)
+    dworker_spawn(pool + i, argc, argv);
+
+  for (;;) {
+    cfd = accept(lfd, NULL, NULL);
+    if (cfd == -1) {
+      if (errno == EINTR)
+        continue;
+      error(1, errno, "accept(2) failed");
+    }
+
+    daemon_request(cfd, pool, env.njobs);
+    close(cfd);
+
+    /* refill the pool between requests, off the latency path */
+    for (i = 0; i < env.njobs; i++)
+      dworker_spawn(pool + i, argc, argv);
+  }
+
+  /* not reached; the daemon runs until killed */
+  return 0;
+}
+
+
+static int
+client_main(const char *sockpath)
+{
+  char buf[PIPE_BUF];
+  char *frame = NULL;
+  size_t frame_cap = 0;
+  ssize_t rd, len;
+  int fd;
+
+  signal(SIGPIPE, SIG_IGN);
+
+  fd = unix_connect(sockpath);
+
+  /* Small-input protocol: ship all of stdin, then read the response.
+   * The daemon buffers the request before dispatching, so there is
+   * no write/write deadlock to worry about. */
+  while ((rd = fread(buf, 1, sizeof(buf), env.in)) > 0)
+    if (send_frame(fd, buf, rd) == -1)
+      error(1, errno, "cannot send to the daemon");
+  if (send_frame(fd, NULL, 0) == -1)
+    error(1, errno, "cannot send to the daemon");
+
+  for (;;) {
+    len = recv_frame(fd, &frame, &frame_cap);
+    if (len == -1)
+      error(1, 0, "daemon went away mid-response");
+    if (len == 0)
+      break;
+    if (fwrite(frame, 1, len, stdout) != (size_t)len)
+      error(1, errno, "write to stdout failed");
+  }
+
+  free(frame);
+  close(fd);
+  return 0;
+}
+
+
 static void
 version_and_exit(void)
 {
@@ -767,6 +1909,22 @@ usage(void)
     "",
     "  -j XX,   --jobs=XX           set number of workers to XX (processes)",
     "  -i FILE, --input=FILE        input is from FILE",
+    "  -B NN,   --block-lines=NN    feed NN lines at a time to a worker",
+    "                               (default: 1)",
+    "  -S[NN],  --splice[=NN]       splice(2) newline-aligned blocks of NN",
+    "                               bytes straight from the input file into",
+    "                               the workers; needs Linux and a regular",
+    "                               file as the input (default: 1 MiB)",
+    "",
+    "  -d SOCK, --daemon=SOCK       stay resident: serve requests arriving",
+    "                               on the unix socket SOCK from a pool of",
+    "                               pre-forked workers",
+    "  -c SOCK, --client=SOCK       send stdin to the daemon on SOCK and",
+    "                               copy the response to stdout",
+    "  -k,      --ordered           emit output on stdout in input order;",
+    "                               each block runs through its own filter",
+    "                               instance, merged via a bounded reorder",
+    "                               buffer of --jobs blocks",
     "",
     "  -O OUT, --output=OUT         child STDOUT will be stored in OUTxxxxxx",
     "  -E ERR, --output=ERR         child STDERR will be stored in ERRxxxxxx",
@@ -17,6 +17,8 @@
  */
 #define _GNU_SOURCE
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,6 +26,7 @@
 #include <limits.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/types.h>
 
 #include <snprintx.h>
@@ -53,6 +56,7 @@
 static int dlog_fd = -1;
 static unsigned dlog_mask;
 static const char *dlog_prefix = NULL;
+static int dlog_binary = 0;     /* emit struct dlog_rechdr records */
 
 
 static int dlog_thread = 0;     /* If zero, disable thread support */
@@ -75,6 +79,51 @@ static struct thinfo_ thinfo = {
 static void free_thname(void *value);
 static void dlog_thread_init_once(void);
 static char *dlog_create_name(void);
+
+/*
+ * Per-thread log buffers.
+ *
+ * With many threads logging at a high verbosity, funnelling every
+ * record through write(2)+fsync(2) serializes them all on the fd.
+ * When buffering is enabled (dlog_set_flush_interval() with a nonzero
+ * interval), each thread appends whole records to its own buffer and
+ * a dedicated thread flushes all of them periodically, so the hot
+ * path touches no shared state but the (uncontended) buffer mutex.
+ *
+ * A record never spans two flushes -- records are appended whole and
+ * flushed whole -- so record atomicity is the same as before.
+ */
+#define DLOG_TBUF_SIZE  (PIPE_BUF * 4)
+
+struct tbuf_ {
+  pthread_mutex_t mutex;        /* taken by the owner and the flusher */
+  size_t len;                   /* byte(s) filled in DATA */
+  int dead;                     /* owner thread is gone; free me */
+  struct tbuf_ *next;           /* sibling in flinfo.list */
+  char data[DLOG_TBUF_SIZE];
+};
+
+struct flinfo_ {
+  pthread_mutex_t mutex;        /* for all members below */
+  pthread_cond_t cond;          /* wakes the flusher early */
+  pthread_t thread;
+  int running;                  /* flusher thread exists */
+  int stop;                     /* asks the flusher to quit */
+  unsigned interval;            /* flush period in msec; 0 = no buffering */
+  struct tbuf_ *list;           /* every live (or dead) buffer */
+  pthread_key_t key;            /* thread-specific struct tbuf_ */
+};
+
+static struct flinfo_ flinfo = {
+  PTHREAD_MUTEX_INITIALIZER,
+  PTHREAD_COND_INITIALIZER,
+};
+
+static struct tbuf_ *tbuf_get(void);
+static void tbuf_flush(struct tbuf_ *tb);
+static void tbuf_retire(void *value);
+static void dlog_flush_all(int reap);
+static void *dlog_flusher(void *arg);
 #endif  /* NO_THREAD */
 
 
@@ -107,6 +156,9 @@ dlog_set_file(int fd)
 static void
 dlog_close_file(void)
 {
+#ifndef NO_THREAD
+  dlog_flush_all(0);
+#endif  /* NO_THREAD */
   if (dlog_fd != -1)
     close(dlog_fd);
 }
@@ -134,13 +186,186 @@ dlog_set_prefix(const char *prefix)
 
 
 #if !defined(NO_THREAD) && defined(USE_GETTID) && (USE_GETTID > 0)
+#if !defined(__GLIBC__) || !__GLIBC_PREREQ(2, 30)
+/* glibc provides gettid(2) itself since 2.30 */
 static pid_t
 gettid(void)
 {
   return syscall(SYS_gettid);
 }
+#endif
 #endif  /* USE_GETTID */
 
+/* Append one whole record, buffered when buffering is on. */
+static void
+dlog_emit(const char *buf, size_t reclen)
+{
+#ifndef NO_THREAD
+  struct tbuf_ *tb;
+
+  if (flinfo.interval && (tb = tbuf_get()) != NULL) {
+    pthread_mutex_lock(&tb->mutex);
+    if (tb->len + reclen > DLOG_TBUF_SIZE)
+      tbuf_flush(tb);           /* size threshold; flush inline */
+    memcpy(tb->data + tb->len, buf, reclen);
+    tb->len += reclen;
+    pthread_mutex_unlock(&tb->mutex);
+    return;
+  }
+#endif  /* NO_THREAD */
+  write(dlog_fd, buf, reclen);
+  fsync(dlog_fd);
+}
+
+
+/*
+ * Build one binary record (see struct dlog_rechdr in dlog.h) in BUF.
+ * The format string is stored verbatim; each argument is consumed
+ * from AP with the width printf would use and stored in its widened
+ * encoded form.  Returns the record length, or -1 if the record does
+ * not fit in SIZE byte(s).
+ */
+static ssize_t
+dlog_encode(char *buf, size_t size, int errnum, unsigned category,
+            const char *format, va_list ap)
+{
+  struct dlog_rechdr hdr;
+  struct timespec ts;
+  size_t len = sizeof(hdr);
+  size_t fmtlen = strlen(format);
+  const char *p = format;
+
+#define PUT(src, n)     do {                    \
+    if (len + (n) > size)                       \
+      return -1;                                \
+    memcpy(buf + len, (src), (n));              \
+    len += (n);                                 \
+  } while (0)
+#define PUT_CLS(c)      do {                    \
+    char cls_ = (c);                            \
+    PUT(&cls_, 1);                              \
+  } while (0)
+
+  if (fmtlen > USHRT_MAX)
+    return -1;
+  PUT(format, fmtlen);
+
+  while (*p != '\0') {
+    int cls, stars, lmod, i;
+    long long iv;
+    unsigned long long uv;
+    double fv;
+
+    if (*p != '%') {
+      p++;
+      continue;
+    }
+    cls = dlog_spec_class(&p, &stars, &lmod);
+
+    for (i = 0; i < stars; i++) {
+      iv = va_arg(ap, int);
+      PUT_CLS('i');
+      PUT(&iv, sizeof(iv));
+    }
+
+    switch (cls) {
+    case 'i':
+      if (lmod == 'l')
+        iv = va_arg(ap, long);
+      else if (lmod == 'L')
+        iv = va_arg(ap, long long);
+      else if (lmod == 'z')
+        iv = (long long)va_arg(ap, size_t);
+      else if (lmod == 'j')
+        iv = va_arg(ap, intmax_t);
+      else if (lmod == 't')
+        iv = va_arg(ap, ptrdiff_t);
+      else
+        iv = va_arg(ap, int);
+      PUT_CLS('i');
+      PUT(&iv, sizeof(iv));
+      break;
+
+    case 'u':
+      if (lmod == 'l')
+        uv = va_arg(ap, unsigned long);
+      else if (lmod == 'L')
+        uv = va_arg(ap, unsigned long long);
+      else if (lmod == 'z')
+        uv = va_arg(ap, size_t);
+      else if (lmod == 'j')
+        uv = va_arg(ap, uintmax_t);
+      else if (lmod == 't')
+        uv = (unsigned long long)va_arg(ap, ptrdiff_t);
+      else
+        uv = va_arg(ap, unsigned int);
+      PUT_CLS('u');
+      PUT(&uv, sizeof(uv));
+      break;
+
+    case 'f':
+      if (lmod == 'L')
+        fv = (double)va_arg(ap, long double);
+      else
+        fv = va_arg(ap, double);
+      PUT_CLS('f');
+      PUT(&fv, sizeof(fv));
+      break;
+
+    case 'c':
+      iv = va_arg(ap, int);
+      PUT_CLS('i');
+      PUT(&iv, sizeof(iv));
+      break;
+
+    case 's': {
+      const char *s = va_arg(ap, const char *);
+      unsigned short slen;
+
+      if (!s)
+        s = "(null)";
+      slen = strlen(s) > USHRT_MAX ? USHRT_MAX : strlen(s);
+      PUT_CLS('s');
+      PUT(&slen, sizeof(slen));
+      PUT(s, slen);
+      break;
+    }
+
+    case 'p':
+      uv = (unsigned long long)(size_t)va_arg(ap, void *);
+      PUT_CLS('p');
+      PUT(&uv, sizeof(uv));
+      break;
+
+    default:                    /* '%%' or malformed; no argument */
+      break;
+    }
+  }
+#undef PUT_CLS
+#undef PUT
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  hdr.magic = DLOG_REC_MAGIC;
+  hdr.reclen = len;
+  hdr.ts = (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  hdr.category = category;
+  hdr.errnum = errnum;
+  hdr.fmtlen = fmtlen;
+  memcpy(buf, &hdr, sizeof(hdr));
+
+  return len;
+}
+
+
+int
+dlog_set_binary(int enable)
+{
+  int old = dlog_binary;
+  dlog_binary = enable;
+  return old;
+}
+
+
 void
 derror(int status, int errnum, unsigned category, const char *format, ...)
 {
@@ -153,6 +378,18 @@ derror(int status, int errnum, unsigned category, const char *format, ...)
     if (dlog_mask & category)
       return;
 
+    if (dlog_binary) {
+      ssize_t reclen;
+
+      va_start(ap, format);
+      reclen = dlog_encode(buf, sizeof(buf), errnum, category, format, ap);
+      va_end(ap);
+
+      if (reclen > 0)
+        dlog_emit(buf, reclen);
+      goto done;
+    }
+
     fflush(stdout);
     if (dlog_fd == STDERR_FILENO)
       fflush(stderr);
@@ -178,13 +415,171 @@ derror(int status, int errnum, unsigned category, const char *format, ...)
     snprintx(&ptr, &bufsize, "\n");
 
     if (bufsize > 0)
-      write(dlog_fd, buf, sizeof(buf) - bufsize);
-
-    fsync(dlog_fd);
+      dlog_emit(buf, sizeof(buf) - bufsize);
   }
 
-  if (status)
+ done:
+  if (status) {
+#ifndef NO_THREAD
+    dlog_flush_all(0);
+#endif  /* NO_THREAD */
     exit(status);
+  }
+}
+
+
+#ifndef NO_THREAD
+/*
+ * Return the calling thread's buffer, creating and registering it on
+ * first use.  Returns NULL if buffering is unusable (e.g. the caller
+ * never went through dlog_thread_init()).
+ */
+static struct tbuf_ *
+tbuf_get(void)
+{
+  struct tbuf_ *tb;
+
+  if (!dlog_thread)
+    return NULL;
+
+  tb = pthread_getspecific(flinfo.key);
+  if (!tb) {
+    tb = malloc(sizeof(*tb));
+    if (!tb)
+      return NULL;
+    pthread_mutex_init(&tb->mutex, NULL);
+    tb->len = 0;
+    tb->dead = 0;
+
+    if (pthread_setspecific(flinfo.key, tb) != 0) {
+      pthread_mutex_destroy(&tb->mutex);
+      free(tb);
+      return NULL;
+    }
+    pthread_mutex_lock(&flinfo.mutex);
+    tb->next = flinfo.list;
+    flinfo.list = tb;
+    pthread_mutex_unlock(&flinfo.mutex);
+  }
+  return tb;
+}
+
+
+/* Write out TB's contents in one shot; TB->MUTEX must be held. */
+static void
+tbuf_flush(struct tbuf_ *tb)
+{
+  if (tb->len > 0 && dlog_fd != -1)
+    write(dlog_fd, tb->data, tb->len);
+  tb->len = 0;
+}
+
+
+/* TSD destructor: the owner thread is exiting.  The flusher (or
+ * dlog_flush_all) frees the node later, under flinfo.mutex. */
+static void
+tbuf_retire(void *value)
+{
+  struct tbuf_ *tb = value;
+
+  pthread_mutex_lock(&tb->mutex);
+  tbuf_flush(tb);
+  tb->dead = 1;
+  pthread_mutex_unlock(&tb->mutex);
+}
+
+
+/* Flush every registered buffer; with REAP, also free retired ones. */
+static void
+dlog_flush_all(int reap)
+{
+  struct tbuf_ **p, *tb;
+
+  pthread_mutex_lock(&flinfo.mutex);
+  p = &flinfo.list;
+  while ((tb = *p) != NULL) {
+    pthread_mutex_lock(&tb->mutex);
+    tbuf_flush(tb);
+    if (reap && tb->dead) {
+      *p = tb->next;
+      pthread_mutex_unlock(&tb->mutex);
+      pthread_mutex_destroy(&tb->mutex);
+      free(tb);
+      continue;
+    }
+    pthread_mutex_unlock(&tb->mutex);
+    p = &tb->next;
+  }
+  pthread_mutex_unlock(&flinfo.mutex);
+}
+
+
+static void *
+dlog_flusher(void *arg)
+{
+  struct timespec ts;
+  unsigned msec;
+
+  pthread_mutex_lock(&flinfo.mutex);
+  while (!flinfo.stop) {
+    msec = flinfo.interval ? flinfo.interval : 1000;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += msec / 1000;
+    ts.tv_nsec += (msec % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&flinfo.cond, &flinfo.mutex, &ts);
+
+    pthread_mutex_unlock(&flinfo.mutex);
+    dlog_flush_all(1);
+    pthread_mutex_lock(&flinfo.mutex);
+  }
+  pthread_mutex_unlock(&flinfo.mutex);
+
+  dlog_flush_all(1);            /* leave nothing behind */
+  return NULL;
+}
+#endif  /* NO_THREAD */
+
+
+unsigned
+dlog_set_flush_interval(unsigned msec)
+{
+  unsigned old = 0;
+
+#ifndef NO_THREAD
+  pthread_mutex_lock(&flinfo.mutex);
+  old = flinfo.interval;
+  flinfo.interval = msec;
+
+  if (msec && !flinfo.running) {
+    flinfo.stop = 0;
+    if (pthread_create(&flinfo.thread, NULL, dlog_flusher, NULL) == 0)
+      flinfo.running = 1;
+    else
+      flinfo.interval = 0;      /* no flusher, no buffering */
+    pthread_mutex_unlock(&flinfo.mutex);
+  }
+  else if (!msec && flinfo.running) {
+    flinfo.stop = 1;
+    pthread_cond_broadcast(&flinfo.cond);
+    pthread_mutex_unlock(&flinfo.mutex);
+    pthread_join(flinfo.thread, NULL);
+
+    pthread_mutex_lock(&flinfo.mutex);
+    flinfo.running = 0;
+    pthread_mutex_unlock(&flinfo.mutex);
+  }
+  else {
+    pthread_cond_broadcast(&flinfo.cond); /* pick up the new period */
+    pthread_mutex_unlock(&flinfo.mutex);
+  }
+#endif  /* NO_THREAD */
+
+  return old;
 }
 
 
@@ -204,6 +599,9 @@ dlog_thread_init_once(void)
   if (pthread_key_create(&thinfo.key, free_thname) < 0)
     fprintf(stderr, "dlog: cannot create a thread key: %s\n",
             strerror(errno));
+  if (pthread_key_create(&flinfo.key, tbuf_retire) < 0)
+    fprintf(stderr, "dlog: cannot create a thread key: %s\n",
+            strerror(errno));
 }
 
 
@@ -274,6 +672,10 @@ dlog_init(void)
     }
   }
 
+  p = getenv("DLOG_BINARY");
+  if (p)
+    dlog_binary = (p[0] != '\0' && strcmp(p, "0") != 0);
+
   p = getenv("DLOG_TRACE_CHILD");
   if (p) {
     if (p[0] != '\0') {
@@ -307,6 +709,8 @@ dlog_thread_init(void)
   dlog_thread = 1;
   if (pthread_once(&thinfo.once, dlog_thread_init_once) != 0)
     return -1;
+
+  (void)tbuf_get();             /* set up this thread's log buffer */
 #endif  /* NO_THREAD */
 
   return ret;
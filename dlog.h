@@ -66,6 +66,110 @@ extern int dlog_init(void);
 extern int dlog_thread_init(void);
 extern int dlog_set_thread_name(const char *name);
 
+/*
+ * With a nonzero MSEC, each thread buffers its records locally and a
+ * dedicated thread writes them out every MSEC millisecond(s) (or
+ * earlier, when a buffer fills up).  Records stay atomic.  Passing
+ * zero reverts to synchronous write(2)+fsync(2) per record.  Returns
+ * the previous interval.
+ */
+extern unsigned dlog_set_flush_interval(unsigned msec);
+
+/*
+ * Binary record mode.
+ *
+ * With a nonzero ENABLE, derror() stops formatting at emit time and
+ * writes compact binary records instead: the record header below,
+ * the format string, then each argument in encoded form.  Formatting
+ * is deferred to the offline decoder (dlogcat.c), which renders the
+ * records back to text.  Returns the previous mode.
+ *
+ * Records use the host's native byte order and must be decoded on a
+ * machine of the same endianness.
+ */
+extern int dlog_set_binary(int enable);
+
+#define DLOG_REC_MAGIC  0x31304c44      /* "DL01" */
+
+struct dlog_rechdr {
+  unsigned magic;               /* DLOG_REC_MAGIC */
+  unsigned reclen;              /* whole record, this header included */
+  long long ts;                 /* CLOCK_REALTIME, in nanoseconds */
+  unsigned category;
+  int errnum;
+  unsigned short fmtlen;        /* format string byte(s), no NUL */
+};
+
+/*
+ * Argument encoding, following the format string: one class byte,
+ * then the payload.  'i'/'u' carry a (long long)/(unsigned long
+ * long), 'f' a double, 'p' an unsigned long long, 's' an unsigned
+ * short length followed by that many byte(s), no NUL.  A '*' width
+ * or precision is encoded as an extra 'i' before its argument.
+ */
+
+/*
+ * Walk one printf conversion specification.  *PP points at the '%';
+ * on return it points just past the conversion character.  Returns
+ * the argument class ('i', 'u', 'f', 'c', 's', 'p', or '%'), or 0 on
+ * a malformed specification.  *STARS receives the number of '*'
+ * width/precision argument(s), *LMOD the length modifier: 'h', 'l',
+ * 'L' (meaning "ll" for integers, "L" for floats), 'z', 'j', 't',
+ * or 0.  Shared between the encoder (dlog.c) and dlogcat.c.
+ */
+static __inline__ int
+dlog_spec_class(const char **pp, int *stars, int *lmod)
+{
+  const char *p = *pp + 1;      /* skip '%' */
+  int cls;
+
+  *stars = 0;
+  *lmod = 0;
+
+  /* flags, width, precision */
+  while (*p != '\0') {
+    if (*p == '*')
+      (*stars)++;
+    else if (!((*p >= '0' && *p <= '9') || *p == '#' || *p == '-'
+               || *p == ' ' || *p == '+' || *p == '\'' || *p == '.'))
+      break;
+    p++;
+  }
+
+  while (*p == 'h' || *p == 'l' || *p == 'L' || *p == 'z'
+         || *p == 'j' || *p == 't') {
+    if (*p == 'l' && *lmod == 'l')
+      *lmod = 'L';              /* "ll" */
+    else
+      *lmod = *p;
+    p++;
+  }
+
+  switch (*p) {
+  case 'd': case 'i':
+    cls = 'i'; break;
+  case 'u': case 'o': case 'x': case 'X':
+    cls = 'u'; break;
+  case 'e': case 'E': case 'f': case 'F':
+  case 'g': case 'G': case 'a': case 'A':
+    cls = 'f'; break;
+  case 'c':
+    cls = 'c'; break;
+  case 's':
+    cls = 's'; break;
+  case 'p':
+    cls = 'p'; break;
+  case '%':
+    cls = '%'; break;
+  default:
+    cls = 0; break;
+  }
+  if (*p != '\0')
+    p++;
+  *pp = p;
+  return cls;
+}
+
 #define D_LOG           0x00000001
 #define D_WARN          0x00000002
 #define D_ERR           0x00000004
@@ -0,0 +1,284 @@
+/* dlogcat: decode binary dlog records to text
+ * Copyright (C) 2009  Seong-Kook Shin <cinsky@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Offline decoder for the binary records produced by dlog.c with
+ * dlog_set_binary() (or DLOG_BINARY=1).  Reads record streams from
+ * the given file(s), or stdin, and renders them back to the text
+ * derror() would have produced:
+ *
+ *   $ dlogcat app.dlog
+ *   2026-08-29 10:31:02.174 [0x00000001] opened 3 connections
+ *
+ * Records are in the machine's native byte order; decode on a
+ * machine of the same endianness as the producer.
+ */
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dlog.h"
+
+#define SPEC_MAX        64
+#define FIELD_MAX       PIPE_BUF
+
+
+/* Consume N byte(s) at *ARG, failing when fewer than N remain. */
+#define GET(dst, n)     do {                            \
+    if (*arglen < (n))                                  \
+      return -1;                                        \
+    memcpy((dst), *arg, (n));                           \
+    *arg += (n);                                        \
+    *arglen -= (n);                                     \
+  } while (0)
+
+
+static int
+get_class(const unsigned char **arg, size_t *arglen, int expected)
+{
+  unsigned char cls;
+
+  GET(&cls, 1);
+  if (cls != expected)
+    return -1;
+  return 0;
+}
+
+
+static int
+get_int(const unsigned char **arg, size_t *arglen, long long *value)
+{
+  if (get_class(arg, arglen, 'i') < 0)
+    return -1;
+  GET(value, sizeof(*value));
+  return 0;
+}
+
+
+/*
+ * Render one conversion (SPEC, classified as CLS with STARS '*'
+ * argument(s)) into FP, consuming the encoded argument(s) at *ARG.
+ * SPEC is rewritten on the fly: length modifiers are dropped and
+ * integer conversions get "ll", matching the widened encoded forms.
+ * Returns 0 on success, -1 on a truncated or mismatched record.
+ */
+static int
+render_spec(FILE *fp, const char *spec, size_t speclen, int cls, int stars,
+            const unsigned char **arg, size_t *arglen)
+{
+  char fmt[SPEC_MAX + 4], out[FIELD_MAX];
+  size_t n = 0;
+  size_t i;
+  long long w = 0, p = 0;
+  long long iv;
+  unsigned long long uv;
+  double fv;
+
+  if (speclen + 2 >= sizeof(fmt))
+    return -1;
+
+  for (i = 0; i < speclen; i++) {
+    if (strchr("hlLzjt", spec[i]) && i > 0)
+      continue;                 /* drop the original length modifier */
+    if (i == speclen - 1 && (cls == 'i' || cls == 'u')) {
+      fmt[n++] = 'l';
+      fmt[n++] = 'l';
+    }
+    fmt[n++] = spec[i];
+  }
+  fmt[n] = '\0';
+
+  if (stars > 0 && get_int(arg, arglen, &w) < 0)
+    return -1;
+  if (stars > 1 && get_int(arg, arglen, &p) < 0)
+    return -1;
+
+#define RENDER(value)   do {                                            \
+    if (stars == 2)                                                     \
+      snprintf(out, sizeof(out), fmt, (int)w, (int)p, (value));         \
+    else if (stars == 1)                                                \
+      snprintf(out, sizeof(out), fmt, (int)w, (value));                 \
+    else                                                                \
+      snprintf(out, sizeof(out), fmt, (value));                         \
+  } while (0)
+
+  switch (cls) {
+  case 'i':
+    if (get_int(arg, arglen, &iv) < 0)
+      return -1;
+    RENDER(iv);
+    break;
+
+  case 'u':
+  case 'p':
+    if (get_class(arg, arglen, cls == 'p' ? 'p' : 'u') < 0)
+      return -1;
+    GET(&uv, sizeof(uv));
+    if (cls == 'p') {
+      snprintf(out, sizeof(out), "0x%llx", uv);
+      break;
+    }
+    RENDER(uv);
+    break;
+
+  case 'f':
+    if (get_class(arg, arglen, 'f') < 0)
+      return -1;
+    GET(&fv, sizeof(fv));
+    RENDER(fv);
+    break;
+
+  case 'c':
+    if (get_int(arg, arglen, &iv) < 0)
+      return -1;
+    RENDER((int)iv);
+    break;
+
+  case 's': {
+    unsigned short slen;
+    static char sbuf[USHRT_MAX + 1];
+
+    if (get_class(arg, arglen, 's') < 0)
+      return -1;
+    GET(&slen, sizeof(slen));
+    GET(sbuf, (size_t)slen);
+    sbuf[slen] = '\0';
+    RENDER(sbuf);
+    break;
+  }
+
+  default:
+    return -1;
+  }
+#undef RENDER
+
+  fputs(out, fp);
+  return 0;
+}
+
+
+static int
+render_record(FILE *fp, const struct dlog_rechdr *hdr,
+              const char *fmt, const unsigned char *arg, size_t arglen)
+{
+  char tstamp[64];
+  struct tm tm;
+  time_t sec = hdr->ts / 1000000000LL;
+  const char *p = fmt;
+
+  localtime_r(&sec, &tm);
+  strftime(tstamp, sizeof(tstamp), "%Y-%m-%d %H:%M:%S", &tm);
+  fprintf(fp, "%s.%03d [0x%08x] ", tstamp,
+          (int)(hdr->ts % 1000000000LL / 1000000LL), hdr->category);
+
+  while (*p != '\0') {
+    const char *spec;
+    int cls, stars, lmod;
+
+    if (*p != '%') {
+      fputc(*p++, fp);
+      continue;
+    }
+    spec = p;
+    cls = dlog_spec_class(&p, &stars, &lmod);
+
+    if (cls == '%')
+      fputc('%', fp);
+    else if (cls == 0)
+      fwrite(spec, 1, p - spec, fp);
+    else if (render_spec(fp, spec, p - spec, cls, stars, &arg, &arglen) < 0)
+      return -1;
+  }
+
+  if (hdr->errnum)
+    fprintf(fp, ": %s", strerror(hdr->errnum));
+  fputc('\n', fp);
+  return 0;
+}
+
+
+static int
+dlogcat(FILE *in, FILE *out, const char *name)
+{
+  struct dlog_rechdr hdr;
+  static char body[USHRT_MAX + PIPE_BUF];
+  long recno = 0;
+
+  while (fread(&hdr, sizeof(hdr), 1, in) == 1) {
+    size_t bodylen;
+
+    recno++;
+    if (hdr.magic != DLOG_REC_MAGIC || hdr.reclen < sizeof(hdr)
+        || hdr.reclen - sizeof(hdr) > sizeof(body)
+        || hdr.fmtlen > hdr.reclen - sizeof(hdr)) {
+      fprintf(stderr, "dlogcat: %s: record %ld: bad header\n", name, recno);
+      return -1;
+    }
+    bodylen = hdr.reclen - sizeof(hdr);
+    if (fread(body, 1, bodylen, in) != bodylen) {
+      fprintf(stderr, "dlogcat: %s: record %ld: truncated\n", name, recno);
+      return -1;
+    }
+    {
+      char fmt[USHRT_MAX + 1];  /* the stored format has no NUL */
+
+      memcpy(fmt, body, hdr.fmtlen);
+      fmt[hdr.fmtlen] = '\0';
+
+      if (render_record(out, &hdr, fmt,
+                        (unsigned char *)body + hdr.fmtlen,
+                        bodylen - hdr.fmtlen) < 0) {
+        fprintf(stderr, "dlogcat: %s: record %ld: malformed arguments\n",
+                name, recno);
+        return -1;
+      }
+    }
+  }
+  if (ferror(in)) {
+    fprintf(stderr, "dlogcat: %s: read error: %s\n", name, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+  int i, ret = 0;
+
+  if (argc < 2)
+    return dlogcat(stdin, stdout, "(stdin)") < 0;
+
+  for (i = 1; i < argc; i++) {
+    FILE *fp = fopen(argv[i], "rb");
+
+    if (!fp) {
+      fprintf(stderr, "dlogcat: %s: %s\n", argv[i], strerror(errno));
+      ret = 1;
+      continue;
+    }
+    if (dlogcat(fp, stdout, argv[i]) < 0)
+      ret = 1;
+    fclose(fp);
+  }
+  return ret;
+}
@@ -132,6 +132,108 @@ easyconv_str2str(iconv_t CD, char **DST, size_t *DST_SIZE,
 }
 
 
+/*
+ * Per-thread descriptor cache for easyconv_str2str2(), most recently
+ * used pair first.  Thread-local, so no locking and no sharing of
+ * iconv descriptors between threads.
+ */
+struct convent {
+  char to[EASYCONV_NAME_MAX];
+  char from[EASYCONV_NAME_MAX];
+  iconv_t cd;
+};
+
+static __thread struct convent conv_cache[EASYCONV_CACHE_MAX];
+static __thread int conv_cached = 0;
+
+
+/*
+ * Return a descriptor for (TOCODE, FROMCODE), opening and caching it
+ * on the first use.  *TRANSIENT is set nonzero when the pair cannot
+ * be cached (encoding name too long) and the caller must close the
+ * descriptor itself.  Returns (iconv_t)-1 on error.
+ */
+static iconv_t
+conv_cache_get(const char *tocode, const char *fromcode, int *transient)
+{
+  struct convent ent;
+  iconv_t cd;
+  int i;
+
+  *transient = 0;
+
+  for (i = 0; i < conv_cached; i++) {
+    if (strcmp(conv_cache[i].to, tocode) == 0
+        && strcmp(conv_cache[i].from, fromcode) == 0) {
+      if (i > 0) {              /* move-to-front keeps hot pairs cheap */
+        ent = conv_cache[i];
+        memmove(conv_cache + 1, conv_cache, sizeof(ent) * i);
+        conv_cache[0] = ent;
+      }
+      return conv_cache[0].cd;
+    }
+  }
+
+  cd = iconv_open(tocode, fromcode);
+  if (cd == (iconv_t)-1)
+    return cd;
+
+  if (strlen(tocode) >= EASYCONV_NAME_MAX
+      || strlen(fromcode) >= EASYCONV_NAME_MAX) {
+    *transient = 1;
+    return cd;
+  }
+
+  if (conv_cached == EASYCONV_CACHE_MAX) {
+    iconv_close(conv_cache[conv_cached - 1].cd); /* drop the LRU pair */
+    conv_cached--;
+  }
+
+  memmove(conv_cache + 1, conv_cache, sizeof(ent) * conv_cached);
+  strcpy(conv_cache[0].to, tocode);
+  strcpy(conv_cache[0].from, fromcode);
+  conv_cache[0].cd = cd;
+  conv_cached++;
+
+  return cd;
+}
+
+
+size_t
+easyconv_str2str2(const char *tocode, const char *fromcode,
+                  char **DST, size_t *DST_SIZE,
+                  const char *SRC, size_t SRC_SIZE, size_t *NREVCONV)
+{
+  iconv_t cd;
+  size_t ret;
+  int transient, olderr;
+
+  cd = conv_cache_get(tocode, fromcode, &transient);
+  if (cd == (iconv_t)-1)
+    return (size_t)-1;
+
+  ret = easyconv_str2str(cd, DST, DST_SIZE, SRC, SRC_SIZE, NREVCONV);
+
+  if (transient) {
+    olderr = errno;
+    iconv_close(cd);
+    errno = olderr;
+  }
+  return ret;
+}
+
+
+void
+easyconv_purge(void)
+{
+  int i;
+
+  for (i = 0; i < conv_cached; i++)
+    iconv_close(conv_cache[i].cd);
+  conv_cached = 0;
+}
+
+
 #ifdef TEST_EASYCONV
 #include <stdio.h>
 #include <unistd.h>
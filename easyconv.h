@@ -108,6 +108,41 @@ extern size_t easyconv_str2str(iconv_t CD, char **DST, size_t *DST_SIZE,
                                const char *SRC, size_t SRC_SIZE,
                                size_t *NREVCONV);
 
+/*
+ * EASYCONV_CACHE_MAX is the number of (TOCODE, FROMCODE) pairs each
+ * thread keeps warm for easyconv_str2str2().  EASYCONV_NAME_MAX
+ * bounds a cacheable encoding name, terminating nul included.
+ */
+#define EASYCONV_CACHE_MAX      8
+#define EASYCONV_NAME_MAX       32
+
+/*
+ * easyconv_str2str2(): like easyconv_str2str(), but easyconv manages
+ * the conversion descriptor for you.
+ *
+ * The descriptor for (TOCODE, FROMCODE) -- the argument order of
+ * iconv_open(3) -- is taken from a per-thread cache, so the very
+ * expensive iconv_open() (it loads gconv modules) happens only on
+ * the first conversion of a pair in each thread; repeated calls
+ * reuse the warm descriptor.  Since the cache is thread-local, no
+ * locking is involved and a descriptor is never shared between
+ * threads.  Each thread caches up to EASYCONV_CACHE_MAX pairs; the
+ * least recently used one is closed to make room.
+ *
+ * Everything else (DST handling, return value, errno) is exactly as
+ * easyconv_str2str() above.
+ *
+ * The cached descriptors live until the thread calls
+ * easyconv_purge(), which closes all of them.  Call it before thread
+ * exit if descriptors must not outlive the thread.
+ */
+extern size_t easyconv_str2str2(const char *tocode, const char *fromcode,
+                                char **DST, size_t *DST_SIZE,
+                                const char *SRC, size_t SRC_SIZE,
+                                size_t *NREVCONV);
+
+extern void easyconv_purge(void);
+
 END_C_DECLS
 
 #endif  /* EASYCONV_H__ */
@@ -343,6 +343,175 @@ edque_pop_front(struct elist *ht)
 #undef EDQUE_HEAD
 #undef EDQUE_TAIL
 
+
+/*
+ * elist_sort() -- Sort the list starting at NODE in place.
+ *
+ * CMP receives two nodes and DATA, and returns negative, zero or
+ * positive like qsort(3) comparators; use ELIST_ENTRY() inside CMP to
+ * reach the enclosing structs.  The sort is a bottom-up merge sort --
+ * no recursion, no extra array -- so a 100k-entry list is ordered in
+ * place in O(N log N) node visits.  The sort is stable.  Returns the
+ * first node of the sorted list.
+ */
+static __inline__ struct elist *
+elist_sort_merge_(struct elist *a, struct elist *b,
+                  int (*cmp)(struct elist *, struct elist *, void *),
+                  void *data)
+{
+  struct elist head, *tail = &head;
+
+  while (a && b) {
+    if (cmp(a, b, data) <= 0) {
+      tail->next = a;
+      a = a->next;
+    }
+    else {
+      tail->next = b;
+      b = b->next;
+    }
+    tail = tail->next;
+  }
+  tail->next = a ? a : b;
+  return head.next;
+}
+
+
+static __inline__ struct elist *
+elist_sort(struct elist *node,
+           int (*cmp)(struct elist *, struct elist *, void *), void *data)
+{
+  /* part[i] holds a sorted sublist of 2^i nodes, or 0; prev pointers
+   * are ignored during the merges and rebuilt in one final pass. */
+  struct elist *part[sizeof(long) * 8] = { 0 };
+  struct elist *p, *prev;
+  int i, max = 0;
+
+  while (node) {
+    p = node;
+    node = node->next;
+    p->next = 0;
+
+    for (i = 0; part[i]; i++) {
+      p = elist_sort_merge_(part[i], p, cmp, data);
+      part[i] = 0;
+    }
+    part[i] = p;
+    if (i > max)
+      max = i;
+  }
+
+  p = 0;
+  for (i = 0; i <= max; i++)
+    if (part[i])
+      p = p ? elist_sort_merge_(part[i], p, cmp, data) : part[i];
+
+  prev = 0;
+  for (node = p; node; node = node->next) {
+    node->prev = prev;
+    prev = node;
+  }
+  return p;
+}
+
+
+/*
+ * ecque -- edque plus an O(1) length.
+ *
+ * Same usage as edque above, except that the head is a struct ecque
+ * and every push/pop/extract maintains ecque_length().  Use it where
+ * the code would otherwise keep a counter next to the list by hand.
+ */
+struct ecque {
+  struct elist list;            /* prev = head, next = tail */
+  int length;
+};
+
+#define ECQUE_HEAD(cq)  ((cq)->list.prev)
+#define ECQUE_TAIL(cq)  ((cq)->list.next)
+
+static __inline__ void
+ecque_init(struct ecque *cq)
+{
+  ELIST_INIT(cq->list);
+  cq->length = 0;
+}
+
+
+static __inline__ int
+ecque_length(struct ecque *cq)
+{
+  return cq->length;
+}
+
+
+static __inline__ void
+ecque_push_back(struct ecque *cq, struct elist *node)
+{
+  edque_push_back(&cq->list, node);
+  cq->length++;
+}
+
+
+static __inline__ void
+ecque_push_front(struct ecque *cq, struct elist *node)
+{
+  edque_push_front(&cq->list, node);
+  cq->length++;
+}
+
+
+static __inline__ struct elist *
+ecque_pop_back(struct ecque *cq)
+{
+  struct elist *p = edque_pop_back(&cq->list);
+  if (p)
+    cq->length--;
+  return p;
+}
+
+
+static __inline__ struct elist *
+ecque_pop_front(struct ecque *cq)
+{
+  struct elist *p = edque_pop_front(&cq->list);
+  if (p)
+    cq->length--;
+  return p;
+}
+
+
+/* unlink ELEM, which must be on CQ, from anywhere in the deque */
+static __inline__ void
+ecque_extract(struct ecque *cq, struct elist *elem)
+{
+  if (ECQUE_HEAD(cq) == elem)
+    ECQUE_HEAD(cq) = elem->next;
+  if (ECQUE_TAIL(cq) == elem)
+    ECQUE_TAIL(cq) = elem->prev;
+
+  if (elem->prev)
+    elem->prev->next = elem->next;
+  if (elem->next)
+    elem->next->prev = elem->prev;
+  elem->next = elem->prev = 0;
+
+  cq->length--;
+}
+
+
+/* sort the whole deque in place; see elist_sort() for CMP */
+static __inline__ void
+ecque_sort(struct ecque *cq,
+           int (*cmp)(struct elist *, struct elist *, void *), void *data)
+{
+  ECQUE_HEAD(cq) = elist_sort(ECQUE_HEAD(cq), cmp, data);
+  ECQUE_TAIL(cq) = elist_last(ECQUE_HEAD(cq));
+}
+
+#undef ECQUE_HEAD
+#undef ECQUE_TAIL
+
 END_C_DECLS
 
 #endif /* ELIST_H_ */
@@ -12,10 +12,12 @@
 #include "fakeobs.h"
 
 #define DEF_MAX_PTRS    32
+#define DEF_GROW_MIN    64
 
 
 void (*obstack_alloc_failed_handler)(void);
 int fake_alignment_mask;
+int fake_grow_limit = 1024 * 1024;
 
 
 #define ERROR   do {                                \
@@ -31,6 +33,11 @@ obstack_init_(struct obstack *stack, void *(*alloc_func)(size_t))
 
   stack->grow = 0;
   stack->grow_size = 0;
+  stack->grow_cap = 0;
+
+  stack->stats.chunks = 0;
+  stack->stats.grow_copies = 0;
+  stack->stats.wasted = 0;
 
   stack->current = -1;
 
@@ -69,6 +76,46 @@ grow_ptrs(struct obstack *stack, void *(*realloc_func)(void *, size_t))
 }
 
 
+/*
+ * Make sure the growing object has room for NEED bytes, enlarging
+ * its capacity geometrically (doubling up to fake_grow_limit, then
+ * in fake_grow_limit steps) so that building a large object costs
+ * O(log n) reallocations instead of one per grow call.
+ */
+static void *
+grow_room(struct obstack *stack, int need,
+          void *(*realloc_func)(void *, size_t))
+{
+  void *p = stack->ptrs[stack->current];
+  int cap = stack->grow_cap;
+
+  if (cap >= need)
+    return p;
+
+  if (cap == 0)
+    cap = DEF_GROW_MIN;
+  while (cap < need) {
+    if (fake_grow_limit > 0 && cap >= fake_grow_limit)
+      cap += fake_grow_limit;
+    else
+      cap *= 2;
+  }
+
+  p = realloc_func(p, cap);
+  if (!p) {
+    ERROR;
+    return 0;
+  }
+  stack->stats.chunks++;
+  if (stack->grow_size > 0)
+    stack->stats.grow_copies++;
+
+  stack->grow_cap = cap;
+  stack->ptrs[stack->current] = p;
+  return p;
+}
+
+
 void *
 obstack_alloc_(struct obstack *stack, int size,
                void *(*realloc_func)(void *, size_t))
@@ -82,6 +129,7 @@ obstack_alloc_(struct obstack *stack, int size,
   p = realloc_func(0, size);
   if (p) {
     stack->ptrs[++stack->current] = p;
+    stack->stats.chunks++;
   }
   else
     ERROR;
@@ -150,16 +198,12 @@ obstack_blank_(struct obstack *stack, int size,
     }
     stack->current++;
     stack->grow_size = 0;
+    stack->grow_cap = 0;
   }
   stack->grow = 1;
-  p = stack->ptrs[stack->current];
-  p = realloc_func(p, stack->grow_size + size + 1);
-  if (p) {
+  p = grow_room(stack, stack->grow_size + size + 1, realloc_func);
+  if (p)
     stack->grow_size += size;
-    stack->ptrs[stack->current] = p;
-  }
-  else
-    ERROR;
 }
 
 
@@ -176,17 +220,14 @@ obstack_grow_(struct obstack *stack, const void *address, int size,
     }
     stack->current++;
     stack->grow_size = 0;
+    stack->grow_cap = 0;
   }
   stack->grow = 1;
-  p = stack->ptrs[stack->current];
-  p = realloc_func(p, stack->grow_size + size);
+  p = grow_room(stack, stack->grow_size + size, realloc_func);
   if (p) {
     stack->grow_size += size;
-    stack->ptrs[stack->current] = p;
     memcpy((unsigned char *)p + stack->grow_size - size, address, size);
   }
-  else
-    ERROR;
 }
 
 
@@ -203,18 +244,15 @@ obstack_grow0_(struct obstack *stack, const void *address, int size,
     }
     stack->current++;
     stack->grow_size = 0;
+    stack->grow_cap = 0;
   }
   stack->grow = 1;
-  p = stack->ptrs[stack->current];
-  p = realloc_func(p, stack->grow_size + size + 1);
+  p = grow_room(stack, stack->grow_size + size + 1, realloc_func);
   if (p) {
     stack->grow_size += size + 1;
-    stack->ptrs[stack->current] = p;
     memcpy((unsigned char *)p + stack->grow_size - size - 1, address, size);
     *((unsigned char *)p + stack->grow_size - 1) = '\0';
   }
-  else
-    ERROR;
 }
 
 
@@ -225,23 +263,20 @@ obstack_1grow_(struct obstack *stack, char data,
   void *p;
 
   if (!stack->grow) {
-    if (stack->current - 1 >= stack->num_ptrs) {
+    if (stack->current + 1 >= stack->num_ptrs) {
       if (grow_ptrs(stack, realloc_func) < 0)
         return;
     }
     stack->current++;
     stack->grow_size = 0;
+    stack->grow_cap = 0;
   }
   stack->grow = 1;
-  p = stack->ptrs[stack->current];
-  p = realloc_func(p, stack->grow_size + 1);
+  p = grow_room(stack, stack->grow_size + 1, realloc_func);
   if (p) {
     stack->grow_size += 1;
-    stack->ptrs[stack->current] = p;
     *((unsigned char *)p + stack->grow_size - 1) = data;
   }
-  else
-    ERROR;
 }
 
 
@@ -33,15 +33,38 @@ BEGIN_C_DECLS
  * Description of the rest functions and macros are found in
  * GNU obstack manual.
  */
+/*
+ * Allocation statistics, kept per obstack since obstack_init().
+ * Scrape them to size chunks properly: lots of grow_copies means the
+ * growth cap (fake_grow_limit) is too small for your objects, lots
+ * of wasted bytes means it is too large.
+ */
+struct obstack_stats {
+  long chunks;                  /* allocator calls made for object memory */
+  long grow_copies;             /* reallocs of a partially built object */
+  long wasted;                  /* capacity left over in finished objects */
+};
+
 struct obstack {
   int grow;
   int grow_size;
+  int grow_cap;
 
   int num_ptrs;
   int current;
   void **ptrs;
+
+  struct obstack_stats stats;
 };
 
+/*
+ * A growing object's capacity is doubled whenever it runs out of
+ * room, starting small; past fake_grow_limit bytes it grows by
+ * fake_grow_limit at a time instead.  Set it to 0 to keep doubling
+ * without bound.
+ */
+extern int fake_grow_limit;
+
 
 /* You should define fake_obstack_malloc, fake_obstack_free, and
  * fake_obstack_realloc appropriately.  obstack_chunk_alloc and
@@ -104,8 +127,11 @@ extern void obstack_int_grow(struct obstack *s, int data);
 static __inline__ void *
 obstack_finish(struct obstack *stack)
 {
+  if (stack->grow_cap > stack->grow_size)
+    stack->stats.wasted += stack->grow_cap - stack->grow_size;
   stack->grow = 0;
   stack->grow_size = 0;
+  stack->grow_cap = 0;
   return stack->ptrs[stack->current];
 }
 
@@ -7,6 +7,8 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 
+#include "ioprobe.h"
+
 #define RCVBUF_SIZE     -1
 #define SNDBUF_SIZE     -1
 
@@ -47,9 +49,10 @@ fd_blk_size(int fd, int *rdbuf_size, int *wrbuf_size)
 
 
 void
-print(const char *name, int rsize, int wsize)
+print(const char *name, int fd, int rsize, int wsize)
 {
-  printf("%20s %10d %10d\n", name, rsize, wsize);
+  printf("%20s %10d %10d %10d %10d\n", name, rsize, wsize,
+         ioprobe_best_bufsize(fd), ioprobe_dio_align(fd));
 }
 
 void
@@ -64,7 +67,7 @@ print_socket_buffer(const char *name, int domain, int type)
     return;
   }
   fd_blk_size(fd, &rsize, &wsize);
-  print(name, rsize, wsize);
+  print(name, fd, rsize, wsize);
   close(fd);
 }
 
@@ -80,7 +83,7 @@ print_pipe_buffer(const char *name)
   }
   fd_blk_size(fd[0], &rsize, 0);
   fd_blk_size(fd[1], &wsize, 0);
-  print(name, rsize, wsize);
+  print(name, fd[0], rsize, wsize);
   close(fd[0]);
   close(fd[1]);
 }
@@ -98,7 +101,7 @@ print_spair_buffer(const char *name, int domain, int type)
   }
 
   fd_blk_size(fd[0], &rsize, &wsize);
-  print(name, rsize, wsize);
+  print(name, fd[0], rsize, wsize);
   close(fd[0]);
   close(fd[1]);
 }
@@ -123,7 +126,7 @@ print_file_buffer(const char *prefix)
   unlink(tmpfile);
   fd_blk_size(fd, &rsize, &wsize);
 
-  print(tmpfile, rsize, wsize);
+  print(tmpfile, fd, rsize, wsize);
 
   free(tmpfile);
   close(fd);
@@ -132,6 +135,8 @@ print_file_buffer(const char *prefix)
 int
 main(int argc, char *argv[])
 {
+  printf("%20s %10s %10s %10s %10s\n",
+         "NAME", "RDBUF", "WRBUF", "BEST", "DIO-ALIGN");
   print_pipe_buffer("PIPE");
   print_spair_buffer("SPAIR-STREAM", AF_LOCAL, SOCK_STREAM);
   print_spair_buffer("SPAIR-DGRAM", AF_LOCAL, SOCK_DGRAM);
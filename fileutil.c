@@ -5,10 +5,17 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
 #include <dirent.h>
+#include <fts.h>
+#include <fcntl.h>
 
 #include <unistd.h>
 
+#ifdef _PTHREAD
+#include <pthread.h>
+#endif
+
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -309,6 +316,411 @@ delete_directory(const char *pathname, int force)
 }
 
 
+int
+make_directory_at(int dirfd, const char *relpath)
+{
+  char *path, *comp, *sp;
+  int fd, nfd;
+  int ret = -1;
+  int saved_errno = errno;
+
+  if (!relpath)
+    return -1;
+
+  path = strdup(relpath);
+  if (!path)
+    return -1;
+
+  fd = dirfd;
+  if (*path == '/') {           /* absolute; DIRFD does not apply */
+    fd = open("/", O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+      saved_errno = errno;
+      goto end;
+    }
+  }
+
+  /* Descend one component at a time, carrying the parent fd along:
+   * each component costs one mkdirat(2) and one openat(2) relative
+   * to its parent, never a lookup of the whole prefix. */
+  for (comp = strtok_r(path, "/", &sp); comp != NULL;
+       comp = strtok_r(NULL, "/", &sp)) {
+    if (mkdirat(fd, comp, 0777) < 0 &&
+        errno != EEXIST && errno != EISDIR) {
+      saved_errno = errno;
+      goto end;
+    }
+    nfd = openat(fd, comp, O_RDONLY | O_DIRECTORY);
+    if (nfd == -1) {
+      saved_errno = errno;
+      goto end;
+    }
+    if (fd != dirfd)
+      close(fd);
+    fd = nfd;
+  }
+  ret = 0;
+
+ end:
+  if (fd != dirfd && fd != -1)
+    close(fd);
+  free(path);
+  errno = saved_errno;
+  return ret;
+}
+
+
+int
+make_directory_cached(const char *pathname)
+{
+  static char cached[PATH_MAX];
+  static size_t cached_len = 0;
+  static int cached_fd = -1;
+
+  const char *base;
+  size_t dirlen;
+  int fd;
+
+  if (!pathname)
+    return -1;
+
+  base = strrchr(pathname, '/');
+
+  if (base && base[1] != '\0' && cached_fd != -1) {
+    dirlen = base - pathname;
+    if (dirlen == cached_len &&
+        strncmp(pathname, cached, cached_len) == 0) {
+      /* parent already made; the sibling costs one mkdirat(2). */
+      if (mkdirat(cached_fd, base + 1, 0777) == 0 ||
+          errno == EEXIST || errno == EISDIR)
+        return 0;
+      return -1;
+    }
+  }
+
+  if (make_directory_at(AT_FDCWD, pathname) < 0)
+    return -1;
+
+  /* re-prime the cache with the new parent directory */
+  if (base && base[1] != '\0' && (size_t)(base - pathname) < PATH_MAX) {
+    dirlen = base - pathname;
+    memcpy(cached, pathname, dirlen);
+    cached[dirlen] = '\0';
+
+    fd = open(dirlen ? cached : "/", O_RDONLY | O_DIRECTORY);
+    if (fd != -1) {
+      if (cached_fd != -1)
+        close(cached_fd);
+      cached_fd = fd;
+      cached_len = dirlen;
+    }
+  }
+  return 0;
+}
+
+
+/*
+ * Serial deletion in fts(3) order.
+ *
+ * fts_read() hands out files before their directory's post-order
+ * visit (FTS_DP), so every rmdir() happens on an already-empty
+ * directory, and fts keeps the per-level fd open -- no re-opendir per
+ * entry like delete_directory() does.
+ */
+static int
+delete_directory_fts(const char *pathname, int force)
+{
+  char *const argv[] = { (char *)pathname, NULL };
+  FTS *fts;
+  FTSENT *ent;
+  int ret = 0;
+  int saved_errno = errno;
+
+  fts = fts_open(argv, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+  if (!fts)
+    return -1;
+
+  while ((ent = fts_read(fts)) != NULL) {
+    switch (ent->fts_info) {
+    case FTS_D:
+      if (force &&
+          chmod(ent->fts_accpath,
+                (ent->fts_statp->st_mode & (S_IRWXU | S_IRWXG | S_IRWXO))
+                | S_IRUSR | S_IWUSR | S_IXUSR) < 0) {
+        saved_errno = errno;
+        ret = -1;
+      }
+      break;
+
+    case FTS_DP:
+      if (rmdir(ent->fts_accpath) < 0) {
+        saved_errno = errno;
+        ret = -1;
+      }
+      break;
+
+    case FTS_DNR:
+    case FTS_ERR:
+    case FTS_NS:
+      saved_errno = ent->fts_errno;
+      ret = -1;
+      break;
+
+    default:                    /* FTS_F, FTS_SL, FTS_SLNONE, ... */
+      if (unlink(ent->fts_accpath) < 0) {
+        saved_errno = errno;
+        ret = -1;
+      }
+      break;
+    }
+  }
+
+  fts_close(fts);
+  errno = saved_errno;
+  return ret;
+}
+
+
+#ifdef _PTHREAD
+/*
+ * Parallel deletion engine.
+ *
+ * Each directory is an independent work unit: a worker opens it once,
+ * unlinks its files through unlinkat(2) relative to that fd (no
+ * full-path lookup per entry), and queues any subdirectory as a new
+ * unit.  A directory is rmdir-ed when its own scan is done and its
+ * last child subtree is gone; PENDING counts both, and the last
+ * decrementer walks the rmdir up toward the root.
+ */
+
+struct dd_node {
+  char *path;
+  struct dd_node *parent;
+  int pending;                  /* 1 while scanning, +1 per child dir */
+  struct dd_node *next;         /* work queue link */
+};
+
+struct dd_ctl {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  struct dd_node *queue;
+  int idle;
+  int nworkers;
+  int stop;
+
+  int force;
+  int error;                    /* first errno met, zero if none */
+};
+
+
+static void
+dd_error(struct dd_ctl *ctl, int errnum)
+{
+  pthread_mutex_lock(&ctl->lock);
+  if (!ctl->error)
+    ctl->error = errnum;
+  pthread_mutex_unlock(&ctl->lock);
+}
+
+
+static void
+dd_push(struct dd_ctl *ctl, struct dd_node *node)
+{
+  pthread_mutex_lock(&ctl->lock);
+  node->next = ctl->queue;
+  ctl->queue = node;
+  pthread_cond_signal(&ctl->cond);
+  pthread_mutex_unlock(&ctl->lock);
+}
+
+
+/*
+ * Drop one reference from NODE; when the count hits zero the
+ * directory is empty, so rmdir it and release the parent's reference
+ * on it, repeating up the tree.
+ */
+static void
+dd_retire(struct dd_ctl *ctl, struct dd_node *node)
+{
+  struct dd_node *parent;
+  int pending;
+
+  while (node) {
+    pthread_mutex_lock(&ctl->lock);
+    pending = --node->pending;
+    pthread_mutex_unlock(&ctl->lock);
+
+    if (pending > 0)
+      return;
+
+    if (rmdir(node->path) < 0)
+      dd_error(ctl, errno);
+
+    parent = node->parent;
+    free(node->path);
+    free(node);
+    node = parent;
+  }
+}
+
+
+static void
+dd_scan(struct dd_ctl *ctl, struct dd_node *node)
+{
+  DIR *dir;
+  struct dirent *ent;
+  struct stat statbuf;
+  struct dd_node *child;
+  int fd;
+
+  if (ctl->force) {
+    if (lstat(node->path, &statbuf) == 0)
+      chmod(node->path, (statbuf.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO))
+            | S_IRUSR | S_IWUSR | S_IXUSR);
+  }
+
+  fd = open(node->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+  if (fd == -1) {
+    dd_error(ctl, errno);
+    dd_retire(ctl, node);
+    return;
+  }
+  dir = fdopendir(fd);
+  if (!dir) {
+    dd_error(ctl, errno);
+    close(fd);
+    dd_retire(ctl, node);
+    return;
+  }
+
+  while ((ent = readdir(dir)) != NULL) {
+    if (strcmp(ent->d_name, ".") == 0 ||
+        strcmp(ent->d_name, "..") == 0)
+      continue;
+
+    if (fstatat(fd, ent->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) < 0) {
+      dd_error(ctl, errno);
+      continue;
+    }
+
+    if (S_ISDIR(statbuf.st_mode)) {
+      child = malloc(sizeof(*child));
+      if (!child) {
+        dd_error(ctl, errno);
+        continue;
+      }
+      child->path = filename_join(node->path, ent->d_name);
+      child->parent = node;
+      child->pending = 1;
+
+      pthread_mutex_lock(&ctl->lock);
+      node->pending++;
+      pthread_mutex_unlock(&ctl->lock);
+
+      dd_push(ctl, child);
+    }
+    else if (unlinkat(fd, ent->d_name, 0) < 0)
+      dd_error(ctl, errno);
+  }
+
+  closedir(dir);                /* closes FD, too */
+  dd_retire(ctl, node);
+}
+
+
+static void *
+dd_worker(void *arg)
+{
+  struct dd_ctl *ctl = arg;
+  struct dd_node *node;
+
+  while (1) {
+    pthread_mutex_lock(&ctl->lock);
+    while (!ctl->queue && !ctl->stop) {
+      /* the last idle worker with an empty queue means no unit can
+       * produce further work; wake everyone up to quit. */
+      if (++ctl->idle == ctl->nworkers) {
+        ctl->stop = 1;
+        pthread_cond_broadcast(&ctl->cond);
+      }
+      else
+        pthread_cond_wait(&ctl->cond, &ctl->lock);
+      ctl->idle--;
+    }
+    if (ctl->stop && !ctl->queue) {
+      pthread_mutex_unlock(&ctl->lock);
+      break;
+    }
+    node = ctl->queue;
+    ctl->queue = node->next;
+    pthread_mutex_unlock(&ctl->lock);
+
+    dd_scan(ctl, node);
+  }
+  return NULL;
+}
+#endif  /* _PTHREAD */
+
+
+int
+delete_directory_mt(const char *pathname, int force, int nworkers)
+{
+#ifdef _PTHREAD
+  struct dd_ctl ctl;
+  struct dd_node *root;
+  pthread_t *threads;
+  int i;
+  int saved_errno = errno;
+
+  if (nworkers <= 1)
+    return delete_directory_fts(pathname, force);
+
+  threads = malloc(sizeof(*threads) * nworkers);
+  if (!threads)
+    return -1;
+
+  root = malloc(sizeof(*root));
+  if (!root) {
+    free(threads);
+    return -1;
+  }
+  root->path = strdup(pathname);
+  root->parent = NULL;
+  root->pending = 1;
+  root->next = NULL;
+
+  pthread_mutex_init(&ctl.lock, NULL);
+  pthread_cond_init(&ctl.cond, NULL);
+  ctl.queue = root;
+  ctl.idle = 0;
+  ctl.nworkers = nworkers;
+  ctl.stop = 0;
+  ctl.force = force;
+  ctl.error = 0;
+
+  for (i = 0; i < nworkers; i++)
+    pthread_create(&threads[i], NULL, dd_worker, &ctl);
+  for (i = 0; i < nworkers; i++)
+    pthread_join(threads[i], NULL);
+
+  pthread_cond_destroy(&ctl.cond);
+  pthread_mutex_destroy(&ctl.lock);
+  free(threads);
+
+  if (ctl.error) {
+    errno = ctl.error;
+    return -1;
+  }
+  errno = saved_errno;
+  return 0;
+#else
+  (void)nworkers;
+  return delete_directory_fts(pathname, force);
+#endif  /* _PTHREAD */
+}
+
+
 #ifdef __APPLE__
 void *
 memrchr(const void *s, int c, size_t n)
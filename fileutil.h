@@ -42,6 +42,27 @@ char *dirname_inp(char *pathname);
  */
 int make_directory(const char *pathname);
 
+/*
+ * Create every component of RELPATH (relative to DIRFD) as
+ * "mkdir -p", descending with mkdirat(2)/openat(2) so each component
+ * costs one syscall pair relative to its parent, instead of a lookup
+ * of the whole prefix per component.
+ *
+ * Unlike make_directory(), the last component is created too.  Pass
+ * AT_FDCWD as DIRFD to resolve RELPATH against the working directory;
+ * an absolute RELPATH ignores DIRFD.
+ */
+int make_directory_at(int dirfd, const char *relpath);
+
+/*
+ * Like make_directory_at(AT_FDCWD, PATHNAME), but remember the fd of
+ * the last parent directory: creating many sibling directories under
+ * one parent costs a single mkdirat(2) each after the first call.
+ *
+ * The cache is a static; this function is not thread-safe.
+ */
+int make_directory_cached(const char *pathname);
+
 /*
  * Concatenate two pathname components.
  *
@@ -88,6 +109,22 @@ const char *filename_extension_imm(const char *pathname);
  */
 int delete_directory(const char *pathname, int force);
 
+/*
+ * Like delete_directory(), but built for bulk purges.
+ *
+ * With NWORKERS greater than one (and compiled with -D_PTHREAD
+ * -lpthread), a pool of NWORKERS threads deletes independent subtrees
+ * concurrently; each directory is opened once and its entries removed
+ * via unlinkat(2) relative to that fd, so no per-entry full-path
+ * lookup is paid.  Deep trees with many small files scale with the
+ * parallelism the disks offer.
+ *
+ * With NWORKERS <= 1 (or without _PTHREAD) it falls back to a serial
+ * traversal in fts(3) order, which is still considerably faster than
+ * delete_directory() since directories are not re-opened per entry.
+ */
+int delete_directory_mt(const char *pathname, int force, int nworkers);
+
 END_C_DECLS
 
 
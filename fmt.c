@@ -41,6 +41,17 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <stdint.h>
+
+#ifdef _PTHREAD
+#include <pthread.h>
+#endif
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
 
 #include "fmt.h"
 
@@ -238,6 +249,12 @@ struct fmt_ {
 
   struct obstack *pool;
   struct obstack pool_;
+
+  /* FF_ARENA: storage for fmt_vectorize() results, released in one
+     sweep by fmt_delete()/fmt_arena_free().  Unlike POOL, it is never
+     touched by fmt_reset(). */
+  struct obstack *arena;
+  struct obstack arena_;
 };
 
 /* Forward declarations.  */
@@ -373,6 +390,113 @@ fmt_getc(fmt_t *fmt)
 }
 
 
+/* Return the number of leading byte(s) of S that belong to a word;
+   i.e. printable ASCII excluding the space character.  The run stops
+   at NUL, at any blank, and conservatively at any byte >= 0x80 or
+   DEL-free control byte, which the byte-at-a-time loop in get_line()
+   then classifies with isspace().
+
+   On SSE2/AVX2 targets the scan examines 16/32 bytes per step.  The
+   vector loads are aligned (after a short scalar prologue), so they
+   never touch a page beyond the terminating NUL.  */
+
+static size_t
+word_run (const char *s)
+{
+  const char *p = s;
+
+#if defined(__AVX2__)
+  while ((uintptr_t)p & 31)
+    {
+      if ((unsigned char)*p <= 0x20 || (unsigned char)*p >= 0x80)
+        return p - s;
+      p++;
+    }
+  for (;;)
+    {
+      /* signed compare: bytes >= 0x80 are negative, hence < 0x21 */
+      __m256i chunk = _mm256_load_si256 ((const __m256i *)p);
+      __m256i stop = _mm256_cmpgt_epi8 (_mm256_set1_epi8 (0x21), chunk);
+      unsigned mask = _mm256_movemask_epi8 (stop);
+
+      if (mask)
+        return p - s + __builtin_ctz (mask);
+      p += 32;
+    }
+#elif defined(__SSE2__)
+  while ((uintptr_t)p & 15)
+    {
+      if ((unsigned char)*p <= 0x20 || (unsigned char)*p >= 0x80)
+        return p - s;
+      p++;
+    }
+  for (;;)
+    {
+      __m128i chunk = _mm_load_si128 ((const __m128i *)p);
+      __m128i stop = _mm_cmplt_epi8 (chunk, _mm_set1_epi8 (0x21));
+      unsigned mask = _mm_movemask_epi8 (stop);
+
+      if (mask)
+        return p - s + __builtin_ctz (mask);
+      p += 16;
+    }
+#else
+  while ((unsigned char)*p > 0x20 && (unsigned char)*p < 0x80)
+    p++;
+  return p - s;
+#endif
+}
+
+
+/* Return the number of leading space (' ') byte(s) of S.  Tabs and
+   other blanks are left to the scalar loop in get_space(), which has
+   to update in_column differently for them.  */
+
+static size_t
+space_run (const char *s)
+{
+  const char *p = s;
+
+#if defined(__AVX2__)
+  while ((uintptr_t)p & 31)
+    {
+      if (*p != ' ')
+        return p - s;
+      p++;
+    }
+  for (;;)
+    {
+      __m256i chunk = _mm256_load_si256 ((const __m256i *)p);
+      unsigned mask = _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (chunk, _mm256_set1_epi8 (' ')));
+
+      if (mask != 0xffffffffu)
+        return p - s + __builtin_ctz (~mask);
+      p += 32;
+    }
+#elif defined(__SSE2__)
+  while ((uintptr_t)p & 15)
+    {
+      if (*p != ' ')
+        return p - s;
+      p++;
+    }
+  for (;;)
+    {
+      __m128i chunk = _mm_load_si128 ((const __m128i *)p);
+      unsigned mask = _mm_movemask_epi8 (_mm_cmpeq_epi8 (chunk, _mm_set1_epi8 (' ')));
+
+      if (mask != 0xffffu)
+        return p - s + __builtin_ctz (~mask);
+      p += 16;
+    }
+#else
+  while (*p == ' ')
+    p++;
+  return p - s;
+#endif
+}
+
+
 fmt_t *
 fmt_new(unsigned flags)
 {
@@ -386,6 +510,9 @@ fmt_new(unsigned flags)
   p->pool = &p->pool_;
   obstack_init(p->pool);
 
+  p->arena = &p->arena_;
+  obstack_init(p->arena);
+
   p->parabuf = obstack_alloc(p->pool, MAXCHARS);
   p->word = obstack_alloc(p->pool, sizeof(WORD) * MAXWORDS);
   for (i = 0; i < MAXWORDS; i++) {
@@ -437,11 +564,23 @@ fmt_set_width(fmt_t *p, int width)
 void
 fmt_delete(fmt_t *fmt)
 {
+  obstack_free(fmt->arena, NULL);
   obstack_free(fmt->pool, NULL);
   free(fmt);
 }
 
 
+void
+fmt_arena_free(fmt_t *f)
+{
+  if (!(f->flags & FF_ARENA))
+    return;
+
+  obstack_free(f->arena, NULL);
+  obstack_init(f->arena);
+}
+
+
 #if 0
 void
 usage (int status)
@@ -539,34 +678,32 @@ fmt_vectorize(fmt_t *f)
   if (!f->output)
     return NULL;
 
-  for (p = q = f->output; *p != '\0'; p++) {
-    if (*p == '\n') {
-      *p = '\0';
-
-      if (f->flags & FF_MALLOC_STR) {
-        r = strdup(q);
-        if (!r) {
-          /* TODO: deallocate all PTR in OBSTACK */
-          return NULL;
-        }
+  /* strchr(3) is vectorized by the C library, which beats scanning
+     the output byte-at-a-time here. */
+  q = f->output;
+  while ((p = strchr(q, '\n')) != NULL) {
+    *p = '\0';
+
+    if (f->flags & FF_ARENA)
+      r = obstack_copy0(f->arena, q, p - q);
+    else if (f->flags & FF_MALLOC_STR) {
+      r = strdup(q);
+      if (!r) {
+        /* TODO: deallocate all PTR in OBSTACK */
+        return NULL;
       }
-      else
-        r = q;
-
-      obstack_ptr_grow(f->pool, r);
-      q = p + 1;
-
-#if 0
-      if (f->flags & FF_MALLOC)
-        obstack_ptr_grow(f->pool, (void *)(q - f->output));
-      else
-        obstack_ptr_grow(f->pool, q);
-      q = p + 1;
-#endif  /* 0 */
     }
+    else
+      r = q;
+
+    obstack_ptr_grow(f->pool, r);
+    q = p + 1;
   }
+  p = q + strlen(q);
   if (p != q) {
-    if (f->flags & FF_MALLOC_STR) {
+    if (f->flags & FF_ARENA)
+      q = obstack_copy0(f->arena, q, p - q);
+    else if (f->flags & FF_MALLOC_STR) {
       q = strdup(q);
       if (!q) {
         /* TODO: deallocate all PTR in OBSTACK */
@@ -577,7 +714,12 @@ fmt_vectorize(fmt_t *f)
   }
   obstack_ptr_grow(f->pool, NULL);
 
-  if (f->flags & FF_MALLOC_VEC) {
+  if (f->flags & FF_ARENA) {
+    size = obstack_object_size(f->pool);
+    vp = obstack_copy(f->arena, obstack_base(f->pool), size);
+    obstack_free(f->pool, obstack_finish(f->pool));
+  }
+  else if (f->flags & FF_MALLOC_VEC) {
     size = obstack_object_size(f->pool);
     vp = malloc(size);
     if (!vp) {
@@ -643,14 +785,12 @@ fmt_reset(fmt_t *f)
 }
 
 
-char *
-fmt_format (fmt_t *f, const char *s)
+/* The body of fmt_format() after the reset, so that a caller which
+   has already reset F (and possibly adjusted it since) can run the
+   formatter without the reset clobbering its adjustments.  */
+static char *
+fmt_run (fmt_t *f, const char *s)
 {
-  fmt_reset(f);
-
-  if (!s)
-    return NULL;
-
   f->dummy = obstack_alloc(f->pool, 1);
   f->input = obstack_copy0(f->pool, s, strlen(s));
 
@@ -666,6 +806,203 @@ fmt_format (fmt_t *f, const char *s)
   return f->output;
 }
 
+
+char *
+fmt_format (fmt_t *f, const char *s)
+{
+  fmt_reset(f);
+
+  if (!s)
+    return NULL;
+
+  return fmt_run(f, s);
+}
+
+
+#ifdef _PTHREAD
+
+/* Parallel reflow.  The formatter state is entirely inside FMT_T, so
+   the document is cut after blank lines -- a blank line always ends a
+   paragraph and is copied through verbatim -- and each slice is
+   reflowed by a private worker formatter.  Concatenating the slice
+   outputs in order then yields the same bytes as one serial pass. */
+
+struct fmt_job {
+  char *chunk;                  /* NUL-terminated slice of the input */
+  char *output;                 /* malloc'ed reflowed result */
+};
+
+struct fmt_crew {
+  struct fmt_job *jobs;
+  int njobs;
+  int next;                     /* next unclaimed job, fetch-and-add */
+  const fmt_t *model;           /* option source for the workers */
+  int error;                    /* some worker ran out of memory */
+};
+
+/* Copy the user-visible options from SRC, so that a worker breaks
+   lines exactly as the caller's formatter would.  */
+static void
+fmt_copy_options(fmt_t *dst, const fmt_t *src)
+{
+  dst->crown = src->crown;
+  dst->tagged = src->tagged;
+  dst->split = src->split;
+  dst->uniform = src->uniform;
+  dst->prefix = src->prefix;
+  dst->prefix_full_length = src->prefix_full_length;
+  dst->prefix_lead_space = src->prefix_lead_space;
+  dst->prefix_length = src->prefix_length;
+  dst->max_width = src->max_width;
+  dst->best_width = src->best_width;
+  dst->tabs = src->tabs;
+}
+
+
+static void *
+fmt_worker(void *arg)
+{
+  struct fmt_crew *crew = (struct fmt_crew *)arg;
+  fmt_t *wf;
+  char *out;
+  int i;
+
+  wf = fmt_new(0);
+  if (!wf) {
+    crew->error = 1;
+    return NULL;
+  }
+
+  for (;;) {
+    i = __sync_fetch_and_add(&crew->next, 1);
+    if (i >= crew->njobs)
+      break;
+
+    /* Reset, then import the options (fmt_reset() would revert them
+       to the defaults once a previous call's output is pending), and
+       run the formatter without a second reset: every job formats
+       with the caller's settings.  */
+    fmt_reset(wf);
+    fmt_copy_options(wf, crew->model);
+
+    out = fmt_run(wf, crew->jobs[i].chunk);
+    crew->jobs[i].output = out ? strdup(out) : NULL;
+    if (!crew->jobs[i].output)
+      crew->error = 1;
+  }
+
+  fmt_delete(wf);
+  return NULL;
+}
+
+#endif  /* _PTHREAD */
+
+
+char *
+fmt_format_mt(fmt_t *f, const char *s, int nthreads)
+{
+#ifdef _PTHREAD
+  struct fmt_crew crew;
+  struct fmt_job *jobs;
+  pthread_t *tids;
+  const char *cut;
+  size_t len, pos, target, size;
+  int maxjobs, njobs, nts, created, i;
+
+  if (!s || nthreads <= 1)
+    return fmt_format(f, s);
+
+  len = strlen(s);
+
+  /* Oversubscribe the job count a little, so one slow slice (many
+     long paragraphs) does not leave the other workers idle.  */
+  maxjobs = nthreads * 4;
+  jobs = malloc(sizeof(*jobs) * maxjobs);
+  if (!jobs)
+    return fmt_format(f, s);
+
+  njobs = 0;
+  pos = 0;
+  while (pos < len && njobs < maxjobs) {
+    if (njobs == maxjobs - 1)
+      size = len - pos;
+    else {
+      target = pos + (len - pos) / (maxjobs - njobs);
+      if (target >= len)
+        size = len - pos;
+      else {
+        cut = strstr(s + target, "\n\n");
+        size = cut ? (size_t)(cut + 2 - (s + pos)) : len - pos;
+      }
+    }
+
+    jobs[njobs].chunk = malloc(size + 1);
+    if (!jobs[njobs].chunk)
+      break;
+    memcpy(jobs[njobs].chunk, s + pos, size);
+    jobs[njobs].chunk[size] = '\0';
+    jobs[njobs].output = NULL;
+    njobs++;
+    pos += size;
+  }
+
+  if (njobs < 2 || pos < len) {         /* nothing to split, or ENOMEM */
+    for (i = 0; i < njobs; i++)
+      free(jobs[i].chunk);
+    free(jobs);
+    return fmt_format(f, s);
+  }
+
+  /* Serial fmt_format() resets first and formats with the resulting
+     options; do the same before the workers copy them.  */
+  fmt_reset(f);
+
+  crew.jobs = jobs;
+  crew.njobs = njobs;
+  crew.next = 0;
+  crew.model = f;
+  crew.error = 0;
+
+  nts = nthreads < njobs ? nthreads : njobs;
+  created = 0;
+  tids = malloc(sizeof(*tids) * nts);
+  if (tids) {
+    for (i = 0; i < nts - 1; i++)
+      if (pthread_create(&tids[created], NULL, fmt_worker, &crew) == 0)
+        created++;
+  }
+  fmt_worker(&crew);            /* the caller's thread pulls jobs too */
+  for (i = 0; i < created; i++)
+    pthread_join(tids[i], NULL);
+  free(tids);
+
+  if (crew.error) {
+    for (i = 0; i < njobs; i++) {
+      free(jobs[i].chunk);
+      free(jobs[i].output);
+    }
+    free(jobs);
+    return fmt_format(f, s);
+  }
+
+  f->dummy = obstack_alloc(f->pool, 1);
+  for (i = 0; i < njobs; i++) {
+    obstack_grow(f->pool, jobs[i].output, strlen(jobs[i].output));
+    free(jobs[i].chunk);
+    free(jobs[i].output);
+  }
+  free(jobs);
+
+  obstack_1grow(f->pool, '\0');
+  f->output = obstack_finish(f->pool);
+
+  return f->output;
+#else
+  (void)nthreads;
+  return fmt_format(f, s);      /* threads unavailable; same result */
+#endif  /* _PTHREAD */
+}
+
 /* Set the global variable `other_indent' according to SAME_PARAGRAPH
    and other global variables.  */
 
@@ -863,6 +1200,21 @@ get_line (fmt_t *f, int c)
               flush_paragraph (f);
             }
           *f->wptr++ = c;
+
+          /* Bulk-copy the unambiguous remainder of the word.  */
+          if (f->input)
+            {
+              size_t run = word_run (f->input);
+
+              if (run > (size_t) (end_of_parabuf - f->wptr))
+                run = end_of_parabuf - f->wptr;
+              if (run)
+                {
+                  memcpy (f->wptr, f->input, run);
+                  f->wptr += run;
+                  f->input += run;
+                }
+            }
           c = fmt_getc(f);
         }
       while (c != '\0' && !isspace (c));
@@ -931,7 +1283,18 @@ get_space (fmt_t *fmt, int c)
   for (;;)
     {
       if (c == ' ')
-        fmt->in_column++;
+        {
+          fmt->in_column++;
+
+          /* Bulk-skip the rest of the run of plain spaces.  */
+          if (fmt->input)
+            {
+              size_t run = space_run (fmt->input);
+
+              fmt->in_column += run;
+              fmt->input += run;
+            }
+        }
       else if (c == '\t')
         {
           fmt->tabs = TRUE;
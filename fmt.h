@@ -29,9 +29,19 @@
  * FF_MALLOC_VEC -- If provided, the return value of fmt_vectorize()
  *                  will be allocated by malloc().  Otherwise, the
  *                  vector is allocated from the obstack.
+ *
+ * FF_ARENA      -- If provided, both the strings and the vector
+ *                  returned by fmt_vectorize() are allocated from an
+ *                  internal arena that survives fmt_format() calls,
+ *                  and are released all at once by fmt_delete() (or
+ *                  explicitly by fmt_arena_free()).  This avoids one
+ *                  malloc()/free() pair per line and keeps the lines
+ *                  of one document contiguous in memory.  FF_ARENA
+ *                  overrides FF_MALLOC_STR and FF_MALLOC_VEC.
  */
 #define FF_MALLOC_STR   0x01
 #define FF_MALLOC_VEC   0x02
+#define FF_ARENA        0x04
 
 struct fmt_;
 typedef struct fmt_ fmt_t;
@@ -72,6 +82,20 @@ extern void fmt_set_width(fmt_t *p, int width);
  */
 extern char *fmt_format (fmt_t *f, const char *s);
 
+/*
+ * Like fmt_format(), but reflow the paragraphs of S on up to NTHREADS
+ * threads (including the calling one).  The input is cut after blank
+ * lines -- a blank line always ends a paragraph -- the slices are
+ * reflowed by private worker formatters, and the results are stitched
+ * back in input order, so the output is byte-identical to
+ * fmt_format() and follows the same lifetime rules.
+ *
+ * Compile with -D_PTHREAD (and link with -lpthread) to get the
+ * parallel version; otherwise, or when NTHREADS <= 1 or S has no
+ * blank line to cut at, this falls back to the serial fmt_format().
+ */
+extern char *fmt_format_mt(fmt_t *f, const char *s, int nthreads);
+
 /*
  * Make an array of pointers to strings from the string obtained
  * by previous call to fmt_format().
@@ -84,4 +108,12 @@ extern char *fmt_format (fmt_t *f, const char *s);
  */
 char **fmt_vectorize(fmt_t *f);
 
+/*
+ * Release every string and vector handed out by fmt_vectorize() in
+ * FF_ARENA mode, in one operation.  The arena is ready for reuse
+ * afterwards.  This is a no-op unless FF_ARENA was given to
+ * fmt_new().
+ */
+extern void fmt_arena_free(fmt_t *f);
+
 #endif  /* fmt_h__ */
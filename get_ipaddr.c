@@ -4,8 +4,41 @@
 #include <netdb.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+
 #include "get_ipaddr.h"
 
+#define IPCACHE_ADDR_MAX   32   /* cached (family, sockaddr) pairs */
+#define IPCACHE_MEMO_MAX   8    /* memoized rendered lookups */
+
+struct ipcache_addr {
+  int family;
+  socklen_t addrlen;
+  struct sockaddr_storage addr;
+};
+
+struct ipcache_memo {
+  int family;
+  int flags;
+  int index;
+  int miss;                     /* lookup resolved to "not found" */
+  char host[NI_MAXHOST];
+};
+
+static struct ipcache_addr ipcache_addrs[IPCACHE_ADDR_MAX];
+static int ipcache_naddrs;
+static struct ipcache_memo ipcache_memos[IPCACHE_MEMO_MAX];
+static int ipcache_nmemos;
+static int ipcache_valid;
+static int ipcache_nlfd = -1;
+
 
 char *
 get_ipv4_address(int flags, int index)
@@ -76,6 +109,177 @@ get_ip_address(int family, int flags, int index)
 }
 
 
+/*
+ * Open a netlink socket subscribed to RTM_NEWADDR/RTM_DELADDR.  We
+ * never parse the messages; the groups carry nothing else, so any
+ * pending datagram means an address changed.
+ */
+static void
+ipcache_open_(void)
+{
+#ifdef __linux__
+  struct sockaddr_nl snl;
+
+  ipcache_nlfd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        NETLINK_ROUTE);
+  if (ipcache_nlfd < 0)
+    return;
+
+  memset(&snl, 0, sizeof(snl));
+  snl.nl_family = AF_NETLINK;
+  snl.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+
+  if (bind(ipcache_nlfd, (struct sockaddr *)&snl, sizeof(snl)) != 0) {
+    close(ipcache_nlfd);
+    ipcache_nlfd = -1;
+  }
+#endif  /* __linux__ */
+}
+
+
+/* Return nonzero if an address change notification is pending. */
+static int
+ipcache_stale_(void)
+{
+  char buf[4096];
+  ssize_t len;
+  int stale = 0;
+
+  if (ipcache_nlfd < 0)
+    return 1;                   /* no netlink; treat as always stale */
+
+  while ((len = recv(ipcache_nlfd, buf, sizeof(buf), 0)) > 0 ||
+         (len < 0 && errno == EINTR))
+    if (len > 0)
+      stale = 1;
+
+  return stale;
+}
+
+
+static int
+ipcache_refresh_(void)
+{
+  struct ifaddrs *addrs;
+  struct ifaddrs *p;
+
+  if (getifaddrs(&addrs) != 0)
+    return -1;
+
+  ipcache_naddrs = 0;
+  ipcache_nmemos = 0;
+
+  for (p = addrs; p != NULL; p = p->ifa_next) {
+    int fam;
+
+    if (!p->ifa_addr)
+      continue;
+    fam = p->ifa_addr->sa_family;
+
+    if (fam != AF_INET && fam != AF_INET6)
+      continue;
+    if (strcmp(p->ifa_name, "lo") == 0)
+      continue;
+    if (ipcache_naddrs >= IPCACHE_ADDR_MAX)
+      break;
+
+    ipcache_addrs[ipcache_naddrs].family = fam;
+    ipcache_addrs[ipcache_naddrs].addrlen =
+      (fam == AF_INET) ?
+      sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+    memcpy(&ipcache_addrs[ipcache_naddrs].addr, p->ifa_addr,
+           ipcache_addrs[ipcache_naddrs].addrlen);
+    ipcache_naddrs++;
+  }
+  freeifaddrs(addrs);
+
+  ipcache_valid = 1;
+  return 0;
+}
+
+
+char *
+get_ip_address_cached(int family, int flags, int index)
+{
+  struct ipcache_memo *m;
+  struct ipcache_addr *a;
+  int ret;
+  int count;
+  int i;
+
+  if (ipcache_nlfd < 0 && !ipcache_valid)
+    ipcache_open_();
+
+  if (!ipcache_valid || ipcache_stale_())
+    if (ipcache_refresh_() != 0)
+      return NULL;
+
+  for (i = 0; i < ipcache_nmemos; i++) {
+    m = ipcache_memos + i;
+    if (m->family == family && m->flags == flags && m->index == index)
+      return m->miss ? NULL : strdup(m->host);
+  }
+
+  m = NULL;
+  if (ipcache_nmemos < IPCACHE_MEMO_MAX) {
+    m = ipcache_memos + ipcache_nmemos;
+    m->family = family;
+    m->flags = flags;
+    m->index = index;
+    m->miss = 1;
+  }
+
+  for (count = 0, i = 0; i < ipcache_naddrs; i++) {
+    a = ipcache_addrs + i;
+
+    if (a->family != family)
+      continue;
+
+    if (index <= count) {
+      char host[NI_MAXHOST];
+
+      ret = getnameinfo((struct sockaddr *)&a->addr, a->addrlen,
+                        host, NI_MAXHOST, NULL, 0, flags);
+      if (ret != 0) {
+        fprintf(stderr, "getnameinfo(3) failed: %s\n", gai_strerror(ret));
+        break;
+      }
+
+      if (family == AF_INET6) {
+        char *d = strrchr(host, '%');
+        if (d)
+          *d = '\0';
+      }
+
+      if (m) {
+        m->miss = 0;
+        strcpy(m->host, host);
+        ipcache_nmemos++;
+      }
+      return strdup(host);
+    }
+    count++;
+  }
+
+  if (m)
+    ipcache_nmemos++;           /* remember the miss, too */
+  return NULL;
+}
+
+
+void
+get_ip_address_uncache(void)
+{
+  if (ipcache_nlfd >= 0) {
+    close(ipcache_nlfd);
+    ipcache_nlfd = -1;
+  }
+  ipcache_valid = 0;
+  ipcache_naddrs = 0;
+  ipcache_nmemos = 0;
+}
+
+
 #ifdef TEST_GETIPADDR
 int
 main(void)
@@ -20,6 +20,17 @@ extern char *get_ip_address(int family, int flags, int index);
 extern char *get_ipv4_address(int flags, int index);
 extern char *get_ipv6_address(int flags, int index);
 
+/*
+ * Like get_ip_address(), but the interface enumeration is kept in an
+ * in-memory table instead of calling getifaddrs(3) every time.  A
+ * netlink socket subscribed to address changes tells us when the
+ * table is stale; until then repeated lookups are just a table read
+ * plus strdup(3).  Not thread-safe.  Call get_ip_address_uncache()
+ * to close the netlink socket and drop the table.
+ */
+extern char *get_ip_address_cached(int family, int flags, int index);
+extern void get_ip_address_uncache(void);
+
 END_C_DECLS
 
 #endif  /* GETIPADDR_H__ */
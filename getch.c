@@ -47,6 +47,202 @@ getch_(int nonblock, int peek)
 }
 
 
+/*
+ * Session-based input (see getch.h).  The terminal is switched to raw
+ * mode once with VMIN=0/VTIME=0, so read(2) never blocks and no
+ * per-call tcsetattr(2) is needed; key events are then decoded from
+ * the session buffer.
+ */
+
+#include <poll.h>
+#include <string.h>
+
+int
+getch_attach(getch_session_t *gs, int fd)
+{
+  struct termios term;
+
+  if (fd == -1)
+    fd = STDIN_FILENO;
+
+  if (tcgetattr(fd, &gs->old_) == -1)
+    return -1;
+
+  term = gs->old_;
+  cfmakeraw(&term);
+  term.c_cc[VMIN] = 0;
+  term.c_cc[VTIME] = 0;
+
+  if (tcsetattr(fd, TCSANOW, &term) == -1)
+    return -1;
+
+  gs->fd = fd;
+  gs->len_ = gs->off_ = 0;
+  return 0;
+}
+
+
+int
+getch_detach(getch_session_t *gs)
+{
+  return tcsetattr(gs->fd, TCSANOW, &gs->old_);
+}
+
+
+/*
+ * Append whatever the terminal has to the session buffer.  TIMEOUT
+ * (milliseconds) is only used while a partial escape sequence is
+ * buffered; otherwise pass zero.  Returns the number of byte(s)
+ * added.
+ */
+static int
+session_fill(getch_session_t *gs, int timeout)
+{
+  int readch;
+
+  if (gs->off_ == gs->len_)
+    gs->off_ = gs->len_ = 0;
+
+  if (gs->len_ == sizeof(gs->buf_))
+    return 0;
+
+  if (timeout) {
+    struct pollfd pfd = { gs->fd, POLLIN, 0 };
+    if (poll(&pfd, 1, timeout) <= 0)
+      return 0;
+  }
+
+  readch = read(gs->fd, gs->buf_ + gs->len_, sizeof(gs->buf_) - gs->len_);
+  if (readch <= 0)
+    return 0;
+
+  gs->len_ += readch;
+  return readch;
+}
+
+
+/* ESC [ NUM ~ */
+static int
+csi_tilde_key(int num)
+{
+  switch (num) {
+  case 1: case 7:  return GETCH_KEY_HOME;
+  case 2:          return GETCH_KEY_INS;
+  case 3:          return GETCH_KEY_DEL;
+  case 4: case 8:  return GETCH_KEY_END;
+  case 5:          return GETCH_KEY_PGUP;
+  case 6:          return GETCH_KEY_PGDN;
+  case 11: case 12: case 13: case 14: case 15:
+    return GETCH_KEY_F(num - 10);
+  case 17: case 18: case 19: case 20: case 21:
+    return GETCH_KEY_F(num - 11);
+  case 23: case 24:
+    return GETCH_KEY_F(num - 12);
+  }
+  return GETCH_ESC;
+}
+
+
+static int
+arrow_key(int ch)
+{
+  switch (ch) {
+  case 'A': return GETCH_KEY_UP;
+  case 'B': return GETCH_KEY_DOWN;
+  case 'C': return GETCH_KEY_RIGHT;
+  case 'D': return GETCH_KEY_LEFT;
+  case 'H': return GETCH_KEY_HOME;
+  case 'F': return GETCH_KEY_END;
+  }
+  return GETCH_ESC;
+}
+
+
+int
+getch_key(getch_session_t *gs)
+{
+  unsigned char ch;
+  int p;
+
+  if (!getch_pending(gs) && session_fill(gs, 0) == 0)
+    return EOF;
+
+  ch = gs->buf_[gs->off_];
+  if (ch != GETCH_ESC) {
+    gs->off_++;
+    return ch;
+  }
+
+  /* a lone ESC at the end of the buffer may be the ESC key or the
+   * head of a sequence whose tail is still in flight; give the
+   * terminal a moment to finish it. */
+  if (gs->len_ - gs->off_ < 2)
+    session_fill(gs, 20);
+  if (gs->len_ - gs->off_ < 2) {
+    gs->off_++;
+    return GETCH_ESC;
+  }
+
+  p = gs->off_ + 1;
+
+  if (gs->buf_[p] == 'O') {     /* SS3: ESC O P..S / A..D / H / F */
+    if (p + 1 >= gs->len_ && session_fill(gs, 20) == 0) {
+      gs->off_++;
+      return GETCH_ESC;
+    }
+    ch = gs->buf_[p + 1];
+    gs->off_ = p + 2;
+    if (ch >= 'P' && ch <= 'S')
+      return GETCH_KEY_F(ch - 'P' + 1);
+    return arrow_key(ch);
+  }
+
+  if (gs->buf_[p] == '[') {     /* CSI: ESC [ params final */
+    int num = 0;
+
+    for (p++; ; p++) {
+      if (p >= gs->len_ && session_fill(gs, 20) == 0) {
+        gs->off_++;             /* incomplete; deliver ESC, keep the rest */
+        return GETCH_ESC;
+      }
+      ch = gs->buf_[p];
+      if (ch >= '0' && ch <= '9')
+        num = num * 10 + (ch - '0');
+      else if (ch == ';')
+        num = 0;                /* modifiers are not reported */
+      else if (ch >= 0x40 && ch <= 0x7e)
+        break;
+      else {
+        gs->off_++;
+        return GETCH_ESC;
+      }
+    }
+    gs->off_ = p + 1;
+
+    if (ch == '~')
+      return csi_tilde_key(num);
+    return arrow_key(ch);
+  }
+
+  gs->off_++;                   /* ESC followed by an ordinary byte */
+  return GETCH_ESC;
+}
+
+
+int
+getch_key_wait(getch_session_t *gs, int timeout)
+{
+  struct pollfd pfd = { gs->fd, POLLIN, 0 };
+
+  if (getch_pending(gs))
+    return getch_key(gs);
+
+  if (poll(&pfd, 1, timeout) <= 0)
+    return EOF;
+  return getch_key(gs);
+}
+
+
 #ifdef TEST_GETCH
 int
 main(void)
@@ -61,3 +257,34 @@ main(void)
   return 0;
 }
 #endif  /* TEST_GETCH */
+
+
+#ifdef TEST_GETCH_SESSION
+#include <stdlib.h>
+
+int
+main(void)
+{
+  getch_session_t gs;
+  int key;
+
+  if (getch_attach(&gs, -1) == -1) {
+    perror("getch_attach");
+    return 1;
+  }
+
+  fprintf(stderr, "press keys ('q' to quit)...\r\n");
+
+  while ((key = getch_key_wait(&gs, -1)) != 'q') {
+    if (key == EOF)
+      continue;
+    if (key > 0xff)
+      fprintf(stderr, "key 0x%03x\r\n", key);
+    else
+      fprintf(stderr, "char %d\r\n", key);
+  }
+
+  getch_detach(&gs);
+  return 0;
+}
+#endif  /* TEST_GETCH_SESSION */
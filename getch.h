@@ -57,4 +57,79 @@ getch(void)
 }
 
 
+/*
+ * Session-based input.
+ *
+ * getch_() and kbhit() above reconfigure the terminal around every
+ * call; two tcsetattr(2) per keystroke (or per poll in a render
+ * loop).  A session configures raw mode exactly once, reads the
+ * terminal in chunks into userspace memory, and decodes key events
+ * from that buffer, so the per-keystroke cost is a memory read.
+ *
+ * GS->fd can be handed to poll(2)/select(2) (or pollxx.h) to wait for
+ * input along with other descriptors -- but check getch_pending()
+ * first, since decoded byte(s) may still sit in the session buffer.
+ */
+
+#include <termios.h>
+
+typedef struct {
+  int fd;                       /* the terminal; use with poll(2) */
+
+  struct termios old_;          /* restored by getch_detach() */
+  unsigned char buf_[256];
+  int len_, off_;
+} getch_session_t;
+
+/* Decoded keys beyond plain byte(s).  Escape sequences (CSI and SS3)
+ * are recognized; anything else comes back byte by byte, GETCH_ESC
+ * first. */
+#define GETCH_ESC       0x1b
+#define GETCH_KEY_UP    0x101
+#define GETCH_KEY_DOWN  0x102
+#define GETCH_KEY_RIGHT 0x103
+#define GETCH_KEY_LEFT  0x104
+#define GETCH_KEY_HOME  0x105
+#define GETCH_KEY_END   0x106
+#define GETCH_KEY_INS   0x107
+#define GETCH_KEY_DEL   0x108
+#define GETCH_KEY_PGUP  0x109
+#define GETCH_KEY_PGDN  0x10a
+#define GETCH_KEY_F(n)  (0x110 + (n))   /* GETCH_KEY_F(1) .. F(12) */
+
+/*
+ * Put the terminal FD into raw mode and initialize the session GS.
+ * Pass -1 for FD to use STDIN.  Returns 0, or -1 with errno set.
+ */
+extern int getch_attach(getch_session_t *gs, int fd);
+
+/*
+ * Restore the terminal state saved by getch_attach().
+ */
+extern int getch_detach(getch_session_t *gs);
+
+/*
+ * Return the next key event, or EOF if none is available.  Never
+ * blocks and performs at most one read(2) -- none at all while
+ * buffered input remains.
+ */
+extern int getch_key(getch_session_t *gs);
+
+/*
+ * Wait up to TIMEOUT milliseconds (-1 = forever) for a key event and
+ * return it, or EOF on timeout.
+ */
+extern int getch_key_wait(getch_session_t *gs, int timeout);
+
+/*
+ * Nonzero if getch_key() would return an event without touching the
+ * terminal; zero syscalls.  This is the render-loop replacement for
+ * kbhit().
+ */
+static __inline__ int
+getch_pending(getch_session_t *gs)
+{
+  return gs->off_ < gs->len_;
+}
+
 #endif  /* GETCH_H__ */
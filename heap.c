@@ -4,47 +4,75 @@
 
 struct node {
   int data;
+  int pos;                      /* heap position; the stable handle */
   char dummy[20];
 };
 
-#define nodeheap_t_cmp(x, y)    ((x)->data - (y)->data)
+#define nodeheap_t_cmp(x, y)        ((x)->data - (y)->data)
+#define nodeheap_t_setpos(x, i)     ((x)->pos = (i))
 
 int
 main(int argc, char *argv[])
 {
-  struct node *p;
+  struct node *p, **nodes;
   HEAP_DECL_TYPE(struct node, nodeheap_t);
-  int i;
+  int i, prev;
 
   int maxsize = atoi(argv[1]);
 
   nodeheap_t heap = HEAP_INITIALIZER(maxsize);
+  nodeheap_t built = HEAP_INITIALIZER(maxsize);
 
   fprintf(stderr, "sizeof(node) = %zd\n", sizeof(*p));
 
+  nodes = malloc(sizeof(*nodes) * maxsize);
+  if (!nodes)
+    abort();
+
   for (i = 0; i < maxsize; ++i) {
     p = malloc(sizeof(*p));
     if (!p)
       abort();
     p->data = rand() % 1000;
-    printf("%p - %d (%zu)\n", p, p->data, sizeof(*p));
-    HEAP_INSERT(nodeheap_t, &heap, p);
-    __builtin___clear_cache(p, ((char *)p) + sizeof(*p));
+    nodes[i] = p;
+    HEAP4_INSERT(nodeheap_t, &heap, p);
   }
 
-  printf("\n\n--\n");
-  while (1) {
-    p = HEAP_POP(nodeheap_t, &heap);
+  /* decrease/increase random keys through their stable handles */
+  for (i = 0; i < maxsize / 10 + 1; ++i) {
+    p = nodes[rand() % maxsize];
+    p->data = rand() % 1000;
+    HEAP4_ADJUST(nodeheap_t, &heap, p->pos);
+  }
 
-    if (!p)
-      break;
+  prev = 1000;
+  while ((p = HEAP4_POP(nodeheap_t, &heap)) != 0) {
+    if (p->data > prev) {
+      fprintf(stderr, "heap order violated: %d after %d\n", p->data, prev);
+      abort();
+    }
+    prev = p->data;
+  }
+  printf("insert/adjust/pop: %d node(s), ok\n", maxsize);
 
+  /* same nodes again, but built in one go */
+  if (HEAP4_HEAPIFY(nodeheap_t, &built, nodes, maxsize) != 0)
+    abort();
 
-    printf("%p - %d\n", p, p->data);
+  prev = 1000;
+  while ((p = HEAP4_POP(nodeheap_t, &built)) != 0) {
+    if (p->data > prev) {
+      fprintf(stderr, "heap order violated: %d after %d\n", p->data, prev);
+      abort();
+    }
+    prev = p->data;
     free(p);
   }
+  printf("heapify/pop: %d node(s), ok\n", maxsize);
 
+  free(nodes);
   HEAP_FREE(&heap);
+  HEAP_FREE(&built);
 
   return 0;
 }
@@ -85,7 +85,7 @@
 
 #define HEAP_INSERT_(type, heap, nodep, result)         \
     do {                                                \
-      int success;                                      \
+      int success = 1;                                  \
       HEAP_MAKE_ROOM_(heap, success);                   \
       if (success) {                                    \
         (heap)->body[(heap)->end++] = nodep;            \
@@ -143,4 +143,151 @@
          result; })
 #endif  /* __GNUC__ */
 
+/*
+ * 4-ary variant.
+ *
+ * The four children of a node sit next to each other in the body
+ * array -- one cache line -- so sift-down touches about half the
+ * lines of the binary layout, and the tree is half as deep.
+ *
+ * In addition to type##_cmp(), the element type must provide
+ * type##_setpos(node, pos), invoked whenever NODE moves to heap
+ * position POS.  Store POS in the node and you have a stable handle:
+ * change the key, then call HEAP4_ADJUST(type, heap, pos) to
+ * re-establish the heap around it (decrease-key and increase-key
+ * alike).  Define type##_setpos() to expand to nothing if handles
+ * are not needed.
+ */
+#define HEAP4_PARENT(x) (((x) - 1) / 4)
+#define HEAP4_CHILD(x)  ((x) * 4 + 1)
+
+#define HEAP4_SETPOS_(type, heap, i)  type##_setpos((heap)->body[i], (i))
+
+#define HEAP4_SWAP_(type, heap, a, b)                   \
+  do {                                                  \
+    (heap)->t_swap = (heap)->body[a];                   \
+    (heap)->body[a] = (heap)->body[b];                  \
+    (heap)->body[b] = (heap)->t_swap;                   \
+    HEAP4_SETPOS_(type, heap, a);                       \
+    HEAP4_SETPOS_(type, heap, b);                       \
+  } while (0)
+
+#define HEAP4_SIFTUP_(type, heap, index)                                \
+  do {                                                                  \
+    int i = (index);                                                    \
+    while (i > 0) {                                                     \
+      int parent = HEAP4_PARENT(i);                                     \
+      if (type##_cmp((heap)->body[parent], (heap)->body[i]) < 0) {      \
+        HEAP4_SWAP_(type, heap, parent, i);                             \
+        i = parent;                                                     \
+      }                                                                 \
+      else break;                                                       \
+    }                                                                   \
+  } while (0)
+
+#define HEAP4_SIFTDOWN_(type, heap, index)                              \
+  do {                                                                  \
+    int c = (index);                                                    \
+    while (1) {                                                         \
+      int child = HEAP4_CHILD(c);                                       \
+      int best, k;                                                      \
+      if (child >= (heap)->end)                                         \
+        break;                                                          \
+      best = child;                                                     \
+      for (k = child + 1; k < child + 4 && k < (heap)->end; k++)        \
+        if (type##_cmp((heap)->body[best], (heap)->body[k]) < 0)        \
+          best = k;                                                     \
+      if (type##_cmp((heap)->body[c], (heap)->body[best]) < 0) {        \
+        HEAP4_SWAP_(type, heap, c, best);                               \
+        c = best;                                                       \
+      }                                                                 \
+      else break;                                                       \
+    }                                                                   \
+  } while (0)
+
+#define HEAP4_INSERT_(type, heap, nodep, result)        \
+    do {                                                \
+      int success = 1;                                  \
+      HEAP_MAKE_ROOM_(heap, success);                   \
+      if (success) {                                    \
+        (heap)->body[(heap)->end] = nodep;              \
+        HEAP4_SETPOS_(type, heap, (heap)->end);         \
+        (heap)->end++;                                  \
+        HEAP4_SIFTUP_(type, heap, (heap)->end - 1);     \
+      }                                                 \
+      (result) = !success;                              \
+    } while (0)
+
+#define HEAP4_POP_(type, heap, result)                  \
+    do {                                                \
+      (heap)->t_ret = 0;                                \
+      if ((heap)->end > 0) {                            \
+        (heap)->t_ret = (heap)->body[0];                \
+        (heap)->end--;                                  \
+        if ((heap)->end > 0) {                          \
+          (heap)->body[0] = (heap)->body[(heap)->end];  \
+          HEAP4_SETPOS_(type, heap, 0);                 \
+        }                                               \
+        (heap)->body[(heap)->end] = 0;                  \
+        HEAP4_SIFTDOWN_(type, heap, 0);                 \
+      }                                                 \
+      (result) = (heap)->t_ret;                         \
+    } while (0)
+
+/* the node at INDEX changed its key; move it where it now belongs */
+#define HEAP4_ADJUST_(type, heap, index)                \
+    do {                                                \
+      HEAP4_SIFTUP_(type, heap, index);                 \
+      HEAP4_SIFTDOWN_(type, heap, index);               \
+    } while (0)
+
+/* build the heap from COUNT node pointers in ARRAY, in O(COUNT) */
+#define HEAP4_HEAPIFY_(type, heap, array, count, result)                \
+    do {                                                                \
+      int n = (count);                                                  \
+      int i;                                                            \
+      (result) = 0;                                                     \
+      if (n <= 0)                                                       \
+        break;                                                          \
+      if (!(heap)->body || (heap)->size < (size_t)n) {                  \
+        void *p = realloc((heap)->body,                                 \
+                          n * 2 * sizeof((heap)->body[0]));             \
+        if (!p) {                                                       \
+          (result) = 1;                                                 \
+          break;                                                        \
+        }                                                               \
+        (heap)->body = p;                                               \
+        (heap)->size = n * 2;                                           \
+      }                                                                 \
+      for (i = 0; i < n; i++) {                                         \
+        (heap)->body[i] = (array)[i];                                   \
+        HEAP4_SETPOS_(type, heap, i);                                   \
+      }                                                                 \
+      (heap)->end = n;                                                  \
+      for (i = HEAP4_PARENT(n - 1); i >= 0; i--)                        \
+        HEAP4_SIFTDOWN_(type, heap, i);                                 \
+    } while (0)
+
+#ifdef __GNUC__
+#define HEAP4_INSERT(type, heap, nodep)                 \
+    ({                                                  \
+      int result;                                       \
+      HEAP4_INSERT_(type, heap, nodep, result);         \
+      result; })
+
+#define HEAP4_POP(type, heap)                           \
+      ({ typeof((heap)->body[0]) result;                \
+         HEAP4_POP_(type, heap, result);                \
+         result; })
+
+#define HEAP4_ADJUST(type, heap, index)                 \
+      do { HEAP4_ADJUST_(type, heap, index); } while (0)
+
+#define HEAP4_HEAPIFY(type, heap, array, count)         \
+    ({                                                  \
+      int result;                                       \
+      HEAP4_HEAPIFY_(type, heap, array, count, result); \
+      result; })
+#endif  /* __GNUC__ */
+
 #endif  /* HEAP_H__ */
@@ -4,12 +4,14 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include <curl/curl.h>
 #include <obstack.h>
+#include <pthread.h>
 
 #include "httpcli.h"
 
@@ -50,6 +52,177 @@ static void httpcli_set_headers(struct http_request *req);
 static int httpcli_perform(struct http_request *req, const char *url);
 
 
+/*
+ * Connection pool.
+ *
+ * libcurl keeps a per-easy-handle cache of established connections,
+ * so requests made through ONE struct http_request already reuse
+ * their connection via keep-alive.  To reuse connections across ALL
+ * http_request objects (one pool per destination), we hang every easy
+ * handle on a global share object that shares the connection cache.
+ * httpcli_pool_init() creates the share and sets the limits that
+ * every subsequent httpcli_new() applies to its handle.
+ */
+/* Engine behind httpcli_multi_*(): one curl multi handle driving any
+ * number of http_request transfers over non-blocking sockets. */
+struct http_multi {
+  CURLM *multi;
+  int nrunning;                 /* handles added but not yet reaped */
+};
+
+static CURLSH *pool_share;
+static int pool_max_idle = 8;   /* max idle connections kept per handle */
+static long pool_max_age = 0;   /* max lifetime of a connection, seconds */
+
+static pthread_mutex_t pool_locks[CURL_LOCK_DATA_LAST] = {
+  PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+  PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+  PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+  PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void
+pool_lock_func(CURL *handle, curl_lock_data data, curl_lock_access access,
+               void *userptr)
+{
+  pthread_mutex_lock(&pool_locks[data]);
+}
+
+static void
+pool_unlock_func(CURL *handle, curl_lock_data data, void *userptr)
+{
+  pthread_mutex_unlock(&pool_locks[data]);
+}
+
+
+int
+httpcli_pool_init(int max_idle, long max_age)
+{
+  if (!pool_share) {
+    pool_share = curl_share_init();
+    if (!pool_share)
+      return -1;
+
+    curl_share_setopt(pool_share, CURLSHOPT_LOCKFUNC, pool_lock_func);
+    curl_share_setopt(pool_share, CURLSHOPT_UNLOCKFUNC, pool_unlock_func);
+#if LIBCURL_VERSION_NUM >= 0x073900 /* 7.57.0 */
+    curl_share_setopt(pool_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+  }
+
+  if (max_idle > 0)
+    pool_max_idle = max_idle;
+  if (max_age > 0)
+    pool_max_age = max_age;
+
+  return 0;
+}
+
+
+void
+httpcli_pool_cleanup(void)
+{
+  if (pool_share) {
+    curl_share_cleanup(pool_share);
+    pool_share = NULL;
+  }
+}
+
+
+/*
+ * Resolver cache.
+ *
+ * libcurl keeps a per-handle DNS cache already; httpcli_dns_cache()
+ * shares one cache (with its TTL) between every http_request, so a
+ * hostname is resolved once per TTL for the whole process instead of
+ * once per handle.  httpcli_dns_pin() bypasses the resolver entirely
+ * for the given host.  Pinned entries are handed to curl right
+ * before each transfer, so pinning affects live handles, too.
+ */
+static long dns_ttl;            /* shared cache TTL, seconds; 0 = off */
+static struct curl_slist *dns_pins; /* CURLOPT_RESOLVE entries */
+
+
+int
+httpcli_dns_cache(long ttl)
+{
+  if (ttl <= 0)
+    return -1;
+
+  if (httpcli_pool_init(0, 0) < 0) /* the cache lives in the share */
+    return -1;
+
+  curl_share_setopt(pool_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  dns_ttl = ttl;
+
+  return 0;
+}
+
+
+int
+httpcli_dns_pin(const char *host, int port, const char *addr)
+{
+  char *ent;
+  int ret;
+
+  if (addr)
+    ret = asprintf(&ent, "%s:%d:%s", host, port, addr);
+  else                          /* withdraw a previous pin */
+    ret = asprintf(&ent, "-%s:%d", host, port);
+
+  if (ret < 0)
+    return -1;
+
+  dns_pins = curl_slist_append(dns_pins, ent);
+  free(ent);
+  return dns_pins ? 0 : -1;
+}
+
+
+void
+httpcli_dns_flush(void)
+{
+  curl_slist_free_all(dns_pins);
+  dns_pins = NULL;
+}
+
+
+/* Called right before a transfer, so that late pins are honored. */
+static void
+dns_apply(CURL *curl)
+{
+  curl_easy_setopt(curl, CURLOPT_RESOLVE, dns_pins);
+}
+
+
+/*
+ * Apply the pool settings to a (new) easy handle.  Called even when
+ * httpcli_pool_init() was never used, so that keep-alive reuse within
+ * one http_request gets the same limits.
+ */
+static void
+pool_attach(CURL *curl)
+{
+  if (pool_share)
+    curl_easy_setopt(curl, CURLOPT_SHARE, pool_share);
+
+  curl_easy_setopt(curl, CURLOPT_MAXCONNECTS, (long)pool_max_idle);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+
+  if (dns_ttl > 0)
+    curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, dns_ttl);
+
+  if (pool_max_age > 0) {
+#if LIBCURL_VERSION_NUM >= 0x074100 /* 7.65.0 */
+    curl_easy_setopt(curl, CURLOPT_MAXAGE_CONN, pool_max_age);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x075000 /* 7.80.0 */
+    curl_easy_setopt(curl, CURLOPT_MAXLIFETIME_CONN, pool_max_age);
+#endif
+  }
+}
+
+
 static int
 mime_ent_compare(const void *lhs, const void *rhs)
 {
@@ -264,6 +437,7 @@ httpcli_new(void)
   struct http_request *p;
   p = malloc(sizeof(*p));
   p->curl = curl_easy_init();
+  pool_attach(p->curl);
   p->headers = NULL;
   p->persistant_hdrs = NULL;
   p->url = NULL;
@@ -483,6 +657,40 @@ httpcli_add_header(struct http_request *req, const char *format, ...)
 }
 
 
+/*
+ * Finalize the response headers and the HTTP status of REQ; to be
+ * called once, after the transfer finished (either way).
+ */
+static void
+httpcli_finish_response(struct http_request *req)
+{
+  size_t hdsize;
+  struct http_header_pair *p;
+  int i;
+
+  hdsize = obstack_object_size(&req->resp_pool) / sizeof(*p);
+  p = obstack_finish(&req->resp_pool);
+
+  req->resp_all_size = hdsize;
+  req->resp_all = p;
+
+  if (hdsize > 0) {
+    /* The index [hdsize - 1] should point the empty element. */
+    for (i = hdsize - 2; i >= 0; i--) {
+      if (p[i].key == 0)
+        break;
+    }
+    req->resp = p + i + 1;
+    req->resp_size = hdsize - i - 2;
+  }
+
+  if (req->error == CURLE_OK)
+    curl_easy_getinfo(req->curl, CURLINFO_RESPONSE_CODE, &req->status);
+  else
+    req->status = -1;
+}
+
+
 static int
 httpcli_perform(struct http_request *req, const char *url)
 {
@@ -495,38 +703,13 @@ httpcli_perform(struct http_request *req, const char *url)
   }
 
   curl_easy_setopt(req->curl, CURLOPT_URL, req->url);
+  dns_apply(req->curl);
 
   httpcli_set_headers(req);
   req->error = curl_easy_perform(req->curl);
   httpcli_unset_headers(req);
 
-  {
-    /* TODO: Finalize the response headers */
-    size_t hdsize;
-    struct http_header_pair *p;
-    int i;
-
-    hdsize = obstack_object_size(&req->resp_pool) / sizeof(*p);
-    p = obstack_finish(&req->resp_pool);
-
-    req->resp_all_size = hdsize;
-    req->resp_all = p;
-
-    if (hdsize > 0) {
-      /* The index [hdsize - 1] should point the empty element. */
-      for (i = hdsize - 2; i >= 0; i--) {
-        if (p[i].key == 0)
-          break;
-      }
-      req->resp = p + i + 1;
-      req->resp_size = hdsize - i - 2;
-    }
-  }
-
-  if (req->error == CURLE_OK)
-    curl_easy_getinfo(req->curl, CURLINFO_RESPONSE_CODE, &req->status);
-  else
-    req->status = -1;
+  httpcli_finish_response(req);
 
   return 0;
 }
@@ -646,6 +829,171 @@ httpcli_put_stream(struct http_request *req, const char *url, FILE *fp,
 }
 
 
+struct http_multi *
+httpcli_multi_new(void)
+{
+  struct http_multi *m;
+
+  m = malloc(sizeof(*m));
+  if (!m)
+    return NULL;
+
+  m->multi = curl_multi_init();
+  if (!m->multi) {
+    free(m);
+    return NULL;
+  }
+  m->nrunning = 0;
+  return m;
+}
+
+
+void
+httpcli_multi_delete(struct http_multi *m)
+{
+  /* Whatever is still in flight is abandoned; the owning
+   * http_request objects stay valid and can be deleted as usual. */
+  curl_multi_cleanup(m->multi);
+  free(m);
+}
+
+
+int
+httpcli_multi_add(struct http_multi *m, struct http_request *req,
+                  const char *url)
+{
+  httpcli_clear_state(req);
+
+  if (url) {
+    if (req->url)
+      free((void *)req->url);
+    req->url = strdup(url);
+    if (!req->url)
+      return -1;
+  }
+  curl_easy_setopt(req->curl, CURLOPT_URL, req->url);
+  dns_apply(req->curl);
+
+  curl_easy_setopt(req->curl, CURLOPT_FOLLOWLOCATION, 1);
+
+  curl_easy_setopt(req->curl, CURLOPT_HEADERFUNCTION, receive_header_func);
+  curl_easy_setopt(req->curl, CURLOPT_HEADERDATA, req);
+
+  curl_easy_setopt(req->curl, CURLOPT_WRITEFUNCTION, receive_buffer_func);
+  curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, req);
+
+  /* so that a finished easy handle leads us back to its request */
+  curl_easy_setopt(req->curl, CURLOPT_PRIVATE, req);
+
+  httpcli_set_headers(req);
+
+  if (curl_multi_add_handle(m->multi, req->curl) != CURLM_OK) {
+    httpcli_unset_headers(req);
+    return -1;
+  }
+  m->nrunning++;
+  return 0;
+}
+
+
+/*
+ * Pull one finished transfer out of M, if any, finalizing the
+ * request the same way the blocking calls do.
+ */
+static struct http_request *
+httpcli_multi_reap(struct http_multi *m)
+{
+  CURLMsg *msg;
+  int msgs_left;
+
+  while ((msg = curl_multi_info_read(m->multi, &msgs_left)) != NULL) {
+    struct http_request *req;
+    char *priv;
+
+    if (msg->msg != CURLMSG_DONE)
+      continue;
+
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &priv);
+    req = (struct http_request *)priv;
+
+    req->error = msg->data.result;
+
+    curl_multi_remove_handle(m->multi, req->curl);
+    m->nrunning--;
+
+    httpcli_unset_headers(req);
+    httpcli_finish_response(req);
+
+    obstack_1grow(&req->body_pool, '\0');
+    req->body = obstack_finish(&req->body_pool);
+
+    return req;
+  }
+  return NULL;
+}
+
+
+struct http_request *
+httpcli_multi_wait(struct http_multi *m, int timeout_ms)
+{
+  struct http_request *req;
+  struct timespec start, now;
+  int still = 0;
+  int remain = timeout_ms;
+
+  if (m->nrunning == 0)
+    return NULL;
+
+  if (timeout_ms >= 0)
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (;;) {
+    if (curl_multi_perform(m->multi, &still) != CURLM_OK)
+      return NULL;
+
+    req = httpcli_multi_reap(m);
+    if (req)
+      return req;
+
+    if (still == 0)             /* nothing in flight, nothing done */
+      return NULL;
+
+    if (timeout_ms >= 0) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      remain = timeout_ms - (int)((now.tv_sec - start.tv_sec) * 1000
+                                  + (now.tv_nsec - start.tv_nsec) / 1000000);
+      if (remain <= 0)
+        return NULL;
+    }
+
+    if (curl_multi_poll(m->multi, NULL, 0,
+                        timeout_ms < 0 ? 1000 : remain, NULL) != CURLM_OK)
+      return NULL;
+  }
+}
+
+
+int
+httpcli_multi_perform(struct http_multi *m,
+                      void (*callback)(struct http_request *req, void *data),
+                      void *data)
+{
+  struct http_request *req;
+  int ndone = 0;
+
+  while (m->nrunning > 0) {
+    req = httpcli_multi_wait(m, -1);
+    if (!req)
+      break;
+
+    ndone++;
+    if (callback)
+      callback(req, data);
+  }
+  return ndone;
+}
+
+
 int
 main(int argc, char *argv[])
 {
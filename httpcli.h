@@ -38,6 +38,49 @@ struct http_request {
   char *body;
 };
 
+/*
+ * Enable the process-wide connection pool.
+ *
+ * Once called, every http_request created by httpcli_new() shares one
+ * connection cache, so keep-alive connections opened by one request
+ * object are transparently reused by the others (per destination).
+ *
+ * MAX_IDLE limits how many idle connections a handle may keep alive;
+ * MAX_AGE (in seconds) retires connections older than that.  Pass
+ * zero to keep the previous (or default) value.
+ *
+ * Requests made through ONE http_request reuse their connection even
+ * without this call; the pool only adds cross-request sharing.
+ */
+int httpcli_pool_init(int max_idle, long max_age);
+
+/*
+ * Tear down the pool created by httpcli_pool_init().
+ *
+ * Call this only after every http_request has been deleted.
+ */
+void httpcli_pool_cleanup(void);
+
+/*
+ * Share one resolver cache between every http_request, with entries
+ * kept for TTL seconds, so that a hostname is resolved once per TTL
+ * for the whole process instead of once per handle.
+ */
+int httpcli_dns_cache(long ttl);
+
+/*
+ * Pin HOST:PORT to ADDR (a numerical IP), bypassing the resolver for
+ * every subsequent request to that host.  Pass a NULL ADDR to
+ * withdraw an earlier pin.
+ */
+int httpcli_dns_pin(const char *host, int port, const char *addr);
+
+/*
+ * Drop all pins made by httpcli_dns_pin().  Cached (unpinned)
+ * entries are not dropped; they expire by the TTL.
+ */
+void httpcli_dns_flush(void);
+
 /*
  * Create new http_request struct.
  *
@@ -131,4 +174,50 @@ int httpcli_put_file(struct http_request *req, const char *url,
 int httpcli_put_stream(struct http_request *req, const char *url, FILE *fp,
                        const char *content_type);
 
+
+/*
+ * Multi-request engine.
+ *
+ * Submit any number of http_request objects with httpcli_multi_add()
+ * and they are all driven concurrently, from the calling thread, over
+ * non-blocking sockets -- the total latency of a fan-out is the
+ * slowest transfer, not the sum.  Each request finishes in the same
+ * state httpcli_get_buffer() would leave it in: the body in
+ * REQ->body (null-terminated), headers in REQ->resp, the HTTP status
+ * in REQ->status and the curl code in REQ->error.
+ *
+ * Collect completions either one at a time with httpcli_multi_wait()
+ * or all at once with httpcli_multi_perform().  An http_request must
+ * not be touched between add and completion, and must not be added
+ * twice at the same time.
+ */
+struct http_multi;
+
+struct http_multi *httpcli_multi_new(void);
+void httpcli_multi_delete(struct http_multi *m);
+
+/*
+ * Submit a GET request for URL; the transfer starts on the next
+ * httpcli_multi_wait()/httpcli_multi_perform() call.
+ */
+int httpcli_multi_add(struct http_multi *m, struct http_request *req,
+                      const char *url);
+
+/*
+ * Wait until any submitted request finishes and return it, or NULL
+ * when nothing is in flight or TIMEOUT_MS (>= 0) elapsed first.  A
+ * negative TIMEOUT_MS waits indefinitely.
+ */
+struct http_request *httpcli_multi_wait(struct http_multi *m, int timeout_ms);
+
+/*
+ * Drive every submitted request to completion, invoking CALLBACK (if
+ * non-NULL) with each finished request and DATA.  Returns the number
+ * of completed requests.
+ */
+int httpcli_multi_perform(struct http_multi *m,
+                          void (*callback)(struct http_request *req,
+                                           void *data),
+                          void *data);
+
 #endif  /* HTTPCLI_H__ */
@@ -18,7 +18,6 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
-// TODO: saving configuration to the file.
 // TODO: use exception for errors (with better error messages)
 // TODO: variable substitution like bash(1)
 // TODO: multiple values for parameters
@@ -28,6 +27,7 @@
 #include <locale>
 #include <limits>
 #include <sstream>
+#include <cctype>
 
 #include "inifile.hpp"
 
@@ -128,7 +128,7 @@ strip(std::string &s, const std::locale &loc = std::locale())
 // it would cause std::bad_cast exception.  Don't know why...
 //
 inifile::inifile()
-  : locale_(std::locale()), lineno_(0), es_(&std::cerr)
+  : locale_(std::locale()), lineno_(0), es_(&std::cerr), cur_keys_(0)
 {
 }
 
@@ -142,22 +142,38 @@ inifile::~inifile()
 inifile::section_type *
 inifile::section(const std::string &section_name)
 {
+#ifdef INIFILE_HAVE_HASH
+  index_type::iterator i = index_.find(section_name);
+  if (i == index_.end())
+    return 0;
+  else
+    return i->second;
+#else
   config_type::iterator i = config_.find(section_name);
   if (i == config_.end())
     return 0;
   else
     return i->second;
+#endif
 }
 
 
 const inifile::section_type *
 inifile::section(const std::string &section_name) const
 {
+#ifdef INIFILE_HAVE_HASH
+  index_type::const_iterator i = index_.find(section_name);
+  if (i == index_.end())
+    return 0;
+  else
+    return i->second;
+#else
   config_type::const_iterator i = config_.find(section_name);
   if (i == config_.end())
     return 0;
   else
     return i->second;
+#endif
 }
 
 
@@ -166,6 +182,18 @@ inifile::clear(void)
 {
   for (config_type::iterator i = config_.begin(); i != config_.end(); ++i)
     delete i->second;
+  config_.clear();
+
+#ifdef INIFILE_HAVE_HASH
+  index_.clear();
+#endif
+  sec_order_.clear();
+  key_order_.clear();
+  cur_keys_ = 0;
+
+  vconfig_.clear();
+  owned_.clear();
+  buf_.clear();
 }
 
 
@@ -210,7 +238,9 @@ bool
 inifile::get_section_name(std::string &name,
                           std::istream &is, char_type lookahead)
 {
-  eat_spaces(is, lookahead);
+  // LOOKAHEAD is the '[' itself; it must not go back into the
+  // stream, or it would end up glued to the section name.
+  eat_spaces(is);
   getline(is, name);
 
   incr_lineno(is, name);
@@ -244,9 +274,9 @@ inifile::get_esc_hex(int_type &value, std::istream &is)
       if (hex[i] >= is.widen('0') && hex[i] <= is.widen('9'))
         hex[i] -= is.widen('0');
       else if (hex[i] >= is.widen('a') && hex[i] <= is.widen('f'))
-        hex[i] -= is.widen('a');
+        hex[i] = hex[i] - is.widen('a') + 10;
       else if (hex[i] >= is.widen('A') && hex[i] <= is.widen('F'))
-        hex[i] -= is.widen('A');
+        hex[i] = hex[i] - is.widen('A') + 10;
       else {
         ERR(this, ie_error) << "invalid hexadecimal escape sequence";
         return false;
@@ -255,8 +285,8 @@ inifile::get_esc_hex(int_type &value, std::istream &is)
   }
 
   value = 0;
-  for (unsigned i = 0; i < sizeof(hex) / sizeof(int_type); ++i, value <<= 4)
-    value += static_cast<unsigned>(hex[i]);
+  for (unsigned i = 0; i < sizeof(hex) / sizeof(int_type); ++i)
+    value = (value << 4) + static_cast<unsigned>(hex[i]);
 
   return true;
 }
@@ -282,8 +312,8 @@ inifile::get_esc_oct(int_type &value, std::istream &is)
     }
 
   value = 0;
-  for (unsigned i = 0; i < sizeof(oct) / sizeof(int_type); ++i, value <<= 3)
-    value += static_cast<unsigned>(oct[i]);
+  for (unsigned i = 0; i < sizeof(oct) / sizeof(int_type); ++i)
+    value = (value << 3) + static_cast<unsigned>(oct[i]);
   return true;
 }
 
@@ -439,16 +469,23 @@ inifile::get_param_name(std::string &name,
 inifile::section_type *
 inifile::create_section(const std::string &name)
 {
-  config_type::iterator i = config_.find(name);
-  if (i != config_.end())
-    return i->second;
+  section_type *p = section(name);
+  if (p) {
+    cur_keys_ = &key_order_[name];
+    return p;
+  }
 
-  section_type *p = new section_type;
+  p = new section_type;
   if (!p)
     return 0;
 
   config_type::value_type value(name, p);
   config_.insert(value);
+#ifdef INIFILE_HAVE_HASH
+  index_[name] = p;
+#endif
+  sec_order_.push_back(name);
+  cur_keys_ = &key_order_[name];
   return p;
 }
 
@@ -467,6 +504,8 @@ inifile::register_parameter(section_type *sect,
 
   if (i != sect->end())
     sect->erase(i);
+  else if (cur_keys_)
+    cur_keys_->push_back(name); // a redefined NAME keeps its place
 
   section_type::value_type v(name, value);
   sect->insert(v);
@@ -531,6 +570,349 @@ inifile::load(const char *pathname)
 }
 
 
+// A value survives unquoted iff reparsing would hand it back
+// unchanged: no surrounding blanks, no comment starters, no quote
+// characters, no backslash, nothing unprintable.
+static bool
+value_needs_quoting(const std::string &v)
+{
+  if (v.empty())
+    return false;
+
+  if (std::isspace((unsigned char)v[0]) ||
+      std::isspace((unsigned char)v[v.size() - 1]))
+    return true;
+
+  for (std::string::size_type i = 0; i < v.size(); ++i) {
+    unsigned char c = v[i];
+    if (c == ';' || c == '#' || c == '\"' || c == '\'' || c == '\\')
+      return true;
+    if (!std::isprint(c))
+      return true;
+  }
+  return false;
+}
+
+
+// Write V as a double-quoted string using the escape sequences that
+// get_param_value() understands.  The reader drops unknown escapes
+// and has no '\\' sequence, so a backslash goes out as \x5c; a single
+// quote inside double quotes is passed through verbatim.
+static void
+write_quoted(std::ostream &os, const std::string &v)
+{
+  static const char hexdig[] = "0123456789abcdef";
+
+  os << '\"';
+  for (std::string::size_type i = 0; i < v.size(); ++i) {
+    unsigned char c = v[i];
+    switch (c) {
+    case '\a': os << "\\a"; break;
+    case '\b': os << "\\b"; break;
+    case '\f': os << "\\f"; break;
+    case '\n': os << "\\n"; break;
+    case '\r': os << "\\r"; break;
+    case '\t': os << "\\t"; break;
+    case '\v': os << "\\v"; break;
+    case '\"': os << "\\\""; break;
+    default:
+      if (std::isprint(c) && c != '\\')
+        os << v[i];
+      else
+        os << "\\x" << hexdig[c >> 4] << hexdig[c & 0x0f];
+      break;
+    }
+  }
+  os << '\"';
+}
+
+
+std::ostream &
+inifile::save(std::ostream &os) const
+{
+  for (std::vector<std::string>::const_iterator s = sec_order_.begin();
+       s != sec_order_.end(); ++s) {
+    const section_type *sect = section(*s);
+    if (!sect)
+      continue;
+
+    // The default section has no header; it is always first in
+    // SEC_ORDER_ since it only ever comes from parameters seen
+    // before any section declaration.
+    if (!s->empty())
+      os << "[" << *s << "]\n";
+
+    std::map<std::string, std::vector<std::string> >::const_iterator keys
+      = key_order_.find(*s);
+    if (keys != key_order_.end()) {
+      for (std::vector<std::string>::const_iterator k = keys->second.begin();
+           k != keys->second.end(); ++k) {
+        section_type::const_iterator v = sect->find(*k);
+        if (v == sect->end())
+          continue;
+
+        os << *k << " = ";
+        if (value_needs_quoting(v->second))
+          write_quoted(os, v->second);
+        else
+          os << v->second;
+        os << "\n";
+      }
+    }
+    os << "\n";
+  }
+  return os;
+}
+
+
+bool
+inifile::save(const char *pathname) const
+{
+  std::ofstream os(pathname, std::ios_base::out | std::ios_base::trunc);
+
+  if (!os.is_open())
+    return false;
+
+  save(os);
+  return !os.fail();
+}
+
+
+const inifile::vsection_type *
+inifile::vsection(const std::string &section_name) const
+{
+  vconfig_type::const_iterator i =
+    vconfig_.find(strview(section_name.data(), section_name.size()));
+  if (i == vconfig_.end())
+    return 0;
+  else
+    return &i->second;
+}
+
+
+// Expand the escape sequences of a quoted value [BEGIN, END) into
+// OUT, following the same rules as get_param_value().
+bool
+inifile::unescape_string(std::string &out, const char *begin, const char *end)
+{
+  const char *p;
+
+  out.clear();
+  out.reserve(end - begin);
+
+  for (p = begin; p != end; ++p) {
+    if (*p != '\\') {
+      out.push_back(*p);
+      continue;
+    }
+
+    if (++p == end) {
+      ERR(this, ie_error) << "prematured escape sequence";
+      return false;
+    }
+
+    switch (*p) {
+    case 'a': out.push_back('\a'); break;
+    case 'b': out.push_back('\b'); break;
+    case 'f': out.push_back('\f'); break;
+    case 'n': out.push_back('\n'); break;
+    case 'r': out.push_back('\r'); break;
+    case 't': out.push_back('\t'); break;
+    case 'v': out.push_back('\v'); break;
+    case '\'': out.push_back('\''); break;
+    case '\"': out.push_back('\"'); break;
+
+    case 'x':
+    case 'X':
+      {
+        int value = 0;
+        for (int i = 0; i < 2; ++i) {
+          if (++p == end) {
+            ERR(this, ie_error) << "prematured escape sequence";
+            return false;
+          }
+          value <<= 4;
+          if (*p >= '0' && *p <= '9')
+            value += *p - '0';
+          else if (*p >= 'a' && *p <= 'f')
+            value += *p - 'a' + 10;
+          else if (*p >= 'A' && *p <= 'F')
+            value += *p - 'A' + 10;
+          else {
+            ERR(this, ie_error) << "invalid hexadecimal escape sequence";
+            return false;
+          }
+        }
+        out.push_back(static_cast<char>(value));
+      }
+      break;
+
+    default:
+      if (*p >= '0' && *p <= '7') {
+        int value = 0;
+        for (int i = 0; i < 3; ++i, ++p) {
+          if (p == end || *p < '0' || *p > '7') {
+            ERR(this, ie_error) << "invalid octal escape sequence";
+            return false;
+          }
+          value = (value << 3) + (*p - '0');
+        }
+        --p;
+        out.push_back(static_cast<char>(value));
+      }
+      // unknown escape sequence; dropped, like get_param_value()
+      break;
+    }
+  }
+  return true;
+}
+
+
+bool
+inifile::load_view(const char *pathname)
+{
+  std::ifstream is(pathname, std::ios_base::in | std::ios_base::binary);
+
+  filename_ = pathname;
+  lineno_ = 1;
+
+  if (!is.is_open()) {
+    ERR(this, ie_error) << "cannot open '" << pathname << "'";
+    return false;
+  }
+
+  is.seekg(0, std::ios_base::end);
+  buf_.resize(is.tellg());
+  is.seekg(0, std::ios_base::beg);
+  if (!buf_.empty())
+    is.read(&buf_[0], buf_.size());
+
+  const char *p = buf_.empty() ? 0 : &buf_[0];
+  const char *end = p + buf_.size();
+  vsection_type *current_section = 0;
+
+  // One pass over the buffer; names and values become strviews into
+  // BUF_, allocating only for quoted values with escape sequences.
+  while (p < end) {
+    while (p < end && std::isspace(*p, locale_)) {
+      if (*p == '\n')
+        incr_lineno();
+      ++p;
+    }
+    if (p >= end)
+      break;
+
+    if (*p == '#' || *p == ';') {
+      while (p < end && *p != '\n')
+        ++p;
+      continue;
+    }
+
+    if (*p == '[') {
+      ++p;
+      while (p < end && *p != '\n' && std::isspace(*p, locale_))
+        ++p;
+      const char *b = p;
+      while (p < end && *p != ']' && *p != '\n')
+        ++p;
+      if (p >= end || *p != ']') {
+        ERR(this, ie_error) << "missing ']' in the section declaration";
+        return false;
+      }
+      const char *e = p++;
+      while (e > b && std::isspace(e[-1], locale_))
+        --e;
+      current_section = &vconfig_[strview(b, e - b)];
+      continue;
+    }
+
+    // parameter name, up to '='
+    const char *nb = p;
+    while (p < end && *p != '=' && *p != '\n')
+      ++p;
+    if (p >= end || *p != '=') {
+      ERR(this, ie_error) << "parameter name contains newline character(s)";
+      return false;
+    }
+    const char *ne = p++;
+    while (ne > nb && std::isspace(ne[-1], locale_))
+      --ne;
+
+    while (p < end && *p != '\n' && std::isspace(*p, locale_))
+      ++p;
+
+    strview value;
+
+    if (p < end && (*p == '\"' || *p == '\'')) {
+      char quote = *p++;
+      const char *vb = p;
+      bool escaped = false;
+
+      while (p < end && *p != quote) {
+        if (*p == '\\') {
+          escaped = true;
+          if (++p >= end)
+            break;
+        }
+        // Even if we found a newline character inside of quoted
+        // string, we accept it here.
+        if (*p == '\n')
+          incr_lineno();
+        ++p;
+      }
+      if (p >= end) {
+        ERR(this, ie_error) << "unexpected EOF encountered";
+        return false;
+      }
+      const char *ve = p++;
+
+      if (escaped) {
+        owned_.push_back(std::string());
+        if (!unescape_string(owned_.back(), vb, ve))
+          return false;
+        value = strview(owned_.back().data(), owned_.back().size());
+      }
+      else
+        value = strview(vb, ve - vb);
+
+      // only whitespace or a comment may follow the closing quote
+      const char *gb = p;
+      while (p < end && *p != '\n')
+        ++p;
+      const char *ge = p;
+      while (gb < ge && std::isspace(*gb, locale_))
+        ++gb;
+      while (ge > gb && std::isspace(ge[-1], locale_))
+        --ge;
+      if (gb != ge && *gb != ';' && *gb != '#')
+        ERR(this, ie_warning) << "ignoring remainig characters '"
+                              << std::string(gb, ge - gb) << "'";
+    }
+    else {
+      // We accept empty value.
+      const char *vb = p;
+      while (p < end && *p != '\n')
+        ++p;
+      const char *ve = p;
+
+      for (const char *q = vb; q < ve; ++q)
+        if (*q == ';' || *q == '#') {
+          ve = q;
+          break;
+        }
+      while (ve > vb && std::isspace(ve[-1], locale_))
+        --ve;
+      value = strview(vb, ve - vb);
+    }
+
+    if (!current_section)
+      current_section = &vconfig_[strview()];
+    (*current_section)[strview(nb, ne - nb)] = value;
+  }
+  return true;
+}
+
+
 #ifdef TEST_INIFILE
 int
 main(int argc, char *argv[])
@@ -538,6 +920,22 @@ main(int argc, char *argv[])
   inifile conf;
 
   for (int i = 1; i < argc; ++i) {
+    if (getenv("INIFILE_VIEW")) {
+      if (!conf.load_view(argv[i]))
+        continue;
+
+      for (inifile::const_viterator s = conf.vbegin(); s != conf.vend(); ++s) {
+        std::cout << "[" << s->first.str() << "]" << std::endl;
+
+        for (inifile::vsection_type::const_iterator j = s->second.begin();
+             j != s->second.end(); ++j) {
+          std::cout << "     [" << j->first.str() << "] = ["
+                    << j->second.str() << "]" << std::endl;
+        }
+      }
+      continue;
+    }
+
     if (!conf.load(argv[i]))
       continue;
 
@@ -30,6 +30,16 @@
 #include <fstream>
 #include <string>
 #include <map>
+#include <vector>
+#include <list>
+#include <cstring>
+
+#if __cplusplus >= 201103L
+// With C++11, section lookup goes through a hash index kept next to
+// the section map -- one O(1) probe instead of a tree descent.
+# include <unordered_map>
+# define INIFILE_HAVE_HASH      1
+#endif
 
 //
 // Since there is no explicit specification for INI file, here is
@@ -87,6 +97,31 @@ public:
   typedef config_type::const_reverse_iterator const_reverse_iterator;
   typedef config_type::const_iterator const_iterator;
 
+  // A length-delimited, borrowed view of a string; see load_view().
+  // PTR is not null-terminated, and its storage belongs to the
+  // inifile object -- valid until clear() or destruction.
+  struct strview {
+    const char *ptr;
+    size_t len;
+
+    strview() : ptr(0), len(0) {}
+    strview(const char *p, size_t n) : ptr(p), len(n) {}
+
+    std::string str() const { return std::string(ptr, len); }
+
+    bool operator<(const strview &rhs) const {
+      size_t n = len < rhs.len ? len : rhs.len;
+      int c = n ? std::memcmp(ptr, rhs.ptr, n) : 0;
+      if (c)
+        return c < 0;
+      return len < rhs.len;
+    }
+  };
+
+  typedef std::map<strview, strview> vsection_type;
+  typedef std::map<strview, vsection_type> vconfig_type;
+  typedef vconfig_type::const_iterator const_viterator;
+
   inifile();
   ~inifile();
 
@@ -95,10 +130,40 @@ public:
   // Returns true if parsing was successful, otherwise returns false.
   bool load(const char *pathname);
 
+  // Load the INI file in borrowed-storage mode.
+  //
+  // The whole file is read into one buffer kept inside this object,
+  // and every section name, parameter name and value is a strview
+  // into that buffer -- no per-string allocation.  Only quoted
+  // values containing escape sequences are expanded into owned
+  // storage.  The result is reachable through vsection()/vbegin(),
+  // separate from the std::string maps that load() fills.
+  //
+  // Returns true if parsing was successful, otherwise returns false.
+  bool load_view(const char *pathname);
+
+  // Return the SECTION_NAME section of load_view() data, if exists.
+  const vsection_type *vsection(const std::string &section_name = "") const;
+
+  const_viterator vbegin() const        { return vconfig_.begin(); }
+  const_viterator vend() const          { return vconfig_.end(); }
+
   // Return the SECTION_NAME section if exists.
   const section_type *section(const std::string &section_name = "") const;
   section_type *section(const std::string &section_name = "");
 
+  // Write the configuration in INI format.
+  //
+  // Sections and parameters are written in the order they were first
+  // seen by load() -- which the sorted lookup maps do not remember --
+  // so a loaded file keeps its original layout.  Values that would
+  // not survive reparsing (surrounding blanks, comment or quote
+  // characters, newlines, ...) are quoted and escaped.
+  //
+  // save(pathname) returns true if the file was written successfully.
+  bool save(const char *pathname) const;
+  std::ostream &save(std::ostream &os) const;
+
   // TODO: I'm not sure whether it is good idea to mimic a STL container.
   // TODO: Perhaps exposing config_ is better?
   iterator begin()                      { return config_.begin(); }
@@ -146,12 +211,32 @@ private:
   long lineno() { return lineno_; }
   std::ostream *estream() { return es_; }
 
+  bool unescape_string(std::string &out, const char *begin, const char *end);
+
   const std::locale locale_;
 
   std::string filename_;
   long lineno_;
   std::ostream *es_;
   config_type config_;
+
+#ifdef INIFILE_HAVE_HASH
+  // Hash index over config_, built as the sections are created, so
+  // that section() resolves a name in O(1).
+  typedef std::unordered_map<std::string, section_type *> index_type;
+  index_type index_;
+#endif
+
+  // Insertion order of the sections and of each section's
+  // parameters, kept separately for save().
+  std::vector<std::string> sec_order_;
+  std::map<std::string, std::vector<std::string> > key_order_;
+  std::vector<std::string> *cur_keys_; // key order of the section
+                                       // being parsed
+
+  vconfig_type vconfig_;        // load_view() result
+  std::vector<char> buf_;       // the borrowed storage behind it
+  std::list<std::string> owned_; // escape-expanded values (stable addresses)
 };
 
 #endif  // INIFILE_HPP__
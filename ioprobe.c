@@ -0,0 +1,196 @@
+/*
+ * ioprobe: probe a fd for its optimal transfer size and O_DIRECT
+ * alignment.  See ioprobe.h for the rationale.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>              /* AT_EMPTY_PATH */
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/socket.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>           /* BLKSSZGET, BLKIOOPT */
+#endif
+
+#include "ioprobe.h"
+
+
+static int
+clamp_bufsize(long size)
+{
+  if (size < IOPROBE_MIN_BUFSIZE)
+    return IOPROBE_MIN_BUFSIZE;
+  if (size > IOPROBE_MAX_BUFSIZE)
+    return IOPROBE_MAX_BUFSIZE;
+  return size;
+}
+
+
+int
+ioprobe_best_bufsize(int fd)
+{
+  struct stat sbuf;
+  struct statvfs vbuf;
+  long size = 0;
+
+  {
+    int rcv, snd;
+    socklen_t len;
+
+    len = sizeof(rcv);
+    if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcv, &len) == 0) {
+      len = sizeof(snd);
+      if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &snd, &len) == -1)
+        snd = 0;
+      return clamp_bufsize(rcv > snd ? rcv : snd);
+    }
+    if (errno != ENOTSOCK)
+      return -1;
+  }
+
+  if (fstat(fd, &sbuf) == -1)
+    return -1;
+
+#ifdef __linux__
+  if (S_ISBLK(sbuf.st_mode)) {
+    unsigned int opt = 0;
+    int ssz = 0;
+
+    if (ioctl(fd, BLKIOOPT, &opt) == 0 && opt > 0)
+      return clamp_bufsize(opt);
+    if (ioctl(fd, BLKSSZGET, &ssz) == 0 && ssz > 0)
+      return clamp_bufsize(ssz);
+  }
+#endif
+
+  size = sbuf.st_blksize;
+
+  /* st_blksize is a per-inode hint; f_bsize is what the filesystem
+   * actually prefers (NFS reports the mount's rsize/wsize in both,
+   * but local filesystems sometimes only in one). */
+  if (fstatvfs(fd, &vbuf) == 0 && (long)vbuf.f_bsize > size)
+    size = vbuf.f_bsize;
+
+  return clamp_bufsize(size);
+}
+
+
+int
+ioprobe_dio_align(int fd)
+{
+  struct stat sbuf;
+  long align = 0;
+
+  if (fstat(fd, &sbuf) == -1)
+    return -1;
+
+#ifdef STATX_DIOALIGN
+  {
+    struct statx stx;
+
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+        (stx.stx_mask & STATX_DIOALIGN)) {
+      align = stx.stx_dio_mem_align;
+      if ((long)stx.stx_dio_offset_align > align)
+        align = stx.stx_dio_offset_align;
+      if (align > 0)
+        return align;
+    }
+  }
+#endif
+
+#ifdef __linux__
+  if (S_ISBLK(sbuf.st_mode)) {
+    int ssz = 0;
+
+    if (ioctl(fd, BLKSSZGET, &ssz) == 0 && ssz > 0)
+      return ssz;
+  }
+#endif
+
+  /* page alignment satisfies O_DIRECT everywhere */
+  align = sysconf(_SC_PAGESIZE);
+  if (align <= 0)
+    align = 4096;
+  return align;
+}
+
+
+void *
+ioprobe_alloc(int fd, size_t size)
+{
+  void *p;
+  int align;
+
+  align = ioprobe_dio_align(fd);
+  if (align == -1)
+    return NULL;
+
+  size = (size + align - 1) / align * align;
+
+  if (posix_memalign(&p, align, size) != 0)
+    return NULL;
+  return p;
+}
+
+
+#ifdef TEST_IOPROBE
+#include <stdio.h>
+#include <fcntl.h>
+#include <string.h>
+
+static void
+probe(const char *name, int fd)
+{
+  if (fd == -1) {
+    fprintf(stderr, "%s: %s\n", name, strerror(errno));
+    return;
+  }
+  printf("%20s best=%-10d align=%d\n", name,
+         ioprobe_best_bufsize(fd), ioprobe_dio_align(fd));
+}
+
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  probe("STDIN", STDIN_FILENO);
+
+  {
+    int fds[2];
+    if (pipe(fds) == 0) {
+      probe("PIPE", fds[0]);
+      close(fds[0]);
+      close(fds[1]);
+    }
+  }
+
+  {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    probe("INET-STREAM", fd);
+    if (fd != -1)
+      close(fd);
+  }
+
+  for (i = 1; i < argc; i++) {
+    int fd = open(argv[i], O_RDONLY);
+    probe(argv[i], fd);
+
+    if (fd != -1) {
+      void *p = ioprobe_alloc(fd, 1000);
+      printf("%20s ioprobe_alloc(1000) = %p\n", argv[i], p);
+      free(p);
+      close(fd);
+    }
+  }
+
+  return 0;
+}
+#endif  /* TEST_IOPROBE */
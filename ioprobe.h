@@ -0,0 +1,59 @@
+#ifndef IOPROBE_H__
+#define IOPROBE_H__
+
+#include <stddef.h>
+
+/*
+ * This module probes a file descriptor for its optimal I/O parameters.
+ *
+ * The kernel already knows the right transfer size for almost every
+ * kind of fd -- SO_RCVBUF/SO_SNDBUF for sockets, st_blksize for files
+ * (which NFS sets from the mount's rsize/wsize), BLKIOOPT for block
+ * devices -- but each one hides behind a different interface.  These
+ * functions gather them behind one call so buffer-sizing code does not
+ * have to guess.
+ */
+
+/* ioprobe_best_bufsize() never returns less/more than these; a probe
+ * that reports something silly (ramfs says 4096, some devices report
+ * 0) is clamped into this range. */
+#define IOPROBE_MIN_BUFSIZE     4096
+#define IOPROBE_MAX_BUFSIZE     (8 * 1024 * 1024)
+
+/*
+ * Return the recommended transfer (buffer) size for FD in byte(s).
+ *
+ * For sockets, this is the larger of the receive/send buffer sizes.
+ * For block devices, the device's optimal I/O size (BLKIOOPT) if it
+ * reports one, otherwise the logical sector size.  For anything with
+ * an inode, the larger of st_blksize and the filesystem's f_bsize.
+ *
+ * The result is clamped between IOPROBE_MIN_BUFSIZE and
+ * IOPROBE_MAX_BUFSIZE.  On failure (FD is not a valid descriptor), it
+ * returns -1.
+ */
+int ioprobe_best_bufsize(int fd);
+
+/*
+ * Return the memory/offset alignment in byte(s) that O_DIRECT
+ * transfers on FD must honor.
+ *
+ * Where the kernel exports it (statx(2) STATX_DIOALIGN, or BLKSSZGET
+ * for block devices) the real requirement is returned; otherwise the
+ * page size, which is sufficient for O_DIRECT on every filesystem we
+ * run.  The result is always a power of two.  On failure it returns
+ * -1.
+ */
+int ioprobe_dio_align(int fd);
+
+/*
+ * Allocate a buffer of at least SIZE byte(s), aligned (and its size
+ * rounded up) so that it can be handed directly to read(2)/write(2)
+ * on FD opened with O_DIRECT.
+ *
+ * The caller must call free(3) to release it.  Returns NULL on
+ * failure.
+ */
+void *ioprobe_alloc(int fd, size_t size);
+
+#endif  /* IOPROBE_H__ */
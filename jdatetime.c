@@ -23,10 +23,29 @@
  */
 #include <time.h>
 #include <string.h>
+#include <stdlib.h>
 
 #include "jdatetime.h"
 #include "xobstack.h"
 
+/*
+ * Sub-second ('S') fields rendered into the result; the cached mode
+ * records where they landed so it can patch them on a cache hit
+ * instead of re-rendering the whole string.
+ */
+#define SDF_SUBSEC_MAX  4
+#define SDF_FORMAT_MAX  128
+#define SDF_RESULT_MAX  256
+
+struct sdf_subsec {
+  int off;                      /* offset of the field in the result */
+  int width;                    /* the 'S' repeat count */
+  int len;                      /* rendered length */
+};
+
+static char *sdf_format(const char *format, const struct timeval *tv,
+                        struct sdf_subsec *ss, int *nss);
+
 #define REPEAT(p, span, repeat) do {            \
     span[0] = *(p);                             \
     (repeat) = strspn((p), (span));             \
@@ -37,7 +56,7 @@
 static const char *months[] = {
   "Jan",
   "Feb",
-  "May",
+  "Mar",
   "Apr",
   "May",
   "Jun",
@@ -72,6 +91,78 @@ static const char *short_weekday[] = {
 
 char *
 simple_date_format(const char *format, const struct timeval *tv)
+{
+  return sdf_format(format, tv, NULL, NULL);
+}
+
+
+/*
+ * Like simple_date_format(), but keep the rendered string in a
+ * thread-local cache keyed on (FORMAT, tv_sec).  As long as the
+ * second does not change, a call only patches the millisecond
+ * fields (if FORMAT has any) into the cached string.  The returned
+ * pointer belongs to the cache -- do not free it; it stays valid
+ * until the next call from the same thread.
+ */
+struct sdf_cache {
+  char format[SDF_FORMAT_MAX];
+  time_t sec;
+  int valid;
+  int nss;
+  struct sdf_subsec ss[SDF_SUBSEC_MAX];
+  char buf[SDF_RESULT_MAX];
+  char *spill;                  /* last uncacheable result */
+};
+
+static __thread struct sdf_cache sdf_cache;
+
+char *
+simple_date_format_cached(const char *format, const struct timeval *tv)
+{
+  struct sdf_cache *c = &sdf_cache;
+  char tmp[16];
+  char *q;
+  int i, n;
+
+  if (c->valid && c->sec == tv->tv_sec && strcmp(c->format, format) == 0) {
+    for (i = 0; i < c->nss; i++) {
+      n = snprintf(tmp, sizeof(tmp), "%0*d",
+                   c->ss[i].width, (int)(tv->tv_usec / 1000));
+      if (n != c->ss[i].len)
+        goto miss;              /* field width changed; re-render */
+      memcpy(c->buf + c->ss[i].off, tmp, n);
+    }
+    return c->buf;
+  }
+
+ miss:
+  c->valid = 0;
+  c->nss = 0;
+  q = sdf_format(format, tv, c->ss, &c->nss);
+  if (!q)
+    return NULL;
+
+  if (c->nss <= SDF_SUBSEC_MAX &&
+      strlen(format) < SDF_FORMAT_MAX && strlen(q) < SDF_RESULT_MAX) {
+    strcpy(c->format, format);
+    strcpy(c->buf, q);
+    c->sec = tv->tv_sec;
+    c->valid = 1;
+    free(q);
+    return c->buf;
+  }
+
+  /* does not fit in the cache; hand the string back and reclaim it
+   * on the next call */
+  free(c->spill);
+  c->spill = q;
+  return q;
+}
+
+
+static char *
+sdf_format(const char *format, const struct timeval *tv,
+           struct sdf_subsec *ss, int *nss)
 {
   const char *p;
   char *q;
@@ -110,8 +201,8 @@ simple_date_format(const char *format, const struct timeval *tv)
       REPEAT(p, span, repeat);
       if (repeat >= 3)
         xobs_sprintf(&pool, "%*s", repeat, months[tmbuf.tm_mon % 12]);
-      else
-        xobs_sprintf(&pool, "%*d", repeat, tmbuf.tm_mon % 12);
+      else                      /* 1-based, as in SimpleDateFormat */
+        xobs_sprintf(&pool, "%0*d", repeat, tmbuf.tm_mon % 12 + 1);
       break;
 
     case 'w':                   /* week in year */
@@ -158,18 +249,20 @@ simple_date_format(const char *format, const struct timeval *tv)
       xobs_sprintf(&pool, "%0*d", repeat, tmbuf.tm_hour);
       break;
 
-    case 'k':
+    case 'k':                   /* 1-24; midnight is 24 */
       REPEAT(p, span, repeat);
-      xobs_sprintf(&pool, "%0*d", repeat, tmbuf.tm_hour + 1);
+      xobs_sprintf(&pool, "%0*d", repeat,
+                   tmbuf.tm_hour == 0 ? 24 : tmbuf.tm_hour);
       break;
 
     case 'K':
       REPEAT(p, span, repeat);
       xobs_sprintf(&pool, "%0*d", repeat, tmbuf.tm_hour % 12);
       break;
-    case 'h':
+    case 'h':                   /* 1-12; noon and midnight are 12 */
       REPEAT(p, span, repeat);
-      xobs_sprintf(&pool, "%0*d", repeat, tmbuf.tm_hour % 12 + 1);
+      xobs_sprintf(&pool, "%0*d", repeat,
+                   tmbuf.tm_hour % 12 == 0 ? 12 : tmbuf.tm_hour % 12);
       break;
     case 'm':
       REPEAT(p, span, repeat);
@@ -181,7 +274,19 @@ simple_date_format(const char *format, const struct timeval *tv)
       break;
     case 'S':                   /* millisecond */
       REPEAT(p, span, repeat);
+      if (ss && *nss < SDF_SUBSEC_MAX) {
+        ss[*nss].off = xobs_object_size(&pool);
+        ss[*nss].width = repeat;
+      }
       xobs_sprintf(&pool, "%0*d", repeat, tv->tv_usec / 1000);
+      if (ss) {
+        if (*nss < SDF_SUBSEC_MAX) {
+          ss[*nss].len = xobs_object_size(&pool) - ss[*nss].off;
+          (*nss)++;
+        }
+        else
+          *nss = SDF_SUBSEC_MAX + 1; /* too many; caller must not cache */
+      }
       break;
     case 'z':
       REPEAT(p, span, repeat);
@@ -229,6 +334,548 @@ simple_date_format(const char *format, const struct timeval *tv)
   return NULL;
 }
 
+
+/*
+ * Compiled timestamp parser, the inverse of simple_date_format().
+ *
+ * strptime(3) re-interprets the format string on every call and ends
+ * its day in mktime(3); sdf_compile() walks the format once into a
+ * small program of field ops (literal run, fixed-width number,
+ * month name, ...) that sdf_parse() then replays over the input with
+ * unrolled digit reads.  The local-zone offset is resolved with one
+ * mktime(3) per wall-clock hour and cached in the program, so the
+ * steady-state parse touches no libc at all.
+ */
+
+#define SDF_OPS_MAX     48
+
+enum {
+  SDF_OP_LIT,                   /* literal byte run */
+  SDF_OP_YEAR4,                 /* 'yyyy' (and other repeats but 2) */
+  SDF_OP_YEAR2,                 /* 'yy'; 69/70 pivot as in strptime */
+  SDF_OP_MON,                   /* 'M'/'MM', 1-based */
+  SDF_OP_MONNAME,               /* 'MMM...' */
+  SDF_OP_MDAY,                  /* 'd' */
+  SDF_OP_HOUR,                  /* 'H', 0-23 */
+  SDF_OP_HOUR1,                 /* 'k', 1-24 */
+  SDF_OP_HOUR12_0,              /* 'K', 0-11 */
+  SDF_OP_HOUR12_1,              /* 'h', 1-12 */
+  SDF_OP_MIN,                   /* 'm' */
+  SDF_OP_SEC,                   /* 's' */
+  SDF_OP_MSEC,                  /* 'S' */
+  SDF_OP_AMPM,                  /* 'a' */
+  SDF_OP_WDAYNAME,              /* 'E...'; matched and discarded */
+  SDF_OP_SKIPNUM,               /* derived fields (w, W, D, F) */
+  SDF_OP_ERA,                   /* 'G'; matched and discarded */
+  SDF_OP_TZ,                    /* 'z'/'Z'; +-HH[:]MM or a zone name */
+};
+
+struct sdf_op {
+  unsigned char op;
+  unsigned char width;          /* repeat count; 0 = variable width */
+  unsigned short lit_off;       /* SDF_OP_LIT: into sdf_.lit */
+  unsigned short lit_len;
+};
+
+struct sdf_ {
+  struct sdf_op ops[SDF_OPS_MAX];
+  int nops;
+
+  char lit[SDF_FORMAT_MAX];     /* literal bytes, all runs packed */
+  int litlen;
+
+  /* local-zone offset cache; see sdf_parse() */
+  int tz_valid;
+  long tz_gmtoff;
+  time_t tz_hour;
+};
+
+
+static int
+sdf_emit(SDF *sdf, int op, int width)
+{
+  if (sdf->nops >= SDF_OPS_MAX)
+    return -1;
+  sdf->ops[sdf->nops].op = op;
+  sdf->ops[sdf->nops].width = width;
+  sdf->ops[sdf->nops].lit_off = 0;
+  sdf->ops[sdf->nops].lit_len = 0;
+  sdf->nops++;
+  return 0;
+}
+
+
+static int
+sdf_emit_lit(SDF *sdf, const char *s, int len)
+{
+  struct sdf_op *prev;
+
+  if (len <= 0)
+    return 0;
+  if (sdf->litlen + len > SDF_FORMAT_MAX)
+    return -1;
+
+  /* merge with a preceding literal run */
+  prev = sdf->nops ? &sdf->ops[sdf->nops - 1] : NULL;
+  if (prev && prev->op == SDF_OP_LIT &&
+      prev->lit_off + prev->lit_len == sdf->litlen) {
+    memcpy(sdf->lit + sdf->litlen, s, len);
+    sdf->litlen += len;
+    prev->lit_len += len;
+    return 0;
+  }
+
+  if (sdf_emit(sdf, SDF_OP_LIT, 0) < 0)
+    return -1;
+  sdf->ops[sdf->nops - 1].lit_off = sdf->litlen;
+  sdf->ops[sdf->nops - 1].lit_len = len;
+  memcpy(sdf->lit + sdf->litlen, s, len);
+  sdf->litlen += len;
+  return 0;
+}
+
+
+SDF *
+sdf_compile(const char *format)
+{
+  SDF *sdf;
+  const char *p;
+  char *q;
+  char span[2] = { 0, };
+  int repeat, op;
+
+  sdf = malloc(sizeof(*sdf));
+  if (!sdf)
+    return NULL;
+  memset(sdf, 0, sizeof(*sdf));
+
+  for (p = format; *p != '\0'; p++) {
+    switch (*p) {
+    case 'G':
+      REPEAT(p, span, repeat);
+      if (sdf_emit(sdf, SDF_OP_ERA, 0) < 0)
+        goto err;
+      break;
+
+    case 'y':
+      REPEAT(p, span, repeat);
+      op = (repeat == 2) ? SDF_OP_YEAR2 : SDF_OP_YEAR4;
+      if (sdf_emit(sdf, op, repeat == 1 ? 0 : repeat) < 0)
+        goto err;
+      break;
+
+    case 'M':
+      REPEAT(p, span, repeat);
+      op = (repeat >= 3) ? SDF_OP_MONNAME : SDF_OP_MON;
+      if (sdf_emit(sdf, op, repeat == 1 ? 0 : repeat) < 0)
+        goto err;
+      break;
+
+    case 'w': case 'W': case 'D': case 'F':
+      REPEAT(p, span, repeat);
+      if (sdf_emit(sdf, SDF_OP_SKIPNUM, 0) < 0)
+        goto err;
+      break;
+
+    case 'd':
+      REPEAT(p, span, repeat);
+      if (sdf_emit(sdf, SDF_OP_MDAY, repeat == 1 ? 0 : repeat) < 0)
+        goto err;
+      break;
+
+    case 'E':
+      REPEAT(p, span, repeat);
+      if (sdf_emit(sdf, SDF_OP_WDAYNAME, 0) < 0)
+        goto err;
+      break;
+
+    case 'a':
+      REPEAT(p, span, repeat);
+      if (sdf_emit(sdf, SDF_OP_AMPM, 0) < 0)
+        goto err;
+      break;
+
+    case 'H': case 'k': case 'K': case 'h':
+      REPEAT(p, span, repeat);
+      op = (*p == 'H') ? SDF_OP_HOUR :
+           (*p == 'k') ? SDF_OP_HOUR1 :
+           (*p == 'K') ? SDF_OP_HOUR12_0 : SDF_OP_HOUR12_1;
+      if (sdf_emit(sdf, op, repeat == 1 ? 0 : repeat) < 0)
+        goto err;
+      break;
+
+    case 'm':
+      REPEAT(p, span, repeat);
+      if (sdf_emit(sdf, SDF_OP_MIN, repeat == 1 ? 0 : repeat) < 0)
+        goto err;
+      break;
+
+    case 's':
+      REPEAT(p, span, repeat);
+      if (sdf_emit(sdf, SDF_OP_SEC, repeat == 1 ? 0 : repeat) < 0)
+        goto err;
+      break;
+
+    case 'S':
+      REPEAT(p, span, repeat);
+      if (sdf_emit(sdf, SDF_OP_MSEC, repeat == 1 ? 0 : repeat) < 0)
+        goto err;
+      break;
+
+    case 'z': case 'Z':
+      REPEAT(p, span, repeat);
+      if (sdf_emit(sdf, SDF_OP_TZ, 0) < 0)
+        goto err;
+      break;
+
+    case '\'':
+      q = strchr(p + 1, '\'');
+      if (!q)
+        goto err;
+      if (q == p + 1) {
+        if (sdf_emit_lit(sdf, "'", 1) < 0)
+          goto err;
+      }
+      else if (sdf_emit_lit(sdf, p + 1, q - p - 1) < 0)
+        goto err;
+      p = q;
+      break;
+
+    default:
+      if (sdf_emit_lit(sdf, p, 1) < 0)
+        goto err;
+      break;
+    }
+  }
+  return sdf;
+
+ err:
+  free(sdf);
+  return NULL;
+}
+
+
+void
+sdf_free(SDF *sdf)
+{
+  free(sdf);
+}
+
+
+/* Read exactly WIDTH characters as a decimal number; leading blanks
+ * are accepted since the formatter space-pads some fields. */
+static __inline__ int
+sdf_digits_fixed(const char **sp, int width, int *out)
+{
+  const char *s = *sp;
+  int v = 0, i = 0;
+  unsigned d;
+
+  while (i < width && s[i] == ' ')
+    i++;
+  if (i == width)
+    return -1;
+  for (; i < width; i++) {
+    d = (unsigned char)s[i] - '0';
+    if (d > 9)
+      return -1;
+    v = v * 10 + d;
+  }
+  *sp = s + width;
+  *out = v;
+  return 0;
+}
+
+
+static __inline__ int
+sdf_digits_var(const char **sp, int *out)
+{
+  const char *s = *sp;
+  int v = 0, n = 0;
+  unsigned d;
+
+  while (n < 9) {
+    d = (unsigned char)s[n] - '0';
+    if (d > 9)
+      break;
+    v = v * 10 + d;
+    n++;
+  }
+  if (n == 0)
+    return -1;
+  *sp = s + n;
+  *out = v;
+  return 0;
+}
+
+
+/* days since the epoch for a civil date; the usual era arithmetic,
+ * so no table and no loop. */
+static __inline__ long
+sdf_days(int y, int m, int d)
+{
+  long era, yoe, doy, doe;
+
+  y -= m <= 2;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153L * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+
+int
+sdf_parse(SDF *sdf, const char *str, struct timeval *tv)
+{
+  const char *s = str;
+  const struct sdf_op *op, *end = sdf->ops + sdf->nops;
+  int year = 1970, mon = 1, mday = 1;
+  int hour = 0, min = 0, sec = 0, msec = 0;
+  int pm = 0, hour12 = 0;
+  int tz_explicit = 0;
+  long tz_off = 0;
+  long naive;
+  int v, i;
+
+  for (op = sdf->ops; op < end; op++) {
+    switch (op->op) {
+    case SDF_OP_LIT:
+      if (memcmp(s, sdf->lit + op->lit_off, op->lit_len) != 0)
+        return -1;
+      s += op->lit_len;
+      break;
+
+    case SDF_OP_YEAR4:
+      if (op->width == 4) {     /* the conventional case, unrolled */
+        unsigned d0 = (unsigned char)s[0] - '0';
+        unsigned d1 = (unsigned char)s[1] - '0';
+        unsigned d2 = (unsigned char)s[2] - '0';
+        unsigned d3 = (unsigned char)s[3] - '0';
+        if (d0 > 9 || d1 > 9 || d2 > 9 || d3 > 9)
+          return -1;
+        year = (int)(d0 * 1000 + d1 * 100 + d2 * 10 + d3);
+        s += 4;
+      }
+      else if (sdf_digits_var(&s, &year) < 0)
+        return -1;
+      break;
+
+    case SDF_OP_YEAR2:
+      if (sdf_digits_fixed(&s, 2, &v) < 0)
+        return -1;
+      year = (v >= 69) ? 1900 + v : 2000 + v;
+      break;
+
+    case SDF_OP_MON:
+      if (op->width ? sdf_digits_fixed(&s, op->width, &mon) < 0
+                    : sdf_digits_var(&s, &mon) < 0)
+        return -1;
+      if (mon < 1 || mon > 12)
+        return -1;
+      break;
+
+    case SDF_OP_MONNAME:
+      while (*s == ' ')
+        s++;
+      for (i = 0; i < 12; i++)
+        if (memcmp(s, months[i], 3) == 0)
+          break;
+      if (i == 12)
+        return -1;
+      mon = i + 1;
+      s += 3;
+      while ((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z'))
+        s++;                    /* a spelled-out month name */
+      break;
+
+    case SDF_OP_MDAY:
+      if (op->width ? sdf_digits_fixed(&s, op->width, &mday) < 0
+                    : sdf_digits_var(&s, &mday) < 0)
+        return -1;
+      if (mday < 1 || mday > 31)
+        return -1;
+      break;
+
+    case SDF_OP_HOUR:
+    case SDF_OP_HOUR1:
+    case SDF_OP_HOUR12_0:
+    case SDF_OP_HOUR12_1:
+      if (op->width ? sdf_digits_fixed(&s, op->width, &v) < 0
+                    : sdf_digits_var(&s, &v) < 0)
+        return -1;
+      switch (op->op) {
+      case SDF_OP_HOUR:     hour = v; break;
+      case SDF_OP_HOUR1:    hour = v % 24; break;
+      case SDF_OP_HOUR12_0: hour = v; hour12 = 1; break;
+      case SDF_OP_HOUR12_1: hour = v % 12; hour12 = 1; break;
+      }
+      if (hour < 0 || hour > 23)
+        return -1;
+      break;
+
+    case SDF_OP_MIN:
+      if (op->width ? sdf_digits_fixed(&s, op->width, &min) < 0
+                    : sdf_digits_var(&s, &min) < 0)
+        return -1;
+      if (min > 59)
+        return -1;
+      break;
+
+    case SDF_OP_SEC:
+      if (op->width ? sdf_digits_fixed(&s, op->width, &sec) < 0
+                    : sdf_digits_var(&s, &sec) < 0)
+        return -1;
+      if (sec > 60)             /* allow a leap second */
+        return -1;
+      break;
+
+    case SDF_OP_MSEC:
+      if (op->width ? sdf_digits_fixed(&s, op->width, &msec) < 0
+                    : sdf_digits_var(&s, &msec) < 0)
+        return -1;
+      break;
+
+    case SDF_OP_AMPM:
+      while (*s == ' ')
+        s++;
+      if ((s[0] == 'P' || s[0] == 'p') && (s[1] == 'M' || s[1] == 'm'))
+        pm = 1;
+      else if ((s[0] == 'A' || s[0] == 'a') && (s[1] == 'M' || s[1] == 'm'))
+        pm = 0;
+      else
+        return -1;
+      s += 2;
+      break;
+
+    case SDF_OP_WDAYNAME:
+      while (*s == ' ')
+        s++;
+      i = 0;
+      while ((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z')) {
+        s++;
+        i++;
+      }
+      if (i < 3)                /* derived from the date; discard */
+        return -1;
+      break;
+
+    case SDF_OP_SKIPNUM:
+      if (sdf_digits_var(&s, &v) < 0)
+        return -1;
+      break;
+
+    case SDF_OP_ERA:
+      while (*s == ' ')
+        s++;
+      if (s[0] == '\0' || s[1] == '\0')
+        return -1;
+      s += 2;                   /* AD/BC; BC is "not possible" above */
+      break;
+
+    case SDF_OP_TZ:
+      while (*s == ' ')
+        s++;
+      if (*s == '+' || *s == '-') {
+        int sign = (*s == '-') ? -1 : 1;
+        int hh, mm;
+        s++;
+        if (sdf_digits_fixed(&s, 2, &hh) < 0)
+          return -1;
+        if (*s == ':')
+          s++;
+        if (sdf_digits_fixed(&s, 2, &mm) < 0)
+          return -1;
+        tz_off = sign * (hh * 3600L + mm * 60L);
+        tz_explicit = 1;
+      }
+      else {
+        /* a zone name; skip it and fall back to the local zone */
+        while ((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') ||
+               *s == '/' || *s == '_')
+          s++;
+      }
+      break;
+    }
+  }
+
+  if (hour12 && pm && hour < 12)
+    hour += 12;
+
+  naive = sdf_days(year, mon, mday) * 86400L +
+    hour * 3600L + min * 60L + sec;
+
+  if (tz_explicit)
+    tv->tv_sec = naive - tz_off;
+  else {
+    /* Resolve the local-zone offset with mktime(3) once per
+     * wall-clock hour and cache it in the program; a DST step in the
+     * middle of that hour is off until the next refresh, the usual
+     * trade for not paying for mktime() on every line. */
+    if (!sdf->tz_valid || sdf->tz_hour != naive / 3600) {
+      struct tm tmb;
+      time_t t;
+
+      memset(&tmb, 0, sizeof(tmb));
+      tmb.tm_year = year - 1900;
+      tmb.tm_mon = mon - 1;
+      tmb.tm_mday = mday;
+      tmb.tm_hour = hour;
+      tmb.tm_min = min;
+      tmb.tm_sec = sec;
+      tmb.tm_isdst = -1;
+
+      t = mktime(&tmb);
+      if (t == (time_t)-1)
+        return -1;
+      sdf->tz_gmtoff = naive - t;
+      sdf->tz_hour = naive / 3600;
+      sdf->tz_valid = 1;
+    }
+    tv->tv_sec = naive - sdf->tz_gmtoff;
+  }
+
+  tv->tv_usec = msec * 1000L;
+  return 0;
+}
+
+
+/*
+ * One-call form of sdf_compile()/sdf_parse(); the compiled program is
+ * kept in a thread-local cache keyed on FORMAT, like the render cache
+ * of simple_date_format_cached(), so a log reader parsing millions of
+ * lines with one format compiles it once.
+ */
+struct sdf_pcache {
+  char format[SDF_FORMAT_MAX];
+  SDF *prog;
+};
+
+static __thread struct sdf_pcache sdf_pcache;
+
+int
+simple_date_parse(const char *format, const char *str, struct timeval *tv)
+{
+  struct sdf_pcache *c = &sdf_pcache;
+
+  if (!c->prog || strcmp(c->format, format) != 0) {
+    if (strlen(format) >= SDF_FORMAT_MAX) {
+      SDF *p = sdf_compile(format);
+      int ret = p ? sdf_parse(p, str, tv) : -1;
+      sdf_free(p);
+      return ret;
+    }
+    sdf_free(c->prog);
+    c->prog = sdf_compile(format);
+    if (!c->prog) {
+      c->format[0] = '\0';
+      return -1;
+    }
+    strcpy(c->format, format);
+  }
+  return sdf_parse(c->prog, str, tv);
+}
+
 #include <stdio.h>
 
 int
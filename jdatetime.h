@@ -41,6 +41,45 @@ BEGIN_C_DECLS
 
 char *simple_date_format(const char *format, const struct timeval *tv);
 
+/*
+ * Cached variant for hot paths that format the current time over and
+ * over (an access-log writer, say).  The rendered string is kept in
+ * a thread-local cache keyed on (FORMAT, tv_sec); while the second
+ * is unchanged only the millisecond fields are patched in.  The
+ * returned pointer must NOT be freed and is valid until the next
+ * call from the same thread.
+ */
+char *simple_date_format_cached(const char *format, const struct timeval *tv);
+
+/*
+ * Compiled timestamp parser, the inverse of simple_date_format().
+ *
+ * sdf_compile() turns FORMAT into a small program of field ops;
+ * sdf_parse() replays it over STR with unrolled fixed-width digit
+ * reads and fills TV.  Fields the date does not determine (weekday
+ * name, week numbers, ...) are matched and discarded.  Timestamps
+ * carrying a numeric zone (+0900, -05:00) are converted with that
+ * offset; otherwise the local zone applies, resolved with one
+ * mktime(3) per wall-clock hour and cached inside the program --
+ * which also makes an SDF single-threaded.
+ *
+ * sdf_compile() returns NULL on a malformed FORMAT; sdf_parse()
+ * returns 0 on success, -1 if STR does not match.
+ */
+struct sdf_;
+typedef struct sdf_ SDF;
+
+SDF *sdf_compile(const char *format);
+int sdf_parse(SDF *sdf, const char *str, struct timeval *tv);
+void sdf_free(SDF *sdf);
+
+/*
+ * One-call form: compile FORMAT (cached per thread, like
+ * simple_date_format_cached()) and parse STR with it.
+ */
+int simple_date_parse(const char *format, const char *str,
+                      struct timeval *tv);
+
 END_C_DECLS
 
 #endif  /* JDATETIME_H__ */
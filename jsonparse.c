@@ -0,0 +1,738 @@
+/* jsonparse - incremental SAX-style JSON parser
+ * Copyright (C) 2009  Seong-Kook Shin <cinsky@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jsonparse.h"
+
+/* tokenizer states */
+#define ST_TOKEN        0       /* between tokens */
+#define ST_STRING       1       /* inside "..." */
+#define ST_ESCAPE       2       /* just seen '\\' inside a string */
+#define ST_LITERAL      3       /* inside a number/true/false/null */
+
+/* what the current nesting level expects next */
+#define EXP_VALUE       0
+#define EXP_KEY         1
+#define EXP_COLON       2
+#define EXP_COMMA       3
+
+#define JP_STACK_SIZE   32      /* initial nesting capacity */
+#define JP_CHUNK_SIZE   65536   /* read(2) unit for jp_perform() */
+
+struct jsoncontext_ {
+  void *data;
+
+  jp_start_handler cb_start;
+  jp_end_handler cb_end;
+  jp_key_handler cb_key;
+  jp_value_handler cb_value;
+
+  unsigned char *stack;         /* JP_OBJECT/JP_ARRAY per level */
+  unsigned char *expect;        /* EXP_* per level; [0] is the top */
+  unsigned lev;
+  unsigned size_stack;
+
+  int state;                    /* ST_* */
+  int is_key;                   /* current string token is an object key */
+
+  char *carry;                  /* partial token split across chunks */
+  size_t carry_len;
+  size_t carry_size;
+
+  char *grab;                   /* raw subtree text for jp_grab() */
+  size_t grab_len;
+  size_t grab_size;
+  int grab_lev;                 /* deliver when this level closes; -1 off */
+  int grab_armed;               /* jp_grab() called in the start handler */
+
+  long long nread;              /* byte(s) consumed so far */
+  const char *errmsg;
+  int canceled;
+  int failed;
+};
+
+
+JSONCONTEXT *
+jp_open(void)
+{
+  JSONCONTEXT *p;
+
+  p = malloc(sizeof(*p));
+  if (!p)
+    return NULL;
+  memset(p, 0, sizeof(*p));
+
+  p->size_stack = JP_STACK_SIZE;
+  p->stack = malloc(p->size_stack);
+  p->expect = malloc(p->size_stack);
+  if (!p->stack || !p->expect) {
+    free(p->stack);
+    free(p->expect);
+    free(p);
+    return NULL;
+  }
+  p->expect[0] = EXP_VALUE;
+  p->grab_lev = -1;
+
+  return p;
+}
+
+
+void
+jp_close(JSONCONTEXT *context)
+{
+  if (!context)
+    return;
+  free(context->stack);
+  free(context->expect);
+  free(context->carry);
+  free(context->grab);
+  free(context);
+}
+
+
+void
+jp_set_start_handler(JSONCONTEXT *context, jp_start_handler callback)
+{
+  context->cb_start = callback;
+}
+
+void
+jp_set_end_handler(JSONCONTEXT *context, jp_end_handler callback)
+{
+  context->cb_end = callback;
+}
+
+void
+jp_set_key_handler(JSONCONTEXT *context, jp_key_handler callback)
+{
+  context->cb_key = callback;
+}
+
+void
+jp_set_value_handler(JSONCONTEXT *context, jp_value_handler callback)
+{
+  context->cb_value = callback;
+}
+
+void
+jp_set_user_data(JSONCONTEXT *context, void *data)
+{
+  context->data = data;
+}
+
+void *
+jp_get_user_data(JSONCONTEXT *context)
+{
+  return context->data;
+}
+
+unsigned
+jp_level(JSONCONTEXT *context)
+{
+  return context->lev;
+}
+
+void
+jp_grab(JSONCONTEXT *context)
+{
+  context->grab_armed = 1;
+}
+
+void
+jp_cancel(JSONCONTEXT *context)
+{
+  context->canceled = 1;
+}
+
+const char *
+jp_error(JSONCONTEXT *context)
+{
+  return context->errmsg;
+}
+
+long long
+jp_offset(JSONCONTEXT *context)
+{
+  return context->nread;
+}
+
+
+static int
+jp_fail(JSONCONTEXT *ctx, const char *msg)
+{
+  ctx->errmsg = msg;
+  ctx->failed = 1;
+  return -1;
+}
+
+
+static int
+grow(char **buf, size_t *size, size_t need)
+{
+  size_t nsize = *size ? *size : 256;
+  char *p;
+
+  while (nsize < need)
+    nsize *= 2;
+  if (nsize == *size)
+    return 0;
+
+  p = realloc(*buf, nsize);
+  if (!p)
+    return -1;
+  *buf = p;
+  *size = nsize;
+  return 0;
+}
+
+
+static int
+carry_add(JSONCONTEXT *ctx, const char *s, size_t len)
+{
+  if (grow(&ctx->carry, &ctx->carry_size, ctx->carry_len + len) < 0)
+    return -1;
+  memcpy(ctx->carry + ctx->carry_len, s, len);
+  ctx->carry_len += len;
+  return 0;
+}
+
+
+static int
+grab_add(JSONCONTEXT *ctx, char c)
+{
+  if (grow(&ctx->grab, &ctx->grab_size, ctx->grab_len + 2) < 0)
+    return -1;
+  ctx->grab[ctx->grab_len++] = c;
+  return 0;
+}
+
+
+static int
+push(JSONCONTEXT *ctx, int type)
+{
+  if (ctx->lev + 1 >= ctx->size_stack) {
+    unsigned nsize = ctx->size_stack * 2;
+    unsigned char *s = realloc(ctx->stack, nsize);
+    unsigned char *e = realloc(ctx->expect, nsize);
+
+    if (s)
+      ctx->stack = s;
+    if (e)
+      ctx->expect = e;
+    if (!s || !e)
+      return -1;
+    ctx->size_stack = nsize;
+  }
+  ctx->lev++;
+  ctx->stack[ctx->lev] = type;
+  ctx->expect[ctx->lev] = (type == JP_OBJECT) ? EXP_KEY : EXP_VALUE;
+  return 0;
+}
+
+
+/* a value may begin here? */
+static int
+value_ok(JSONCONTEXT *ctx)
+{
+  if (ctx->lev == 0)
+    return 1;                   /* top level: a value sequence (JSONL) */
+  return ctx->expect[ctx->lev] == EXP_VALUE;
+}
+
+
+/* a scalar (or container) value just completed at the current level */
+static void
+value_done(JSONCONTEXT *ctx)
+{
+  if (ctx->lev > 0)
+    ctx->expect[ctx->lev] = EXP_COMMA;
+}
+
+
+/* classify and deliver a completed literal token */
+static int
+literal_done(JSONCONTEXT *ctx, const char *span, size_t len)
+{
+  int type;
+
+  if (len == 4 && memcmp(span, "true", 4) == 0)
+    type = JP_BOOL;
+  else if (len == 5 && memcmp(span, "false", 5) == 0)
+    type = JP_BOOL;
+  else if (len == 4 && memcmp(span, "null", 4) == 0)
+    type = JP_NULL;
+  else if (len > 0 && strspn(span, "-+.0123456789eE") >= len
+           && (span[0] == '-' || (span[0] >= '0' && span[0] <= '9')))
+    type = JP_NUMBER;
+  else
+    return jp_fail(ctx, "malformed literal");
+
+  if (!value_ok(ctx))
+    return jp_fail(ctx, "unexpected value");
+
+  if (ctx->cb_value)
+    ctx->cb_value(ctx, type, span, (int)len);
+  value_done(ctx);
+  return 0;
+}
+
+
+/* a completed string token: an object key or a string value */
+static int
+string_done(JSONCONTEXT *ctx, const char *span, size_t len)
+{
+  if (ctx->is_key) {
+    if (ctx->cb_key)
+      ctx->cb_key(ctx, span, (int)len);
+    ctx->expect[ctx->lev] = EXP_COLON;
+  }
+  else {
+    if (!value_ok(ctx))
+      return jp_fail(ctx, "unexpected string");
+    if (ctx->cb_value)
+      ctx->cb_value(ctx, JP_STRING, span, (int)len);
+    value_done(ctx);
+  }
+  return 0;
+}
+
+
+int
+jp_parse(JSONCONTEXT *context, const char *buf, size_t len)
+{
+  JSONCONTEXT *ctx = context;
+  const char *p = buf;
+  const char *end = buf + len;
+  const char *tok = buf;        /* token start; continues from the carry */
+  char c;
+
+  if (ctx->failed)
+    return -1;
+  if (ctx->canceled)
+    return -2;
+
+  while (p < end) {
+    c = *p;
+
+    switch (ctx->state) {
+    case ST_TOKEN:
+      switch (c) {
+      case ' ': case '\t': case '\n': case '\r':
+        break;
+
+      case '{':
+      case '[': {
+        int type = (c == '{') ? JP_OBJECT : JP_ARRAY;
+
+        if (ctx->lev > 0 && ctx->expect[ctx->lev] == EXP_KEY)
+          return jp_fail(ctx, "expected object key");
+        if (!value_ok(ctx))
+          return jp_fail(ctx, "unexpected container");
+        if (push(ctx, type) < 0)
+          return jp_fail(ctx, "out of memory");
+        if (ctx->cb_start)
+          ctx->cb_start(ctx, type);
+        if (ctx->grab_armed) {
+          if (ctx->grab_lev < 0) { /* outermost grab wins */
+            ctx->grab_lev = ctx->lev;
+            ctx->grab_len = 0;
+          }
+          ctx->grab_armed = 0;
+        }
+        break;
+      }
+
+      case '}':
+      case ']': {
+        int type = (c == '}') ? JP_OBJECT : JP_ARRAY;
+        int exp;
+
+        if (ctx->lev == 0 || ctx->stack[ctx->lev] != type)
+          return jp_fail(ctx, "unbalanced container close");
+        exp = ctx->expect[ctx->lev];
+        if (exp == EXP_COLON || (type == JP_OBJECT && exp == EXP_VALUE))
+          return jp_fail(ctx, "truncated object member");
+
+        if (ctx->grab_lev >= 0 && grab_add(ctx, c) < 0)
+          return jp_fail(ctx, "out of memory");
+
+        ctx->lev--;
+        if (ctx->grab_lev == (int)ctx->lev + 1) {
+          ctx->grab[ctx->grab_len] = '\0';
+          if (ctx->cb_end)
+            ctx->cb_end(ctx, type, ctx->grab, (int)ctx->grab_len);
+          ctx->grab_lev = -1;
+        }
+        else if (ctx->cb_end)
+          ctx->cb_end(ctx, type, NULL, 0);
+        value_done(ctx);
+        break;
+      }
+
+      case ',':
+        if (ctx->lev == 0 || ctx->expect[ctx->lev] != EXP_COMMA)
+          return jp_fail(ctx, "unexpected ','");
+        ctx->expect[ctx->lev] =
+          (ctx->stack[ctx->lev] == JP_OBJECT) ? EXP_KEY : EXP_VALUE;
+        break;
+
+      case ':':
+        if (ctx->lev == 0 || ctx->expect[ctx->lev] != EXP_COLON)
+          return jp_fail(ctx, "unexpected ':'");
+        ctx->expect[ctx->lev] = EXP_VALUE;
+        break;
+
+      case '"':
+        ctx->is_key = (ctx->lev > 0
+                       && ctx->stack[ctx->lev] == JP_OBJECT
+                       && ctx->expect[ctx->lev] == EXP_KEY);
+        if (!ctx->is_key && !value_ok(ctx))
+          return jp_fail(ctx, "unexpected string");
+        ctx->state = ST_STRING;
+        ctx->carry_len = 0;
+        tok = p + 1;
+        break;
+
+      default:
+        if (ctx->lev > 0 && ctx->expect[ctx->lev] == EXP_KEY)
+          return jp_fail(ctx, "expected object key");
+        ctx->state = ST_LITERAL;
+        ctx->carry_len = 0;
+        tok = p;
+        break;
+      }
+      break;
+
+    case ST_STRING:
+      if (c == '\\')
+        ctx->state = ST_ESCAPE;
+      else if (c == '"') {
+        const char *span = tok;
+        size_t slen = p - tok;
+
+        if (ctx->carry_len) {   /* token was split across chunks */
+          if (carry_add(ctx, tok, slen) < 0)
+            return jp_fail(ctx, "out of memory");
+          span = ctx->carry;
+          slen = ctx->carry_len;
+          ctx->carry_len = 0;
+        }
+        ctx->state = ST_TOKEN;
+        if (string_done(ctx, span, slen) < 0)
+          return -1;
+      }
+      break;
+
+    case ST_ESCAPE:
+      ctx->state = ST_STRING;
+      break;
+
+    case ST_LITERAL:
+      if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')
+          || (c >= 'A' && c <= 'Z') || c == '+' || c == '-' || c == '.') {
+        break;                  /* still inside the literal */
+      }
+      else {
+        const char *span = tok;
+        size_t slen = p - tok;
+
+        if (ctx->carry_len) {
+          if (carry_add(ctx, tok, slen) < 0
+              || carry_add(ctx, "", 1) < 0)
+            return jp_fail(ctx, "out of memory");
+          span = ctx->carry;
+          slen = ctx->carry_len - 1;
+          ctx->carry_len = 0;
+        }
+        ctx->state = ST_TOKEN;
+        if (literal_done(ctx, span, slen) < 0)
+          return -1;
+        if (ctx->canceled)
+          return -2;
+        tok = p;
+        continue;               /* reprocess C as the next token */
+      }
+    }
+
+    if (ctx->grab_lev >= 0
+        && !(ctx->state == ST_TOKEN && (c == '}' || c == ']'))) {
+      if (grab_add(ctx, c) < 0)
+        return jp_fail(ctx, "out of memory");
+    }
+
+    if (ctx->canceled)
+      return -2;
+    p++;
+    ctx->nread++;
+  }
+
+  /* spill a token that continues into the next chunk */
+  if (ctx->state == ST_STRING || ctx->state == ST_ESCAPE
+      || ctx->state == ST_LITERAL) {
+    if (carry_add(ctx, tok, end - tok) < 0)
+      return jp_fail(ctx, "out of memory");
+  }
+
+  return 0;
+}
+
+
+int
+jp_final(JSONCONTEXT *context)
+{
+  JSONCONTEXT *ctx = context;
+
+  if (ctx->failed)
+    return -1;
+  if (ctx->canceled)
+    return -2;
+
+  if (ctx->state == ST_LITERAL) {
+    /* number at end-of-input; the chunk spill holds the token */
+    if (carry_add(ctx, "", 1) < 0)
+      return jp_fail(ctx, "out of memory");
+    ctx->state = ST_TOKEN;
+    if (literal_done(ctx, ctx->carry, ctx->carry_len - 1) < 0)
+      return -1;
+    ctx->carry_len = 0;
+    if (ctx->canceled)
+      return -2;
+  }
+  else if (ctx->state != ST_TOKEN)
+    return jp_fail(ctx, "unterminated string");
+
+  if (ctx->lev > 0)
+    return jp_fail(ctx, "unclosed container");
+  if (ctx->lev == 0 && ctx->expect[0] == EXP_COLON)
+    return jp_fail(ctx, "truncated input");
+
+  return 0;
+}
+
+
+int
+jp_perform(JSONCONTEXT *context, int fd)
+{
+  char buf[JP_CHUNK_SIZE];
+  ssize_t readch;
+  int ret;
+
+  while ((readch = read(fd, buf, sizeof(buf))) > 0) {
+    ret = jp_parse(context, buf, readch);
+    if (ret != 0)
+      return ret;
+  }
+  if (readch < 0)
+    return jp_fail(context, "read error");
+
+  return jp_final(context);
+}
+
+
+/* append one unicode code point as UTF-8 */
+static int
+utf8_put(char *dst, unsigned cp)
+{
+  if (cp < 0x80) {
+    dst[0] = cp;
+    return 1;
+  }
+  if (cp < 0x800) {
+    dst[0] = 0xC0 | (cp >> 6);
+    dst[1] = 0x80 | (cp & 0x3F);
+    return 2;
+  }
+  if (cp < 0x10000) {
+    dst[0] = 0xE0 | (cp >> 12);
+    dst[1] = 0x80 | ((cp >> 6) & 0x3F);
+    dst[2] = 0x80 | (cp & 0x3F);
+    return 3;
+  }
+  dst[0] = 0xF0 | (cp >> 18);
+  dst[1] = 0x80 | ((cp >> 12) & 0x3F);
+  dst[2] = 0x80 | ((cp >> 6) & 0x3F);
+  dst[3] = 0x80 | (cp & 0x3F);
+  return 4;
+}
+
+
+static int
+hex4(const char *s, unsigned *value)
+{
+  unsigned v = 0;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    char c = s[i];
+
+    v <<= 4;
+    if (c >= '0' && c <= '9')
+      v |= c - '0';
+    else if (c >= 'a' && c <= 'f')
+      v |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      v |= c - 'A' + 10;
+    else
+      return -1;
+  }
+  *value = v;
+  return 0;
+}
+
+
+char *
+jp_string_unescape(const char *span, int len)
+{
+  /* decoded text never outgrows the raw span */
+  char *out = malloc(len + 1);
+  char *d = out;
+  const char *p = span;
+  const char *end = span + len;
+
+  if (!out)
+    return NULL;
+
+  while (p < end) {
+    if (*p != '\\') {
+      *d++ = *p++;
+      continue;
+    }
+    if (++p >= end)
+      goto err;
+
+    switch (*p++) {
+    case '"':  *d++ = '"';  break;
+    case '\\': *d++ = '\\'; break;
+    case '/':  *d++ = '/';  break;
+    case 'b':  *d++ = '\b'; break;
+    case 'f':  *d++ = '\f'; break;
+    case 'n':  *d++ = '\n'; break;
+    case 'r':  *d++ = '\r'; break;
+    case 't':  *d++ = '\t'; break;
+
+    case 'u': {
+      unsigned cp, lo;
+
+      if (end - p < 4 || hex4(p, &cp) < 0)
+        goto err;
+      p += 4;
+
+      if (cp >= 0xD800 && cp <= 0xDBFF) { /* high surrogate */
+        if (end - p < 6 || p[0] != '\\' || p[1] != 'u'
+            || hex4(p + 2, &lo) < 0 || lo < 0xDC00 || lo > 0xDFFF)
+          goto err;
+        p += 6;
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+      }
+      else if (cp >= 0xDC00 && cp <= 0xDFFF)
+        goto err;               /* stray low surrogate */
+
+      d += utf8_put(d, cp);
+      break;
+    }
+
+    default:
+      goto err;
+    }
+  }
+  *d = '\0';
+  return out;
+
+ err:
+  free(out);
+  return NULL;
+}
+
+
+#ifdef TEST_JSONPARSE
+#include <stdio.h>
+#include <fcntl.h>
+
+static void
+indent(JSONCONTEXT *ctx)
+{
+  unsigned i;
+
+  for (i = 1; i < jp_level(ctx); i++)
+    fputs("  ", stdout);
+}
+
+static void
+on_start(JSONCONTEXT *ctx, int type)
+{
+  indent(ctx);
+  printf("%c\n", type == JP_OBJECT ? '{' : '[');
+}
+
+static void
+on_end(JSONCONTEXT *ctx, int type, const char *text, int len)
+{
+  indent(ctx);
+  printf("  %c", type == JP_OBJECT ? '}' : ']');
+  if (text)
+    printf("  (grabbed %d bytes: %.*s)", len, len, text);
+  putchar('\n');
+}
+
+static void
+on_key(JSONCONTEXT *ctx, const char *key, int len)
+{
+  indent(ctx);
+  printf("  key   |%.*s|\n", len, key);
+}
+
+static void
+on_value(JSONCONTEXT *ctx, int type, const char *span, int len)
+{
+  indent(ctx);
+  printf("  value (%d) |%.*s|\n", type, len, span);
+}
+
+int
+main(int argc, char *argv[])
+{
+  JSONCONTEXT *ctx;
+  int fd = 0;
+  int ret;
+
+  if (argc > 1) {
+    fd = open(argv[1], O_RDONLY);
+    if (fd == -1) {
+      fprintf(stderr, "error: cannot open %s\n", argv[1]);
+      return 1;
+    }
+  }
+
+  ctx = jp_open();
+  jp_set_start_handler(ctx, on_start);
+  jp_set_end_handler(ctx, on_end);
+  jp_set_key_handler(ctx, on_key);
+  jp_set_value_handler(ctx, on_value);
+
+  ret = jp_perform(ctx, fd);
+  if (ret != 0)
+    fprintf(stderr, "error: %s (at byte %lld)\n",
+            jp_error(ctx) ? jp_error(ctx) : "canceled", jp_offset(ctx));
+
+  jp_close(ctx);
+  return ret != 0;
+}
+#endif  /* TEST_JSONPARSE */
@@ -0,0 +1,160 @@
+/* jsonparse - incremental SAX-style JSON parser
+ * Copyright (C) 2009  Seong-Kook Shin <cinsky@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef JSONPARSE_H__
+#define JSONPARSE_H__
+
+#include <stddef.h>
+
+/* This indirect using of extern "C" { ... } makes Emacs happy */
+#ifndef BEGIN_C_DECLS
+# ifdef __cplusplus
+#  define BEGIN_C_DECLS extern "C" {
+#  define END_C_DECLS   }
+# else
+#  define BEGIN_C_DECLS
+#  define END_C_DECLS
+# endif
+#endif /* BEGIN_C_DECLS */
+
+BEGIN_C_DECLS
+
+/*
+ * jsonparse is the JSON counterpart of xmlparse: a callback-based
+ * parser that never builds a tree.  You feed it byte ranges as they
+ * arrive -- from read(2), a BUFFER, a stream, anything -- and it
+ * calls your handlers as containers open and close and as keys and
+ * scalar values complete.  A sequence of top-level values (JSONL) is
+ * accepted, so multi-gigabyte record streams parse in constant
+ * memory.
+ *
+ * Strings and numbers are delivered as zero-copy (pointer, length)
+ * spans.  When a token lies entirely inside the chunk you fed, the
+ * span points into YOUR buffer; a token split across chunks is
+ * reassembled internally and the span points into parser-owned
+ * storage.  Either way the span is only valid for the duration of
+ * the callback.  String spans are the raw bytes between the quotes,
+ * escapes untouched; jp_string_unescape() decodes them on demand.
+ *
+ * When a subtree is worth a DOM after all, call jp_grab() from the
+ * start handler: the raw text of that container is captured and
+ * handed to the matching end handler, ready for a DOM parser of your
+ * choice (cf. jsonc-sample.c).
+ */
+
+struct jsoncontext_;
+typedef struct jsoncontext_ JSONCONTEXT;
+
+/* value/container types, as passed to the handlers */
+#define JP_OBJECT       1
+#define JP_ARRAY        2
+#define JP_STRING       3
+#define JP_NUMBER       4
+#define JP_BOOL         5
+#define JP_NULL         6
+
+/*
+ * TYPE is JP_OBJECT or JP_ARRAY for the start/end handlers.  The end
+ * handler's (TEXT, LEN) is the raw subtree captured by jp_grab(), or
+ * (NULL, 0) when nothing was grabbed.  The key handler gets the raw
+ * string span of an object key; the value handler gets the scalar
+ * type and its raw span (for JP_BOOL the span is "true"/"false", for
+ * JP_NULL it is "null").
+ */
+typedef void (*jp_start_handler)(JSONCONTEXT *, int type);
+typedef void (*jp_end_handler)(JSONCONTEXT *, int type,
+                               const char *text, int len);
+typedef void (*jp_key_handler)(JSONCONTEXT *, const char *key, int len);
+typedef void (*jp_value_handler)(JSONCONTEXT *, int type,
+                                 const char *span, int len);
+
+/*
+ * Create/destroy a parser context.
+ */
+JSONCONTEXT *jp_open(void);
+void jp_close(JSONCONTEXT *context);
+
+/*
+ * Feed LEN byte(s) at BUF to the parser.  May be called any number
+ * of times with arbitrarily split input.  Returns 0 on success, -1
+ * on a syntax error (jp_error() tells where and why), and -2 if a
+ * handler called jp_cancel().
+ */
+int jp_parse(JSONCONTEXT *context, const char *buf, size_t len);
+
+/*
+ * Signal end-of-input; completes a trailing number and verifies that
+ * every container was closed.  Same return convention as jp_parse().
+ */
+int jp_final(JSONCONTEXT *context);
+
+/*
+ * Convenience wrapper: feed everything read from FD, then jp_final().
+ * The return value convention is that of jp_parse().
+ */
+int jp_perform(JSONCONTEXT *context, int fd);
+
+void jp_set_start_handler(JSONCONTEXT *context, jp_start_handler callback);
+void jp_set_end_handler(JSONCONTEXT *context, jp_end_handler callback);
+void jp_set_key_handler(JSONCONTEXT *context, jp_key_handler callback);
+void jp_set_value_handler(JSONCONTEXT *context, jp_value_handler callback);
+
+void jp_set_user_data(JSONCONTEXT *context, void *data);
+void *jp_get_user_data(JSONCONTEXT *context);
+
+/*
+ * Current container nesting depth; 0 between top-level values.
+ */
+unsigned jp_level(JSONCONTEXT *context);
+
+/*
+ * Callable from the start handler only: capture the raw text of the
+ * container that just opened (including its braces/brackets) and
+ * pass it to the matching end handler as (TEXT, LEN), nul-terminated
+ * for convenience.  Handlers still fire for everything inside.
+ */
+void jp_grab(JSONCONTEXT *context);
+
+/*
+ * Cancel parsing from inside any handler; jp_parse()/jp_perform()
+ * then returns -2.
+ */
+void jp_cancel(JSONCONTEXT *context);
+
+/*
+ * Human-readable description of the last error, or NULL.
+ */
+const char *jp_error(JSONCONTEXT *context);
+
+/*
+ * Byte offset (from the first byte ever fed) the parser has
+ * consumed; with jp_error(), locates a syntax error in the input.
+ */
+long long jp_offset(JSONCONTEXT *context);
+
+/*
+ * Decode a raw string span (as delivered to the key/value handlers)
+ * into a malloc-ed, nul-terminated UTF-8 string, resolving \" \\ \/
+ * \b \f \n \r \t and \uXXXX (surrogate pairs included).  The caller
+ * must free() it.  Returns NULL on malformed escapes.
+ */
+char *jp_string_unescape(const char *span, int len);
+
+END_C_DECLS
+
+#endif  /* JSONPARSE_H__ */
@@ -9,10 +9,18 @@
 
 #include <unistd.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define DEFAULT_INDENT  2
 #define DEFAULT_NFIELD  4
 #define DEFAULT_NCHAR   8
+#define DEFAULT_NSTR    32
+
+/* output is assembled in chunks of this size; one fwrite(3) per
+ * chunk instead of one fprintf(3) per byte. */
+#define DUMP_BUFSIZ     (1 << 16)
 
 #define F_OCT   "0%03o, "
 #define F_DEC   "%3u, "
@@ -22,12 +30,29 @@
 #define OFF_F_DEC "/* %0*lu */ "
 #define OFF_F_HEX "/* 0x%0*lX */ "
 
-int gen_struct(FILE *out, FILE *in, const char *ident, size_t nfield);
-unsigned long dump(FILE *out, FILE *in, const char *ident, size_t nfield);
+/* loaded input file; DATA is either a private mapping or a malloc'ed
+ * slurp (stdin, or whatever mmap(2) refuses). */
+struct blob {
+  unsigned char *data;
+  size_t len;
+  int mapped;
+};
+
+int gen_struct(FILE *out, const struct blob *bp, const char *ident,
+               size_t nfield);
+int gen_string(FILE *out, const struct blob *bp, const char *ident);
+unsigned long dump(FILE *out, const unsigned char *data, size_t len,
+                   size_t nfield);
+int load_blob(const char *pathname, struct blob *bp);
+void unload_blob(struct blob *bp);
+unsigned long long blob_hash(unsigned long long hash,
+                             const unsigned char *data, size_t len);
+int stamp_matches(const char *pathname, unsigned long long hash);
 FILE *xfopen_write(const char *pathname);
 char *basename(const char *pathname);
-void indent(FILE *out);
-int fsize_digit_count(FILE *fp);
+char *indent(char *p);
+int size_digit_count(size_t size);
+void print_len_macro(FILE *out, const char *ident, unsigned long written);
 char *xstrncpy(char *d, const char *s, size_t size);
 void error(int status, int ecode, const char *format, ...);
 
@@ -38,6 +63,7 @@ void help_and_exit(void);
 void version_and_exit(void);
 
 FILE *target_stream;
+const char *target_pathname;
 
 char *ident_template;
 int force_overwrite;
@@ -45,10 +71,13 @@ int use_static;
 int use_const;
 int use_tab;
 int append_mode;
+int string_mode;
+int update_mode;
 int digit_nfield = DEFAULT_NFIELD;
 int show_offset = 1;
 int indent_spaces = 2;
 int char_per_line = 5;
+int nchar_given;
 int base_offset = 10;
 int base_data = 16;
 
@@ -68,21 +97,24 @@ struct option longopts[] = {
   { "use-tab", no_argument, 0, 't' },
   { "no-tab", no_argument, 0, 'T' },
   { "indent-nchar", required_argument, 0, 'i' },
+  { "string", no_argument, 0, 'e' },
+  { "update", no_argument, 0, 'u' },
   { 0, 0, 0, 0 },
 };
 
 static const char *program_name = "bin2c";
-static const char *version_string = "0.1";
+static const char *version_string = "0.2";
 
 int
 main(int argc, char *argv[])
 {
-  FILE *src;
-  int optch, i;
-  char ident[LINE_MAX] = { 0, };
+  struct blob *blobs;
+  char (*idents)[LINE_MAX];
+  unsigned long long hash;
+  int optch, i, nblob;
 
   while (1) {
-    optch = getopt_long(argc, argv, "o:b:B:n:aAtTcCsSi:I:mM", longopts, 0);
+    optch = getopt_long(argc, argv, "o:b:B:n:aAtTcCsSi:I:mMeu", longopts, 0);
     if (optch == -1)
       break;
 
@@ -110,6 +142,7 @@ main(int argc, char *argv[])
       break;
     case 'C':
       use_const = 0;
+      break;
 
     case 'a':
       append_mode = 1;
@@ -124,6 +157,13 @@ main(int argc, char *argv[])
       use_tab = 0;
       break;
 
+    case 'e':
+      string_mode = 1;
+      break;
+    case 'u':
+      update_mode = 1;
+      break;
+
     case 'i':
       ident_template = strdup(optarg);
       break;
@@ -139,6 +179,7 @@ main(int argc, char *argv[])
       char_per_line = atoi(optarg);
       if (char_per_line <= 0)
         char_per_line = DEFAULT_NCHAR;
+      nchar_given = 1;
       break;
     case 'b':
       base_data = atoi(optarg);
@@ -147,9 +188,7 @@ main(int argc, char *argv[])
       base_offset = atoi(optarg);
       break;
     case 'o':
-      target_stream = xfopen_write(optarg);
-      if (!target_stream)
-        error(1, errno, "cannot open %s", optarg);
+      target_pathname = optarg;
       break;
 
     case '?':
@@ -158,8 +197,9 @@ main(int argc, char *argv[])
       break;
     }
   }
-  if (!target_stream)
-    target_stream = stdout;
+
+  if (string_mode && !nchar_given)
+    char_per_line = DEFAULT_NSTR;
 
   if (argc == optind) {
     /* no argument */
@@ -167,30 +207,67 @@ main(int argc, char *argv[])
     return 1;
   }
 
+  /* Load everything up front; mappings cost nothing until the pages
+   * are touched, and it lets the stamp check below see the whole
+   * input before a single output byte is written. */
+  blobs = malloc((argc - optind) * sizeof(*blobs));
+  idents = malloc((argc - optind) * sizeof(*idents));
+  if (!blobs || !idents)
+    error(1, errno, "out of memory");
+
+  nblob = 0;
   for (i = optind; i < argc; i++) {
-    if (strcmp(argv[i], "-") == 0)
-      src = stdin;
-    else {
-      src = fopen(argv[i], "rb");
-      if (!src) {
-        error(0, errno, "cannot open %s", argv[i]);
-        continue;
-      }
+    if (load_blob(argv[i], &blobs[nblob]) < 0) {
+      error(0, errno, "cannot open %s", argv[i]);
+      continue;
     }
 
     if (ident_template) {
       if (optind == argc - 1)
-        snprintf(ident, LINE_MAX, "%s", ident_template);
+        snprintf(idents[nblob], LINE_MAX, "%s", ident_template);
       else
-        snprintf(ident, LINE_MAX, "%s%d", ident_template, i - optind);
+        snprintf(idents[nblob], LINE_MAX, "%s%d", ident_template, i - optind);
     }
+    else if (strcmp(argv[i], "-") == 0)
+      xstrncpy(idents[nblob], "stdin_dump", LINE_MAX);
     else
-      xstrncpy(ident, basename(argv[i]), LINE_MAX);
+      xstrncpy(idents[nblob], basename(argv[i]), LINE_MAX);
+
+    nblob++;
+  }
+
+  hash = blob_hash(0, 0, 0);
+  for (i = 0; i < nblob; i++)
+    hash = blob_hash(hash, blobs[i].data, blobs[i].len);
+
+  if (update_mode && target_pathname && !append_mode &&
+      stamp_matches(target_pathname, hash)) {
+    /* input unchanged since the output was generated; leave it be so
+     * the build system sees an old timestamp. */
+    for (i = 0; i < nblob; i++)
+      unload_blob(&blobs[i]);
+    return 0;
+  }
 
-    gen_struct(target_stream, src, ident, digit_nfield);
+  if (target_pathname) {
+    if (update_mode)
+      force_overwrite = 1;
+    target_stream = xfopen_write(target_pathname);
+    if (!target_stream)
+      error(1, errno, "cannot open %s", target_pathname);
+  }
+  else
+    target_stream = stdout;
 
-    if (src != stdin)
-      fclose(src);
+  if (target_pathname && !append_mode)
+    fprintf(target_stream, "/* bin2c: %016llx */\n", hash);
+
+  for (i = 0; i < nblob; i++) {
+    if (string_mode)
+      gen_string(target_stream, &blobs[i], idents[i]);
+    else
+      gen_struct(target_stream, &blobs[i], idents[i], digit_nfield);
+    unload_blob(&blobs[i]);
   }
 
   return 0;
@@ -198,10 +275,131 @@ main(int argc, char *argv[])
 
 
 int
-gen_struct(FILE *out, FILE *in, const char *ident, size_t nfield)
+load_blob(const char *pathname, struct blob *bp)
+{
+  int fd;
+  struct stat st;
+  void *p;
+
+  bp->data = 0;
+  bp->len = 0;
+  bp->mapped = 0;
+
+  if (strcmp(pathname, "-") == 0)
+    fd = STDIN_FILENO;
+  else {
+    fd = open(pathname, O_RDONLY);
+    if (fd < 0)
+      return -1;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        close(fd);
+        bp->data = (unsigned char *)p;
+        bp->len = st.st_size;
+        bp->mapped = 1;
+        return 0;
+      }
+    }
+  }
+
+  /* stdin, or something mmap(2) refuses: slurp it. */
+  {
+    size_t cap = 0;
+    ssize_t readch;
+
+    while (1) {
+      if (bp->len == cap) {
+        unsigned char *q;
+        cap = cap ? cap * 2 : BUFSIZ;
+        q = realloc(bp->data, cap);
+        if (!q) {
+          unload_blob(bp);
+          if (fd != STDIN_FILENO)
+            close(fd);
+          return -1;
+        }
+        bp->data = q;
+      }
+      readch = read(fd, bp->data + bp->len, cap - bp->len);
+      if (readch < 0) {
+        if (errno == EINTR)
+          continue;
+        unload_blob(bp);
+        if (fd != STDIN_FILENO)
+          close(fd);
+        return -1;
+      }
+      if (readch == 0)
+        break;
+      bp->len += readch;
+    }
+  }
+  if (fd != STDIN_FILENO)
+    close(fd);
+  return 0;
+}
+
+
+void
+unload_blob(struct blob *bp)
+{
+  if (bp->mapped)
+    munmap(bp->data, bp->len);
+  else
+    free(bp->data);
+  bp->data = 0;
+  bp->len = 0;
+  bp->mapped = 0;
+}
+
+
+/*
+ * FNV-1a, 64 bit.  Pass the return value of a previous call in HASH
+ * to chain several buffers; pass DATA as NULL to get the seed.
+ */
+unsigned long long
+blob_hash(unsigned long long hash, const unsigned char *data, size_t len)
+{
+  if (!data)
+    return 0xcbf29ce484222325ULL;
+
+  while (len-- > 0) {
+    hash ^= *data++;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+
+/*
+ * Nonzero iff PATHNAME already starts with the stamp comment for
+ * HASH, i.e. it was generated from identical input.
+ */
+int
+stamp_matches(const char *pathname, unsigned long long hash)
+{
+  FILE *fp;
+  unsigned long long old;
+  int matched = 0;
+
+  fp = fopen(pathname, "r");
+  if (!fp)
+    return 0;
+
+  if (fscanf(fp, "/* bin2c: %llx */", &old) == 1 && old == hash)
+    matched = 1;
+
+  fclose(fp);
+  return matched;
+}
+
+
+int
+gen_struct(FILE *out, const struct blob *bp, const char *ident,
+           size_t nfield)
 {
-  int i;
-  int firstch = 1;
   unsigned long written;
 
   if (use_static)
@@ -212,71 +410,183 @@ gen_struct(FILE *out, FILE *in, const char *ident, size_t nfield)
 
   fprintf(out, "char ");
 
-  if (in == stdin && ident == 0)
-    ident = "stdin_dump";
-
   if (isdigit(ident[0]))
     fprintf(out, "_%s[] = {\n", ident);
   else
     fprintf(out, "%s[] = {\n", ident);
 
-  written = dump(out, in, ident, digit_nfield);
+  if (nfield == 0)
+    nfield = size_digit_count(bp->len);
+
+  written = dump(out, bp->data, bp->len, nfield);
 
   fprintf(out, "};\n");
-  fprintf(out, "#define ");
+  print_len_macro(out, ident, written);
+  return 0;
+}
 
-  for (i = 0; ident[i] != '\0'; i++) {
-    if (firstch && isdigit(ident[i]))
-      fputc('_', out);
-    firstch = 0;
 
-    if (isalnum(ident[i]))
-      fputc(toupper(ident[i]), out);
-    else
-      fputc('_', out);
+unsigned long
+dump(FILE *out, const unsigned char *data, size_t len, size_t nfield)
+{
+  /* one formatted string per byte value, precomputed; every entry of
+   * a given base has the same width, so a line is a run of memcpys. */
+  static char tbl[256][8];
+  static int tbl_base = -1;
+  static int tbl_w;
+
+  char *buf, *p;
+  size_t bufsiz, linesiz, pos, i, n;
+  const char *off_format = format_offset(base_offset);
+
+  if (tbl_base != base_data) {
+    const char *format = format_data(base_data);
+
+    for (i = 0; i < 256; i++)
+      tbl_w = snprintf(tbl[i], sizeof(tbl[i]), format, (unsigned)i);
+    tbl_base = base_data;
   }
 
-  fprintf(out, "_LEN\t%lu\n\n", written);
-  return 0;
+  linesiz = indent_spaces + nfield + 16 + char_per_line * tbl_w + 2;
+  bufsiz = DUMP_BUFSIZ > 2 * linesiz ? DUMP_BUFSIZ : 2 * linesiz;
+  buf = malloc(bufsiz);
+  if (!buf)
+    error(1, errno, "out of memory");
+
+  p = buf;
+  for (pos = 0; pos < len; pos += n) {
+    if ((size_t)(p - buf) > bufsiz - linesiz) {
+      fwrite(buf, 1, p - buf, out);
+      p = buf;
+    }
+
+    p = indent(p);
+    if (show_offset)
+      p += sprintf(p, off_format, (int)nfield, (unsigned long)pos);
+
+    n = len - pos < (size_t)char_per_line ? len - pos : (size_t)char_per_line;
+    for (i = 0; i < n; i++) {
+      memcpy(p, tbl[data[pos + i]], tbl_w);
+      p += tbl_w;
+    }
+    *p++ = '\n';
+  }
+  if (p != buf)
+    fwrite(buf, 1, p - buf, out);
+
+  free(buf);
+  return (unsigned long)len;
 }
 
 
-unsigned long
-dump(FILE *out, FILE *in, const char *ident, size_t nfield)
+/*
+ * Emit one string literal instead of an initializer list; compilers
+ * swallow these dramatically faster than a 200 MB brace list.  The
+ * escape table uses three-digit octal throughout, so an escape
+ * followed by a digit never changes meaning.  Note the array picks
+ * up a trailing NUL beyond the _LEN count, as string literals do.
+ */
+int
+gen_string(FILE *out, const struct blob *bp, const char *ident)
 {
-  unsigned long written = 0;
-  int ch;
-  unsigned char c;
-  const char *format, *off_format;
+  static char esc[256][5];
+  static int esclen[256];
+  static int esc_ready;
+
+  char *buf, *p;
+  size_t bufsiz, linesiz, pos, i, n, nfield;
+  const char *off_format = format_offset(base_offset);
+
+  if (!esc_ready) {
+    for (i = 0; i < 256; i++) {
+      if (i >= 0x20 && i < 0x7f && i != '"' && i != '\\') {
+        esc[i][0] = (char)i;
+        esclen[i] = 1;
+      }
+      else
+        esclen[i] = sprintf(esc[i], "\\%03o", (unsigned)i);
+    }
+    esc_ready = 1;
+  }
 
-  format = format_data(base_data);
-  off_format = format_offset(base_offset);
+  if (use_static)
+    fprintf(out, "static ");
 
-  if (nfield == 0) {
-    if (in != stdin)
-      nfield = fsize_digit_count(in);
-    else
-      nfield = DEFAULT_NFIELD;
-  }
+  if (use_const)
+    fprintf(out, "const ");
+
+  if (isdigit(ident[0]))
+    fprintf(out, "char _%s[] =\n", ident);
+  else
+    fprintf(out, "char %s[] =\n", ident);
+
+  nfield = size_digit_count(bp->len);
+
+  linesiz = indent_spaces + nfield + 16 + char_per_line * 4 + 4;
+  bufsiz = DUMP_BUFSIZ > 2 * linesiz ? DUMP_BUFSIZ : 2 * linesiz;
+  buf = malloc(bufsiz);
+  if (!buf)
+    error(1, errno, "out of memory");
 
-  while ((ch = fgetc(in)) != EOF) {
-    if (written % char_per_line == 0) {
-      indent(out);
-      if (show_offset)
-        fprintf(out, off_format, nfield, written);
+  p = buf;
+  for (pos = 0; pos < bp->len; pos += n) {
+    if ((size_t)(p - buf) > bufsiz - linesiz) {
+      fwrite(buf, 1, p - buf, out);
+      p = buf;
     }
 
-    c = (unsigned char)ch;
-    fprintf(out, format, c);
-    if (written % char_per_line == char_per_line - 1) {
-      fprintf(out, "\n");
+    p = indent(p);
+    if (show_offset)
+      p += sprintf(p, off_format, (int)nfield, (unsigned long)pos);
+
+    *p++ = '"';
+    n = bp->len - pos < (size_t)char_per_line
+      ? bp->len - pos : (size_t)char_per_line;
+    for (i = 0; i < n; i++) {
+      unsigned char c = bp->data[pos + i];
+      memcpy(p, esc[c], esclen[c]);
+      p += esclen[c];
     }
-    written++;
+    *p++ = '"';
+    *p++ = '\n';
   }
-  if (written % char_per_line != 0) {
-    fprintf(out, "\n");
+  if (bp->len == 0) {
+    p = indent(p);
+    *p++ = '"';
+    *p++ = '"';
+    *p++ = '\n';
   }
-  return written;
+  p--;                          /* terminate the last literal */
+  *p++ = ';';
+  *p++ = '\n';
+  fwrite(buf, 1, p - buf, out);
+
+  free(buf);
+  print_len_macro(out, ident, (unsigned long)bp->len);
+  return 0;
+}
+
+
+void
+print_len_macro(FILE *out, const char *ident, unsigned long written)
+{
+  int i;
+  int firstch = 1;
+
+  fprintf(out, "#define ");
+
+  for (i = 0; ident[i] != '\0'; i++) {
+    if (firstch && isdigit(ident[i]))
+      fputc('_', out);
+    firstch = 0;
+
+    if (isalnum(ident[i]))
+      fputc(toupper(ident[i]), out);
+    else
+      fputc('_', out);
+  }
+
+  fprintf(out, "_LEN\t%lu\n\n", written);
 }
 
 
@@ -286,7 +596,7 @@ xfopen_write(const char *pathname)
   FILE *fp;
   assert(pathname != 0);
 
-  if (access(pathname, F_OK) == 0 && !force_overwrite)
+  if (access(pathname, F_OK) == 0 && !force_overwrite && !append_mode)
     return 0;
 
   fp = fopen(pathname, append_mode ? "a" : "w");
@@ -310,33 +620,27 @@ basename(const char *pathname)
 }
 
 
-void
-indent(FILE *out)
+char *
+indent(char *p)
 {
   int i;
 
   if (use_tab)
-    fputc('\t', out);
+    *p++ = '\t';
   else {
     for (i = 0; i < indent_spaces; i++)
-      fputc(' ', out);
+      *p++ = ' ';
   }
+  return p;
 }
 
 
 int
-fsize_digit_count(FILE *fp)
+size_digit_count(size_t size)
 {
   int count;
-  long pos;
-
-  pos = ftell(fp);
 
-  rewind(fp);
-  fseek(fp, 0, SEEK_END);
-  count = snprintf(0, 0, "%lu", (unsigned long)ftell(fp));
-
-  fseek(fp, pos, SEEK_SET);
+  count = snprintf(0, 0, "%lu", (unsigned long)size);
   if (count < 4)
     count = 4;
   return count;
@@ -384,6 +688,11 @@ help_and_exit(void)
     "  -n, --char-per-line=CHARS     override the number of chars in a line",
     "  -o, --output=FILE             override the output to FILE",
     "",
+    "  -e, --string                  emit a string literal instead of an",
+    "                                initializer list (compiles much faster)",
+    "  -u, --update                  regenerate FILE only when the input",
+    "                                no longer matches its stamp comment",
+    "",
     "  -b, --base=NUM                use base NUM digits to print data",
     "  -B, --offset-base=NUM         use base NUM digits to print the offset",
     "",
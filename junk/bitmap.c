@@ -43,6 +43,9 @@ bitmap_new(size_t nbits, unsigned flags)
      bm->size = size;
      bm->flags = flags & (~BMO_STATIC);
      bm->block = bm->block_;
+     bm->ngroups = 0;
+     bm->gcount = 0;
+     bm->sum_any = bm->sum_full = 0;
      return bm;
 }
 
@@ -69,15 +72,32 @@ bitmap_new_with_buffer(size_t nbits, unsigned flags, void *src, size_t *len)
      bm->size = size;
      bm->flags = flags | BMO_STATIC;
      bm->block = bm->block_;
+     bm->ngroups = 0;
+     bm->gcount = 0;            /* the index always lives on the heap */
+     bm->sum_any = bm->sum_full = 0;
      return bm;
 }
 
 
+/* free the group index (if any); harmless when none was built */
+static void
+index_drop(bitmap_t *bm)
+{
+     free(bm->gcount);
+     free(bm->sum_any);
+     free(bm->sum_full);
+     bm->gcount = 0;
+     bm->sum_any = bm->sum_full = 0;
+     bm->ngroups = 0;
+}
+
+
 void
 bitmap_delete(bitmap_t *bitmap)
 {
-     if
-     free(bitmap);
+     index_drop(bitmap);
+     if ((bitmap->flags & BMO_STATIC) == 0)
+          free(bitmap);
 }
 
 
@@ -115,6 +135,9 @@ bitmap_set_size(bitmap_t *bitmap, size_t nbits)
      bitmap->block = bitmap->block_;
      bitmap->size = size;
 
+     if (bitmap->gcount)
+          index_drop(bitmap);   /* stale; rebuilt on the next query */
+
      if (bitmap->num_bits < nbits) {
           oldbits = bitmap->num_bits;
           bitmap->num_bits = nbits;
@@ -128,6 +151,166 @@ bitmap_set_size(bitmap_t *bitmap, size_t nbits)
 }
 
 
+int
+bitmap_reindex(bitmap_t *bitmap)
+{
+     size_t ngroups, sumwords, g, w;
+
+     ngroups = (bitmap->num_bits + BITMAP_GROUP_BIT - 1) / BITMAP_GROUP_BIT;
+     if (ngroups == 0)
+          ngroups = 1;
+     sumwords = (ngroups + INT_BIT - 1) / INT_BIT;
+
+     if (bitmap->gcount && bitmap->ngroups != ngroups)
+          index_drop(bitmap);
+
+     if (!bitmap->gcount) {
+          bitmap->gcount = malloc(ngroups * sizeof(*bitmap->gcount));
+          bitmap->sum_any = malloc(sumwords * sizeof(*bitmap->sum_any));
+          bitmap->sum_full = malloc(sumwords * sizeof(*bitmap->sum_full));
+          if (!bitmap->gcount || !bitmap->sum_any || !bitmap->sum_full) {
+               index_drop(bitmap);
+               return -1;
+          }
+          bitmap->ngroups = ngroups;
+     }
+
+     for (w = 0; w < sumwords; w++)
+          bitmap->sum_any[w] = bitmap->sum_full[w] = 0;
+
+     for (g = 0; g < ngroups; g++) {
+          size_t nbits = bitmap_group_bits__(bitmap, g);
+          size_t nwords = (nbits + INT_BIT - 1) / INT_BIT;
+          unsigned count = 0;
+
+          for (w = 0; w < nwords; w++) {
+               unsigned int v = bitmap->block[g * BITMAP_GROUP_WORDS + w];
+
+               if (nbits - w * INT_BIT < INT_BIT)
+                    v &= (1U << (nbits - w * INT_BIT)) - 1;
+               count += __builtin_popcount(v);
+          }
+          bitmap->gcount[g] = count;
+          if (count > 0)
+               bitmap->sum_any[g / INT_BIT] |= 1U << (g % INT_BIT);
+          if (count == nbits)
+               bitmap->sum_full[g / INT_BIT] |= 1U << (g % INT_BIT);
+     }
+     return 0;
+}
+
+
+/*
+ * Scan group G for the first bit with value VALUE at position FROM
+ * or later; -1 when the group has none.
+ */
+static int
+group_scan(bitmap_t *bm, size_t g, size_t from, int value)
+{
+     size_t nbits = bitmap_group_bits__(bm, g);
+     size_t nwords = (nbits + INT_BIT - 1) / INT_BIT;
+     size_t base = g * BITMAP_GROUP_BIT;
+     size_t wi = (from - base) / INT_BIT;
+
+     for (; wi < nwords; wi++) {
+          unsigned int v = bm->block[g * BITMAP_GROUP_WORDS + wi];
+
+          if (!value)
+               v = ~v;
+          if (base + wi * INT_BIT < from)
+               v &= ~0U << (from - base - wi * INT_BIT);
+          if (nbits - wi * INT_BIT < INT_BIT)
+               v &= (1U << (nbits - wi * INT_BIT)) - 1;
+          if (v)
+               return base + wi * INT_BIT + __builtin_ctz(v);
+     }
+     return -1;
+}
+
+
+int
+bitmap_ffs_from(bitmap_t *bitmap, int value, int from)
+{
+     size_t g, sw, sumwords;
+     int ret;
+
+     if (from < 0)
+          from = 0;
+     if ((size_t)from >= bitmap->num_bits)
+          return -1;
+
+     if (!bitmap->gcount && bitmap_reindex(bitmap) < 0) {
+          /* no memory for the index: degrade to a full scan */
+          size_t i;
+          for (i = from; i < bitmap->num_bits; i++)
+               if (bitmap_get(bitmap, i) == value)
+                    return i;
+          return -1;
+     }
+
+     /* the group FROM lies in, from FROM on */
+     g = (size_t)from / BITMAP_GROUP_BIT;
+     ret = group_scan(bitmap, g, from, value);
+     if (ret >= 0)
+          return ret;
+
+     /* then jump by summary: the next group that has a set bit
+      * (VALUE 1) resp. that is not full (VALUE 0) */
+     g++;
+     sumwords = (bitmap->ngroups + INT_BIT - 1) / INT_BIT;
+     for (sw = g / INT_BIT; sw < sumwords; sw++) {
+          unsigned int v = value ? bitmap->sum_any[sw] : ~bitmap->sum_full[sw];
+
+          if (sw == g / INT_BIT && g % INT_BIT)
+               v &= ~0U << (g % INT_BIT);
+          if (bitmap->ngroups - sw * INT_BIT < INT_BIT)
+               v &= (1U << (bitmap->ngroups - sw * INT_BIT)) - 1;
+          if (v) {
+               size_t gg = sw * INT_BIT + __builtin_ctz(v);
+               return group_scan(bitmap, gg, gg * BITMAP_GROUP_BIT, value);
+          }
+     }
+     return -1;
+}
+
+
+size_t
+bitmap_count_range(bitmap_t *bitmap, size_t from, size_t to)
+{
+     size_t total = 0, pos;
+
+     if (to > bitmap->num_bits)
+          to = bitmap->num_bits;
+     if (from >= to)
+          return 0;
+
+     if (!bitmap->gcount)
+          bitmap_reindex(bitmap); /* on failure: word loop below */
+
+     pos = from;
+     while (pos < to) {
+          size_t wi = pos / INT_BIT;
+          unsigned int v;
+
+          if (bitmap->gcount && pos % BITMAP_GROUP_BIT == 0
+              && pos + BITMAP_GROUP_BIT <= to) {
+               total += bitmap->gcount[pos / BITMAP_GROUP_BIT];
+               pos += BITMAP_GROUP_BIT;
+               continue;
+          }
+
+          v = bitmap->block[wi];
+          if (pos % INT_BIT)
+               v &= ~0U << (pos % INT_BIT);
+          if (to - wi * INT_BIT < INT_BIT)
+               v &= (1U << (to - wi * INT_BIT)) - 1;
+          total += __builtin_popcount(v);
+          pos = (wi + 1) * INT_BIT;
+     }
+     return total;
+}
+
+
 void
 bitmap_or(bitmap_t *dst, const bitmap_t *src)
 {
@@ -137,6 +320,8 @@ bitmap_or(bitmap_t *dst, const bitmap_t *src)
 
      for (i = 0; i < dst->size; i++)
           dst->block[i] |= src->block[i];
+     if (dst->gcount)
+          bitmap_reindex(dst);
 }
 
 
@@ -149,6 +334,8 @@ bitmap_xor(bitmap_t *dst, const bitmap_t *src)
 
      for (i = 0; i < dst->size; i++)
           dst->block[i] ^= src->block[i];
+     if (dst->gcount)
+          bitmap_reindex(dst);
 }
 
 
@@ -161,6 +348,8 @@ bitmap_and(bitmap_t *dst, const bitmap_t *src)
 
      for (i = 0; i < dst->size; i++)
           dst->block[i] &= src->block[i];
+     if (dst->gcount)
+          bitmap_reindex(dst);
 }
 
 
@@ -170,6 +359,8 @@ bitmap_not(bitmap_t *bitmap)
      int i;
      for (i = 0; i < bitmap->size; i++)
           bitmap->block[i] = ~bitmap->block[i];
+     if (bitmap->gcount)
+          bitmap_reindex(bitmap);
 }
 
 
@@ -227,6 +418,10 @@ main(void)
 
      printf("%s\n", bitmap_string(bm, s, 48));
 
+     printf("first set: %d, first clear: %d, set in [0,36): %zu\n",
+            bitmap_ffs_from(bm, 1, 0), bitmap_ffs_from(bm, 0, 0),
+            bitmap_count_range(bm, 0, 36));
+
      bm = bitmap_set_size(bm, 10);
      printf("%s\n", bitmap_string(bm, s, 48));
 
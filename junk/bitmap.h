@@ -42,11 +42,27 @@ BEGIN_C_DECLS
 # define INT_BIT        (sizeof(int) * CHAR_BIT)
 #endif
 
+/*
+ * The bit array is carved into groups of BITMAP_GROUP_WORDS words.
+ * An optional two-level index (built lazily by the query functions,
+ * kept current by bitmap_set()/bitmap_clear()) holds the number of
+ * set bits per group plus two summary bitmaps -- one bit per group
+ * telling "some bit set" and "every bit set" -- so that
+ * bitmap_ffs_from() jumps over full or empty regions instead of
+ * scanning them word by word.
+ */
+#define BITMAP_GROUP_WORDS      64
+#define BITMAP_GROUP_BIT        (BITMAP_GROUP_WORDS * INT_BIT)
+
 struct bitmap_ {
   size_t size;
   size_t num_bits;
   int flags;
   unsigned int *block;
+  size_t ngroups;               /* zero until the index is built */
+  unsigned short *gcount;       /* set bit(s) per group, or NULL */
+  unsigned int *sum_any;        /* bit per group: has a set bit */
+  unsigned int *sum_full;       /* bit per group: all bits set */
   unsigned int block_[1];
 };
 typedef struct bitmap_ bitmap_t;
@@ -66,6 +82,30 @@ extern void bitmap_and(bitmap_t *dst, const bitmap_t *src);
 extern void bitmap_not(bitmap_t *bitmap);
 extern bitmap_t *bitmap_copy(bitmap_t *src);
 
+/*
+ * (Re)build the group index from the bit array.  Called implicitly
+ * by the queries below; call it yourself after writing into
+ * bitmap_t::block directly.  Returns 0, or -1 if the index memory
+ * could not be allocated (the queries then fall back to plain
+ * scanning).
+ */
+extern int bitmap_reindex(bitmap_t *bitmap);
+
+/*
+ * Return the index of the first bit with value VALUE (0 or 1) at or
+ * after FROM, or -1 if there is none.  With the group index this
+ * touches one summary word and one group -- O(log n)-ish -- instead
+ * of walking the whole array; finding a free slot in a nearly full
+ * map costs the same as in an empty one.
+ */
+extern int bitmap_ffs_from(bitmap_t *bitmap, int value, int from);
+
+/*
+ * Return the number of set bits in [FROM, TO), using the per-group
+ * counts for every fully covered group.
+ */
+extern size_t bitmap_count_range(bitmap_t *bitmap, size_t from, size_t to);
+
 
 static __inline__ int
 bitmap_get(bitmap_t *bitmap, int index)
@@ -76,17 +116,48 @@ bitmap_get(bitmap_t *bitmap, int index)
 }
 
 
+/* valid bit(s) in GROUP; only the last group can be partial */
+static __inline__ size_t
+bitmap_group_bits__(bitmap_t *bitmap, size_t group)
+{
+  size_t n = bitmap->num_bits - group * BITMAP_GROUP_BIT;
+  return (n > BITMAP_GROUP_BIT) ? BITMAP_GROUP_BIT : n;
+}
+
+
 static __inline__ void
 bitmap_set(bitmap_t *bitmap, int index)
 {
-  bitmap->block[index / INT_BIT] |= (1 << (index % INT_BIT));
+  unsigned int *w = &bitmap->block[index / INT_BIT];
+  unsigned int m = 1 << (index % INT_BIT);
+
+  if (bitmap->gcount && !(*w & m)) {
+    size_t g = (size_t)index / BITMAP_GROUP_BIT;
+
+    if (bitmap->gcount[g]++ == 0)
+      bitmap->sum_any[g / INT_BIT] |= 1 << (g % INT_BIT);
+    if (bitmap->gcount[g] == bitmap_group_bits__(bitmap, g))
+      bitmap->sum_full[g / INT_BIT] |= 1 << (g % INT_BIT);
+  }
+  *w |= m;
 }
 
 
 static __inline__ void
 bitmap_clear(bitmap_t *bitmap, int index)
 {
-  bitmap->block[index / INT_BIT] &= ~(1 << (index % INT_BIT));
+  unsigned int *w = &bitmap->block[index / INT_BIT];
+  unsigned int m = 1 << (index % INT_BIT);
+
+  if (bitmap->gcount && (*w & m)) {
+    size_t g = (size_t)index / BITMAP_GROUP_BIT;
+
+    if (bitmap->gcount[g] == bitmap_group_bits__(bitmap, g))
+      bitmap->sum_full[g / INT_BIT] &= ~(1 << (g % INT_BIT));
+    if (--bitmap->gcount[g] == 0)
+      bitmap->sum_any[g / INT_BIT] &= ~(1 << (g % INT_BIT));
+  }
+  *w &= ~m;
 }
 
 
@@ -96,6 +167,17 @@ bitmap_set_all(bitmap_t *bitmap)
   size_t i;
   for (i = 0; i < bitmap->size; i++)
     bitmap->block[i] = ~(unsigned char)0;
+  if (bitmap->gcount) {
+    size_t sw = (bitmap->ngroups + INT_BIT - 1) / INT_BIT;
+    for (i = 0; i < bitmap->ngroups; i++)
+      bitmap->gcount[i] = bitmap_group_bits__(bitmap, i);
+    for (i = 0; i < sw; i++)
+      bitmap->sum_any[i] = bitmap->sum_full[i] = ~0U;
+    if (bitmap->ngroups % INT_BIT) {
+      bitmap->sum_any[sw - 1] &= (1U << (bitmap->ngroups % INT_BIT)) - 1;
+      bitmap->sum_full[sw - 1] &= (1U << (bitmap->ngroups % INT_BIT)) - 1;
+    }
+  }
 }
 
 
@@ -105,6 +187,13 @@ bitmap_clear_all(bitmap_t *bitmap)
   size_t i;
   for (i = 0; i < bitmap->size; i++)
     bitmap->block[i] = 0;
+  if (bitmap->gcount) {
+    size_t sw = (bitmap->ngroups + INT_BIT - 1) / INT_BIT;
+    for (i = 0; i < bitmap->ngroups; i++)
+      bitmap->gcount[i] = 0;
+    for (i = 0; i < sw; i++)
+      bitmap->sum_any[i] = bitmap->sum_full[i] = 0;
+  }
 }
 
 
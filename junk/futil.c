@@ -18,6 +18,7 @@
 #include <futil.h>
 #include <obsutil.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
@@ -154,6 +155,178 @@ fu_url2pathname(const char *url)
 }
 
 
+/*
+ * Map PATHNAME read-only into FM.  A regular file costs one mmap(2)
+ * -- no buffer, no copy; pipes and specials (and files the
+ * filesystem refuses to map) fall back to looping read(2) into a
+ * heap buffer.  Either way FM->data spans FM->size bytes until
+ * fu_unmap().  Returns 0, or -1 with errno set.
+ */
+int
+fu_map(const char *pathname, fu_mapped_t *fm)
+{
+  struct stat sbuf;
+  int fd;
+  int saved_errno;
+  void *p;
+  char *buf = 0;
+  size_t cap, len;
+  ssize_t rd;
+
+  assert(pathname != 0);
+  assert(fm != 0);
+
+  fm->data = 0;
+  fm->size = 0;
+  fm->how_ = FU_MAP_NONE_;
+
+  fd = open(pathname, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  if (fstat(fd, &sbuf) < 0)
+    goto err;
+
+  if (fu_isreg_with_stat(&sbuf)) {
+    if (sbuf.st_size == 0) {    /* mmap(2) rejects a zero length */
+      close(fd);
+      fm->data = "";
+      return 0;
+    }
+
+    p = mmap(0, sbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      close(fd);
+      fm->data = p;
+      fm->size = sbuf.st_size;
+      fm->how_ = FU_MAP_MMAPPED_;
+      return 0;
+    }
+    /* ...else fall through to the read(2) path. */
+  }
+
+  cap = (size_t)FU_READ_CHUNK;
+  len = 0;
+  buf = malloc(cap);
+  if (!buf)
+    goto err;
+
+  for (;;) {
+    if (len == cap) {
+      char *q = realloc(buf, cap * 2);
+      if (!q)
+        goto err;
+      buf = q;
+      cap *= 2;
+    }
+    rd = read(fd, buf + len, cap - len);
+    if (rd < 0) {
+      if (errno == EINTR)
+        continue;
+      goto err;
+    }
+    if (rd == 0)
+      break;
+    len += rd;
+  }
+  close(fd);
+
+  fm->data = buf;
+  fm->size = len;
+  fm->how_ = FU_MAP_MALLOCED_;
+  return 0;
+
+ err:
+  saved_errno = errno;
+  free(buf);
+  close(fd);
+  errno = saved_errno;
+  return -1;
+}
+
+
+void
+fu_unmap(fu_mapped_t *fm)
+{
+  switch (fm->how_) {
+  case FU_MAP_MMAPPED_:
+    munmap((void *)fm->data, fm->size);
+    break;
+  case FU_MAP_MALLOCED_:
+    free((void *)fm->data);
+    break;
+  default:
+    break;
+  }
+  fm->data = 0;
+  fm->size = 0;
+  fm->how_ = FU_MAP_NONE_;
+}
+
+
+/*
+ * Read the whole of PATHNAME into POOL and return the contents as
+ * one finished object, NUL-terminated; the data size (sans the NUL)
+ * goes out via SIZEP if it is non-null.  A regular file reserves its
+ * st_size up front so the common case grows the pool exactly once.
+ * Returns 0 with errno set on failure, leaving POOL as it was.
+ */
+char *
+fu_read_all(const char *pathname, struct obstack *pool, size_t *sizep)
+{
+  struct stat sbuf;
+  int fd;
+  int saved_errno;
+  size_t total = 0;
+  ssize_t rd;
+  char *base;
+
+  assert(pathname != 0);
+  assert(pool != 0);
+
+  fd = open(pathname, O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  if (fstat(fd, &sbuf) == 0 &&
+      fu_isreg_with_stat(&sbuf) && sbuf.st_size > 0)
+    OBSTACK_BLANK(pool, sbuf.st_size);
+
+  for (;;) {
+    if (OBSTACK_OBJECT_SIZE(pool) < total + FU_READ_CHUNK)
+      OBSTACK_BLANK(pool, total + FU_READ_CHUNK - OBSTACK_OBJECT_SIZE(pool));
+
+    rd = read(fd, (char *)OBSTACK_BASE(pool) + total,
+              OBSTACK_OBJECT_SIZE(pool) - total);
+    if (rd < 0) {
+      if (errno == EINTR)
+        continue;
+      goto err;
+    }
+    if (rd == 0)
+      break;
+    total += rd;
+  }
+  close(fd);
+
+  /* Shrink to the bytes actually read, plus the terminating NUL. */
+  OBSTACK_BLANK(pool, (long)(total + 1) - (long)OBSTACK_OBJECT_SIZE(pool));
+  base = OBSTACK_BASE(pool);
+  base[total] = '\0';
+
+  if (sizep)
+    *sizep = total;
+  return OBSTACK_FINISH(pool);
+
+ err:
+  saved_errno = errno;
+  close(fd);
+  OBSTACK_FREE(pool, OBSTACK_FINISH(pool));
+  errno = saved_errno;
+  return 0;
+}
+
+
 fu_findfiles_t *
 fu_find_files(const char *basedir, struct obstack *pool,
               size_t nbulk, int flags,
@@ -58,6 +58,13 @@ fu_islink_with_stat(const struct stat *sbuf)
   return S_ISLNK(sbuf->st_mode);
 }
 
+
+static __inline__ int
+fu_isreg_with_stat(const struct stat *sbuf)
+{
+  return S_ISREG(sbuf->st_mode);
+}
+
 extern int fu_isdir(const char *pathname);
 extern char *fu_url2pathname(const char *url);
 extern int fu_datasync(const char *pathname);
@@ -74,6 +81,32 @@ extern fu_findfiles_t *fu_find_files(const char *basedir, struct obstack *pool,
                                      int (*predicate)(const char *, void *),
                                      void *data);
 
+/* How fu_map() obtained the span -- internal to fu_unmap(). */
+#define FU_MAP_NONE_    0
+#define FU_MAP_MMAPPED_ 1
+#define FU_MAP_MALLOCED_ 2
+
+#define FU_READ_CHUNK   8192
+
+struct fu_mapped_ {
+  const char *data;
+  size_t size;
+  int how_;
+};
+typedef struct fu_mapped_ fu_mapped_t;
+
+/*
+ * Whole-file loading.  fu_map() gives a read-only span over the file
+ * contents -- mmap(2) for regular files, a read(2) fallback for
+ * pipes and specials -- released with fu_unmap().  fu_read_all()
+ * copies the contents into the caller's obstack instead, returning a
+ * NUL-terminated object.
+ */
+extern int fu_map(const char *pathname, fu_mapped_t *fm);
+extern void fu_unmap(fu_mapped_t *fm);
+extern char *fu_read_all(const char *pathname, struct obstack *pool,
+                         size_t *sizep);
+
 END_C_DECLS
 
 #endif  /* FUTIL_H__ */
@@ -65,6 +65,8 @@ struct msg_category {
                    const void *data, size_t size);
   void (*close)(struct msg_category *self);
   void (*refresh)(struct msg_category *self);
+
+  struct msg_ring *mq;          /* MPSC ring, or NULL (direct mode) */
 };
 
 struct msg_cmap {
@@ -129,6 +131,51 @@ struct category_multiplex {
   struct msg_category **sink;
 };
 
+/*
+ * Asynchronous producing -- message_async_mode().
+ *
+ * In the classic mode message_c() calls category->write() directly,
+ * and thread-safety relies on the atomicity of write(2) under
+ * PIPE_BUF; a lengthy record serializes every producer in the kernel
+ * and a record over PIPE_BUF may interleave.
+ *
+ * In async mode each category owns a bounded MPSC ring (Vyukov's
+ * bounded queue, degenerated to one consumer).  message_c() claims a
+ * slot with a single CAS, stores the formatted record and publishes
+ * it by advancing the slot sequence; it takes no lock and never
+ * blocks.  One consumer thread drains every ring in order and does
+ * the usual file/syslog/multiplexer fan-out via category->write(),
+ * so records of any length come out intact, and all write(2) calls
+ * are issued from a single thread.
+ *
+ * When a ring is full the record is dropped and counted -- see
+ * message_async_dropped().  That is the backpressure contract:
+ * producers pay with drops, never with stalls.
+ */
+#define MSG_RING_SLOTS  1024    /* per category; must be a power of two */
+
+struct msg_slot {
+  volatile unsigned long seq;
+  int level;
+  char *msg;                    /* malloc'ed record; consumer frees it */
+};
+
+struct msg_ring {
+  struct msg_ring *next;        /* ring_list link; rings live until
+                                 * message_finalize() */
+  struct msg_category *category;
+
+  volatile unsigned long head;  /* next position producers will claim */
+  volatile unsigned long ndropped;
+
+  char pad__[64];               /* keep the consumer off the producers'
+                                 * cache line */
+  unsigned long tail;           /* consumer only */
+  volatile unsigned long ndrained;
+
+  struct msg_slot slot[MSG_RING_SLOTS];
+};
+
 static struct msg_category *message_get_category_(const char *name,
                                                   int index, int ref,
                                                   int locked);
@@ -166,6 +213,11 @@ struct msg_category *message_syslog_category(const char *name,
                                              int option, int facility);
 #endif  /* HAVE_SYSLOG */
 
+static struct msg_ring *ring_attach(struct msg_category *category);
+static int ring_put(struct msg_ring *mq, int level, char *msg);
+static size_t ring_drain(struct msg_ring *mq);
+static void *async_main(void *arg);
+
 static int run_signal_handler(void);
 static void *signal_thread(void *arg);
 
@@ -191,6 +243,13 @@ static int threadname_counter = 0;
 static struct msg_cmap *category_map = NULL;
 struct msg_category *MC_DEFAULT = NULL;
 
+static struct msg_ring *ring_list = NULL; /* CAS-pushed; never popped */
+static volatile int async_mode = 0;       /* producers consult this */
+static int async_consumer_up = 0;
+static volatile int async_quit = 0;
+static pthread_t async_thread;
+static pthread_mutex_t async_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 #define THREADNAME_MAX  64
 #define TIMEBUF_MAX     256
 #define PROLOGUE_MAX    1024
@@ -459,6 +518,9 @@ message_add_category_(struct msg_category *category)
   //category_ref(category);
   UNLOCK(category_map->locks + index);
 
+  if (async_mode)
+    ring_attach(category);
+
   return TRUE;
 }
 
@@ -484,6 +546,7 @@ init_category_base(struct msg_category *p, const char *name, int type)
 
   p->write = NULL;
   p->close = NULL;
+  p->mq = NULL;
 
   ret = INIT_LOCK(&p->lock);
   if (ret) {
@@ -1031,6 +1094,9 @@ message_init(const char *pathname, ...)
         fprintf(stderr, "sigaction(2) failed: %s\n", strerror(errno));
       }
       break;
+    case MCO_NONBLOCK:
+      message_async_mode(TRUE);
+      break;
     case MCO_NONE:
     default:
       cont = FALSE;
@@ -1052,6 +1118,16 @@ message_finalize(void)
   unsigned i;
   struct msg_cmap *dst = category_map;
   struct msg_category *cp;
+  struct msg_ring *mq;
+
+  message_async_mode(FALSE);    /* drains the rings, joins the consumer */
+
+  while (ring_list) {
+    mq = ring_list;
+    ring_list = mq->next;
+    free(mq);
+  }
+
   category_map = NULL;
 
   for (i = 0; i < dst->size; i++)
@@ -1081,6 +1157,253 @@ message_finalize(void)
 }
 
 
+/*
+ * Give CATEGORY its ring.  The ring pins the category (one extra
+ * refcount) so that message_unget_category() cannot destroy it while
+ * the consumer still dereferences it; rings themselves are released
+ * in message_finalize() only.  On malloc failure the category simply
+ * stays in the direct mode.
+ */
+static struct msg_ring *
+ring_attach(struct msg_category *category)
+{
+  struct msg_ring *mq;
+  unsigned long i;
+
+  if (category->mq)
+    return category->mq;
+
+  mq = malloc(sizeof(*mq));
+  if (!mq)
+    return NULL;
+
+  mq->category = category;
+  mq->head = mq->tail = 0;
+  mq->ndropped = mq->ndrained = 0;
+
+  for (i = 0; i < MSG_RING_SLOTS; i++) {
+    mq->slot[i].seq = i;
+    mq->slot[i].level = 0;
+    mq->slot[i].msg = NULL;
+  }
+
+  WR_LOCK(&category->lock);
+  category->refcount++;
+  UNLOCK(&category->lock);
+
+  do
+    mq->next = ring_list;
+  while (!__sync_bool_compare_and_swap(&ring_list, mq->next, mq));
+
+  __sync_synchronize();
+  category->mq = mq;
+
+  return mq;
+}
+
+
+/*
+ * Enqueue MSG (malloc'ed; ownership passes to the consumer).
+ * Returns 0, or -1 if the ring is full -- the caller keeps the
+ * ownership and the drop is accounted.  Lock-free; called from any
+ * number of producers concurrently.
+ */
+static int
+ring_put(struct msg_ring *mq, int level, char *msg)
+{
+  struct msg_slot *slot;
+  unsigned long pos, seq;
+  long dif;
+
+  pos = mq->head;
+  for (;;) {
+    slot = &mq->slot[pos % MSG_RING_SLOTS];
+    seq = slot->seq;
+    dif = (long)(seq - pos);
+
+    if (dif == 0) {             /* the slot is free at POS */
+      if (__sync_bool_compare_and_swap(&mq->head, pos, pos + 1))
+        break;
+      pos = mq->head;           /* lost the claim; retry */
+    }
+    else if (dif < 0) {
+      /* The consumer has not recycled this slot yet: the ring has
+       * been full for a whole lap.  Drop -- never block. */
+      __sync_add_and_fetch(&mq->ndropped, 1);
+      return -1;
+    }
+    else
+      pos = mq->head;           /* stale POS; reload */
+  }
+
+  slot->level = level;
+  slot->msg = msg;
+  __sync_synchronize();
+  slot->seq = pos + 1;          /* publish */
+
+  return 0;
+}
+
+
+/*
+ * Drain every published record of MQ through category->write().
+ * Consumer thread only.  Returns the number of records written.
+ */
+static size_t
+ring_drain(struct msg_ring *mq)
+{
+  struct msg_slot *slot;
+  struct msg_category *mc = mq->category;
+  size_t n = 0;
+  char *msg;
+  int level;
+
+  for (;;) {
+    slot = &mq->slot[mq->tail % MSG_RING_SLOTS];
+    if ((long)(slot->seq - (mq->tail + 1)) < 0)
+      break;                    /* nothing published at TAIL yet */
+
+    __sync_synchronize();
+    msg = slot->msg;
+    level = slot->level;
+    slot->msg = NULL;
+    __sync_synchronize();
+    slot->seq = mq->tail + MSG_RING_SLOTS; /* recycle the slot */
+    mq->tail++;
+
+    RD_LOCK(&mc->lock);         /* against refresh(), not producers */
+    mc->write(mc, level, msg, strlen(msg));
+    UNLOCK(&mc->lock);
+
+    free(msg);
+    mq->ndrained++;
+    n++;
+  }
+  return n;
+}
+
+
+static void *
+async_main(void *arg)
+{
+  struct msg_ring *mq;
+  struct timespec ts;
+  size_t n;
+  unsigned idle = 0;
+  (void)arg;
+
+  message_thread_init("message-q");
+
+  while (1) {
+    n = 0;
+    for (mq = ring_list; mq != NULL; mq = mq->next)
+      n += ring_drain(mq);
+
+    if (n > 0) {
+      idle = 0;
+      continue;
+    }
+    if (async_quit)
+      break;
+
+    /* Idle.  Producers do not signal us -- that would cost them a
+     * futex call -- so back off from 1ms up to 16ms; that bounds the
+     * flush latency of a quiet process. */
+    if (idle < 5)
+      idle++;
+    ts.tv_sec = 0;
+    ts.tv_nsec = (1L << idle) * 500000L;
+    nanosleep(&ts, NULL);
+  }
+  return NULL;
+}
+
+
+int
+message_async_mode(int enable)
+{
+  unsigned i;
+  struct msg_category *mc;
+  int ret;
+
+  pthread_mutex_lock(&async_mutex);
+
+  if (!enable) {
+    if (async_consumer_up) {
+      async_mode = 0;           /* producers fall back to direct mode */
+      __sync_synchronize();
+      async_quit = 1;
+      pthread_join(async_thread, NULL); /* exits with the rings empty */
+      async_consumer_up = 0;
+      async_quit = 0;
+    }
+    pthread_mutex_unlock(&async_mutex);
+    return TRUE;
+  }
+
+  if (async_consumer_up) {
+    pthread_mutex_unlock(&async_mutex);
+    return TRUE;
+  }
+
+  assert(category_map != NULL);
+
+  for (i = 0; i < category_map->size; i++) {
+    RD_LOCK(category_map->locks + i);
+    for (mc = category_map->map[i]; mc != NULL; mc = mc->next)
+      ring_attach(mc);
+    UNLOCK(category_map->locks + i);
+  }
+
+  ret = pthread_create(&async_thread, NULL, async_main, NULL);
+  if (ret) {
+    fprintf(stderr, "error: pthread_create() failed: %s\n", strerror(ret));
+    pthread_mutex_unlock(&async_mutex);
+    return FALSE;
+  }
+  async_consumer_up = 1;
+  __sync_synchronize();
+  async_mode = 1;
+
+  pthread_mutex_unlock(&async_mutex);
+  return TRUE;
+}
+
+
+void
+message_async_flush(void)
+{
+  struct msg_ring *mq;
+  struct timespec ts;
+  int busy;
+
+  if (!async_mode)
+    return;
+
+  do {
+    busy = 0;
+    for (mq = ring_list; mq != NULL; mq = mq->next)
+      if (mq->ndrained < mq->head) /* dropped records never claim HEAD */
+        busy = 1;
+
+    if (busy) {
+      ts.tv_sec = 0;
+      ts.tv_nsec = 1000000L;
+      nanosleep(&ts, NULL);
+    }
+  } while (busy);
+}
+
+
+unsigned long
+message_async_dropped(struct msg_category *category)
+{
+  if (!category || !category->mq)
+    return 0;
+  return category->mq->ndropped;
+}
+
+
 void
 message_thread_init(const char *thread_name)
 {
@@ -1303,10 +1626,30 @@ message_c(struct msg_category *category, int level, const char *fmt, ...)
   char *user = NULL;
   int sz;
   int ret;
+  struct msg_ring *mq;
 
   if (category == NULL)
     return;
 
+  mq = async_mode ? category->mq : NULL;
+  if (mq) {
+    /* async fast path: no category->lock, no write(2); the level
+     * check is an unlocked read (the race against
+     * message_set_level() only mis-filters the record in flight). */
+    if (level > category->level)
+      return;
+
+    va_start(ap, fmt);
+    sz = vasprintf(&user, fmt, ap);
+    va_end(ap);
+
+    if (sz < 0)
+      return;
+    if (ring_put(mq, level, user) == -1)
+      free(user);               /* ring full; counted in mq->ndropped */
+    return;
+  }
+
   ret = RD_LOCK(&category->lock);
   if (ret)
     return;
@@ -15,6 +15,11 @@
  * If the absolute robustness is required, I can make the output
  * routine completely critical region so that I can accept a lengthy
  * log (greater than PIPE_BUF).
+ *
+ * Or, turn on the async mode -- message_async_mode(), or MCO_NONBLOCK
+ * in message_init() -- where each category owns a lock-free MPSC ring
+ * and a single consumer thread does all the writing; producers never
+ * block and lengthy records never interleave.  See message.c.
  */
 #ifndef FALSE
 #define FALSE   0
@@ -84,5 +89,21 @@ extern int message_multiplexer_add(struct msg_category *multiplexer,
 
 extern int message_set_level(struct msg_category *category, int level);
 
+/*
+ * Enable (disable) the async producing mode.  When enabled,
+ * message_c() appends the record to the category's lock-free ring
+ * and returns; a dedicated consumer thread performs the actual
+ * file/syslog/multiplexer output.  Producers never block: if a ring
+ * is full the record is dropped and counted.  Disabling drains every
+ * ring, then joins the consumer.  Returns TRUE on success.
+ */
+extern int message_async_mode(int enable);
+
+/* Wait until every record produced so far has been written out. */
+extern void message_async_flush(void);
+
+/* Number of records dropped on CATEGORY's full ring so far. */
+extern unsigned long message_async_dropped(struct msg_category *category);
+
 
 #endif  /* MESSAGE_H__ */
@@ -1,13 +1,53 @@
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#include <fcntl.h>
 #include <syslog.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <mlog.h>
 
 
 #define TIME_BUF_MAX    32
 
+/*
+ * mmap(2)-backed persistent ring (see mlog_set_ring()).
+ *
+ * The file starts with mlog_ring_hdr_; records follow, written
+ * contiguously and wrapping back to offset zero when the tail is too
+ * short (the skipped tail is zero-filled).  A record never straddles
+ * the wrap point.  Every store goes through the shared mapping, so a
+ * record survives the death of the process the instant memcpy(3)
+ * returns -- the kernel writes the pages back on its own schedule,
+ * no syscall per record.  Only a machine crash can lose the dirty
+ * pages.
+ *
+ * The record text is copied before its header, and HEAD/SEQ are
+ * advanced last, so a crash mid-write leaves the previous state
+ * intact and at worst one torn record that the dumper skips.
+ */
+#define MLOG_RING_MAGIC "mlogring"
+#define MLOG_REC_MAGIC  0x4d4c          /* "ML" */
+
+struct mlog_ring_hdr_ {
+  char magic[8];
+  unsigned long size;           /* record area size in bytes */
+  unsigned long head;           /* next write offset into the area */
+  unsigned long seq;            /* sequence number of the next record */
+};
+
+struct mlog_rec_ {
+  unsigned short magic;
+  unsigned short len;           /* of TEXT, including the NUL */
+  unsigned long seq;
+};
+
+static struct mlog_ring_hdr_ *mlog_ring = 0;
+
 static FILE *mlog_stream = 0;
 static int syslog_opened = 0;
 
@@ -53,6 +93,143 @@ mlog_get_stream(void)
 }
 
 
+int
+mlog_set_ring(const char *pathname, size_t size)
+{
+  struct mlog_ring_hdr_ *hdr;
+  int fd;
+
+  if (mlog_ring) {
+    munmap(mlog_ring, sizeof(*mlog_ring) + mlog_ring->size);
+    mlog_ring = 0;
+  }
+  if (!pathname)
+    return 0;
+
+  if (size < MLOG_BUFFER_MAX)
+    size = MLOG_BUFFER_MAX;
+
+  fd = open(pathname, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    return -1;
+  if (ftruncate(fd, sizeof(*hdr) + size) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  hdr = mmap(0, sizeof(*hdr) + size, PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, 0);
+  close(fd);
+  if (hdr == MAP_FAILED)
+    return -1;
+
+  if (memcmp(hdr->magic, MLOG_RING_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->size != size || hdr->head >= size) {
+    /* fresh (or resized, or mangled) file; start over */
+    memset(hdr, 0, sizeof(*hdr) + size);
+    memcpy(hdr->magic, MLOG_RING_MAGIC, sizeof(hdr->magic));
+    hdr->size = size;
+  }
+  /* otherwise keep appending where the previous run stopped */
+
+  mlog_ring = hdr;
+  return 0;
+}
+
+
+static void
+ring_put(const char *text, size_t len)
+{
+  struct mlog_ring_hdr_ *hdr = mlog_ring;
+  struct mlog_rec_ rec;
+  char *area = (char *)(hdr + 1);
+  size_t need;
+
+  len++;                        /* keep the NUL; the dumper relies on it */
+  if (len > MLOG_BUFFER_MAX)
+    len = MLOG_BUFFER_MAX;
+
+  need = sizeof(rec) + len;
+  if (hdr->head + need > hdr->size) {
+    memset(area + hdr->head, 0, hdr->size - hdr->head);
+    hdr->head = 0;
+  }
+
+  memcpy(area + hdr->head + sizeof(rec), text, len - 1);
+  area[hdr->head + sizeof(rec) + len - 1] = '\0';
+
+  rec.magic = MLOG_REC_MAGIC;
+  rec.len = len;
+  rec.seq = hdr->seq;
+  memcpy(area + hdr->head, &rec, sizeof(rec));
+
+  hdr->head += need;
+  hdr->seq++;
+}
+
+
+int
+mlog_ring_dump(const char *pathname, FILE *fp)
+{
+  struct mlog_ring_hdr_ *hdr;
+  struct mlog_rec_ rec;
+  struct stat st;
+  const char *area;
+  unsigned long off, scanned, last;
+  int fd, ndumped = 0;
+
+  fd = open(pathname, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+  hdr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (hdr == MAP_FAILED)
+    return -1;
+
+  if ((size_t)st.st_size < sizeof(*hdr) ||
+      memcmp(hdr->magic, MLOG_RING_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->size + sizeof(*hdr) > (size_t)st.st_size) {
+    munmap(hdr, st.st_size);
+    return -1;
+  }
+  area = (const char *)(hdr + 1);
+
+  /* The region past HEAD holds the previous lap -- the oldest
+   * records -- so one pass from HEAD around the ring comes out
+   * oldest first.  Anything that does not parse as a record (the
+   * torn remains at the overwrite boundary, the zero-filled tail) is
+   * skipped byte by byte; requiring SEQ to increase drops stale
+   * leftovers. */
+  off = hdr->head;
+  last = 0;
+  for (scanned = 0; scanned < hdr->size; scanned++, off++) {
+    if (off >= hdr->size)
+      off = 0;
+    if (off + sizeof(rec) > hdr->size)
+      continue;
+    memcpy(&rec, area + off, sizeof(rec));
+    if (rec.magic != MLOG_REC_MAGIC || rec.len == 0 ||
+        rec.len > MLOG_BUFFER_MAX || off + sizeof(rec) + rec.len > hdr->size ||
+        rec.seq >= hdr->seq || (ndumped > 0 && rec.seq <= last) ||
+        area[off + sizeof(rec) + rec.len - 1] != '\0')
+      continue;
+
+    fprintf(fp, "%lu: %s\n", rec.seq, area + off + sizeof(rec));
+    last = rec.seq;
+    ndumped++;
+    scanned += sizeof(rec) + rec.len - 1;
+    off += sizeof(rec) + rec.len - 1;
+  }
+
+  munmap(hdr, st.st_size);
+  return ndumped;
+}
+
+
 static const char *
 current_time()
 {
@@ -76,7 +253,23 @@ mlog(const char *format, ...)
   va_list ap;
   int ret;
 
-  if (using_stream()) {
+  if (mlog_ring) {
+    char buf[MLOG_BUFFER_MAX];
+    int len;
+
+    len = snprintf(buf, MLOG_BUFFER_MAX, "%s: %s[%d]: ",
+                   current_time(), program_name, (int)getpid());
+    va_start(ap, format);
+    ret = vsnprintf(buf + len, MLOG_BUFFER_MAX - len, format, ap);
+    va_end(ap);
+    if (ret >= 0 && ret < MLOG_BUFFER_MAX - len)
+      len += ret;
+    else
+      len = MLOG_BUFFER_MAX - 1;
+
+    ring_put(buf, len);
+  }
+  else if (using_stream()) {
     fprintf(mlog_stream, "%s: %s[%d]: ",
             current_time(), program_name, (int)getpid());
     va_start(ap, format);
@@ -108,6 +301,19 @@ main(int argc, char *argv[])
 {
   FILE *fp;
   char buf[10];
+  int i;
+
+  if (argc > 2 && strcmp(argv[1], "-d") == 0)
+    return mlog_ring_dump(argv[2], stdout) < 0;
+
+  if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+    if (mlog_set_ring(argv[2], 4096) < 0)
+      return -1;
+    for (i = 0; i < atoi(argv[3] ? argv[3] : "8"); i++)
+      MLOG(1, "record %d", i);
+    /* no teardown on purpose; the mapping is the persistence */
+    return 0;
+  }
 
   fp = fopen(argv[1], "a");
   if (!fp)
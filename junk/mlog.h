@@ -39,6 +39,19 @@ extern int mlog_set_stream(FILE *fp);
 /* Get the stream for logging. */
 extern FILE *mlog_get_stream(void);
 
+/* Log into a memory-mapped ring file of SIZE bytes instead; records
+ * carry sequence stamps, the oldest are overwritten, and whatever was
+ * logged before a crash survives in PATHNAME -- a flight recorder
+ * with no syscall per record.  An existing ring of the same SIZE is
+ * appended to.  Pass NULL to return to the stream/syslog sinks.
+ * Returns zero on success, otherwise returns -1 */
+extern int mlog_set_ring(const char *pathname, size_t size);
+
+/* Print the surviving records of a ring file, oldest first, each
+ * prefixed with its sequence stamp.
+ * Returns the number of records, or -1 if PATHNAME is no ring. */
+extern int mlog_ring_dump(const char *pathname, FILE *fp);
+
 extern void mlog(const char *format, ...);
 
 #define MLOG(expr, ...)         do { if (expr) mlog(__VA_ARGS__); } while (0)
@@ -3,6 +3,7 @@
  * Copyright (C) 2004  Seong-Kook Shin <cinsky@gmail.com>
  */
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,8 +14,10 @@ static long xmem_limit = -1;
 static int malloc_called;
 static int calloc_called;
 static int realloc_called;
+static int pool_called;
 
 static int free_called;
+static int pool_free_called;
 static size_t xmem_cur_size;
 static size_t xmem_max_size;
 static FILE *xmem_error_stream = stderr;
@@ -32,6 +35,50 @@ struct xmemfooter {
   unsigned int redzone[2];
 };
 
+/*
+ * Size-class pools -- xmalloc_pool().
+ *
+ * Small fixed-size nodes (list cells, hash nodes, records under 128
+ * bytes) dominate most of our workloads, and each one pays the full
+ * malloc cost.  xmalloc_pool() serves them from per-thread free
+ * lists, one per size class, refilled a slab at a time: the common
+ * case is a pointer pop with no lock and no syscall.
+ *
+ * A slab is a XPOOL_SLAB_SIZE-aligned chunk carved into cells of one
+ * class, with a small header at its base.  xfree() masks the pointer
+ * down to the slab boundary and looks the base up in a grow-only
+ * hash of slab addresses; a hit routes the cell back to the calling
+ * thread's free list, a miss falls through to the plain free() path.
+ * Slabs are never returned to the system, so the registry needs no
+ * read-side locking -- insertion is a single CAS on a bucket chain.
+ *
+ * Sizes over XPOOL_MAX (or a failed slab allocation) fall back to
+ * xmalloc(), which xfree() already handles.
+ */
+#define XPOOL_SLAB_SIZE 16384           /* power of two; slab alignment */
+#define XPOOL_MAX       128
+#define XPOOL_NCLASS    6
+#define XSLAB_MAGIC     0x5b5ab5a1UL
+
+#define XPOOL_NBUCKET   256             /* slab registry hash */
+
+struct xslab {
+  unsigned long magic;
+  int cls;                              /* size class index */
+  struct xslab *next;                   /* registry bucket chain */
+};
+
+/* Cells begin past the header, kept 16-byte aligned. */
+#define XSLAB_HDR       ((sizeof(struct xslab) + 15) & ~(size_t)15)
+
+static const unsigned short pool_class_size[XPOOL_NCLASS] = {
+  16, 32, 48, 64, 96, 128
+};
+
+static struct xslab *pool_bucket[XPOOL_NBUCKET];
+
+static __thread void *pool_cache[XPOOL_NCLASS];
+
 
 static __inline__ size_t
 ptr_size(size_t size)
@@ -98,6 +145,101 @@ add_stat(size_t size)
 }
 
 
+static __inline__ int
+pool_class(size_t size)
+{
+  int cls;
+
+  for (cls = 0; cls < XPOOL_NCLASS; cls++)
+    if (size <= pool_class_size[cls])
+      return cls;
+  return -1;
+}
+
+
+static __inline__ unsigned
+slab_hash(uintptr_t base)
+{
+  return (base / XPOOL_SLAB_SIZE) % XPOOL_NBUCKET;
+}
+
+
+static __inline__ struct xslab *
+slab_lookup(void *ptr)
+{
+  uintptr_t base = (uintptr_t)ptr & ~(uintptr_t)(XPOOL_SLAB_SIZE - 1);
+  struct xslab *sp;
+
+  for (sp = pool_bucket[slab_hash(base)]; sp != NULL; sp = sp->next)
+    if ((uintptr_t)sp == base)
+      return sp;
+  return NULL;
+}
+
+
+/*
+ * Allocate a slab for CLS, carve it into the calling thread's free
+ * list and return the first cell.  Returns NULL on allocation
+ * failure (the caller falls back to xmalloc).
+ */
+static void *
+pool_refill(int cls)
+{
+  struct xslab *sp;
+  size_t csize = pool_class_size[cls];
+  char *p, *end;
+  void *head = NULL;
+
+  if (posix_memalign((void **)&sp, XPOOL_SLAB_SIZE, XPOOL_SLAB_SIZE) != 0)
+    return NULL;
+
+  sp->magic = XSLAB_MAGIC;
+  sp->cls = cls;
+
+  /* Publish the slab before any cell can reach xfree(). */
+  {
+    unsigned h = slab_hash((uintptr_t)sp);
+    do
+      sp->next = pool_bucket[h];
+    while (!__sync_bool_compare_and_swap(&pool_bucket[h], sp->next, sp));
+  }
+
+  end = (char *)sp + XPOOL_SLAB_SIZE;
+  for (p = (char *)sp + XSLAB_HDR; p + csize <= end; p += csize) {
+    *(void **)p = head;
+    head = p;
+  }
+
+  pool_cache[cls] = *(void **)head;
+  return head;
+}
+
+
+void *
+xmalloc_pool(size_t size)
+{
+  int cls;
+  void *ptr;
+
+  cls = pool_class(size);
+  if (cls < 0)
+    return xmalloc(size);
+
+  ptr = pool_cache[cls];
+  if (ptr) {
+    pool_cache[cls] = *(void **)ptr;
+    pool_called++;
+    return ptr;
+  }
+
+  ptr = pool_refill(cls);
+  if (!ptr)
+    return xmalloc(size);
+  pool_called++;
+  return ptr;
+}
+
+
 void *
 xmalloc(size_t size)
 {
@@ -181,6 +323,16 @@ redzone_check(void *ptr, size_t size)
 void
 xfree(void *ptr)
 {
+  struct xslab *sp;
+
+  sp = slab_lookup(ptr);
+  if (sp) {
+    *(void **)ptr = pool_cache[sp->cls];
+    pool_cache[sp->cls] = ptr;
+    pool_free_called++;
+    return;
+  }
+
 #ifdef XMEM_STAT
   {
     struct xmemheader *p;
@@ -246,7 +398,9 @@ xmemstat(memstat_t *ms)
   ms->malloc_called = malloc_called;
   ms->calloc_called = calloc_called;
   ms->realloc_called = realloc_called;
+  ms->pool_called = pool_called;
   ms->free_called = free_called;
+  ms->pool_free_called = pool_free_called;
 
   ms->cur_size = xmem_cur_size;
   ms->max_size = xmem_max_size;
@@ -289,7 +443,18 @@ main(void)
     xfree(vec[i]);
   }
 
+  for (i = 0; i < 80; i++) {
+    int size = rand() % 128 + 1;
+    vec[i] = xmalloc_pool(size);
+    for (j = 0; j < size; j++)
+      vec[i][j] = '*';
+  }
+  for (i = 0; i < 80; i++)
+    xfree(vec[i]);
+
   xmemstat(&ms);
+  printf("pool: %d allocated, %d freed\n",
+         ms.pool_called, ms.pool_free_called);
   return 0;
 }
 #endif /* TEST_XMALLOC */
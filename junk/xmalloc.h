@@ -31,11 +31,22 @@ BEGIN_C_DECLS
 extern void *xmalloc(size_t size);
 extern void *xcalloc(size_t nmemb, size_t size);
 extern void *xrealloc(void *ptr, size_t size);
+
+/*
+ * Like xmalloc(), but sizes up to 128 bytes are served from
+ * per-thread size-class pools refilled in slabs; the common case
+ * costs a pointer pop.  Release with xfree() as usual -- it routes
+ * pool cells back by slab lookup.  Larger sizes (and slab allocation
+ * failures) silently fall back to xmalloc().
+ */
+extern void *xmalloc_pool(size_t size);
+
 extern void xfree(void *ptr);
 extern void xmemstat(memstat_t *ms);
 extern long xmemopt(int option, ...);
 #else
 # define xmalloc(size)          malloc(size)
+# define xmalloc_pool(size)     malloc(size)
 # define xcalloc(nmemb, size)   calloc(nmemb, size)
 # define xrealloc(ptr, size)    realloc(ptr, size)
 # define xfree(ptr)             free(ptr)
@@ -47,7 +58,9 @@ struct memstat_ {
   int malloc_called;
   int calloc_called;
   int realloc_called;
+  int pool_called;
   int free_called;
+  int pool_free_called;
 
   size_t cur_size;
   size_t max_size;
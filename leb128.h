@@ -0,0 +1,50 @@
+/* -*-c-*- */
+#ifndef LEB128_H__
+#define LEB128_H__
+
+/*
+ * leb128: Encode/Decode LEB128 numbers
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Encode VALUE into P as LEB128; signed encoding if SIGN is nonzero.
+ * Returns the number of bytes written (at most 10 for 64-bit values).
+ */
+extern int output_leb128(char *p, unsigned long value, int sign);
+
+/*
+ * Decode one LEB128 number from DATA; signed decoding if SIGN is
+ * nonzero.  If LENGTH_RETURN is not NULL, it receives the number of
+ * bytes consumed.
+ */
+extern unsigned long int read_leb128(unsigned char *data,
+                                     unsigned int *length_return, int sign);
+
+/*
+ * Bulk interfaces.  Encode or decode N values in one call; each
+ * returns the number of bytes produced into (or consumed from) BUF.
+ * The decoders assume BUF holds at least N well-formed values; the
+ * encoders assume BUF has room for the worst case (10 bytes per
+ * value).  One- and two-byte values -- the bulk of a typical delta
+ * stream -- are handled inline without the per-value call overhead.
+ */
+extern size_t leb128_encode_n(unsigned char *buf,
+                              const unsigned long *values, size_t n);
+extern size_t leb128_decode_n(const unsigned char *buf,
+                              unsigned long *out, size_t n);
+extern size_t leb128_encode_sn(unsigned char *buf,
+                               const long *values, size_t n);
+extern size_t leb128_decode_sn(const unsigned char *buf,
+                               long *out, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* LEB128_H__ */
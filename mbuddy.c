@@ -25,8 +25,10 @@
 #include <stdio.h>
 #include <math.h>
 
+#include <signal.h>
 #include <sys/time.h>
 #include <pthread.h>
+#include <unistd.h>
 
 #include <malloc.h>
 #include <execinfo.h>
@@ -35,6 +37,22 @@
 
 #define MB_LOGNAME      "mb.out"
 #define MAX_BACKTRACE   32
+#define MB_RECORD_MAX   8192
+
+/*
+ * Binary log format (MB_BINARY): after the "MBB1\n" magic, the file
+ * is a stream of records; each starts with a one-byte tag ('m', 'r'
+ * or 'f') followed by LEB128 varints (see leb128.c): sec, usec,
+ * total, delta (signed), size, old pointer, new pointer, caller.
+ * Every MB_INDEX_EVERY records an index record is appended -- an
+ * 8-byte sync marker, the tag 'I' and varints count, sec, usec,
+ * total -- so that mbuddy_dump can seek to an arbitrary byte offset
+ * and resynchronize.
+ */
+#define MB_BIN_MAGIC    "MBB1"
+#define MB_BIN_MARK     "\377\377\377\377MBX"
+#define MB_BIN_MARKLEN  8       /* the marker includes its NUL */
+#define MB_INDEX_EVERY  4096
 
 pthread_mutex_t mb_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -60,6 +78,7 @@ FILE *mb_stream;
 
 struct mb_head {
   size_t size;
+  size_t site;                  /* 1-based index into SITES, 0 = none */
   time_t created;
   time_t modified;
 };
@@ -87,19 +106,24 @@ struct mb_head {
                           __free_hook = mb_free_; \
                         } while (0)
 
-#define SET_PEAK()      do { \
-                          if (mb_allocated > mb_alloc_peak) \
-                            mb_alloc_peak = mb_allocated; \
-                        } while (0)
-
 static void *mb_malloc_(size_t size, const void *caller);
 static void *mb_realloc_(void *ptr, size_t size, const void *caller);
 static void mb_free_(void *p, const void *caller);
-static void mb_log(const char *fmt, ...);
+static int want_trace(size_t size);
+static void mb_record(int trace, size_t total, const char *fmt, ...);
+static void mb_emit(int trace, size_t total, int tag, ssize_t delta,
+                    size_t size, const void *oldp, const void *newp,
+                    const void *caller);
 
 static const char *log_pathname = 0;
 static int call_limit = 0;
 static size_t mem_limit = 0;
+static int bt_sample = 0;       /* backtrace 1-in-N allocations only */
+static size_t bt_size = 0;      /* ...but always at/above this size */
+static int binary_mode = 0;     /* write the compact binary format */
+static int mb_records = 0;      /* binary records written, for indexing */
+static int site_depth = 0;      /* frames forming a call site (MB_SITES) */
+static int site_interval = 0;   /* seconds between summaries, 0 = off */
 
 static int str2int(const char *s);
 static void init_env(void);
@@ -111,7 +135,7 @@ static void *(*old_realloc_hook)(void *ptr, size_t size, const void *caller);
 static void (*old_free_hook)(void *ptr, const void *caller);
 
 static void malloc_init(void);
-static void print_trace(void);
+static int format_trace(char *buf, size_t size);
 
 void (*__malloc_initialize_hook)(void) = malloc_init;
 static int debug_mode = 1;
@@ -123,13 +147,326 @@ static int abort_mode = 0;
 int stats[STATS_MAX];
 
 
+/*
+ * Statistics are kept in per-thread shards so that the hooks never
+ * contend on mb_mutex in the hot path; the shards are folded into
+ * the global counters above when the report is written.  A shard is
+ * allocated on the first allocation of each thread and intentionally
+ * never freed -- the report may run after its thread is gone.
+ */
+struct mb_shard {
+  size_t allocated;             /* net bytes allocated by this thread */
+
+  int malloc_called;
+  int realloc_called;
+  int realloc_malloc;
+  int realloc_free;
+  int free_called;
+
+  int stats[STATS_MAX];
+
+  struct mb_shard *next;
+};
+
+static struct mb_shard *shards;         /* all registered shards */
+static __thread struct mb_shard *shard; /* this thread's shard */
+static __thread int in_hook;            /* reentrancy guard */
+
+static int mb_calls;                    /* allocator calls, for MB_CLIMIT */
+
+/*
+ * Online per-call-site aggregation (MB_SITES).
+ *
+ * Allocations are hashed by the top MB_SITES return addresses of
+ * their backtrace into a fixed open-addressing table; each site
+ * tracks live bytes and blocks, peak live bytes, and lifetime
+ * allocation count and bytes.  The owning site index rides in the
+ * block header, so frees and reallocs are charged back without a
+ * second backtrace.  Slots are claimed with a compare-and-swap and
+ * the counters are updated with atomic adds -- no lock anywhere near
+ * the hot path.  A day-long run then needs only the kilobyte-sized
+ * site summary (mb_sites_dump(), written on SIGUSR2, every
+ * MB_SITES_EVERY seconds, and at exit) instead of the full event
+ * log.
+ */
+#define MB_SITE_DEPTH_MAX       8
+#define MB_SITE_SLOTS           4096    /* power of two */
+#define MB_SITE_SKIP            2       /* our own frames in the backtrace */
+
+struct mb_site {
+  void *pc[MB_SITE_DEPTH_MAX];  /* innermost first */
+  int npc;
+  unsigned hash;
+  volatile int state;           /* 0 empty, 1 being claimed, 2 ready */
+
+  size_t live;                  /* live bytes right now */
+  size_t live_blocks;
+  size_t peak;                  /* largest LIVE ever seen */
+  size_t allocs;                /* blocks ever allocated here */
+  size_t total;                 /* bytes ever allocated here */
+};
+
+static struct mb_site *sites;           /* MB_SITE_SLOTS entries */
+static size_t site_overflow;            /* allocations with no slot left */
+static volatile long site_last_dump;
+
+/* the underlying allocator, free from our hooks */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+
+static struct mb_shard *
+my_shard(void)
+{
+  struct mb_shard *sh = shard;
+
+  if (!sh) {
+    sh = __libc_malloc(sizeof(*sh));
+    memset(sh, 0, sizeof(*sh));
+
+    LOCK();                     /* registration only; once per thread */
+    sh->next = shards;
+    shards = sh;
+    UNLOCK();
+
+    shard = sh;
+  }
+  return sh;
+}
+
+
+/* account AMOUNT bytes (negative on free) and return the new total */
+static size_t
+charge(ssize_t amount)
+{
+  size_t total = __atomic_add_fetch(&mb_allocated, (size_t)amount,
+                                    __ATOMIC_RELAXED);
+  size_t peak = __atomic_load_n(&mb_alloc_peak, __ATOMIC_RELAXED);
+
+  while (total > peak &&
+         !__atomic_compare_exchange_n(&mb_alloc_peak, &peak, total, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  return total;
+}
+
+
+static int
+mem_limit_hit(size_t incr)
+{
+  if (!mem_limit)
+    return 0;
+  return __atomic_load_n(&mb_allocated, __ATOMIC_RELAXED) + incr > mem_limit;
+}
+
+
+static int
+call_limit_hit(void)
+{
+  if (!call_limit)
+    return 0;
+  return __atomic_add_fetch(&mb_calls, 1, __ATOMIC_RELAXED) > call_limit;
+}
+
+
+/*
+ * Find (or claim) the site slot of the current allocation, keyed on
+ * the top SITE_DEPTH return addresses.  Returns its 1-based index,
+ * or 0 when the backtrace is empty or the table is full.
+ */
+static size_t
+site_find(void)
+{
+  void *bt[MB_SITE_SKIP + MB_SITE_DEPTH_MAX];
+  void **pc;
+  unsigned hash;
+  size_t i, n;
+  int npc, j;
+
+  npc = backtrace(bt, MB_SITE_SKIP + site_depth) - MB_SITE_SKIP;
+  if (npc <= 0)
+    return 0;
+  pc = bt + MB_SITE_SKIP;
+
+  hash = 2166136261u;           /* FNV-1a over the address bytes */
+  for (j = 0; j < npc; j++) {
+    const unsigned char *b = (const unsigned char *)&pc[j];
+    size_t k;
+
+    for (k = 0; k < sizeof(pc[j]); k++)
+      hash = (hash ^ b[k]) * 16777619u;
+  }
+
+  i = hash & (MB_SITE_SLOTS - 1);
+  for (n = 0; n < MB_SITE_SLOTS; n++, i = (i + 1) & (MB_SITE_SLOTS - 1)) {
+    struct mb_site *s = &sites[i];
+    int state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+
+    if (state == 0) {
+      int expect = 0;
+
+      if (__atomic_compare_exchange_n(&s->state, &expect, 1, 0,
+                                      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        memcpy(s->pc, pc, npc * sizeof(*pc));
+        s->npc = npc;
+        s->hash = hash;
+        __atomic_store_n(&s->state, 2, __ATOMIC_RELEASE);
+        return i + 1;
+      }
+      state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+    }
+    while (state == 1)          /* another thread is filling it in */
+      state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+
+    if (s->hash == hash && s->npc == npc
+        && memcmp(s->pc, pc, npc * sizeof(*pc)) == 0)
+      return i + 1;
+  }
+
+  __atomic_add_fetch(&site_overflow, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+
+/*
+ * Charge DELTA bytes to SITE (1-based); ISALLOC/ISFREE adjust the
+ * block counts.  Grows and shrinks by realloc pass 0 for both.
+ */
+static void
+site_charge(size_t site, ssize_t delta, int isalloc, int isfree)
+{
+  struct mb_site *s;
+  size_t live, peak;
+
+  if (!site)
+    return;
+  s = &sites[site - 1];
+
+  live = __atomic_add_fetch(&s->live, (size_t)delta, __ATOMIC_RELAXED);
+  peak = __atomic_load_n(&s->peak, __ATOMIC_RELAXED);
+  while (live > peak &&
+         !__atomic_compare_exchange_n(&s->peak, &peak, live, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+
+  if (delta > 0)
+    __atomic_add_fetch(&s->total, (size_t)delta, __ATOMIC_RELAXED);
+  if (isalloc) {
+    __atomic_add_fetch(&s->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->live_blocks, 1, __ATOMIC_RELAXED);
+  }
+  if (isfree)
+    __atomic_add_fetch(&s->live_blocks, (size_t)-1, __ATOMIC_RELAXED);
+}
+
+
+static int
+site_cmp_live(const void *a, const void *b)
+{
+  const struct mb_site *x = *(const struct mb_site * const *)a;
+  const struct mb_site *y = *(const struct mb_site * const *)b;
+
+  if (x->live != y->live)
+    return x->live < y->live ? 1 : -1;
+  return x->total < y->total ? 1 : x->total > y->total ? -1 : 0;
+}
+
+
+/*
+ * Write the per-site totals, biggest live footprint first, as
+ * comment records.  In binary mode the summary goes to stderr, like
+ * the one at exit.  Addresses are raw; feed them to addr2line(1) (or
+ * look them up in a backtraced text log).
+ */
+void
+mb_sites_dump(void)
+{
+  char buf[MB_RECORD_MAX];
+  struct mb_site **sorted;
+  size_t i, nsite = 0;
+  int fd, len, j, n;
+
+  if (!sites || !mb_stream)
+    return;
+  fd = binary_mode ? fileno(stderr) : fileno(mb_stream);
+
+  sorted = __libc_malloc(MB_SITE_SLOTS * sizeof(*sorted));
+  if (!sorted)
+    return;
+  for (i = 0; i < MB_SITE_SLOTS; i++)
+    if (__atomic_load_n(&sites[i].state, __ATOMIC_ACQUIRE) == 2)
+      sorted[nsite++] = &sites[i];
+  qsort(sorted, nsite, sizeof(*sorted), site_cmp_live);
+
+  len = snprintf(buf, sizeof(buf),
+                 "# Sites ---------------------\n#\n"
+                 "# %zu site(s), %zu allocation(s) overflowed the table\n"
+                 "#\n"
+                 "# %12s %8s %12s %10s %14s  %s\n",
+                 nsite, __atomic_load_n(&site_overflow, __ATOMIC_RELAXED),
+                 "live", "blocks", "peak", "allocs", "total", "call-site");
+  write(fd, buf, len);
+
+  for (i = 0; i < nsite; i++) {
+    struct mb_site *s = sorted[i];
+
+    len = snprintf(buf, sizeof(buf), "# %12zu %8zu %12zu %10zu %14zu ",
+                   __atomic_load_n(&s->live, __ATOMIC_RELAXED),
+                   __atomic_load_n(&s->live_blocks, __ATOMIC_RELAXED),
+                   __atomic_load_n(&s->peak, __ATOMIC_RELAXED),
+                   __atomic_load_n(&s->allocs, __ATOMIC_RELAXED),
+                   __atomic_load_n(&s->total, __ATOMIC_RELAXED));
+    for (j = 0; j < s->npc && len < (int)sizeof(buf) - 2; j++) {
+      n = snprintf(buf + len, sizeof(buf) - 1 - len, "%s%p",
+                   j ? "<" : "", s->pc[j]);
+      if (n <= 0)
+        break;
+      len += n;
+    }
+    buf[len++] = '\n';
+    write(fd, buf, len);
+  }
+  write(fd, "#\n", 2);
+
+  __libc_free(sorted);
+}
+
+
+static void
+site_sighandler(int signo)
+{
+  (void)signo;
+  mb_sites_dump();
+}
+
+
+/* called from the hooks; one thread wins the CAS and writes the
+ * periodic summary record */
+static void
+site_maybe_dump(void)
+{
+  long now, last;
+
+  if (!sites || !site_interval)
+    return;
+
+  now = (long)time(0);
+  last = site_last_dump;
+  if (now - last >= site_interval &&
+      __atomic_compare_exchange_n(&site_last_dump, &last, now, 0,
+                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    mb_sites_dump();
+}
+
+
 void
 add_stats(size_t size)
 {
   int i;
   for (i = STATS_MAX - 1; i >= 0; i--)
     if (size >= (1 << i)) {
-      stats[i]++;
+      my_shard()->stats[i]++;
       break;
     }
 }
@@ -164,6 +501,38 @@ init_env(void)
       backtrace_mode = MAX_BACKTRACE;
   }
 
+  p = getenv("MB_BTSAMPLE");
+  if (p)
+    bt_sample = str2int(p);
+
+  p = getenv("MB_BTSIZE");
+  if (p)
+    bt_size = (size_t)str2int(p);
+
+  p = getenv("MB_BINARY");
+  if (p)
+    binary_mode = str2int(p);
+
+  p = getenv("MB_SITES");
+  if (p) {
+    site_depth = str2int(p);
+    if (site_depth > MB_SITE_DEPTH_MAX)
+      site_depth = MB_SITE_DEPTH_MAX;
+  }
+
+  p = getenv("MB_SITES_EVERY");
+  if (p)
+    site_interval = str2int(p);
+
+  if (site_depth > 0) {
+    sites = __libc_malloc(MB_SITE_SLOTS * sizeof(*sites));
+    if (sites) {
+      memset(sites, 0, MB_SITE_SLOTS * sizeof(*sites));
+      site_last_dump = (long)time(0);
+      signal(SIGUSR2, site_sighandler);
+    }
+  }
+
   if (debug_mode) {
     fprintf(stderr, " mem_limit: %zu\n", mem_limit);
     fprintf(stderr, "call_limit: %d\n", call_limit);
@@ -197,38 +566,48 @@ mb_malloc_(size_t size, const void *caller)
 {
   void *p;
   struct mb_head *h;
+  struct mb_shard *sh;
+  size_t total;
 
-  LOCK();
-  RESTORE_HOOK();
+  if (in_hook)                  /* our own internal allocation */
+    return __libc_malloc(size);
+  in_hook = 1;
+
+  sh = my_shard();
 
   assert(size > 0);
 
-  if (mem_limit && mb_allocated + size > mem_limit)
-    p = 0;
-  else if (call_limit && malloc_called + realloc_called > call_limit)
+  if (mem_limit_hit(size) || call_limit_hit())
     p = 0;
   else
-    p = malloc(size + HEADER_SIZE);
+    p = __libc_malloc(size + HEADER_SIZE);
 
-  malloc_called++;
+  sh->malloc_called++;
+  total = __atomic_load_n(&mb_allocated, __ATOMIC_RELAXED);
   if (p) {
-    mb_allocated += size;
+    total = charge(size);
+    sh->allocated += size;
     add_stats(size);
-    SET_PEAK();
 
     h = (struct mb_head *)p;
     h->size = size;
+    h->site = 0;
     h->created = 0;
     h->modified = 0;
   }
 
-  print_trace();
+  mb_emit(want_trace(size), total, 'm', (ssize_t)size, size,
+          0, p ? p + HEADER_SIZE : 0, caller);
 
-  mb_log("%10zd: malloc(%zu) from %p => %p",
-         (ssize_t)size, size, caller, p ? p + HEADER_SIZE : 0);
+  /* after mb_emit(): the first call of the process initializes the
+   * environment (and SITES) there */
+  if (p && sites) {
+    h->site = site_find();
+    site_charge(h->site, (ssize_t)size, 1, 0);
+  }
 
-  SAVE_HOOK();
-  UNLOCK();
+  site_maybe_dump();
+  in_hook = 0;
 
   return p ? p + HEADER_SIZE : 0;
 }
@@ -239,71 +618,83 @@ mb_realloc_(void *ptr, size_t size, const void *caller)
 {
   void *p;
   struct mb_head *h = HEADER(ptr);
+  struct mb_shard *sh;
   size_t oldsize;
+  size_t total;
 
-  LOCK();
-  RESTORE_HOOK();
+  if (in_hook)                  /* our own internal allocation */
+    return __libc_realloc(ptr, size);
+  in_hook = 1;
+
+  sh = my_shard();
 
-  realloc_called++;
+  sh->realloc_called++;
 
   if (!ptr) {
     assert(size > 0);
 
-    if ((mem_limit && mb_allocated + size > mem_limit) ||
-        (call_limit && malloc_called + realloc_called > call_limit))
+    sh->realloc_malloc++;
+
+    if (mem_limit_hit(size) || call_limit_hit())
       p = 0;
     else
-      p = malloc(size + HEADER_SIZE);
+      p = __libc_malloc(size + HEADER_SIZE);
 
+    total = __atomic_load_n(&mb_allocated, __ATOMIC_RELAXED);
     if (p) {
-      mb_allocated += size;
+      total = charge(size);
+      sh->allocated += size;
       add_stats(size);
-      SET_PEAK();
     }
-    print_trace();
-    mb_log("%10zd: realloc(%p, %zu) from %p => %p", (ssize_t)size,
-           ptr, size, caller, p ? p + HEADER_SIZE : 0);
+    mb_emit(want_trace(size), total, 'r', (ssize_t)size, size,
+            ptr, p ? p + HEADER_SIZE : 0, caller);
+
+    if (p) {
+      ((struct mb_head *)p)->site = sites ? site_find() : 0;
+      site_charge(((struct mb_head *)p)->site, (ssize_t)size, 1, 0);
+    }
 
     SET_HEAD(p, size);
-    SAVE_HOOK();
-    UNLOCK();
+    site_maybe_dump();
+    in_hook = 0;
     return p ? (unsigned char *)p + HEADER_SIZE : 0;
   }
 
   if (h->size == size) {
-    print_trace();
-    mb_log("%10zd: realloc(%p, %zu) from %p => %p", (ssize_t)0,
-           ptr, size, caller, p + HEADER_SIZE);
+    mb_emit(want_trace(size), __atomic_load_n(&mb_allocated, __ATOMIC_RELAXED),
+            'r', (ssize_t)0, size, ptr, ptr, caller);
 
-    if (call_limit && malloc_called + realloc_called > call_limit)
+    if (call_limit_hit())
       ptr = 0;
 
-    SAVE_HOOK();
-    UNLOCK();
+    in_hook = 0;
     return ptr;
   }
 
   oldsize = h->size;
 
-  if ((mem_limit && mb_allocated + size - oldsize > mem_limit) ||
-      (call_limit && malloc_called + realloc_called > call_limit))
+  if (mem_limit_hit(size - oldsize) || call_limit_hit())
     p = 0;
   else
-    p = realloc((unsigned char *)ptr - HEADER_SIZE, size + HEADER_SIZE);
+    p = __libc_realloc((unsigned char *)ptr - HEADER_SIZE,
+                       size + HEADER_SIZE);
 
+  total = __atomic_load_n(&mb_allocated, __ATOMIC_RELAXED);
   if (p) {
-    mb_allocated += size - oldsize;
+    total = charge((ssize_t)size - (ssize_t)oldsize);
+    sh->allocated += size - oldsize;
     add_stats(size);
-    SET_PEAK();
+    /* growth stays charged to the site that allocated the block */
+    site_charge(((struct mb_head *)p)->site,
+                (ssize_t)size - (ssize_t)oldsize, 0, 0);
   }
 
-  print_trace();
-  mb_log("%10zd: realloc(%p, %zu) from %p => %p",
-         (int)(size - oldsize), ptr, size, caller, p ? p + HEADER_SIZE : 0);
-  SET_HEAD(p, size - oldsize);
+  mb_emit(want_trace(size), total, 'r', (ssize_t)(size - oldsize), size,
+          ptr, p ? p + HEADER_SIZE : 0, caller);
+  SET_HEAD(p, size);
 
-  SAVE_HOOK();
-  UNLOCK();
+  site_maybe_dump();
+  in_hook = 0;
 
   return p ? (unsigned char *)p + HEADER_SIZE : 0;
 }
@@ -313,25 +704,37 @@ static void
 mb_free_(void *p, const void *caller)
 {
   struct mb_head *h = HEADER(p);
+  struct mb_shard *sh;
   size_t oldsize;
+  size_t total;
 
-  LOCK();
-  RESTORE_HOOK();
+  if (in_hook) {                /* our own internal allocation; no header */
+    __libc_free(p);
+    return;
+  }
+  in_hook = 1;
+
+  sh = my_shard();
 
-  free_called++;
+  sh->free_called++;
   if (p) {
-    mb_allocated -= h->size;
+    size_t site = h->site;
+
     oldsize = h->size;
-    free(h);
-    print_trace();
-    mb_log("%10zd: free(%p) from %p", -oldsize, p, caller);
+    total = charge(-(ssize_t)oldsize);
+    sh->allocated -= oldsize;
+    __libc_free(h);
+    site_charge(site, -(ssize_t)oldsize, 0, 1);
+    mb_emit(want_trace(oldsize), total, 'f', -(ssize_t)oldsize, oldsize,
+            p, 0, caller);
   }
   else {
-    print_trace();
-    mb_log("%10zd: free(%p) from %p", (ssize_t)0, p, caller);
+    mb_emit(want_trace(0), __atomic_load_n(&mb_allocated, __ATOMIC_RELAXED),
+            'f', (ssize_t)0, 0, p, 0, caller);
   }
-  SAVE_HOOK();
-  UNLOCK();
+
+  site_maybe_dump();
+  in_hook = 0;
 }
 
 
@@ -393,8 +796,33 @@ print_stats(void)
 static void
 close_stream(void)
 {
+  struct mb_shard *sh;
+  int i;
+
   RESTORE_HOOK();
 
+  /* fold the per-thread shards into the global counters */
+  LOCK();
+  for (sh = shards; sh != NULL; sh = sh->next) {
+    malloc_called += sh->malloc_called;
+    realloc_called += sh->realloc_called;
+    realloc_malloc += sh->realloc_malloc;
+    realloc_free += sh->realloc_free;
+    free_called += sh->free_called;
+
+    for (i = 0; i < STATS_MAX; i++)
+      stats[i] += sh->stats[i];
+  }
+  shards = NULL;
+  UNLOCK();
+
+  /* a binary log must stay pure records; the human-readable summary
+   * goes to stderr instead. */
+  if (binary_mode && mb_stream && mb_stream != stderr) {
+    fclose(mb_stream);
+    mb_stream = stderr;
+  }
+
   fprintf(mb_stream, "#\n");
   fprintf(mb_stream, "# Summary -------------------\n#\n");
   fprintf(mb_stream, "#  peak: %zu byte(s)\n", mb_alloc_peak);
@@ -404,6 +832,7 @@ close_stream(void)
   fprintf(mb_stream, "#\n");
 
   print_stats();
+  mb_sites_dump();
 
   if (mb_stream && mb_stream != stderr)
     fclose(mb_stream);
@@ -459,6 +888,33 @@ static const char *help_msgs[] = {
   "              mbuddy will show 10 caller information in a comment.",
   "              The recommended value is 10.",
   "",
+  " MB_BTSAMPLE  If set to N (> 1), only one in every N operations gets a",
+  "              backtrace, per thread.  Capturing the backtrace is the",
+  "              dominant cost of mbuddy, so sampling makes it cheap",
+  "              enough to leave enabled in long-running programs.",
+  "              Has no effect unless MB_BACKTRACE is set.",
+  "",
+  " MB_BTSIZE -- If set to nonzero value, operations on blocks of this",
+  "              size or bigger are always backtraced, regardless of",
+  "              MB_BTSAMPLE.  'K', 'M', 'T' postfixes work as in",
+  "              MB_MLIMIT.",
+  "",
+  " MB_BINARY -- If set to nonzero value, records are written in a",
+  "              compact binary format (varint fields, with an index",
+  "              record every few thousand records), several times",
+  "              smaller and much faster to post-process.  Use",
+  "              mbuddy_dump to decode it; mbuddy_plot detects it",
+  "              automatically.  Backtraces are not written in this",
+  "              format, and the summary goes to stderr.",
+  "",
+  " MB_SITES --  If set to N (> 0), allocations are aggregated online",
+  "              by call site (the top N backtrace frames): live",
+  "              bytes/blocks, peak and lifetime totals per site.",
+  "              The table is dumped at exit, on SIGUSR2, and every",
+  "              MB_SITES_EVERY seconds (if set) -- a kilobyte of",
+  "              per-site totals instead of a multi-gigabyte event",
+  "              log.  Addresses resolve with addr2line(1).",
+  "",
   NULL,
 };
 
@@ -503,42 +959,226 @@ open_stream(void)
   setbuf(fp, NULL);
   atexit(close_stream);
 
-  print_header(fp);
+  if (binary_mode)
+    fwrite(MB_BIN_MAGIC "\n", 1, 5, fp);
+  else
+    print_header(fp);
 
   return fp;
 }
 
 
-void
-mb_log(const char *fmt, ...)
+/*
+ * output_uleb128()/output_sleb128() follow the encoder in leb128.c,
+ * which is itself taken from binutils.
+ */
+static int
+output_uleb128(unsigned char *p, unsigned long value)
 {
-  va_list ap;
+  unsigned char *orig = p;
+
+  do {
+    unsigned byte = value & 0x7f;
+
+    value >>= 7;
+    if (value)
+      byte |= 0x80;
+    *p++ = byte;
+  } while (value);
+
+  return p - orig;
+}
+
+
+static int
+output_sleb128(unsigned char *p, long value)
+{
+  unsigned char *orig = p;
+  int more;
+
+  do {
+    unsigned byte = value & 0x7f;
+
+    value >>= 7;
+    more = !((value == 0 && (byte & 0x40) == 0) ||
+             (value == -1 && (byte & 0x40) != 0));
+    if (more)
+      byte |= 0x80;
+    *p++ = byte;
+  } while (more);
+
+  return p - orig;
+}
+
+
+/*
+ * The binary counterpart of mb_record(); one tagged varint record,
+ * plus an index record every MB_INDEX_EVERY records, appended with a
+ * single write(2).  Backtraces are not written in binary mode.
+ */
+static void
+mb_record_bin(int tag, size_t total, ssize_t delta, size_t size,
+              const void *oldp, const void *newp, const void *caller)
+{
+  unsigned char buf[256];
   struct timeval tv;
+  int len = 0;
+  int n;
 
   if (!mb_stream) {
-    init_env();
-    mb_stream = open_stream();
+    LOCK();
+    if (!mb_stream) {
+      init_env();
+      mb_stream = open_stream();
+    }
+    UNLOCK();
   }
 
-  va_start(ap, fmt);
+  if (gettimeofday(&tv, NULL) < 0)
+    tv.tv_sec = tv.tv_usec = 0;
+
+  buf[len++] = tag;
+  len += output_uleb128(buf + len, (unsigned long)tv.tv_sec);
+  len += output_uleb128(buf + len, (unsigned long)tv.tv_usec);
+  len += output_uleb128(buf + len, (unsigned long)total);
+  len += output_sleb128(buf + len, (long)delta);
+  len += output_uleb128(buf + len, (unsigned long)size);
+  len += output_uleb128(buf + len, (unsigned long)oldp);
+  len += output_uleb128(buf + len, (unsigned long)newp);
+  len += output_uleb128(buf + len, (unsigned long)caller);
+
+  n = __atomic_add_fetch(&mb_records, 1, __ATOMIC_RELAXED);
+  if (n % MB_INDEX_EVERY == 0) {
+    memcpy(buf + len, MB_BIN_MARK, MB_BIN_MARKLEN);
+    len += MB_BIN_MARKLEN;
+    buf[len++] = 'I';
+    len += output_uleb128(buf + len, (unsigned long)n);
+    len += output_uleb128(buf + len, (unsigned long)tv.tv_sec);
+    len += output_uleb128(buf + len, (unsigned long)tv.tv_usec);
+    len += output_uleb128(buf + len, (unsigned long)total);
+  }
+
+  write(fileno(mb_stream), buf, len);
+}
+
+
+/*
+ * Emit one record for an allocator operation.  TAG is 'm', 'r' or
+ * 'f'; DELTA is the change of the running total, SIZE the requested
+ * size, OLDP/NEWP the block addresses and CALLER the return address.
+ * Text mode produces the classic mb.out lines; MB_BINARY selects the
+ * compact varint format understood by mbuddy_dump.
+ */
+static void
+mb_emit(int trace, size_t total, int tag, ssize_t delta, size_t size,
+        const void *oldp, const void *newp, const void *caller)
+{
+  if (!mb_stream) {             /* binary_mode is decided by init_env() */
+    LOCK();
+    if (!mb_stream) {
+      init_env();
+      mb_stream = open_stream();
+    }
+    UNLOCK();
+  }
+
+  if (binary_mode) {
+    mb_record_bin(tag, total, delta, size, oldp, newp, caller);
+    return;
+  }
+
+  switch (tag) {
+  case 'm':
+    mb_record(trace, total, "%10zd: malloc(%zu) from %p => %p",
+              delta, size, caller, newp);
+    break;
+  case 'r':
+    mb_record(trace, total, "%10zd: realloc(%p, %zu) from %p => %p",
+              delta, oldp, size, caller, newp);
+    break;
+  case 'f':
+    mb_record(trace, total, "%10zd: free(%p) from %p", delta, oldp, caller);
+    break;
+  }
+}
+
+
+/*
+ * Decide whether this operation on SIZE bytes deserves a backtrace.
+ * backtrace(3) dominates the cost of mbuddy, so MB_BTSAMPLE=N keeps
+ * only every N-th one (per thread, no shared counter) while
+ * MB_BTSIZE always captures the big allocations leaks tend to hide
+ * in.  Unset, every operation is traced as before.
+ */
+static int
+want_trace(size_t size)
+{
+  static __thread unsigned skipped;
+
+  if (backtrace_mode == 0)
+    return 0;
+
+  if (bt_size && size >= bt_size)
+    return 1;
+
+  if (bt_sample <= 1)
+    return 1;
+
+  if (++skipped < (unsigned)bt_sample)
+    return 0;
+
+  skipped = 0;
+  return 1;
+}
+
+
+/*
+ * Append one record to the log with a single write(2) on the
+ * append-mode log fd, so that records from concurrent threads never
+ * interleave.  No lock is taken; TOTAL is the running total the
+ * caller observed when the operation was accounted, and TRACE tells
+ * whether to prepend a backtrace (see want_trace()).
+ */
+static void
+mb_record(int trace, size_t total, const char *fmt, ...)
+{
+  char buf[MB_RECORD_MAX];
+  struct timeval tv;
+  va_list ap;
+  int len = 0, n;
+
+  if (!mb_stream) {
+    LOCK();
+    if (!mb_stream) {
+      init_env();
+      mb_stream = open_stream();
+    }
+    UNLOCK();
+  }
+
+  if (trace)
+    len = format_trace(buf, sizeof(buf) - 1);
 
   if (gettimeofday(&tv, NULL) < 0)
     fprintf(stderr, "gettimeofday(2) failed: %s", strerror(errno));
   else {
-    fprintf(mb_stream,
-#if 0
-            "%10lu:%06u.%06u:%10zu:",
-            ++seq,
-#else
-            "%06u.%06u:%10zu:",
-#endif  /* 0 */
-            (unsigned)tv.tv_sec, (unsigned)tv.tv_usec, mb_allocated);
+    n = snprintf(buf + len, sizeof(buf) - 1 - len, "%06u.%06u:%10zu:",
+                 (unsigned)tv.tv_sec, (unsigned)tv.tv_usec, total);
+    if (n > 0)
+      len += n;
   }
 
-  vfprintf(mb_stream, fmt, ap);
-  fputc('\n', mb_stream);
-  fflush(mb_stream);
+  va_start(ap, fmt);
+  n = vsnprintf(buf + len, sizeof(buf) - 1 - len, fmt, ap);
   va_end(ap);
+  if (n > 0) {
+    if (n > (int)sizeof(buf) - 1 - len)
+      n = sizeof(buf) - 1 - len;
+    len += n;
+  }
+
+  buf[len++] = '\n';
+  write(fileno(mb_stream), buf, len);
 }
 
 
@@ -588,31 +1228,36 @@ malloc_init(void)
 }
 
 
-static void
-print_trace(void)
+/* format the backtrace of the current call into BUF, comment-style,
+ * so that mb_record() can emit it with the record in one write(2). */
+static int
+format_trace(char *buf, size_t size)
 {
   void *array[MAX_BACKTRACE];
-  size_t size;
+  size_t nframes;
   char **strings;
   size_t i;
+  int len = 0, n;
 
-  if (backtrace_mode == 0)
-    return;
-
-  if (!mb_stream) {
-    init_env();
-    mb_stream = open_stream();
-  }
+  nframes = backtrace(array, backtrace_mode);
+  strings = backtrace_symbols(array, nframes);
 
-  size = backtrace(array, backtrace_mode);
-  strings = backtrace_symbols(array, size);
+  n = snprintf(buf + len, size - len, "# Obtained %zd stack frames.\n",
+               nframes);
+  if (n > 0)
+    len += n;
 
-  fprintf(mb_stream, "# Obtained %zd stack frames.\n", size);
-
-  for (i = 0; i < size; i++)
-    fprintf(mb_stream, "# [BT] %d: %s\n", i, strings[i]);
+  for (i = 0; i < nframes && len < (int)size; i++) {
+    n = snprintf(buf + len, size - len, "# [BT] %zu: %s\n", i, strings[i]);
+    if (n <= 0)
+      break;
+    len += n;
+  }
+  if (len > (int)size)
+    len = size;
 
-  free (strings);
+  free(strings);
+  return len;
 }
 
 
@@ -0,0 +1,251 @@
+/*
+ * mbuddy_dump: decode binary mbuddy logs (see MB_BINARY in mbuddy.c)
+ *
+ * The binary log starts with "MBB1\n"; each record is a one-byte tag
+ * ('m', 'r', 'f') followed by LEB128 varints: sec, usec, total,
+ * delta (signed), size, old pointer, new pointer, caller.  Every few
+ * thousand records an index record follows -- an 8-byte sync marker,
+ * the tag 'I' and varints count, sec, usec, total -- so this tool
+ * can seek to an arbitrary byte offset (-o) and resynchronize there
+ * instead of decoding a multi-GB capture from the beginning.
+ *
+ * read_uleb128()/read_sleb128() follow the decoder in leb128.c,
+ * which is itself taken from binutils.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MB_BIN_MARK     "\377\377\377\377MBX"
+#define MB_BIN_MARKLEN  8       /* the marker includes its NUL */
+
+static int option_plot = 0;
+static long option_offset = -1;
+static long option_count = -1;
+
+static void help_and_exit(void);
+
+
+static int
+read_uleb128(FILE *fp, unsigned long *value)
+{
+  unsigned long result = 0;
+  int shift = 0;
+  int c;
+
+  while ((c = getc(fp)) != EOF) {
+    result |= (unsigned long)(c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      *value = result;
+      return 0;
+    }
+    shift += 7;
+  }
+  return -1;
+}
+
+
+static int
+read_sleb128(FILE *fp, long *value)
+{
+  unsigned long result = 0;
+  int shift = 0;
+  int c;
+
+  while ((c = getc(fp)) != EOF) {
+    result |= (unsigned long)(c & 0x7f) << shift;
+    shift += 7;
+    if (!(c & 0x80)) {
+      if (shift < (int)(sizeof(long) * 8) && (c & 0x40))
+        result |= -((unsigned long)1 << shift);
+      *value = (long)result;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+
+/* scan forward for the 8-byte sync marker; returns 0 when found */
+static int
+resync(FILE *fp)
+{
+  const unsigned char *mark = (const unsigned char *)MB_BIN_MARK;
+  int matched = 0;
+  int c;
+
+  while ((c = getc(fp)) != EOF) {
+    if (c == mark[matched]) {
+      if (++matched == MB_BIN_MARKLEN)
+        return 0;
+    }
+    else
+      matched = (c == mark[0]) ? 1 : 0;
+  }
+  return -1;
+}
+
+
+/* decode one index record body (after the marker and the 'I' tag) */
+static int
+read_index(FILE *fp, unsigned long *count)
+{
+  unsigned long sec, usec, total;
+
+  if (read_uleb128(fp, count) == -1 ||
+      read_uleb128(fp, &sec) == -1 ||
+      read_uleb128(fp, &usec) == -1 ||
+      read_uleb128(fp, &total) == -1)
+    return -1;
+
+  if (!option_plot)
+    printf("# index: record %lu, %06lu.%06lu, total %lu\n",
+           *count, sec, usec, total);
+  return 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+  FILE *fp;
+  const char *pathname = "mb.out";
+  char magic[5];
+  unsigned long nr = 0;
+  int opt, c;
+
+  while ((opt = getopt(argc, argv, "po:c:h")) != -1) {
+    switch (opt) {
+    case 'p':
+      option_plot = 1;
+      break;
+    case 'o':
+      option_offset = strtol(optarg, NULL, 0);
+      break;
+    case 'c':
+      option_count = strtol(optarg, NULL, 0);
+      break;
+    case 'h':
+      help_and_exit();
+      break;
+    default:
+      fprintf(stderr, "Try `-h' for more help.\n");
+      return 1;
+    }
+  }
+
+  if (optind < argc)
+    pathname = argv[optind];
+
+  fp = fopen(pathname, "rb");
+  if (!fp) {
+    fprintf(stderr, "error: cannot open `%s'\n", pathname);
+    return 1;
+  }
+
+  if (fread(magic, 1, 5, fp) != 5 || memcmp(magic, "MBB1\n", 5) != 0) {
+    fprintf(stderr, "error: `%s' is not a binary mbuddy log\n", pathname);
+    return 1;
+  }
+
+  if (option_offset > 5) {
+    fseek(fp, option_offset, SEEK_SET);
+    if (resync(fp) == -1) {
+      fprintf(stderr, "error: no index record after offset %ld\n",
+              option_offset);
+      return 1;
+    }
+    if ((c = getc(fp)) != 'I' || read_index(fp, &nr) == -1) {
+      fprintf(stderr, "error: corrupt index record\n");
+      return 1;
+    }
+  }
+
+  while ((c = getc(fp)) != EOF) {
+    unsigned long sec, usec, total, size, oldp, newp, caller;
+    long delta;
+
+    if (c == (unsigned char)MB_BIN_MARK[0]) {
+      /* an index record in the middle of sequential reading */
+      ungetc(c, fp);
+      if (resync(fp) == -1)
+        break;
+      if ((c = getc(fp)) != 'I' || read_index(fp, &nr) == -1) {
+        fprintf(stderr, "error: corrupt index record\n");
+        return 1;
+      }
+      continue;
+    }
+
+    if (c != 'm' && c != 'r' && c != 'f') {
+      fprintf(stderr, "error: unknown record tag 0x%02x\n", c);
+      return 1;
+    }
+
+    if (read_uleb128(fp, &sec) == -1 ||
+        read_uleb128(fp, &usec) == -1 ||
+        read_uleb128(fp, &total) == -1 ||
+        read_sleb128(fp, &delta) == -1 ||
+        read_uleb128(fp, &size) == -1 ||
+        read_uleb128(fp, &oldp) == -1 ||
+        read_uleb128(fp, &newp) == -1 ||
+        read_uleb128(fp, &caller) == -1) {
+      fprintf(stderr, "error: truncated record\n");
+      return 1;
+    }
+
+    nr++;
+
+    if (option_plot)
+      printf("%lu %lu %ld\n", nr, total, delta);
+    else {
+      switch (c) {
+      case 'm':
+        printf("%06lu.%06lu:%10lu:%10ld: malloc(%lu) from 0x%lx => 0x%lx\n",
+               sec, usec, total, delta, size, caller, newp);
+        break;
+      case 'r':
+        printf("%06lu.%06lu:%10lu:%10ld: realloc(0x%lx, %lu) "
+               "from 0x%lx => 0x%lx\n",
+               sec, usec, total, delta, oldp, size, caller, newp);
+        break;
+      case 'f':
+        printf("%06lu.%06lu:%10lu:%10ld: free(0x%lx) from 0x%lx\n",
+               sec, usec, total, delta, oldp, caller);
+        break;
+      }
+    }
+
+    if (option_count > 0 && --option_count == 0)
+      break;
+  }
+
+  fclose(fp);
+  return 0;
+}
+
+
+static void
+help_and_exit(void)
+{
+  static const char *msgs[] = {
+    "usage: mbuddy_dump [OPTION...] [FILE]",
+    "decode a binary mbuddy log (MB_BINARY=1); FILE defaults to mb.out",
+    "",
+    "  -p         plot output: one \"NR TOTAL DELTA\" line per record",
+    "             (what mbuddy_plot feeds to gnuplot)",
+    "  -o OFFSET  seek to byte OFFSET and resume at the next index",
+    "             record, instead of decoding from the beginning",
+    "  -c COUNT   stop after COUNT records",
+    "  -h         show this message and exit",
+    NULL,
+  };
+  int i;
+
+  for (i = 0; msgs[i]; i++)
+    puts(msgs[i]);
+
+  exit(0);
+}
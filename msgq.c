@@ -16,6 +16,8 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+/* for sendmmsg(2)/recvmmsg(2), struct mmsghdr and MSG_WAITFORONE */
+#define _GNU_SOURCE
 
 #include <assert.h>
 #include <stdarg.h>
@@ -24,10 +26,17 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <signal.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <time.h>
 
@@ -47,6 +56,49 @@
 
 #define sizeof_packet(packet)   (sizeof(*(packet)) + (packet)->size)
 
+/* Number of datagrams the receiver thread drains per recvmmsg(2)
+ * call, and the size of the receive buffer in MSGQ_MSG_MAX units. */
+#define MSGQ_RECV_BATCH 32
+
+/*
+ * Shared-memory ring transport (addresses of the form "shm:/name").
+ *
+ * The shm object holds a bounded MPMC ring of MSGQ_SHM_SLOTS fixed
+ * slots, coordinated with per-slot sequence numbers (Vyukov's bounded
+ * queue), so co-located producers enqueue with one memcpy and no
+ * lock.  The consumer (our receiver thread) blocks on NOTIFY, a futex
+ * word that producers bump once per enqueue.  A slot carries the same
+ * bytes that would have gone over the socket (struct msgq_packet
+ * image), so everything downstream of the receiver thread is shared
+ * with the socket transport.
+ */
+#define MSGQ_SHM_PREFIX         "shm:"
+#define MSGQ_SHM_PREFIX_LEN     (sizeof(MSGQ_SHM_PREFIX) - 1)
+#define MSGQ_SHM_SLOTS          64      /* power of two */
+#define MSGQ_SHM_MAGIC          0x5251534du     /* "MSQR" */
+
+struct shm_slot {
+  unsigned seq;
+  char sender[UNIX_PATH_MAX];
+  size_t size;                  /* bytes used in data[] */
+  unsigned char data[MSGQ_MSG_MAX];
+};
+
+struct shm_ring {
+  unsigned magic;               /* stored last on creation */
+  unsigned nslot;
+  unsigned epos;                /* enqueue ticket */
+  unsigned dpos;                /* dequeue ticket */
+  int notify;                   /* futex word; one bump per enqueue */
+  struct shm_slot slot[MSGQ_SHM_SLOTS];
+};
+
+struct shm_peer {               /* send-side cache of attached rings */
+  char name[UNIX_PATH_MAX];
+  struct shm_ring *ring;
+  struct shm_peer *next;
+};
+
 /*
  * All received message is packaged in struct msgq_node.  This struct
  * provides 'link' so that each struct can be wired in a doubly linked list
@@ -83,14 +135,17 @@ struct msgq_node {
  */
 struct msgq_ {
   int fd;
+  int evfd;                     /* readable iff packets are queued;
+                                 * exported by msgq_pollfd() */
   char address[UNIX_PATH_MAX];
 
   unsigned char *pkbuf;         /* internal buffer to receive a message */
 
   int broadcast;                /* use ptheread_cond_broatcast() if nonzero */
 
-  struct elist recvq;           /* queue for received messages */
-  size_t recvs;                 /* number of packets in recvq */
+  struct elist recvq[MSGQ_LANES]; /* per-lane queues; high lane first */
+  size_t recvs;                 /* number of packets over all lanes */
+  long drops;                   /* packets dropped past their deadline */
 
 
   pthread_cond_t recv_cond;     /* condition for waiting for incoming msg */
@@ -101,6 +156,10 @@ struct msgq_ {
   int receiver_status;          /* receiver status, MSGQ_STAT_* */
 
   pthread_t receiver;           /* thread for receiving messages */
+
+  struct shm_ring *ring;        /* non-NULL if shm transport is used */
+  struct shm_peer *peers;       /* cached mappings of remote rings */
+  pthread_mutex_t peer_mutex;   /* guards 'peers' */
 };
 
 #define MSGQ_LOCK(msgq)        LOCK(&(msgq)->recv_mutex, "recv")
@@ -110,6 +169,14 @@ struct msgq_ {
 static int validate_packet(struct msgq_packet *packet, ssize_t len);
 static int msgq_start_receiver(MSGQ *msgq);
 static void *msgq_receiver(void *arg);
+static void *msgq_shm_receiver(void *arg);
+
+static struct shm_ring *shm_ring_map(const char *name, int create);
+static int shm_ring_push(struct shm_ring *r, const char *sender,
+                         const struct msgq_packet *packet);
+static ssize_t shm_ring_pop(struct shm_ring *r, char *sender, void *buf);
+static int msgq_shm_send(MSGQ *msgq, const char *receiver,
+                         const struct msgq_packet *packet);
 static int msgq_get_listener(MSGQ *msgq, const char *address);
 
 static int bind_anonymous(int fd, char address[]);
@@ -120,6 +187,7 @@ static struct msgq_node *msgq_node_create(const char *sender,
 static int gettime(struct timespec *res);
 static int timespec_subtract(struct timespec *result,
                              struct timespec *x, struct timespec *y);
+static struct elist *msgq_pop_node(MSGQ *msgq);
 
 #ifndef NDEBUG
 static void verror_(const char *kind, int status, int errnum,
@@ -159,6 +227,34 @@ UNLOCK(pthread_mutex_t *mutex, const char *id)
 }
 
 
+/*
+ * The eventfd counter mirrors the number of queued packets: the
+ * receiver threads post one count per node they enqueue, and the pop
+ * path takes one count per node delivered or dropped.  Since the
+ * counter moves after the list does, a poller may see a brief
+ * readable-but-empty window (like a spurious condvar wakeup); it must
+ * treat a NULL msgq_recv() after a wakeup as normal.
+ */
+static __inline__ void
+evfd_post(MSGQ *msgq, int count)
+{
+  uint64_t v = count;
+
+  while (write(msgq->evfd, &v, sizeof(v)) < 0 && errno == EINTR)
+    ;
+}
+
+
+static __inline__ void
+evfd_take(MSGQ *msgq)
+{
+  uint64_t v;
+
+  while (read(msgq->evfd, &v, sizeof(v)) < 0 && errno == EINTR)
+    ;
+}
+
+
 static int
 gettime(struct timespec *res)
 {
@@ -209,6 +305,8 @@ msgq_send_string(MSGQ *msgq, const char *receiver, const char *fmt, ...)
   va_end(ap);
   p->size = ret + 1;
   p->container = NULL;
+  p->lane = 0;
+  p->deadline = 0;
 
   ret = msgq_send_(msgq, receiver, p);
   free(p);
@@ -326,7 +424,7 @@ msgq_recv_timedwait(MSGQ *msgq, struct timespec *abstime)
   MSGQ_LOCK(msgq);
 
   while (1) {
-    p = edque_pop_front(&msgq->recvq);
+    p = msgq_pop_node(msgq);
     if (p)
       break;
 
@@ -442,6 +540,67 @@ timespec_subtract(struct timespec *result,
   return x->tv_sec < y->tv_sec;
 }
 
+static __inline__ long long
+msgq_now_msec(void)
+{
+  struct timespec ts;
+  gettime(&ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/*
+ * Pop the next deliverable node, preferring higher lanes.  Expired
+ * packets are destroyed on the way (counted in 'drops') rather than
+ * delivered.  The caller must hold 'recv_mutex' and decrement 'recvs'
+ * for the returned node.
+ */
+static struct elist *
+msgq_pop_node(MSGQ *msgq)
+{
+  struct elist *p;
+  struct msgq_node *np;
+  long long now = 0;            /* fetched lazily; 0 means not yet */
+  int lane;
+
+  for (lane = MSGQ_LANES - 1; lane >= 0; lane--) {
+    while ((p = edque_pop_front(&msgq->recvq[lane])) != NULL) {
+      np = ELIST_ENTRY(p, struct msgq_node, link);
+
+      if (np->packet->deadline != 0) {
+        if (now == 0)
+          now = msgq_now_msec();
+        if (np->packet->deadline < now) {
+          DEBUG(0, "dropping expired packet from %s", np->sender);
+          msgq->recvs--;
+          msgq->drops++;
+          evfd_take(msgq);
+          free(np->packet);
+          free(np);
+          continue;
+        }
+      }
+      evfd_take(msgq);
+      return p;
+    }
+  }
+  return NULL;
+}
+
+
+long
+msgq_drop_count(MSGQ *msgq)
+{
+  long ret;
+
+  MSGQ_LOCK(msgq);
+  ret = msgq->drops;
+  MSGQ_UNLOCK(msgq);
+
+  return ret;
+}
+
+
 struct msgq_packet *
 msgq_recv(MSGQ *msgq)
 {
@@ -449,7 +608,7 @@ msgq_recv(MSGQ *msgq)
   struct msgq_node *np;
 
   MSGQ_LOCK(msgq);
-  p = edque_pop_front(&msgq->recvq);
+  p = msgq_pop_node(msgq);
   if (!p) {
     MSGQ_UNLOCK(msgq);
     return NULL;
@@ -475,6 +634,37 @@ msgq_send(MSGQ *msgq, const char *receiver,
 
   p->container = 0;
   p->size = size;
+  p->lane = 0;
+  p->deadline = 0;
+  memcpy(p->data, packet, size);
+
+  ret = msgq_send_(msgq, receiver, p);
+  free(p);
+
+  return ret;
+}
+
+
+int
+msgq_send_prio(MSGQ *msgq, const char *receiver,
+               const void *packet, size_t size, int lane, long timeout_msec)
+{
+  struct msgq_packet *p;
+  int ret;
+
+  if (lane < 0 || lane >= MSGQ_LANES) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  p = malloc(sizeof(*p) + size);
+  if (!p)
+    return -1;
+
+  p->container = 0;
+  p->size = size;
+  p->lane = lane;
+  p->deadline = (timeout_msec > 0) ? msgq_now_msec() + timeout_msec : 0;
   memcpy(p->data, packet, size);
 
   ret = msgq_send_(msgq, receiver, p);
@@ -490,6 +680,9 @@ msgq_send_(MSGQ *msgq, const char *receiver, const struct msgq_packet *packet)
   struct sockaddr_un addr;
   ssize_t ret;
 
+  if (strncmp(receiver, MSGQ_SHM_PREFIX, MSGQ_SHM_PREFIX_LEN) == 0)
+    return msgq_shm_send(msgq, receiver, packet);
+
   addr.sun_family = AF_LOCAL;
   strncpy(addr.sun_path, receiver, sizeof(addr.sun_path) - 1);
 
@@ -507,6 +700,401 @@ msgq_send_(MSGQ *msgq, const char *receiver, const struct msgq_packet *packet)
 }
 
 
+int
+msgq_send_batch(MSGQ *msgq, const char *receiver,
+                const struct msgq_packet *packets[], int count)
+{
+  struct sockaddr_un addr;
+  struct mmsghdr *msgs;
+  struct iovec *iovs;
+  int i, sent, total = 0;
+
+  if (count <= 0)
+    return 0;
+
+  if (strncmp(receiver, MSGQ_SHM_PREFIX, MSGQ_SHM_PREFIX_LEN) == 0) {
+    /* no multi-message syscall to amortize here; push one by one */
+    for (i = 0; i < count; i++)
+      if (msgq_shm_send(msgq, receiver, packets[i]) < 0)
+        return i > 0 ? i : -1;
+    return count;
+  }
+
+  msgs = malloc((sizeof(*msgs) + sizeof(*iovs)) * count);
+  if (!msgs)
+    return -1;
+  iovs = (struct iovec *)(msgs + count);
+
+  addr.sun_family = AF_LOCAL;
+  strncpy(addr.sun_path, receiver, sizeof(addr.sun_path) - 1);
+
+  for (i = 0; i < count; i++) {
+    iovs[i].iov_base = (void *)packets[i];
+    iovs[i].iov_len = sizeof_packet(packets[i]);
+
+    memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &addr;
+    msgs[i].msg_hdr.msg_namelen = sizeof(addr);
+  }
+
+  while (total < count) {
+    sent = sendmmsg(msgq->fd, msgs + total, count - total, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (total == 0) {
+        WARN(errno, "sendmmsg(2) failed");
+        total = -1;
+      }
+      break;
+    }
+    total += sent;
+  }
+
+  free(msgs);
+  return total;
+}
+
+
+int
+msgq_recv_batch(MSGQ *msgq, struct msgq_packet *packets[], int count)
+{
+  struct elist *p;
+  struct msgq_node *np;
+  int n = 0;
+
+  if (count <= 0)
+    return 0;
+
+  MSGQ_LOCK(msgq);
+  while (n < count && (p = msgq_pop_node(msgq)) != NULL) {
+    msgq->recvs--;
+    np = ELIST_ENTRY(p, struct msgq_node, link);
+    packets[n++] = np->packet;
+  }
+  MSGQ_UNLOCK(msgq);
+
+  return n;
+}
+
+
+int
+msgq_pollfd(MSGQ *msgq)
+{
+  return msgq->evfd;
+}
+
+
+int
+msgq_select(MSGQ *queues[], int count, long timeout_msec)
+{
+  struct pollfd fds[count];
+  static unsigned rr;           /* rotates the scan start for fairness */
+  unsigned start;
+  int i, k, n;
+
+  if (count <= 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (i = 0; i < count; i++) {
+    fds[i].fd = queues[i]->evfd;
+    fds[i].events = POLLIN;
+    fds[i].revents = 0;
+  }
+
+  do
+    n = poll(fds, count, timeout_msec < 0 ? -1 : (int)timeout_msec);
+  while (n < 0 && errno == EINTR);
+
+  if (n < 0)
+    return -1;
+  if (n == 0) {
+    errno = ETIMEDOUT;
+    return -1;
+  }
+
+  /* several queues may be ready; report a different one each call so
+   * a busy queue cannot starve the others */
+  start = __atomic_fetch_add(&rr, 1, __ATOMIC_RELAXED);
+  for (k = 0; k < count; k++) {
+    i = (start + k) % count;
+    if (fds[i].revents & (POLLIN | POLLERR | POLLHUP))
+      return i;
+  }
+
+  errno = EIO;                  /* cannot happen: N > 0 said otherwise */
+  return -1;
+}
+
+
+static __inline__ int
+futex_op(int *addr, int op, int val)
+{
+  return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+
+static struct shm_ring *
+shm_ring_map(const char *name, int create)
+{
+  struct shm_ring *r;
+  int fd, i;
+  int saved_errno;
+
+  fd = shm_open(name, create ? (O_RDWR | O_CREAT | O_EXCL) : O_RDWR,
+                MSGQ_PERM_DEFAULT);
+  if (fd < 0) {
+    WARN(errno, "shm_open(3) failed");
+    return NULL;
+  }
+
+  if (create && ftruncate(fd, sizeof(struct shm_ring)) < 0) {
+    WARN(errno, "ftruncate(2) failed");
+    saved_errno = errno;
+    close(fd);
+    shm_unlink(name);
+    errno = saved_errno;
+    return NULL;
+  }
+
+  r = mmap(NULL, sizeof(struct shm_ring), PROT_READ | PROT_WRITE,
+           MAP_SHARED, fd, 0);
+  saved_errno = errno;
+  close(fd);
+
+  if (r == MAP_FAILED) {
+    WARN(saved_errno, "mmap(2) failed");
+    if (create)
+      shm_unlink(name);
+    errno = saved_errno;
+    return NULL;
+  }
+
+  if (create) {
+    r->nslot = MSGQ_SHM_SLOTS;
+    r->epos = r->dpos = 0;
+    r->notify = 0;
+    for (i = 0; i < MSGQ_SHM_SLOTS; i++)
+      r->slot[i].seq = i;
+    /* publish MAGIC last so attachers never see a half-built ring */
+    __atomic_store_n(&r->magic, MSGQ_SHM_MAGIC, __ATOMIC_RELEASE);
+  }
+  else if (__atomic_load_n(&r->magic, __ATOMIC_ACQUIRE) != MSGQ_SHM_MAGIC) {
+    WARN(0, "shm ring (%s) is not initialized", name);
+    munmap(r, sizeof(struct shm_ring));
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return r;
+}
+
+
+static int
+shm_ring_push(struct shm_ring *r, const char *sender,
+              const struct msgq_packet *packet)
+{
+  struct shm_slot *s;
+  unsigned pos, seq;
+  size_t len = sizeof_packet(packet);
+
+  if (len > sizeof(s->data)) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  pos = __atomic_load_n(&r->epos, __ATOMIC_RELAXED);
+  for (;;) {
+    s = &r->slot[pos & (r->nslot - 1)];
+    seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+
+    if (seq == pos) {
+      if (__atomic_compare_exchange_n(&r->epos, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    else if ((int)(seq - pos) < 0) {
+      errno = EAGAIN;           /* ring is full */
+      return -1;
+    }
+    else
+      pos = __atomic_load_n(&r->epos, __ATOMIC_RELAXED);
+  }
+
+  strncpy(s->sender, sender, UNIX_PATH_MAX - 1);
+  s->sender[UNIX_PATH_MAX - 1] = '\0';
+  s->size = len;
+  memcpy(s->data, packet, len);
+  __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+
+  __atomic_fetch_add(&r->notify, 1, __ATOMIC_RELEASE);
+  futex_op(&r->notify, FUTEX_WAKE, 1);
+
+  return 0;
+}
+
+
+/*
+ * Pop one message into BUF (at least MSGQ_MSG_MAX bytes) and SENDER
+ * (at least UNIX_PATH_MAX bytes).  Returns the number of payload
+ * byte(s) copied, or -1 if the ring is empty.
+ */
+static ssize_t
+shm_ring_pop(struct shm_ring *r, char *sender, void *buf)
+{
+  struct shm_slot *s;
+  unsigned pos, seq;
+  ssize_t len;
+
+  pos = __atomic_load_n(&r->dpos, __ATOMIC_RELAXED);
+  for (;;) {
+    s = &r->slot[pos & (r->nslot - 1)];
+    seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+
+    if (seq == pos + 1) {
+      if (__atomic_compare_exchange_n(&r->dpos, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    else if ((int)(seq - (pos + 1)) < 0)
+      return -1;                /* ring is empty */
+    else
+      pos = __atomic_load_n(&r->dpos, __ATOMIC_RELAXED);
+  }
+
+  len = s->size;
+  memcpy(sender, s->sender, UNIX_PATH_MAX);
+  memcpy(buf, s->data, len);
+  __atomic_store_n(&s->seq, pos + r->nslot, __ATOMIC_RELEASE);
+
+  return len;
+}
+
+
+/*
+ * Return the (cached) mapping of the ring at RECEIVER, attaching on
+ * first use.  RECEIVER includes the "shm:" prefix.
+ */
+static struct shm_ring *
+msgq_peer_ring(MSGQ *msgq, const char *receiver)
+{
+  struct shm_peer *p;
+  struct shm_ring *ring;
+
+  if (msgq->ring && strcmp(receiver, msgq->address) == 0)
+    return msgq->ring;
+
+  LOCK(&msgq->peer_mutex, "peer");
+  for (p = msgq->peers; p != NULL; p = p->next)
+    if (strcmp(p->name, receiver) == 0) {
+      UNLOCK(&msgq->peer_mutex, "peer");
+      return p->ring;
+    }
+
+  ring = shm_ring_map(receiver + MSGQ_SHM_PREFIX_LEN, 0);
+  if (ring) {
+    p = malloc(sizeof(*p));
+    if (p) {
+      strncpy(p->name, receiver, UNIX_PATH_MAX - 1);
+      p->name[UNIX_PATH_MAX - 1] = '\0';
+      p->ring = ring;
+      p->next = msgq->peers;
+      msgq->peers = p;
+    }
+    else {
+      munmap(ring, sizeof(struct shm_ring));
+      ring = NULL;
+    }
+  }
+  UNLOCK(&msgq->peer_mutex, "peer");
+
+  return ring;
+}
+
+
+static int
+msgq_shm_send(MSGQ *msgq, const char *receiver,
+              const struct msgq_packet *packet)
+{
+  struct shm_ring *ring = msgq_peer_ring(msgq, receiver);
+
+  if (!ring)
+    return -1;
+
+  return shm_ring_push(ring, msgq->address, packet);
+}
+
+
+static void *
+msgq_shm_receiver(void *arg)
+{
+  MSGQ *msgq = (MSGQ *)arg;
+  struct msgq_packet *packet;
+  struct msgq_node *np;
+  char sender[UNIX_PATH_MAX];
+  ssize_t len;
+  int seen;
+
+  DEBUG(0, "receiver: shm thread started");
+
+  MSGQ_LOCK(msgq);
+  msgq->receiver_status = MSGQ_STAT_ALIVE;
+  pthread_cond_broadcast(&msgq->stat_cond);
+  MSGQ_UNLOCK(msgq);
+
+  while (1) {
+    seen = __atomic_load_n(&msgq->ring->notify, __ATOMIC_ACQUIRE);
+    len = shm_ring_pop(msgq->ring, sender, msgq->pkbuf);
+    if (len < 0) {
+      /* Harmless race: if NOTIFY moved since SEEN, FUTEX_WAIT
+       * returns EAGAIN immediately and we retry the pop. */
+      futex_op(&msgq->ring->notify, FUTEX_WAIT, seen);
+      continue;
+    }
+
+    packet = (struct msgq_packet *)msgq->pkbuf;
+    if (validate_packet(packet, len) < 0) {
+      DEBUG(0, "receiver: ignoring invalid(too short) packet from %s",
+            sender);
+      continue;
+    }
+
+    if (strcmp(sender, msgq->address) == 0) {
+      /* Self-control message */
+      if (strncmp(packet->data, "shutdown", 8) == 0) {
+        DEBUG(0, "receiver: initiate shutdown sequence");
+        break;
+      }
+    }
+
+    np = msgq_node_create(sender, packet);
+    if (!np)
+      continue;
+
+    MSGQ_LOCK(msgq);
+    edque_push_back(&msgq->recvq[np->packet->lane], &np->link);
+    msgq->recvs++;
+    evfd_post(msgq, 1);
+
+    if (msgq->broadcast)
+      pthread_cond_broadcast(&msgq->recv_cond);
+    else
+      pthread_cond_signal(&msgq->recv_cond);
+    MSGQ_UNLOCK(msgq);
+  }
+
+  MSGQ_LOCK(msgq);
+  msgq->receiver_status = MSGQ_STAT_DEAD;
+  pthread_cond_broadcast(&msgq->recv_cond);
+  pthread_cond_broadcast(&msgq->stat_cond);
+  MSGQ_UNLOCK(msgq);
+
+  return NULL;
+}
+
+
 #ifdef MSGQ_BROADCAST
 int
 msgq_broadcast_string_wildcard(MSGQ *msgq, const char *pattern,
@@ -527,6 +1115,8 @@ msgq_broadcast_string_wildcard(MSGQ *msgq, const char *pattern,
   va_end(ap);
   p->size = ret + 1;
   p->container = NULL;
+  p->lane = 0;
+  p->deadline = 0;
 
   msgq_broadcast_wildcard(msgq, pattern, p);
 
@@ -571,7 +1161,7 @@ msgq_open(const char *address)
 
   memset(p, 0, sizeof(*p));
 
-  p->pkbuf = malloc(MSGQ_MSG_MAX);
+  p->pkbuf = malloc(MSGQ_MSG_MAX * MSGQ_RECV_BATCH);
   if (!p->pkbuf) {
     saved_errno = errno;
     free(p);
@@ -579,10 +1169,28 @@ msgq_open(const char *address)
     return NULL;
   }
 
+  /* EFD_SEMAPHORE so one read consumes one packet's worth of count */
+  p->evfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+  if (p->evfd < 0) {
+    saved_errno = errno;
+    free(p->pkbuf);
+    free(p);
+    errno = saved_errno;
+    return NULL;
+  }
+
   p->fd = -1;
-  ELIST_INIT(p->recvq);
+  {
+    int lane;
+    for (lane = 0; lane < MSGQ_LANES; lane++)
+      ELIST_INIT(p->recvq[lane]);
+  }
   p->recvs = 0;
+  p->drops = 0;
   p->broadcast = 0;
+  p->ring = NULL;
+  p->peers = NULL;
+  pthread_mutex_init(&p->peer_mutex, NULL);
 
   pthread_mutexattr_init(&attr);
   pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
@@ -607,7 +1215,16 @@ msgq_open(const char *address)
   MSGQ_LOCK(p);
   p->receiver_status = MSGQ_STAT_INIT;
 
-  if (msgq_get_listener(p, address) < 0) {
+  if (address &&
+      strncmp(address, MSGQ_SHM_PREFIX, MSGQ_SHM_PREFIX_LEN) == 0) {
+    p->ring = shm_ring_map(address + MSGQ_SHM_PREFIX_LEN, 1);
+    if (!p->ring) {
+      saved_errno = errno;
+      goto err;
+    }
+    strncpy(p->address, address, UNIX_PATH_MAX - 1);
+  }
+  else if (msgq_get_listener(p, address) < 0) {
     saved_errno = errno;
     goto err;
   }
@@ -628,8 +1245,13 @@ msgq_open(const char *address)
   MSGQ_UNLOCK(p);
   if (p->fd >= 0)
     close(p->fd);
+  if (p->ring) {
+    munmap(p->ring, sizeof(struct shm_ring));
+    shm_unlink(p->address + MSGQ_SHM_PREFIX_LEN);
+  }
   pthread_mutex_destroy(&p->recv_mutex);
  err_free_livemutex:
+  close(p->evfd);
   if (p->pkbuf)
     free(p->pkbuf);
   if (p)
@@ -670,6 +1292,24 @@ msgq_close(MSGQ *msgq)
     msgq->fd = -1;
   }
 
+  if (msgq->evfd >= 0) {
+    close(msgq->evfd);
+    msgq->evfd = -1;
+  }
+
+  if (msgq->ring) {
+    munmap(msgq->ring, sizeof(struct shm_ring));
+    shm_unlink(msgq->address + MSGQ_SHM_PREFIX_LEN);
+    msgq->ring = NULL;
+  }
+
+  while (msgq->peers) {
+    struct shm_peer *peer = msgq->peers;
+    msgq->peers = peer->next;
+    munmap(peer->ring, sizeof(struct shm_ring));
+    free(peer);
+  }
+
   if (msgq->pkbuf) {
     free(msgq->pkbuf);
     msgq->pkbuf = NULL;
@@ -678,18 +1318,23 @@ msgq_close(MSGQ *msgq)
   /* TODO: delete all remaining packets??? */
   DEBUG(0, "%u packet(s) will be destroyed", msgq->recvs);
 
-  while ((p = edque_pop_front(&msgq->recvq)) != NULL) {
-    np = ELIST_ENTRY(p, struct msgq_node, link);
-    msgq->recvs--;
+  {
+    int lane;
+    for (lane = 0; lane < MSGQ_LANES; lane++)
+      while ((p = edque_pop_front(&msgq->recvq[lane])) != NULL) {
+        np = ELIST_ENTRY(p, struct msgq_node, link);
+        msgq->recvs--;
 
-    DEBUG(0, "\tdestroying packet from %s...", np->sender);
-    free(np->packet);
-    free(np);
+        DEBUG(0, "\tdestroying packet from %s...", np->sender);
+        free(np->packet);
+        free(np);
+      }
   }
 
   MSGQ_UNLOCK(msgq);
 
   /* TODO: possible race condition? */
+  pthread_mutex_destroy(&msgq->peer_mutex);
   pthread_mutex_destroy(&msgq->recv_mutex);
   free(msgq);
 
@@ -837,7 +1482,8 @@ msgq_start_receiver(MSGQ *msgq)
   pthread_sigmask(SIG_SETMASK, &cur, NULL);
 
   if ((ret = pthread_create(&msgq->receiver, NULL,
-                            msgq_receiver, (void *)msgq)) != 0) {
+                            msgq->ring ? msgq_shm_receiver : msgq_receiver,
+                            (void *)msgq)) != 0) {
     WARN(ret, "pthread_create(3) failed");
     saved_errno = ret;
     ret = -1;
@@ -866,8 +1512,11 @@ static void *
 msgq_receiver(void *arg)
 {
   int fd;
-  struct sockaddr_un addr;
-  socklen_t addrlen;
+  struct mmsghdr msgs[MSGQ_RECV_BATCH];
+  struct iovec iovs[MSGQ_RECV_BATCH];
+  struct sockaddr_un addrs[MSGQ_RECV_BATCH];
+  struct msgq_node *nodes[MSGQ_RECV_BATCH];
+  int i, nrecv, nnodes, stop = 0;
   ssize_t len;
   struct msgq_packet *packet;
   struct msgq_node *np;
@@ -882,49 +1531,74 @@ msgq_receiver(void *arg)
   fd = msgq->fd;
   MSGQ_UNLOCK(msgq);
 
-  while (1) {
+  while (!stop) {
     //pthread_testcancel();
 
-    DEBUG(0, "receiver: waiting for incoming packet from fd(%d)", fd);
-    addrlen = sizeof(addr);
-    len = recvfrom(fd, (void *)msgq->pkbuf, MSGQ_MSG_MAX, MSG_WAITALL,
-                   (struct sockaddr *)&addr, &addrlen);
-    if (len < 0) {
+    DEBUG(0, "receiver: waiting for incoming packet(s) from fd(%d)", fd);
+
+    for (i = 0; i < MSGQ_RECV_BATCH; i++) {
+      iovs[i].iov_base = msgq->pkbuf + i * MSGQ_MSG_MAX;
+      iovs[i].iov_len = MSGQ_MSG_MAX;
+
+      memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = &addrs[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+    }
+
+    /* MSG_WAITFORONE: block for the first datagram, then grab
+     * whatever else is already queued, up to MSGQ_RECV_BATCH. */
+    nrecv = recvmmsg(fd, msgs, MSGQ_RECV_BATCH, MSG_WAITFORONE, NULL);
+    if (nrecv < 0) {
       if (errno == EAGAIN || errno == EWOULDBLOCK) {
         /* Since 'fd' is blocking socket, we will not get these errors */
         continue;
       }
       else {
-        WARN(errno, "recvfrom(2) failed");
+        WARN(errno, "recvmmsg(2) failed");
         break;
       }
     }
 
-    packet = (struct msgq_packet *)msgq->pkbuf;
-    if (validate_packet(packet, len) < 0) {
-      DEBUG(0, "receiver: ignoring invalid(too short) packet from %s",
-            addr.sun_path);
-      continue;
-    }
+    nnodes = 0;
+    for (i = 0; i < nrecv; i++) {
+      len = msgs[i].msg_len;
+      packet = (struct msgq_packet *)(msgq->pkbuf + i * MSGQ_MSG_MAX);
 
-    if (strcmp(addr.sun_path, msgq->address) == 0) {
-      /* Self-control message */
-      if (strncmp(packet->data, "shutdown", 8) == 0) {
-        DEBUG(0, "receiver: initiate shutdown sequence");
-        break;
+      if (validate_packet(packet, len) < 0) {
+        DEBUG(0, "receiver: ignoring invalid(too short) packet from %s",
+              addrs[i].sun_path);
+        continue;
       }
+
+      if (strcmp(addrs[i].sun_path, msgq->address) == 0) {
+        /* Self-control message */
+        if (strncmp(packet->data, "shutdown", 8) == 0) {
+          DEBUG(0, "receiver: initiate shutdown sequence");
+          stop = 1;
+          break;
+        }
+      }
+
+      np = msgq_node_create(addrs[i].sun_path, packet);
+      if (!np) {
+        /* TODO: failed to create msgq_node struct, out of memory? */
+        continue;
+      }
+      nodes[nnodes++] = np;
     }
 
-    np = msgq_node_create(addr.sun_path, packet);
-    if (!np) {
-      /* TODO: failed to create msgq_node struct, out of memory? */
+    if (nnodes == 0)
       continue;
-    }
 
     MSGQ_LOCK(msgq);
-    edque_push_back(&msgq->recvq, &np->link);
-    msgq->recvs++;
-    DEBUG(0, "receiver: accepting a packet.");
+    for (i = 0; i < nnodes; i++) {
+      edque_push_back(&msgq->recvq[nodes[i]->packet->lane], &nodes[i]->link);
+      msgq->recvs++;
+    }
+    evfd_post(msgq, nnodes);
+    DEBUG(0, "receiver: accepting %d packet(s).", nnodes);
 
     if (msgq->broadcast) {
       DEBUG(0, "receiver: broadcast!");
@@ -932,7 +1606,8 @@ msgq_receiver(void *arg)
     }
     else {
       DEBUG(0, "receiver: signal!");
-      pthread_cond_signal(&msgq->recv_cond);
+      for (i = 0; i < nnodes; i++)
+        pthread_cond_signal(&msgq->recv_cond);
     }
 
     MSGQ_UNLOCK(msgq);
@@ -978,6 +1653,9 @@ validate_packet(struct msgq_packet *packet, ssize_t len)
   if (estimated < (ssize_t)packet->size) /* correct wrong sized packet */
     packet->size = estimated;
 
+  if (packet->lane < 0 || packet->lane >= MSGQ_LANES)
+    packet->lane = 0;           /* sender left it uninitialized */
+
   packet->container = 0;
   return 0;
 }
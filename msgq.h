@@ -80,6 +80,7 @@
 #endif /* BEGIN_C_DECLS */
 
 #include <stddef.h>             /* required for 'size_t' */
+#include <time.h>               /* required for 'struct timespec' */
 
 BEGIN_C_DECLS
 
@@ -89,9 +90,19 @@ BEGIN_C_DECLS
 #define MSGQ_PERM_DEFAULT       (S_IRUSR | S_IWUSR | S_IXUSR | \
                                  S_IRGRP | S_IROTH)
 
+/*
+ * Number of delivery lanes.  Lane 0 is the default; higher lanes are
+ * drained first on the receive side, so control messages sent on
+ * MSGQ_LANE_CTRL never queue behind bulk traffic on lane 0.
+ */
+#define MSGQ_LANES      4
+#define MSGQ_LANE_CTRL  (MSGQ_LANES - 1)
+
 struct msgq_packet {
   void *container;              /* internal purpose only.  Do not change. */
   size_t size;                  /* size of data in bytes */
+  int lane;                     /* delivery lane, 0..MSGQ_LANES-1 */
+  long long deadline;           /* CLOCK_REALTIME msec; 0 for none */
   char data[0];
 };
 
@@ -111,6 +122,16 @@ typedef struct msgq_ MSGQ;
  * This function will not return until the listening thread is
  * running.  Thus, once msgq_open() returns, you may directly call any
  * of msgq_recv*().
+ *
+ * If ADDRESS starts with "shm:" (e.g. "shm:/myqueue", the rest is
+ * passed to shm_open(3)), the queue uses a shared-memory ring instead
+ * of a unix domain socket.  Messages from co-located processes are
+ * then exchanged through one memcpy into the ring plus a futex wake,
+ * with no socket hop.  Any MSGQ may send to a "shm:" receiver; the
+ * mapping is attached on first use and cached.  The ring holds a
+ * bounded number of MSGQ_MSG_MAX slots, and sending to a full ring
+ * fails with EAGAIN instead of blocking.  Use the socket form for
+ * queues that must be reachable across host/namespace boundaries.
  */
 extern MSGQ *msgq_open(const char *address);
 
@@ -137,6 +158,32 @@ extern int msgq_close(MSGQ *msgq);
 extern int msgq_send(MSGQ *msgq, const char *receiver,
                      const void *packet, size_t size);
 
+/*
+ * Like msgq_send(), but deliver on LANE (0..MSGQ_LANES-1) with an
+ * optional deadline.
+ *
+ * The receive side always drains higher lanes first, so a packet on
+ * MSGQ_LANE_CTRL is handed out before any queued packet on lower
+ * lanes regardless of arrival order.
+ *
+ * If TIMEOUT_MSEC is positive, the packet expires that many
+ * milliseconds from now; an expired packet still waiting in the
+ * receive queue is dropped instead of delivered (see
+ * msgq_drop_count()).  Zero or negative TIMEOUT_MSEC means no
+ * deadline.
+ *
+ * On success, returns zero.  Otherwise -1.
+ */
+extern int msgq_send_prio(MSGQ *msgq, const char *receiver,
+                          const void *packet, size_t size,
+                          int lane, long timeout_msec);
+
+/*
+ * Returns the number of packets this queue dropped because their
+ * deadline passed before delivery.
+ */
+extern long msgq_drop_count(MSGQ *msgq);
+
 /*
  * Send a string to the remote.
  *
@@ -157,13 +204,39 @@ extern int msgq_send_string(MSGQ *msgq, const char *receiver,
  * msgq_send*() family.
  *
  * You need to construct struct msgq_packet by yourself.
- * You need to fill only 'size' and 'data' members of struct msgq_packet.
+ * You need to fill the 'size' and 'data' members of struct msgq_packet,
+ * and clear 'lane' and 'deadline' (or set them as msgq_send_prio()
+ * would) -- leaving them uninitialized sends garbage routing data.
  *
  * On success, returns zero, otherwise -1.
  */
 extern int msgq_send_(MSGQ *msgq, const char *receiver,
                const struct msgq_packet *packet);
 
+/*
+ * Send COUNT packets to the remote in as few syscalls as possible.
+ *
+ * PACKETS is an array of packets built like for msgq_send_(); all of
+ * them go to RECEIVER.  The packets are handed to the kernel with
+ * sendmmsg(2), so one syscall is amortized over the whole batch.
+ *
+ * Returns the number of packets actually sent (which may be less
+ * than COUNT), or -1 if nothing could be sent.
+ */
+extern int msgq_send_batch(MSGQ *msgq, const char *receiver,
+                           const struct msgq_packet *packets[], int count);
+
+/*
+ * Drain up to COUNT received packets into the caller-provided array
+ * PACKETS, taking the queue lock only once.
+ *
+ * Like msgq_recv(), this function does not block; it returns the
+ * number of packets stored (possibly zero).  Each stored packet must
+ * be released with msgq_pkt_delete() as usual.
+ */
+extern int msgq_recv_batch(MSGQ *msgq, struct msgq_packet *packets[],
+                           int count);
+
 
 #ifdef MSGQ_BROADCAST
 /*
@@ -240,6 +313,34 @@ extern struct msgq_packet *msgq_recv_timedwait(MSGQ *msgq,
 extern struct msgq_packet *msgq_recv_wait(MSGQ *msgq);
 
 
+/*
+ * Return a file descriptor that is readable if and only if MSGQ has
+ * queued packets (modulo a brief spurious-wakeup window; treat a
+ * NULL msgq_recv() after a wakeup as normal, exactly like a spurious
+ * condvar wakeup).
+ *
+ * The descriptor is level-triggered and suitable for poll(2),
+ * select(2) and epoll(7), so one thread can wait on many queues (or
+ * mix queues with sockets and timers) instead of parking one blocked
+ * thread per queue.  Do not read from or write to it; drain the
+ * queue with msgq_recv()/msgq_recv_batch() instead.  The descriptor
+ * is owned by MSGQ and dies with msgq_close().
+ */
+extern int msgq_pollfd(MSGQ *msgq);
+
+/*
+ * Wait until one of the COUNT queues in QUEUES has a packet, for at
+ * most TIMEOUT_MSEC milliseconds (negative means forever, zero means
+ * poll and return).
+ *
+ * Returns the index of a ready queue; drain it with the nonblocking
+ * msgq_recv().  When several queues are ready, successive calls
+ * report them round-robin, so a flooded bulk queue cannot starve a
+ * quiet control queue.  On timeout, returns -1 with errno set to
+ * ETIMEDOUT; on error, -1 with errno set accordingly.
+ */
+extern int msgq_select(MSGQ *queues[], int count, long timeout_msec);
+
 /*
  * Returns the number of received packets which is not processed.
  *
@@ -29,8 +29,10 @@ pthread_once_t obsutil_once = PTHREAD_ONCE_INIT;
 
 pthread_key_t obsutil_key_errno;
 pthread_key_t obsutil_key_errbuf;
+pthread_key_t obsutil_key_pool;
 
 static void obsutil_thread_init_once(void);
+static void obs_pool_destroy_(void *arg);
 
 char *
 obsutil_strerror(int errnum)
@@ -50,12 +52,12 @@ obsutil_strerror(int errnum)
 
 
 void
-obsutil_thread_init(void)
+obs_thread_init(void)
 {
   int ret = pthread_once(&obsutil_once, obsutil_thread_init_once);
 
   if (ret) {
-    fprintf(stderr, "error: obsutil_thread_init() failed: %s\n",
+    fprintf(stderr, "error: obs_thread_init() failed: %s\n",
             obsutil_strerror(ret));
     abort();
   }
@@ -82,6 +84,14 @@ obsutil_thread_init_once(void)
             __FILE__, __LINE__, errbuf);
     abort();
   }
+
+  ret = pthread_key_create(&obsutil_key_pool, obs_pool_destroy_);
+  if (ret) {
+    strerror_r(ret, errbuf, ERRBUF_LEN);
+    fprintf(stderr, "%s:%d: pthread_key_create() failed: %s\n",
+            __FILE__, __LINE__, errbuf);
+    abort();
+  }
 }
 
 
@@ -90,13 +100,13 @@ obsutil_set_errno(int errno)
 {
   char errbuf[ERRBUF_LEN] = { 0, };
 
-  int *p = obsutil_errno_();
+  int *p = obs_errno_();
   *p = errno;
 }
 
 
 int *
-obsutil_errno_(void)
+obs_errno_(void)
 {
   int ret;
   int *p = pthread_getspecific(obsutil_key_errno);
@@ -144,6 +154,130 @@ obsutil_init(void)
 }
 
 
+/*
+ * Per-thread cache of warm obstacks; see obsutil.h for the contract.
+ */
+#define OBS_POOL_MAX            8
+#define OBS_POOL_CHUNK_SIZE     16384
+
+struct obs_pool_ent {
+  struct obstack stack;         /* must be first; obs_pool_put() casts back */
+  void *base;                   /* rewind point, just past the chunk header */
+};
+
+struct obs_pool {
+  struct obs_pool_ent *ents[OBS_POOL_MAX];
+  int nents;
+};
+
+#ifdef _PTHREAD
+static struct obs_pool *
+obs_pool_(void)
+{
+  int ret;
+  struct obs_pool *pool = pthread_getspecific(obsutil_key_pool);
+
+  if (!pool) {
+    pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+      fprintf(stderr, "%s:%d: calloc() failed: %s\n",
+              __FILE__, __LINE__, obsutil_strerror(errno));
+      abort();
+    }
+    ret = pthread_setspecific(obsutil_key_pool, pool);
+    if (ret) {
+      fprintf(stderr, "%s:%d: pthread_setspecific() failed: %s\n",
+              __FILE__, __LINE__, obsutil_strerror(ret));
+      abort();
+    }
+  }
+  return pool;
+}
+#else
+static struct obs_pool obs_pool_static;
+
+static struct obs_pool *
+obs_pool_(void)
+{
+  return &obs_pool_static;
+}
+#endif  /* _PTHREAD */
+
+
+struct obstack *
+obs_pool_get(void)
+{
+  struct obs_pool *pool = obs_pool_();
+  struct obs_pool_ent *ent;
+
+  if (pool->nents > 0)
+    return &pool->ents[--pool->nents]->stack;
+
+  ent = malloc(sizeof(*ent));
+  if (!ent)
+    return 0;
+
+  if (obs_begin(&ent->stack, OBS_POOL_CHUNK_SIZE) < 0) {
+    free(ent);
+    return 0;
+  }
+  ent->base = obs_alloc(&ent->stack, 0);
+  return &ent->stack;
+}
+
+
+void
+obs_pool_put(struct obstack *stack)
+{
+  struct obs_pool *pool = obs_pool_();
+  struct obs_pool_ent *ent = (struct obs_pool_ent *)stack;
+
+  /* rewind to the beginning of the first chunk; chunks grown beyond
+   * it go back to malloc here, the first one stays warm */
+  obs_free(stack, ent->base);
+
+  if (pool->nents < OBS_POOL_MAX)
+    pool->ents[pool->nents++] = ent;
+  else {
+    obs_free(stack, 0);
+    free(ent);
+  }
+}
+
+
+static void
+obs_pool_free_(struct obs_pool *pool)
+{
+  struct obs_pool_ent *ent;
+
+  while (pool->nents > 0) {
+    ent = pool->ents[--pool->nents];
+    obs_free(&ent->stack, 0);
+    free(ent);
+  }
+}
+
+
+void
+obs_pool_drain(void)
+{
+  obs_pool_free_(obs_pool_());
+}
+
+
+#ifdef _PTHREAD
+/* pthread_key destructor; reclaims the cache at thread exit */
+static void
+obs_pool_destroy_(void *arg)
+{
+  struct obs_pool *pool = arg;
+
+  obs_pool_free_(pool);
+  free(pool);
+}
+#endif  /* _PTHREAD */
+
+
 char *
 obs_format(struct obstack *stack, const char *format, ...)
 {
@@ -310,7 +444,7 @@ main(int argc, char *argv[])
   {
     pthread_t child;
 
-    obsutil_thread_init();
+    obs_thread_init();
 
 
     obsutil_errno = 0;
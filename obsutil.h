@@ -665,6 +665,28 @@ obs_wstr_grow3(struct obstack *stack,
 }
 #endif  /* NO_WCHAR_SUPPORT */
 
+/*
+ * Pooled obstacks for request-scoped allocation.
+ *
+ * obs_pool_get() returns a ready-to-use obstack from a per-thread
+ * cache of warm ones, creating a new obstack only when the cache is
+ * empty.  obs_pool_put() rewinds the obstack -- everything allocated
+ * from it is gone -- and returns it to the cache, so a get/put cycle
+ * in steady state touches no malloc at all; the first chunk is large
+ * enough (OBS_POOL_CHUNK_SIZE) that typical request-scoped usage
+ * never grows a second one.
+ *
+ * Only pass obstacks obtained from obs_pool_get() to obs_pool_put().
+ * obs_pool_drain() destroys the calling thread's cached obstacks;
+ * with _PTHREAD it is also run automatically at thread exit.
+ * As with the rest of obsutil, call obsutil_init() first (and
+ * obsutil_thread_init() when compiled with _PTHREAD).
+ */
+extern struct obstack *obs_pool_get(void);
+extern void obs_pool_put(struct obstack *stack);
+extern void obs_pool_drain(void);
+
+
 extern char *obs_format(struct obstack *stack, const char *format, ...)
   __attribute__ ((format (printf, 2, 3)));
 
@@ -92,16 +92,19 @@ release_converter(void)
 }
 
 int
-parse_qstring(char **parsed, size_t *len, const char *source)
+parse_qstring_ref(const char **parsed, size_t *parsed_len, size_t *len,
+                  const char *source, char *buf, size_t bufsize)
 {
   const char *src;
+  char stopset[3];
+  size_t n;
   int quote;
   int code;
   int i;
   int ret;
 
-  char *dst;
   char *dp;
+  char *bend = buf + bufsize;
 
 #ifdef HAVE_ICONV
   char *inbuf = 0;
@@ -132,13 +135,44 @@ parse_qstring(char **parsed, size_t *len, const char *source)
     return QSE_UNQUOTED;
   }
 
-  dst = malloc(strlen(source) + 1);
-  dp = dst;
-
   quote = *source;
   src = (source + 1);
 
+  /* fast path: no escape before the closing quote means the string
+   * needs no transformation at all -- borrow it from SOURCE. */
+  stopset[0] = quote;
+  stopset[1] = '\\';
+  stopset[2] = '\0';
+  n = strcspn(src, stopset);
+
+  if (src[n] == quote) {
+    *parsed = src;
+    *parsed_len = n;
+    if (len)
+      *len = src + n + 1 - source;
+    return QSE_OK;
+  }
+  if (src[n] == '\0') {
+    src += n + 1;
+    ret = QSE_PREMATURE_EOS;
+    goto err;
+  }
+
+  /* an escape is present; decode into BUF, starting with the clean
+   * prefix we already scanned. */
+  if (n >= bufsize) {
+    ret = QSE_NOBUFS;
+    goto err;
+  }
+  memcpy(buf, src, n);
+  dp = buf + n;
+  src += n;
+
   while (*src) {
+    if (dp >= bend) {
+      ret = QSE_NOBUFS;
+      goto err;
+    }
     if (*src == '\\') {
       src++;
       switch (*src++) {
@@ -253,7 +287,8 @@ parse_qstring(char **parsed, size_t *len, const char *source)
     else {                      /* *src != '\\' */
       if (*src == quote) {      /* done! */
         *dp = '\0';
-        *parsed = dst;
+        *parsed = buf;
+        *parsed_len = dp - buf;
         src++;
         if (len)
           *len = src - source;
@@ -271,7 +306,40 @@ parse_qstring(char **parsed, size_t *len, const char *source)
   if (len)
     *len = src - source;
 
-  free(dst);
+  return ret;
+}
+
+
+int
+parse_qstring(char **parsed, size_t *len, const char *source)
+{
+  const char *ref;
+  size_t rlen;
+  size_t bufsize;
+  char *dst;
+  int ret;
+
+  if (!source || source[0] == '\0') {
+    if (len) *len = -1;
+    return QSE_EMPTY;
+  }
+
+  bufsize = strlen(source) + 1;
+  dst = malloc(bufsize);
+  if (!dst)
+    return QSE_NOBUFS;
+
+  ret = parse_qstring_ref(&ref, &rlen, len, source, dst, bufsize);
+  if (ret != QSE_OK) {
+    free(dst);
+    return ret;
+  }
+
+  if (ref != dst) {             /* borrowed; copy out of SOURCE */
+    memcpy(dst, ref, rlen);
+    dst[rlen] = '\0';
+  }
+  *parsed = dst;
   return ret;
 }
 
@@ -45,9 +45,25 @@ BEGIN_C_DECLS
 #define QSE_INVALID_ESC         -4
 #define QSE_PREMATURE_EOS       -5
 #define QSE_UNICODE_NOCONV      -6
+#define QSE_NOBUFS              -7
 
 extern int parse_qstring(char **parsed, size_t *len, const char *source);
 
+/*
+ * Zero-allocation variant of parse_qstring().
+ *
+ * If the quoted string contains no escape sequence (the common case),
+ * *PARSED points into SOURCE itself -- no allocation, no copy -- and
+ * *PARSED_LEN is its length; the slice is NOT null-terminated.
+ * Otherwise the string is decoded into BUF (null-terminated), *PARSED
+ * points to BUF, and QSE_NOBUFS is returned if BUFSIZE is too small;
+ * strlen(SOURCE) bytes are always enough.  *LEN receives the number
+ * of bytes consumed from SOURCE like parse_qstring().
+ */
+extern int parse_qstring_ref(const char **parsed, size_t *parsed_len,
+                             size_t *len, const char *source,
+                             char *buf, size_t bufsize);
+
 END_C_DECLS
 
 #endif  /* PARSE_QSTR_H__ */
@@ -115,7 +115,7 @@ path_join_va(char buf[], size_t bufsize, va_list *ap, const char *argv[])
   if (argv)
     elem = argv[i++];
   else
-    elem = (const char *)va_arg(ap, const char *);
+    elem = (const char *)va_arg(*ap, const char *);
   if (!elem)
     return 0;
 
@@ -197,6 +197,193 @@ path_join_va(char buf[], size_t bufsize, va_list *ap, const char *argv[])
 }
 
 
+/*
+ * Path builder (see pathjoin.h).
+ */
+
+#include <stdlib.h>
+
+#ifndef DEBUG_OBSTACK
+# include <obstack.h>
+#else
+# include "fakeobs.h"
+#endif  /* DEBUG_OBSTACK */
+
+#define PB_COMP_GROW    16
+#define PB_SCRATCH_UNIT 64
+
+
+void
+path_builder_init(path_builder_t *pb)
+{
+  pb->comps_ = NULL;
+  pb->ncomp_ = pb->cap_ = 0;
+  pb->pushed_ = pb->lead_ = 0;
+  pb->total_ = 0;
+  pb->scratch_ = NULL;
+  pb->scratch_size_ = 0;
+}
+
+
+void
+path_builder_free(path_builder_t *pb)
+{
+  free(pb->comps_);
+  free(pb->scratch_);
+  path_builder_init(pb);
+}
+
+
+void
+path_builder_clear(path_builder_t *pb)
+{
+  pb->ncomp_ = 0;
+  pb->pushed_ = pb->lead_ = 0;
+  pb->total_ = 0;
+}
+
+
+int
+path_push_l(path_builder_t *pb, const char *comp, size_t len)
+{
+  const char *begin = comp, *end = comp + len;
+  struct path_comp_ *pc;
+
+  /* strip like path_elem_strip(), but on (ptr, len) */
+  while (begin < end && *begin == DIR_SEPARATOR)
+    begin++;
+  while (end > begin && end[-1] == DIR_SEPARATOR)
+    end--;
+
+  if (!pb->pushed_) {
+    pb->pushed_ = 1;
+    /* path_join() semantics: an absolute first component keeps its
+     * leading separator, and a first component that strips to nothing
+     * still leaves the next one separator-prefixed */
+    if (begin == end)
+      pb->lead_ = 1;
+    else
+      pb->lead_ = (comp[0] == DIR_SEPARATOR);
+  }
+
+  if (begin == end)             /* empty or all separators */
+    return 0;
+
+  if (pb->ncomp_ == pb->cap_) {
+    int cap = pb->cap_ ? pb->cap_ * 2 : PB_COMP_GROW;
+    pc = realloc(pb->comps_, cap * sizeof(*pc));
+    if (!pc)
+      return -1;
+    pb->comps_ = pc;
+    pb->cap_ = cap;
+  }
+
+  pc = pb->comps_ + pb->ncomp_++;
+  pc->ptr = begin;
+  pc->len = end - begin;
+  pc->dir_ = (comp + len > end); /* had trailing separator(s) */
+
+  pb->total_ += pc->len;
+  return 0;
+}
+
+
+int
+path_push(path_builder_t *pb, const char *comp)
+{
+  return path_push_l(pb, comp, strlen(comp));
+}
+
+
+int
+path_pop(path_builder_t *pb)
+{
+  if (pb->ncomp_ == 0)
+    return -1;
+
+  pb->ncomp_--;
+  pb->total_ -= pb->comps_[pb->ncomp_].len;
+  if (pb->ncomp_ == 0)
+    pb->pushed_ = pb->lead_ = 0;
+  return pb->ncomp_;
+}
+
+
+static __inline__ size_t
+pb_need(const path_builder_t *pb)
+{
+  /* components + separators between them + leading and trailing
+   * separators + '\0'; all known without touching the byte(s) */
+  return pb->total_ +
+    (pb->ncomp_ > 1 ? pb->ncomp_ - 1 : 0) +
+    (pb->ncomp_ > 0 ? pb->lead_ : 0) +
+    (pb->ncomp_ > 0 && pb->comps_[pb->ncomp_ - 1].dir_) +
+    1;
+}
+
+
+static __inline__ char *
+pb_emit(const path_builder_t *pb, char *p)
+{
+  int i;
+
+  if (pb->ncomp_ > 0 && pb->lead_)
+    *p++ = DIR_SEPARATOR;
+
+  for (i = 0; i < pb->ncomp_; i++) {
+    if (i > 0)
+      *p++ = DIR_SEPARATOR;
+    memcpy(p, pb->comps_[i].ptr, pb->comps_[i].len);
+    p += pb->comps_[i].len;
+  }
+
+  if (pb->ncomp_ > 0 && pb->comps_[pb->ncomp_ - 1].dir_)
+    *p++ = DIR_SEPARATOR;
+
+  *p = '\0';
+  return p;
+}
+
+
+const char *
+path_build(path_builder_t *pb, size_t *lenp)
+{
+  size_t need = pb_need(pb);
+  char *p;
+
+  if (pb->scratch_size_ < need) {
+    size_t size = (need / PB_SCRATCH_UNIT + 1) * PB_SCRATCH_UNIT;
+
+    p = realloc(pb->scratch_, size);
+    if (!p)
+      return NULL;
+    pb->scratch_ = p;
+    pb->scratch_size_ = size;
+  }
+
+  p = pb_emit(pb, pb->scratch_);
+  if (lenp)
+    *lenp = p - pb->scratch_;
+  return pb->scratch_;
+}
+
+
+char *
+path_build_obs(path_builder_t *pb, struct obstack *obs, size_t *lenp)
+{
+  size_t need = pb_need(pb);
+  char *base, *p;
+
+  obstack_blank(obs, need);
+  base = obstack_finish(obs);
+
+  p = pb_emit(pb, base);
+  if (lenp)
+    *lenp = p - base;
+  return base;
+}
+
+
 #ifdef TEST_PATHJOIN
 #include <stdio.h>
 
@@ -56,6 +56,85 @@ extern int path_join(char buf[], size_t bufsize, ...);
  */
 extern int path_join_v(char buf[], size_t bufsize, const char *argv[]);
 
+
+/*
+ * Path builder.
+ *
+ * path_join() measures every component with strlen() and copies into
+ * a caller buffer, retrying when it does not fit.  A builder instead
+ * carries (ptr, len) components -- each measured exactly once, at
+ * push time -- plus a retained scratch buffer, so joining the same
+ * directory prefix with a different leaf is a path_pop(), a
+ * path_push() of the leaf, and a couple of memcpy()s; no strlen of
+ * the prefix, no truncation retries.
+ *
+ * Components are borrowed, not copied: the pointed-to byte(s) must
+ * stay valid until the next path_build()/path_build_obs().  The
+ * separator stripping matches path_join(): an absolute first
+ * component keeps its leading separator, and a trailing separator on
+ * the last component is preserved (directory result).
+ */
+
+struct path_comp_ {
+  const char *ptr;
+  size_t len;
+  int dir_;                     /* component ended with a separator */
+};
+
+typedef struct {
+  struct path_comp_ *comps_;
+  int ncomp_;
+  int cap_;
+  int pushed_;                  /* a first component was pushed (even
+                                 * one that stripped to nothing) */
+  int lead_;                    /* emit a separator before comps_[0] */
+  size_t total_;                /* byte(s) in stripped components */
+
+  char *scratch_;               /* retained path_build() output */
+  size_t scratch_size_;
+} path_builder_t;
+
+extern void path_builder_init(path_builder_t *pb);
+extern void path_builder_free(path_builder_t *pb);
+
+/*
+ * Forget all components (the scratch buffer is retained).
+ */
+extern void path_builder_clear(path_builder_t *pb);
+
+/*
+ * Append the component [COMP, COMP + LEN) to the builder; path_push()
+ * measures COMP with one strlen().  Empty (or all-separator)
+ * components are ignored, like in path_join().  Returns zero, or -1
+ * on allocation failure.
+ */
+extern int path_push_l(path_builder_t *pb, const char *comp, size_t len);
+extern int path_push(path_builder_t *pb, const char *comp);
+
+/*
+ * Drop the most recently pushed component.  Returns the number of
+ * remaining components, or -1 if the builder was empty.
+ */
+extern int path_pop(path_builder_t *pb);
+
+/*
+ * Join the components into the builder's retained scratch buffer and
+ * return it; the buffer stays valid until the next push/build/free.
+ * If LENP is non-null, it receives the length of the result.  The
+ * total length is known up front, so the join is one allocation check
+ * and a memcpy per component.  Returns NULL on allocation failure.
+ */
+extern const char *path_build(path_builder_t *pb, size_t *lenp);
+
+/*
+ * Like path_build(), but the result is allocated from OBS (growing
+ * object; see obstack(3)).  The builder's scratch buffer is not
+ * touched.
+ */
+struct obstack;
+extern char *path_build_obs(path_builder_t *pb, struct obstack *obs,
+                            size_t *lenp);
+
 END_C_DECLS
 
 #endif  /* PATHJOIN_H__ */
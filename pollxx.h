@@ -20,9 +20,17 @@
 #define POLLXX_H__
 
 #include <iterator>
+#include <vector>
 #include <cstdlib>
 #include <errno.h>
 #include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#define POLLXX_HAVE_EPOLL       1
+#endif
 
 #ifndef BEGIN_NAMESPACE
 #define BEGIN_NAMESPACE(x)      namespace x {
@@ -41,6 +49,7 @@ public:
   bool writable(int fd, short revent, void *arg) { return true; }
   bool hanged(int fd, short revent, void *arg)   { return true; }
   bool errored(int fd, short revent, void *arg)  { return true; }
+  bool expired(int timer, void *arg)             { return true; }
 };
 
 
@@ -128,7 +137,7 @@ private:
     pollfd *p;
     size_t newsize = pfds_capacity_ + grow_size;
 
-    p = static_cast<pollfd *>(std::realloc(pfds_, newsize));
+    p = static_cast<pollfd *>(std::realloc(pfds_, newsize * sizeof(pollfd)));
     if (!p)
       throw std::bad_alloc();
 
@@ -146,6 +155,263 @@ private:
 };
 
 
+#define EVENTLOOP_BATCH_SIZE    64
+
+/*
+ * EventLoop: a persistent event loop on top of the Poll handler
+ * interface.  Unlike Poll, which rescans the whole fd set inside the
+ * kernel on every call, EventLoop keeps the interest set registered
+ * with epoll(7) (edge-triggered), so the cost of a wait is
+ * proportional to the number of READY descriptors, not the number of
+ * watched ones.  Where epoll is unavailable it degrades to a plain
+ * poll(2) backend behind the same interface.
+ *
+ * Because the epoll backend is edge-triggered, handlers must consume
+ * events completely (read/write until EAGAIN); such handlers behave
+ * identically on the level-triggered poll fallback.
+ *
+ * Timers fire through PollHandler::expired(timer, arg) where TIMER is
+ * the id returned from add_timer(); a periodic timer re-arms itself,
+ * a one-shot timer is removed after firing.
+ *
+ *   xbridge::EventLoop<MyHandler> loop(&handler);
+ *   loop.add(listen_fd, POLLIN);
+ *   loop.add_timer(1000, true);          // every second
+ *   while (loop.run_once(-1, &ctx))
+ *     ;
+ */
+template<class PollHandler = PollHandlerBase>
+class EventLoop {
+public:
+  EventLoop(PollHandler *handlers = NULL)
+    : handlers_(handlers), handler_args_(0), next_timer_(0)
+  {
+#ifdef POLLXX_HAVE_EPOLL
+    epfd_ = ::epoll_create1(0);
+#endif
+  }
+
+  ~EventLoop() {
+#ifdef POLLXX_HAVE_EPOLL
+    if (epfd_ >= 0)
+      ::close(epfd_);
+#endif
+  }
+
+  bool add(int fd, short events) {
+#ifdef POLLXX_HAVE_EPOLL
+    if (epfd_ >= 0) {
+      struct epoll_event ev;
+      ev.events = to_epoll(events) | EPOLLET;
+      ev.data.fd = fd;
+      return ::epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) == 0;
+    }
+#endif
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    pfds_.push_back(pfd);
+    return true;
+  }
+
+  bool modify(int fd, short events) {
+#ifdef POLLXX_HAVE_EPOLL
+    if (epfd_ >= 0) {
+      struct epoll_event ev;
+      ev.events = to_epoll(events) | EPOLLET;
+      ev.data.fd = fd;
+      return ::epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev) == 0;
+    }
+#endif
+    for (size_t i = 0; i < pfds_.size(); i++)
+      if (pfds_[i].fd == fd) {
+        pfds_[i].events = events;
+        return true;
+      }
+    return false;
+  }
+
+  bool remove(int fd) {
+#ifdef POLLXX_HAVE_EPOLL
+    if (epfd_ >= 0)
+      return ::epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, NULL) == 0;
+#endif
+    for (size_t i = 0; i < pfds_.size(); i++)
+      if (pfds_[i].fd == fd) {
+        pfds_.erase(pfds_.begin() + i);
+        return true;
+      }
+    return false;
+  }
+
+  /* Returns the timer id (>= 0), to be matched against the TIMER
+   * argument of PollHandler::expired(). */
+  int add_timer(long milliseconds, bool periodic = false) {
+    timer_ent t;
+    t.id = next_timer_++;
+    t.deadline = now_msec() + milliseconds;
+    t.interval = periodic ? milliseconds : -1;
+    timers_.push_back(t);
+    return t.id;
+  }
+
+  bool remove_timer(int id) {
+    for (size_t i = 0; i < timers_.size(); i++)
+      if (timers_[i].id == id) {
+        timers_.erase(timers_.begin() + i);
+        return true;
+      }
+    return false;
+  }
+
+  /*
+   * Wait for events (at most MILLISECONDS; -1 waits indefinitely,
+   * bounded by the nearest timer) and dispatch the whole ready batch
+   * plus any expired timers.  Returns false on error or when a
+   * handler returned false.
+   */
+  bool run_once(int milliseconds = -1, void *args = 0) {
+    int timeout = next_timeout(milliseconds);
+    int nready;
+
+    handler_args_ = args;
+
+#ifdef POLLXX_HAVE_EPOLL
+    if (epfd_ >= 0) {
+      struct epoll_event evs[EVENTLOOP_BATCH_SIZE];
+
+      nready = ::epoll_wait(epfd_, evs, EVENTLOOP_BATCH_SIZE, timeout);
+      if (nready == -1)
+        return errno == EINTR ? fire_timers() : false;
+
+      for (int i = 0; i < nready; i++)
+        if (!dispatch_one(evs[i].data.fd, from_epoll(evs[i].events)))
+          return false;
+      return fire_timers();
+    }
+#endif
+    nready = ::poll(pfds_.empty() ? NULL : &pfds_[0], pfds_.size(), timeout);
+    if (nready == -1)
+      return errno == EINTR ? fire_timers() : false;
+
+    for (size_t i = 0; i < pfds_.size() && nready > 0; i++)
+      if (pfds_[i].revents) {
+        nready--;
+        if (!dispatch_one(pfds_[i].fd, pfds_[i].revents))
+          return false;
+      }
+    return fire_timers();
+  }
+
+private:
+  struct timer_ent {
+    int id;
+    long long deadline;         /* msec, CLOCK_MONOTONIC */
+    long interval;              /* msec; -1 for one-shot */
+  };
+
+  static long long now_msec() {
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  }
+
+  int next_timeout(int milliseconds) {
+    if (timers_.empty())
+      return milliseconds;
+
+    long long nearest = timers_[0].deadline;
+    for (size_t i = 1; i < timers_.size(); i++)
+      if (timers_[i].deadline < nearest)
+        nearest = timers_[i].deadline;
+
+    long long left = nearest - now_msec();
+    if (left < 0)
+      left = 0;
+    if (milliseconds >= 0 && milliseconds < left)
+      return milliseconds;
+    return (int)left;
+  }
+
+  bool fire_timers() {
+    if (timers_.empty())
+      return true;
+
+    long long now = now_msec();
+    for (size_t i = 0; i < timers_.size(); ) {
+      if (timers_[i].deadline > now) {
+        i++;
+        continue;
+      }
+      if (handlers_ && !handlers_->expired(timers_[i].id, handler_args_))
+        return false;
+      if (timers_[i].interval < 0)
+        timers_.erase(timers_.begin() + i);
+      else {
+        timers_[i].deadline = now + timers_[i].interval;
+        i++;
+      }
+    }
+    return true;
+  }
+
+  bool dispatch_one(int fd, short revents) {
+    if (!handlers_)
+      return true;
+
+    if ((revents & POLLIN || revents & POLLPRI)
+        && !handlers_->readable(fd, revents, handler_args_))
+      return false;
+    if ((revents & POLLOUT)
+        && !handlers_->writable(fd, revents, handler_args_))
+      return false;
+    if ((revents & POLLHUP
+#ifdef POLLRDHUP
+         || revents & POLLRDHUP
+#endif
+         ) && !handlers_->hanged(fd, revents, handler_args_))
+      return false;
+    if ((revents & POLLERR || revents & POLLNVAL)
+        && !handlers_->errored(fd, revents, handler_args_))
+      return false;
+    return true;
+  }
+
+#ifdef POLLXX_HAVE_EPOLL
+  static unsigned to_epoll(short events) {
+    unsigned ev = EPOLLRDHUP;
+    if (events & POLLIN)   ev |= EPOLLIN;
+    if (events & POLLPRI)  ev |= EPOLLPRI;
+    if (events & POLLOUT)  ev |= EPOLLOUT;
+    return ev;
+  }
+
+  static short from_epoll(unsigned events) {
+    short rev = 0;
+    if (events & EPOLLIN)    rev |= POLLIN;
+    if (events & EPOLLPRI)   rev |= POLLPRI;
+    if (events & EPOLLOUT)   rev |= POLLOUT;
+    if (events & EPOLLHUP)   rev |= POLLHUP;
+#ifdef POLLRDHUP
+    if (events & EPOLLRDHUP) rev |= POLLRDHUP;
+#endif
+    if (events & EPOLLERR)   rev |= POLLERR;
+    return rev;
+  }
+
+  int epfd_;
+#endif  /* POLLXX_HAVE_EPOLL */
+
+  PollHandler *handlers_;
+  void *handler_args_;
+
+  std::vector<pollfd> pfds_;    /* poll(2) fallback interest set */
+  std::vector<timer_ent> timers_;
+  int next_timer_;
+};
+
+
 END_NAMESPACE(xbridge)
 
 #endif  /* POLLXX_H__ */
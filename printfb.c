@@ -1,20 +1,27 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <printf.h>
 #include <limits.h>
 #include "xerror.h"
 
 static void register_printf_b(void) __attribute__((constructor));
 
+/*
+ * BTAB[B] is the 8-character ASCII expansion of the byte B, MSB
+ * first, so the handler emits eight digits per table lookup instead
+ * of one digit per shift-and-test.  Filled in register_printf_b().
+ */
+static char btab[256][8];
+
 static int
 b_handler(FILE *fp, const struct printf_info *info, const void *const *args)
 {
-  int len = 0;
   int width;
-  char *output;
+  char output[80];              /* 64 digit(s) + group separators */
+  char *dst = output;
   unsigned long long value;
-  int one_encountered = 0;
-  int i;
+  int i, npad, outlen;
 
   if (info->is_char) {
     width = sizeof(char) * CHAR_BIT;
@@ -39,39 +46,39 @@ b_handler(FILE *fp, const struct printf_info *info, const void *const *args)
   //fprintf(stderr, "width: %d\n", width);
   //fprintf(stderr, "info width: %d\n", info->width);
 
-  output = alloca(width);
-  for (i = 0; i < width; i++) {
-    output[i] = (value & 1) ? '1' : '0';
-    value >>= 1;
-  }
-  for (i = 0; i < width / 2; i++) {
-    char t = output[i];
-    output[i] = output[width - 1 - i];
-    output[width - 1 - i] = t;
+  /* expand eight bits per lookup, most significant byte first; with
+   * the `'' flag (%'b) a `_' separates the groups of eight. */
+  for (i = width - 8; i >= 0; i -= 8) {
+    memcpy(dst, btab[(value >> i) & 0xff], 8);
+    dst += 8;
+    if (info->group && i > 0)
+      *dst++ = '_';
   }
+  outlen = dst - output;
+
+  /* leading zero bit(s) show as the pad character, as they always
+   * have; a zero value is all pad.  Group separators stay put. */
+  for (i = 0; i < outlen && output[i] != '1'; i++)
+    if (output[i] == '0')
+      output[i] = info->pad;
+
+  npad = (info->width > outlen) ? info->width - outlen : 0;
 
   flockfile(fp);
-  if (info->width > width)
-    for (i = 0; i < info->width - width; i++) {
-      fputc_unlocked(info->pad, fp);
-      len++;
-    }
+  if (npad > 0) {
+    char padbuf[32];
+    int n;
 
-  for (i = 0; i < width; i++) {
-    if (output[i] == '1') {
-      one_encountered = 1;
-      fputc_unlocked(output[i], fp);
+    memset(padbuf, info->pad, sizeof(padbuf));
+    for (i = npad; i > 0; i -= n) {
+      n = (i < (int)sizeof(padbuf)) ? i : (int)sizeof(padbuf);
+      fwrite_unlocked(padbuf, 1, n, fp);
     }
-    else if (output[i] == '0') {
-      if (!one_encountered)
-        fputc_unlocked(info->pad, fp);
-      else
-        fputc_unlocked(output[i], fp);
-    }
-    len++;
   }
+  fwrite_unlocked(output, 1, outlen, fp);
   funlockfile(fp);
-  return len;
+
+  return npad + outlen;
 }
 
 
@@ -97,6 +104,12 @@ b_arginfo(const struct printf_info *info, size_t n, int *argtypes)
 static void
 register_printf_b(void)
 {
+  int i, b;
+
+  for (i = 0; i < 256; i++)
+    for (b = 0; b < 8; b++)
+      btab[i][b] = (i & (0x80 >> b)) ? '1' : '0';
+
   register_printf_function('b', b_handler, b_arginfo);
 }
 
@@ -105,6 +118,7 @@ int
 main(void)
 {
   printf("%0b\n", 0xbeef);
+  printf("%'0b\n", 0xbeef);
 
   return 0;
 }
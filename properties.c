@@ -37,6 +37,7 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #ifdef HAVE_UNISTRING
@@ -70,6 +71,19 @@ struct property {
   char *key;
   char *value;
 
+  /* For entries parsed in place by properties_load_mmap(), KPTR/VPTR
+   * point into the mapping (not null-terminated) and KEY/VALUE start
+   * as NULL; they are copied into the pool lazily, on the first
+   * properties_get()/properties_enum() that needs a C string.  The
+   * hash is keyed on (KPTR, KLEN) so lookups never need the copy. */
+  const char *kptr;
+  const char *vptr;
+  size_t klen;
+  size_t vlen;
+
+  unsigned gen;                 /* last load that saw this key; entries
+                                 * left behind are swept on reload */
+
   UT_hash_handle hh;
 };
 
@@ -109,6 +123,13 @@ struct properties {
 
   const char *filename;
 
+  char *map;                    /* set by properties_load_mmap() */
+  size_t map_size;
+
+  unsigned gen;                 /* bumped by every properties_load() */
+  int nchanged;                 /* keys added/updated/removed by the
+                                 * most recent load */
+
   struct xobs pool_;
 };
 
@@ -133,6 +154,9 @@ static void free_lexer(struct lexer *lex);
 static char *token_string(struct lexer *lex);
 static int get_token(struct lexer *lex);
 
+static int parse_mapped(PROPERTIES *props);
+static char *unescape_mapped(PROPERTIES *props, const char *s, size_t len);
+
 
 struct ifs *
 ifs_open(const char *filename)
@@ -309,9 +333,12 @@ static int
 init_lexer(struct xobs *pool, struct lexer *lex, const char *filename)
 {
   lex->is = ifs_open(filename);
+  if (!lex->is)
+    return -1;
+
   lex->pool = pool;
 
-  lex->filename = xobs_copy0(lex->pool, filename, strlen(filename));
+  lex->filename = (char *)filename; /* owned by the caller's pool */
   lex->lineno = 1;
 
   return 0;
@@ -321,8 +348,10 @@ init_lexer(struct xobs *pool, struct lexer *lex, const char *filename)
 static void
 free_lexer(struct lexer *lex)
 {
-  if (lex)
+  if (lex && lex->is) {
     ifs_close(lex->is);
+    lex->is = NULL;
+  }
   //xobs_free(lex->pool, NULL);
 }
 
@@ -335,8 +364,10 @@ token_string(struct lexer *lex)
   p = xobs_base(lex->pool);
   end = p + xobs_object_size(lex->pool);
 
+  /* the token ends with the '\0' grown by get_token(); step over it,
+   * or the blank(s) before it would never be trimmed */
   for (q = end - 1; q >= p; q--) {
-    if (isspace(*q))
+    if (*q == '\0' || isspace((unsigned char)*q))
       *q = '\0';
     else
       break;
@@ -346,6 +377,47 @@ token_string(struct lexer *lex)
 }
 
 
+/*
+ * Insert or update (KEY, VALUE), both pool objects with VALUE
+ * allocated after KEY.  Returns 1 if the table changed, 0 if the
+ * existing entry already held VALUE -- in which case both strings are
+ * given back to the pool, so re-parsing an unchanged file does not
+ * grow it.  An entry whose value did change keeps its node and key
+ * (pointer identity), only the value string is replaced.
+ */
+static int
+prop_put(PROPERTIES *props, char *key, char *value)
+{
+  struct property *p;
+  size_t vlen = strlen(value);
+
+  HASH_FIND_STR(props->root, key, p);
+  if (p) {
+    p->gen = props->gen;
+    if (p->vlen == vlen && memcmp(p->vptr, value, vlen) == 0) {
+      xobs_free(&props->pool_, key); /* releases VALUE too */
+      return 0;
+    }
+    p->value = value;
+    p->vptr = value;
+    p->vlen = vlen;
+    return 1;
+  }
+
+  p = xobs_alloc(&props->pool_, sizeof(*p));
+  p->key = key;
+  p->value = value;
+  p->kptr = key;
+  p->klen = strlen(key);
+  p->vptr = value;
+  p->vlen = vlen;
+  p->gen = props->gen;
+
+  HASH_ADD_KEYPTR(hh, props->root, p->kptr, p->klen, p);
+  return 1;
+}
+
+
 static int
 parse(PROPERTIES *props)
 {
@@ -372,9 +444,7 @@ parse(PROPERTIES *props)
     else
       value = token_string(lex);
 
-    printf("[%s] = [%s]\n", key, value);
-
-    properties_put(props, key, value);
+    props->nchanged += prop_put(props, key, value);
   }
   return 0;
 }
@@ -514,9 +584,6 @@ properties_load(const char *pathname, PROPERTIES *reuse)
 {
   PROPERTIES *p;
 
-  /* REUSE is not fully implemented yet, read the comment in parse(). */
-  assert(reuse == NULL);
-
   if (!reuse) {
     p = malloc(sizeof(*p));
     if (!p)
@@ -526,26 +593,307 @@ properties_load(const char *pathname, PROPERTIES *reuse)
     p->root = NULL;
     p->filename = NULL;
     p->lex = NULL;
+    p->map = NULL;
+    p->map_size = 0;
+    p->gen = 0;
+    p->nchanged = 0;
   }
   else
     p = reuse;
 
   if (pathname) {
-    p->filename = xobs_copy0(&p->pool_, pathname, strlen(pathname));
+    struct property *q, *tmp;
+
+    if (!p->filename || strcmp(p->filename, pathname) != 0)
+      p->filename = xobs_copy0(&p->pool_, pathname, strlen(pathname));
 
     if (p->lex)
       free_lexer(p->lex);
+    else
+      p->lex = xobs_alloc(&p->pool_, sizeof(*p->lex));
+
+    if (init_lexer(&p->pool_, p->lex, p->filename) < 0) {
+      /* keep the old table intact; the file may be mid-rename and
+       * the caller can retry with the same handle */
+      if (!reuse) {
+        xobs_free(&p->pool_, NULL);
+        free(p);
+      }
+      return NULL;
+    }
 
-    p->lex = xobs_alloc(&p->pool_, sizeof(*p->lex));
-    init_lexer(&p->pool_, p->lex, pathname);
+    p->gen++;
+    p->nchanged = 0;
 
     parse(p);
+
+    /* sweep keys that are gone from the file; their node and strings
+     * stay in the pool, which is the price of obstack storage */
+    HASH_ITER(hh, p->root, q, tmp) {
+      if (q->gen != p->gen) {
+        HASH_DEL(p->root, q);
+        p->nchanged++;
+      }
+    }
+  }
+
+  return p;
+}
+
+
+int
+properties_changed(PROPERTIES *props)
+{
+  return props->nchanged;
+}
+
+
+PROPERTIES *
+properties_load_mmap(const char *pathname)
+{
+  PROPERTIES *p;
+  struct stat sbuf;
+  int fd;
+  int saved_errno;
+
+  fd = open(pathname, O_RDONLY);
+  if (fd == -1)
+    return NULL;
+
+  if (fstat(fd, &sbuf) == -1) {
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return NULL;
+  }
+
+  p = malloc(sizeof(*p));
+  if (!p) {
+    close(fd);
+    return NULL;
   }
+  xobs_init(&p->pool_);
+  p->root = NULL;
+  p->lex = NULL;
+  p->map = NULL;
+  p->map_size = sbuf.st_size;
+  p->gen = 0;
+  p->nchanged = 0;
+
+  if (p->map_size > 0) {
+    p->map = mmap(NULL, p->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p->map == MAP_FAILED) {
+      saved_errno = errno;
+      close(fd);
+      xobs_free(&p->pool_, NULL);
+      free(p);
+      errno = saved_errno;
+      return NULL;
+    }
+    madvise(p->map, p->map_size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  p->filename = xobs_copy0(&p->pool_, pathname, strlen(pathname));
+
+  parse_mapped(p);
 
   return p;
 }
 
 
+/*
+ * Copy (S, LEN) into the pool with escape sequences expanded,
+ * mirroring what get_token() does for the read(2)-based loader.
+ */
+static char *
+unescape_mapped(PROPERTIES *props, const char *s, size_t len)
+{
+  struct xobs *pool = &props->pool_;
+  char escseq[5];
+  size_t i;
+  int j;
+
+  for (i = 0; i < len; i++) {
+    if (s[i] != '\\') {
+      xobs_1grow(pool, s[i]);
+      continue;
+    }
+
+    if (++i >= len)
+      break;
+
+    switch (s[i]) {
+    case 'u':
+    case 'U':
+      {
+        char *endptr;
+        ucs4_t uc;
+#ifdef HAVE_UNISTRING
+        char mb[MB_LEN_MAX];
+        int len_;
+#endif
+
+        memset(escseq, 0, sizeof(escseq));
+        for (j = 0; j < 4 && i + 1 < len; j++)
+          escseq[j] = s[++i];
+
+        uc = strtoul(escseq, &endptr, 16);
+        i -= j - (endptr - escseq); /* give back non-hex leftovers */
+
+#ifdef HAVE_UNISTRING
+        len_ = u8_uctomb((uint8_t *)mb, uc, MB_LEN_MAX);
+        if (len_ >= 0) {
+          for (j = 0; j < len_; j++)
+            xobs_1grow(pool, mb[j]);
+        }
+#else
+        xerror(0, 0, "%s: unicode escape sequence is not supported",
+               props->filename);
+        xobs_1grow(pool, '?');
+#endif  /* HAVE_UNISTRING */
+      }
+      break;
+
+    case '\n':                  /* escaping line terminator */
+      break;
+
+    case ':':
+    case '=':
+      xobs_1grow(pool, s[i]);
+      break;
+
+    default:
+      /* TODO: handle other escape sequences */
+      break;
+    }
+  }
+
+  xobs_1grow(pool, '\0');
+  return xobs_finish(pool);
+}
+
+
+static void
+prop_add_mapped(PROPERTIES *props,
+                const char *k, size_t klen, int kesc,
+                const char *v, size_t vlen, int vesc)
+{
+  struct property *p;
+  char *s;
+
+  p = xobs_alloc(&props->pool_, sizeof(*p));
+
+  if (kesc) {
+    s = unescape_mapped(props, k, klen);
+    p->key = s;
+    p->kptr = s;
+    p->klen = strlen(s);
+  }
+  else {
+    p->key = NULL;
+    p->kptr = k;
+    p->klen = klen;
+  }
+
+  if (vesc) {
+    s = unescape_mapped(props, v, vlen);
+    p->value = s;
+    p->vptr = s;
+    p->vlen = strlen(s);
+  }
+  else {
+    p->value = NULL;
+    p->vptr = v;
+    p->vlen = vlen;
+  }
+
+  p->gen = props->gen;
+
+  {
+    struct property *old;
+    HASH_FIND(hh, props->root, p->kptr, p->klen, old);
+    if (old)
+      HASH_DEL(props->root, old);
+  }
+
+  HASH_ADD_KEYPTR(hh, props->root, p->kptr, p->klen, p);
+  props->nchanged++;
+}
+
+
+/*
+ * The in-place counterpart of parse()/get_token(): walk the mapping
+ * once, record (pointer, length) of each key and value, and fall back
+ * to a pool copy only for tokens that contain a backslash escape.
+ */
+static int
+parse_mapped(PROPERTIES *props)
+{
+  const char *p = props->map;
+  const char *end = props->map + props->map_size;
+  const char *kbeg, *kend, *vbeg, *vend;
+  int kesc, vesc;
+
+  if (!p)                       /* zero-length file; nothing mapped */
+    return 0;
+
+  while (p < end) {
+    while (p < end && (isblank((unsigned char)*p) || *p == '\n' || *p == '\r'))
+      p++;
+    if (p >= end)
+      break;
+
+    if (*p == '#' || *p == '!') { /* ignore comments */
+      while (p < end && *p != '\n')
+        p++;
+      continue;
+    }
+
+    kbeg = p;
+    kesc = 0;
+    while (p < end && *p != '=' && *p != ':' && *p != '\n') {
+      if (*p == '\\') {           /* skip the escaped char, which may
+                                   * be a separator or a newline */
+        kesc = 1;
+        p++;
+        if (p >= end)
+          break;
+      }
+      p++;
+    }
+    if (p >= end || *p == '\n')   /* no separator; give up like parse() */
+      break;
+    kend = p;
+    p++;                          /* skip the separator */
+
+    while (p < end && isblank((unsigned char)*p))
+      p++;
+
+    vbeg = p;
+    vesc = 0;
+    while (p < end && *p != '\n') {
+      if (*p == '\\') {
+        vesc = 1;
+        p++;
+        if (p >= end)
+          break;
+      }
+      p++;
+    }
+    vend = p;
+
+    while (kend > kbeg && isspace((unsigned char)kend[-1]))
+      kend--;
+    while (vend > vbeg && isspace((unsigned char)vend[-1]))
+      vend--;
+
+    prop_add_mapped(props, kbeg, kend - kbeg, kesc, vbeg, vend - vbeg, vesc);
+  }
+  return 0;
+}
+
+
 void
 properties_close(PROPERTIES *props)
 {
@@ -556,6 +904,8 @@ properties_close(PROPERTIES *props)
   }
 
   free_lexer(props->lex);
+  if (props->map)
+    munmap(props->map, props->map_size);
   xobs_free(&props->pool_, NULL);
   free(props);
 }
@@ -564,17 +914,28 @@ properties_close(PROPERTIES *props)
 void
 properties_put(PROPERTIES *props, const char *key, const char *value)
 {
-  struct property *p;
+  char *k = xobs_copy0(&props->pool_, key, strlen(key));
+  char *v = xobs_copy0(&props->pool_, value, strlen(value));
 
-  HASH_FIND_STR(props->root, key, p);
-  if (p)
-    HASH_DEL(props->root, p);
+  prop_put(props, k, v);
+}
 
-  p = xobs_alloc(&props->pool_, sizeof(*p));
-  p->key = xobs_copy0(&props->pool_, key, strlen(key));
-  p->value = xobs_copy0(&props->pool_, value, strlen(value));
 
-  HASH_ADD_KEYPTR(hh, props->root, p->key, strlen(p->key), p);
+static __inline__ const char *
+prop_key(PROPERTIES *props, struct property *p)
+{
+  if (!p->key)
+    p->key = xobs_copy0(&props->pool_, p->kptr, p->klen);
+  return p->key;
+}
+
+
+static __inline__ const char *
+prop_value(PROPERTIES *props, struct property *p)
+{
+  if (!p->value)
+    p->value = xobs_copy0(&props->pool_, p->vptr, p->vlen);
+  return p->value;
 }
 
 
@@ -586,7 +947,7 @@ properties_get(PROPERTIES *props, const char *key)
   HASH_FIND_STR(props->root, key, p);
 
   if (p)
-    return p->value;
+    return prop_value(props, p);
   else
     return NULL;
 }
@@ -602,8 +963,8 @@ properties_enum(PROPERTIES *props,
   int count = 0;
 
   HASH_ITER(hh, props->root, p, tmp) {
-    if (!pattern || (pattern && fnmatch(pattern, p->key, 0) == 0)) {
-      if (iter(p->key, p->value, data) == -1)
+    if (!pattern || (pattern && fnmatch(pattern, prop_key(props, p), 0) == 0)) {
+      if (iter(prop_key(props, p), prop_value(props, p), data) == -1)
         break;
 
       count++;
@@ -628,7 +989,10 @@ main(int argc, char *argv[])
   PROPERTIES *props;
   int i;
 
-  props = properties_load(argv[1], NULL);
+  if (getenv("PROPERTIES_MMAP"))
+    props = properties_load_mmap(argv[1]);
+  else
+    props = properties_load(argv[1], NULL);
 
   printf("--\n");
 
@@ -52,16 +52,42 @@ typedef struct properties PROPERTIES;
  * This function will parse the properties file and returns the structure
  * that containing parsing result.
  *
- * Currently non-null REUSE is not permitted.
+ * If REUSE is non-null (it must be the return value of a previous
+ * call), the file is re-parsed differentially against the existing
+ * table: entries whose value did not change keep their node and
+ * strings (pointer identity preserved), changed values are replaced
+ * in place, new keys are added, and keys gone from the file are
+ * removed.  Reloading an unchanged file allocates nothing, so the
+ * handle can be refreshed periodically at little cost; call
+ * properties_changed() afterwards to learn whether anything did.
  *
- * if REUSE is non-null, this function will reuse the structure that
- * containing the result.  In other words, you can have union of
- * properties by calling this function multiple times.  In this case,
- * except the first call, remaining calls should use the return value
- * of the first call as REUSE argument.
+ * On failure (e.g. the file is unreadable) it returns NULL; with
+ * REUSE the old table is left intact so the caller can retry.
  */
 extern PROPERTIES *properties_load(const char *pathname, PROPERTIES *reuse);
 
+/*
+ * Return the number of keys added, updated or removed by the most
+ * recent properties_load() on PROPS.  Zero means the reload was a
+ * no-op and any downstream recomputation can be skipped.
+ */
+extern int properties_changed(PROPERTIES *props);
+
+/*
+ * Like properties_load(), but mmap(2) the file and parse it in place.
+ *
+ * Keys and values are kept as (pointer, length) references into the
+ * read-only mapping, so loading costs one pass over the file and no
+ * per-entry copy; the pages stay in the page cache and are shared
+ * with any other process mapping the same file.  Only entries that
+ * contain backslash escapes are expanded into private storage at
+ * load time; others are copied lazily, the first time a call needs a
+ * null-terminated string.
+ *
+ * The mapping stays alive until properties_close().
+ */
+extern PROPERTIES *properties_load_mmap(const char *pathname);
+
 /*
  * Release the structure returned by properties_load().
  */
@@ -8,6 +8,17 @@
 #include <errno.h>
 #include <stdint.h>
 
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
 #define HAVE_UNISTRING
 
 #ifdef HAVE_UNISTRING
@@ -133,6 +144,20 @@ add_sstream(struct c_strstream *stream, const char *s)
 }
 
 
+int
+addn_sstream(struct c_strstream *stream, const char *s, size_t n)
+{
+  if (reserve_sstream(stream, n + 1) == -1)
+    return -1;
+
+  memcpy(stream->pos, s, n);
+
+  stream->pos += n;
+  *stream->pos = '\0';
+  return 0;
+}
+
+
 int
 addf_sstream(struct c_strstream *stream, const char *fmt, ...)
 {
@@ -157,6 +182,68 @@ addf_sstream(struct c_strstream *stream, const char *fmt, ...)
 }
 
 
+/*
+ * Return the number of leading byte(s) of S that can be copied into
+ * the stream verbatim: anything except NUL, '\\' (an escape sequence
+ * follows) and byte(s) >= 0x80, which are UTF-8 leaders/trailers and
+ * are left to the character-at-a-time loop.  Our property files are
+ * almost entirely ASCII with sparse escapes, so this run covers whole
+ * lines at a time.
+ *
+ * With SSE2/AVX2 the classification examines 16/32 byte(s) per step;
+ * the scalar prologue aligns the pointer first, so the vector loads
+ * never read past the page holding the terminating NUL.
+ */
+static size_t
+plain_run(const char *s)
+{
+  const char *p = s;
+
+#if defined(__AVX2__)
+  while ((uintptr_t)p & 31) {
+    unsigned char c = *p;
+    if (c == '\0' || c == '\\' || c >= 0x80)
+      return p - s;
+    p++;
+  }
+  for (;;) {
+    /* signed compare: NUL and byte(s) >= 0x80 are both < 1 */
+    __m256i chunk = _mm256_load_si256((const __m256i *)p);
+    __m256i stop =
+      _mm256_or_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(1), chunk),
+                      _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\\')));
+    unsigned mask = _mm256_movemask_epi8(stop);
+
+    if (mask)
+      return p - s + __builtin_ctz(mask);
+    p += 32;
+  }
+#elif defined(__SSE2__)
+  while ((uintptr_t)p & 15) {
+    unsigned char c = *p;
+    if (c == '\0' || c == '\\' || c >= 0x80)
+      return p - s;
+    p++;
+  }
+  for (;;) {
+    __m128i chunk = _mm_load_si128((const __m128i *)p);
+    __m128i stop = _mm_or_si128(_mm_cmplt_epi8(chunk, _mm_set1_epi8(1)),
+                                _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\')));
+    unsigned mask = _mm_movemask_epi8(stop);
+
+    if (mask)
+      return p - s + __builtin_ctz(mask);
+    p += 16;
+  }
+#else
+  while ((unsigned char)*p != '\0' && (unsigned char)*p != '\\' &&
+         (unsigned char)*p < 0x80)
+    p++;
+  return p - s;
+#endif
+}
+
+
 int
 add_sstream_u8escaped(struct c_strstream *stream, const char *s)
 {
@@ -172,8 +259,16 @@ add_sstream_u8escaped(struct c_strstream *stream, const char *s)
   int retval = 0;
 
   for (p = s; *p != '\0'; p++) {
-    if (*p != '\\')
-      addc_sstream(stream, *p);
+    if (*p != '\\') {
+      size_t n = plain_run(p);
+
+      if (n > 0) {              /* bulk-copy the ASCII run */
+        addn_sstream(stream, p, n);
+        p += n - 1;
+      }
+      else                      /* non-ASCII byte; copied verbatim */
+        addc_sstream(stream, *p);
+    }
     else {                      /* process the escape sequence */
       ahead[0] = *(p + 1);
 
@@ -587,6 +682,207 @@ props_get(PROPERTIES *props, const char *key)
 }
 
 
+/*
+ * Watcher mode: keep a property table in sync with its file.
+ *
+ * props_watch_open() loads the file and registers it with inotify(7);
+ * a background thread re-parses on every IN_CLOSE_WRITE into a brand
+ * new table and publishes it with one atomic pointer swap, so a
+ * reader either sees the complete old table or the complete new one,
+ * never a half-built or rehashing one, and never blocks on the parse.
+ *
+ * Readers bracket each lookup with props_watch_acquire() /
+ * props_watch_release(); the pair is two atomic ops, no lock.  The
+ * writer retires the old table with a two-epoch count: after the
+ * swap it flips the epoch and waits until every reader that entered
+ * under the old epoch has left, then frees the old table.  A reader
+ * that increments the old epoch counter after the flip is harmless --
+ * its subsequent load of the table pointer can only see the new one.
+ *
+ * IN_MOVE_SELF/IN_DELETE_SELF re-arm the watch on the pathname, so
+ * write-to-temp-then-rename editors and atomic installers work too.
+ */
+
+struct props_watch {
+  char *pathname;
+  FILE *errlog;
+
+  PROPERTIES *current;          /* readers load this atomically */
+
+  int readers[2];               /* in-flight readers, per epoch */
+  unsigned epoch;
+
+  int ifd;                      /* inotify fd */
+  int wd;
+  int stopfd[2];                /* self-pipe to stop the watcher */
+  pthread_t thread;
+};
+
+#define PROPS_WATCH_MASK        (IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF)
+
+
+PROPERTIES *
+props_watch_acquire(struct props_watch *w, int *epoch)
+{
+  unsigned e = __atomic_load_n(&w->epoch, __ATOMIC_SEQ_CST) & 1;
+
+  __atomic_fetch_add(&w->readers[e], 1, __ATOMIC_SEQ_CST);
+  *epoch = e;
+  return __atomic_load_n(&w->current, __ATOMIC_SEQ_CST);
+}
+
+
+void
+props_watch_release(struct props_watch *w, int epoch)
+{
+  __atomic_fetch_sub(&w->readers[epoch], 1, __ATOMIC_SEQ_CST);
+}
+
+
+static void
+props_watch_reload(struct props_watch *w)
+{
+  PROPERTIES *fresh, *old;
+  unsigned e;
+
+  if (access(w->pathname, R_OK) == -1) {
+    if (w->errlog)
+      fprintf(w->errlog, "%s: unreadable, keeping the old table\n",
+              w->pathname);
+    return;                     /* mid-rename; the next event retries */
+  }
+
+  fresh = props_load(w->pathname, w->errlog, NULL);
+
+  old = __atomic_exchange_n(&w->current, fresh, __ATOMIC_SEQ_CST);
+  e = __atomic_fetch_add(&w->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+
+  /* grace period: only readers that entered before the flip can hold
+   * OLD, and each of them leaves in bounded time. */
+  while (__atomic_load_n(&w->readers[e], __ATOMIC_SEQ_CST) != 0)
+    usleep(1000);
+
+  if (old)
+    props_free(old);
+}
+
+
+static void *
+props_watch_main(void *arg)
+{
+  struct props_watch *w = arg;
+  struct pollfd fds[2];
+  char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len, i;
+  int rearm;
+
+  fds[0].fd = w->ifd;
+  fds[0].events = POLLIN;
+  fds[1].fd = w->stopfd[0];
+  fds[1].events = POLLIN;
+
+  while (1) {
+    fds[0].revents = fds[1].revents = 0;
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[1].revents)
+      break;
+    if (!fds[0].revents)
+      continue;
+
+    len = read(w->ifd, buf, sizeof(buf));
+    if (len <= 0)
+      continue;
+
+    rearm = 0;
+    for (i = 0; i < len; ) {
+      struct inotify_event *ev = (struct inotify_event *)(buf + i);
+      if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED))
+        rearm = 1;
+      i += sizeof(*ev) + ev->len;
+    }
+
+    if (rearm)                  /* the file was replaced, not updated */
+      w->wd = inotify_add_watch(w->ifd, w->pathname, PROPS_WATCH_MASK);
+
+    props_watch_reload(w);
+  }
+  return NULL;
+}
+
+
+struct props_watch *
+props_watch_open(const char *pathname, FILE *errlog)
+{
+  struct props_watch *w;
+
+  w = calloc(1, sizeof(*w));
+  if (!w)
+    return NULL;
+  w->ifd = w->wd = w->stopfd[0] = w->stopfd[1] = -1;
+  w->errlog = errlog;
+
+  w->pathname = strdup(pathname);
+  if (!w->pathname)
+    goto err;
+
+  w->current = props_load(pathname, errlog, NULL);
+
+  w->ifd = inotify_init();
+  if (w->ifd == -1)
+    goto err;
+
+  w->wd = inotify_add_watch(w->ifd, pathname, PROPS_WATCH_MASK);
+  if (w->wd == -1)
+    goto err;
+
+  if (pipe(w->stopfd) == -1)
+    goto err;
+
+  if (pthread_create(&w->thread, NULL, props_watch_main, w) != 0)
+    goto err;
+
+  return w;
+
+ err:
+  if (w->stopfd[0] != -1) {
+    close(w->stopfd[0]);
+    close(w->stopfd[1]);
+  }
+  if (w->ifd != -1)
+    close(w->ifd);
+  if (w->current)
+    props_free(w->current);
+  free(w->pathname);
+  free(w);
+  return NULL;
+}
+
+
+void
+props_watch_close(struct props_watch *w)
+{
+  char ch = 0;
+
+  if (write(w->stopfd[1], &ch, 1) == -1)
+    xerror(0, errno, "props_watch_close: wake-up write failed");
+  pthread_join(w->thread, NULL);
+
+  close(w->stopfd[0]);
+  close(w->stopfd[1]);
+  close(w->ifd);
+
+  if (w->current)
+    props_free(w->current);
+  free(w->pathname);
+  free(w);
+}
+
+
 int
 main_(int argc, char *argv[])
 {
@@ -624,6 +920,30 @@ main(int argc, char *argv[])
 }
 
 
+int
+main_watch(int argc, char *argv[])
+{
+  struct props_watch *w;
+  PROPERTIES *table;
+  int epoch;
+
+  w = props_watch_open(argv[1], stderr);
+  if (!w)
+    xerror(1, errno, "props_watch_open(%s) failed", argv[1]);
+
+  while (1) {
+    table = props_watch_acquire(w, &epoch);
+    printf("[%s] = |%s|\n", argv[2], props_get(table, argv[2]));
+    props_watch_release(w, epoch);
+
+    sleep(1);
+  }
+
+  props_watch_close(w);
+  return 0;
+}
+
+
 int
 main5(int argc, char *argv[])
 {
@@ -1,9 +1,50 @@
+/*
+ * rbtree-test: correctness check and container benchmark driver.
+ *
+ * Without arguments it runs the original word-count correctness test
+ * over stdin.  With "bench" it becomes a benchmark harness comparing
+ * the containers we keep re-evaluating by hand -- rbtree.c, and
+ * optionally symtable.c (-DHAVE_SYMTABLE, needs a working obstack
+ * environment for obsutil.h) and the uthash tables props.c uses
+ * (-DHAVE_UTHASH) -- under parameterized workloads, with CSV on
+ * stdout:
+ *
+ *   rbtree-test bench [-e ENGINE] [-w WORKLOAD] [-n N,N,...] [-r REPS]
+ *
+ *   -e  rbtree | symtable | uthash | all        (default: all)
+ *   -w  insert | lookup | zipf | churn | mixed | all
+ *   -n  comma-separated element counts; the defaults 10000, 100000
+ *       and 1000000 put the working set in L2, L3 and DRAM
+ *   -r  repetitions per cell (default 3)
+ *   -s  RNG seed
+ *
+ * Each cell reports wall time (DIFFTIME_NS) and, where the kernel
+ * allows perf_event_open(2), cycles, instructions, cache references
+ * and cache misses; unavailable counters print as 0.
+ */
 #include "rbtree.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include "difftime.h"
 
+#include <math.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYMTABLE
+#include "symtable.h"
+#endif
+
+#ifdef HAVE_UTHASH
+#include "uthash.h"
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#endif
+
 struct mytype {
   struct rb_node node_;
   char *name;
@@ -100,8 +141,8 @@ my_clear2(struct rb_root *root)
 }
 
 
-int
-main(void)
+static int
+check_main(void)
 {
   //struct rb_root myroot = RB_ROOT;
   struct rb_root root = RB_ROOT;
@@ -146,3 +187,528 @@ main(void)
   }
   return 0;
 }
+
+
+/*
+ * Hardware counters.  One fd per event, enabled around the timed
+ * region; a failed perf_event_open (no permission, no PMU) leaves the
+ * fd at -1 and the column reads 0.
+ */
+#define PCTR_MAX        4
+
+struct pctr {
+  int fd[PCTR_MAX];
+  unsigned long long val[PCTR_MAX];
+};
+
+#ifdef __linux__
+/* order matches the cycles/instructions/cache_refs/cache_misses
+ * columns of the CSV */
+static const unsigned long long pctr_configs[PCTR_MAX] = {
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_REFERENCES,
+  PERF_COUNT_HW_CACHE_MISSES,
+};
+#endif
+
+static void
+pctr_open(struct pctr *pc)
+{
+  int i;
+
+  for (i = 0; i < PCTR_MAX; i++) {
+    pc->fd[i] = -1;
+    pc->val[i] = 0;
+  }
+
+#ifdef __linux__
+  for (i = 0; i < PCTR_MAX; i++) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = pctr_configs[i];
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    pc->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+#endif
+}
+
+
+static void
+pctr_start(struct pctr *pc)
+{
+#ifdef __linux__
+  int i;
+  for (i = 0; i < PCTR_MAX; i++) {
+    if (pc->fd[i] != -1) {
+      ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#endif
+}
+
+
+static void
+pctr_stop(struct pctr *pc)
+{
+#ifdef __linux__
+  int i;
+  for (i = 0; i < PCTR_MAX; i++) {
+    if (pc->fd[i] != -1) {
+      ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+      if (read(pc->fd[i], &pc->val[i], sizeof(pc->val[i])) !=
+          sizeof(pc->val[i]))
+        pc->val[i] = 0;
+    }
+  }
+#endif
+}
+
+
+static void
+pctr_close(struct pctr *pc)
+{
+#ifdef __linux__
+  int i;
+  for (i = 0; i < PCTR_MAX; i++)
+    if (pc->fd[i] != -1)
+      close(pc->fd[i]);
+#endif
+}
+
+
+/*
+ * Engines.  One vtable per container; HANDLE is whatever the engine
+ * wants.  insert() overwrites, lookup() returns nonzero on a hit,
+ * remove() must only see keys known to be present.
+ */
+struct bench_ops {
+  const char *name;
+  void *(*init)(size_t nelem);
+  void (*insert)(void *h, char *key, int value);
+  int (*lookup)(void *h, const char *key);
+  void (*remove)(void *h, const char *key);
+  void (*fini)(void *h);
+};
+
+
+static void *
+rbt_init(size_t nelem)
+{
+  struct rb_root *root = malloc(sizeof(*root));
+  (void)nelem;
+  *root = (struct rb_root)RB_ROOT;
+  return root;
+}
+
+static void
+rbt_insert(void *h, char *key, int value)
+{
+  struct mytype *p = my_search(h, key);
+  if (p)
+    p->value = value;
+  else
+    my_insert(h, key, value);
+}
+
+static int
+rbt_lookup(void *h, const char *key)
+{
+  return my_search(h, (char *)key) != NULL;
+}
+
+static void
+rbt_remove(void *h, const char *key)
+{
+  my_delete(h, key);
+}
+
+static void
+rbt_fini(void *h)
+{
+  my_clear1(h);
+  free(h);
+}
+
+
+#ifdef HAVE_SYMTABLE
+static void *
+sym_init(size_t nelem)
+{
+  return symtable_new(nelem, 1, 0);
+}
+
+static void
+sym_insert(void *h, char *key, int value)
+{
+  symtable_register(h, key, &value, sizeof(value));
+}
+
+static int
+sym_lookup(void *h, const char *key)
+{
+  return symtable_lookup(h, key, NULL, 0) != NULL;
+}
+
+static void
+sym_remove(void *h, const char *key)
+{
+  symtable_unregister(h, key);
+}
+
+static void
+sym_fini(void *h)
+{
+  symtable_delete(h);
+}
+#endif  /* HAVE_SYMTABLE */
+
+
+#ifdef HAVE_UTHASH
+/* Modeled on the property tables in props.c. */
+struct uent {
+  char *key;
+  int value;
+  UT_hash_handle hh;
+};
+
+struct utab {
+  struct uent *head;
+};
+
+static void *
+ut_init(size_t nelem)
+{
+  struct utab *t = malloc(sizeof(*t));
+  (void)nelem;
+  t->head = NULL;
+  return t;
+}
+
+static void
+ut_insert(void *h, char *key, int value)
+{
+  struct utab *t = h;
+  struct uent *p;
+
+  HASH_FIND_STR(t->head, key, p);
+  if (p) {
+    p->value = value;
+    return;
+  }
+  p = malloc(sizeof(*p));
+  p->key = strdup(key);
+  p->value = value;
+  HASH_ADD_KEYPTR(hh, t->head, p->key, strlen(p->key), p);
+}
+
+static int
+ut_lookup(void *h, const char *key)
+{
+  struct utab *t = h;
+  struct uent *p;
+
+  HASH_FIND_STR(t->head, key, p);
+  return p != NULL;
+}
+
+static void
+ut_remove(void *h, const char *key)
+{
+  struct utab *t = h;
+  struct uent *p;
+
+  HASH_FIND_STR(t->head, key, p);
+  if (p) {
+    HASH_DEL(t->head, p);
+    free(p->key);
+    free(p);
+  }
+}
+
+static void
+ut_fini(void *h)
+{
+  struct utab *t = h;
+  struct uent *p, *tmp;
+
+  HASH_ITER(hh, t->head, p, tmp) {
+    HASH_DEL(t->head, p);
+    free(p->key);
+    free(p);
+  }
+  free(t);
+}
+#endif  /* HAVE_UTHASH */
+
+
+static const struct bench_ops engines[] = {
+  { "rbtree",   rbt_init, rbt_insert, rbt_lookup, rbt_remove, rbt_fini },
+#ifdef HAVE_SYMTABLE
+  { "symtable", sym_init, sym_insert, sym_lookup, sym_remove, sym_fini },
+#endif
+#ifdef HAVE_UTHASH
+  { "uthash",   ut_init,  ut_insert,  ut_lookup,  ut_remove,  ut_fini  },
+#endif
+};
+
+#define NENGINES        (sizeof(engines) / sizeof(engines[0]))
+
+
+enum {
+  WL_INSERT, WL_LOOKUP, WL_ZIPF, WL_CHURN, WL_MIXED, WL_COUNT
+};
+
+static const char *workload_names[WL_COUNT] = {
+  "insert", "lookup", "zipf", "churn", "mixed"
+};
+
+
+static unsigned long rng_state = 88172645463325252UL;
+
+static unsigned long
+rng_next(void)
+{
+  /* xorshift64 -- cheap enough not to show up next to the table ops */
+  unsigned long x = rng_state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return rng_state = x;
+}
+
+
+/*
+ * Zipf-distributed rank in [0, n).  Log-uniform inversion --
+ * P(X <= k) ~ ln(k+1)/ln(n+1) -- which is the s=1 zipf shape, close
+ * enough for skewing lookups toward a hot set.
+ */
+static size_t
+zipf_rank(size_t n)
+{
+  double u = (double)(rng_next() >> 11) / (double)(1UL << 53);
+  size_t k = (size_t)(exp(u * log((double)n + 1.0)) - 1.0);
+  return k < n ? k : n - 1;
+}
+
+
+static char **
+make_keys(size_t n)
+{
+  char **keys = malloc(n * sizeof(char *));
+  char buf[32];
+  size_t i, j;
+
+  for (i = 0; i < n; i++) {
+    snprintf(buf, sizeof(buf), "key-%08lu", (unsigned long)i);
+    keys[i] = strdup(buf);
+  }
+  for (i = n - 1; i > 0; i--) { /* Fisher-Yates */
+    char *tmp;
+    j = rng_next() % (i + 1);
+    tmp = keys[i];
+    keys[i] = keys[j];
+    keys[j] = tmp;
+  }
+  return keys;
+}
+
+
+static void
+free_keys(char **keys, size_t n)
+{
+  size_t i;
+  for (i = 0; i < n; i++)
+    free(keys[i]);
+  free(keys);
+}
+
+
+static void
+bench_cell(const struct bench_ops *ops, int workload, size_t n, int rep)
+{
+  char **keys = make_keys(n);
+  char *present = NULL;
+  void *h = ops->init(n);
+  struct pctr pc;
+  size_t i, nops;
+  long ns = 0;
+  int sink = 0;
+
+  nops = (workload == WL_INSERT) ? n : 2 * n;
+
+  if (workload != WL_INSERT)    /* preload, untimed */
+    for (i = 0; i < n; i++)
+      ops->insert(h, keys[i], (int)i);
+
+  if (workload == WL_CHURN || workload == WL_MIXED) {
+    present = malloc(n);
+    memset(present, 1, n);
+  }
+
+  pctr_open(&pc);
+  pctr_start(&pc);
+
+  DIFFTIME_NS(ns) {
+    switch (workload) {
+    case WL_INSERT:
+      for (i = 0; i < n; i++)
+        ops->insert(h, keys[i], (int)i);
+      break;
+
+    case WL_LOOKUP:
+      for (i = 0; i < nops; i++)
+        sink += ops->lookup(h, keys[rng_next() % n]);
+      break;
+
+    case WL_ZIPF:
+      for (i = 0; i < nops; i++)
+        sink += ops->lookup(h, keys[zipf_rank(n)]);
+      break;
+
+    case WL_CHURN:
+      /* delete/reinsert pairs over a stable population */
+      for (i = 0; i < nops; i++) {
+        size_t k = rng_next() % n;
+        if (present[k]) {
+          ops->remove(h, keys[k]);
+          present[k] = 0;
+        }
+        else {
+          ops->insert(h, keys[k], (int)k);
+          present[k] = 1;
+        }
+      }
+      break;
+
+    case WL_MIXED:
+      /* 90% lookup, 10% churn */
+      for (i = 0; i < nops; i++) {
+        size_t k = rng_next() % n;
+        if (rng_next() % 10) {
+          if (present[k])
+            sink += ops->lookup(h, keys[k]);
+        }
+        else if (present[k]) {
+          ops->remove(h, keys[k]);
+          present[k] = 0;
+        }
+        else {
+          ops->insert(h, keys[k], (int)k);
+          present[k] = 1;
+        }
+      }
+      break;
+    }
+  }
+
+  pctr_stop(&pc);
+
+  printf("%s,%s,%lu,%d,%lu,%.6f,%.1f,%llu,%llu,%llu,%llu\n",
+         ops->name, workload_names[workload],
+         (unsigned long)n, rep, (unsigned long)nops,
+         (double)ns / 1e9, (double)ns / nops,
+         pc.val[0], pc.val[1], pc.val[2], pc.val[3]);
+
+  pctr_close(&pc);
+  if (sink == -1)               /* keep the lookups un-elidable */
+    fprintf(stderr, "?");
+
+  /* CHURN/MIXED may finish with holes; refill so fini() sees a full
+   * table and every engine tears down the same population. */
+  if (present) {
+    for (i = 0; i < n; i++)
+      if (!present[i])
+        ops->insert(h, keys[i], (int)i);
+    free(present);
+  }
+
+  ops->fini(h);
+  free_keys(keys, n);
+}
+
+
+static int
+bench_main(int argc, char *argv[])
+{
+  size_t sizes[16] = { 10000, 100000, 1000000 };
+  int nsizes = 3;
+  int reps = 3;
+  const char *engine = "all";
+  const char *workload = "all";
+  int opt, w, rep;
+  size_t e;
+  int i;
+
+  while ((opt = getopt(argc, argv, "e:w:n:r:s:")) != -1) {
+    switch (opt) {
+    case 'e':
+      engine = optarg;
+      break;
+    case 'w':
+      workload = optarg;
+      break;
+    case 'n': {
+      char *p = optarg, *end;
+      nsizes = 0;
+      while (*p && nsizes < 16) {
+        sizes[nsizes] = strtoul(p, &end, 10);
+        if (end == p)
+          break;
+        nsizes++;
+        p = (*end == ',') ? end + 1 : end;
+      }
+      break;
+    }
+    case 'r':
+      reps = atoi(optarg);
+      break;
+    case 's':
+      rng_state = strtoul(optarg, NULL, 10);
+      if (rng_state == 0)
+        rng_state = 1;
+      break;
+    default:
+      fprintf(stderr,
+              "usage: rbtree-test bench [-e ENGINE] [-w WORKLOAD]"
+              " [-n N,N,...] [-r REPS] [-s SEED]\n");
+      return 1;
+    }
+  }
+
+  printf("engine,workload,nelem,rep,ops,secs,ns_per_op,"
+         "cycles,instructions,cache_refs,cache_misses\n");
+
+  for (e = 0; e < NENGINES; e++) {
+    if (strcmp(engine, "all") != 0 && strcmp(engine, engines[e].name) != 0)
+      continue;
+
+    for (w = 0; w < WL_COUNT; w++) {
+      if (strcmp(workload, "all") != 0 &&
+          strcmp(workload, workload_names[w]) != 0)
+        continue;
+
+      for (i = 0; i < nsizes; i++)
+        for (rep = 0; rep < reps; rep++)
+          bench_cell(&engines[e], w, sizes[i], rep);
+    }
+  }
+  return 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+  if (argc > 1 && strcmp(argv[1], "bench") == 0)
+    return bench_main(argc - 1, argv + 1);
+
+  return check_main();
+}
@@ -28,6 +28,11 @@
 #define EXPORT_SYMBOL(x)
 #endif
 
+static inline size_t __rb_count(const struct rb_node *node)
+{
+        return node ? node->rb_count : 0;
+}
+
 static void __rb_rotate_left(struct rb_node *node, struct rb_root *root)
 {
         struct rb_node *right = node->rb_right;
@@ -49,6 +54,10 @@ static void __rb_rotate_left(struct rb_node *node, struct rb_root *root)
         else
                 root->rb_node = right;
         rb_set_parent(node, right);
+
+        right->rb_count = node->rb_count;
+        node->rb_count = __rb_count(node->rb_left)
+                + __rb_count(node->rb_right) + 1;
 }
 
 static void __rb_rotate_right(struct rb_node *node, struct rb_root *root)
@@ -72,6 +81,10 @@ static void __rb_rotate_right(struct rb_node *node, struct rb_root *root)
         else
                 root->rb_node = left;
         rb_set_parent(node, left);
+
+        left->rb_count = node->rb_count;
+        node->rb_count = __rb_count(node->rb_left)
+                + __rb_count(node->rb_right) + 1;
 }
 
 void rb_insert_color(struct rb_node *node, struct rb_root *root)
@@ -220,6 +233,15 @@ static void __rb_erase_color(struct rb_node *node, struct rb_node *parent,
                 rb_set_black(node);
 }
 
+/* one node leaves the subtree of NODE and of each of its ancestors */
+static void __rb_count_dec_path(struct rb_node *node)
+{
+        while (node) {
+                node->rb_count--;
+                node = rb_parent(node);
+        }
+}
+
 void rb_erase(struct rb_node *node, struct rb_root *root)
 {
         struct rb_node *child, *parent;
@@ -237,6 +259,9 @@ void rb_erase(struct rb_node *node, struct rb_root *root)
                 while ((left = node->rb_left) != NULL)
                         node = left;
 
+                /* the successor is unlinked from its position */
+                __rb_count_dec_path(rb_parent(node));
+
                 if (rb_parent(old)) {
                         if (rb_parent(old)->rb_left == old)
                                 rb_parent(old)->rb_left = node;
@@ -262,11 +287,14 @@ void rb_erase(struct rb_node *node, struct rb_root *root)
 
                 node->rb_parent_color = old->rb_parent_color;
                 node->rb_left = old->rb_left;
+                node->rb_count = old->rb_count;
                 rb_set_parent(old->rb_left, node);
 
                 goto color;
         }
 
+        __rb_count_dec_path(rb_parent(node));
+
         parent = rb_parent(node);
         color = rb_color(node);
 
@@ -465,3 +493,89 @@ void rb_replace_node(struct rb_node *victim, struct rb_node *new,
         *new = *victim;
 }
 EXPORT_SYMBOL(rb_replace_node);
+
+/*
+ * Link NODES[LO..HI-1] into a balanced subtree and return its root.
+ *
+ * Only the nodes of the deepest level (DEPTH == RED_DEPTH) are
+ * colored red; every path from the root to a NULL then passes the
+ * same number of black nodes, so the result is a valid rbtree.
+ */
+static struct rb_node *__rb_build(struct rb_node **nodes,
+                                  size_t lo, size_t hi,
+                                  int depth, int red_depth,
+                                  struct rb_node *parent)
+{
+        size_t mid;
+        struct rb_node *node;
+
+        if (lo >= hi)
+                return NULL;
+
+        mid = lo + (hi - lo) / 2;
+        node = nodes[mid];
+
+        node->rb_parent_color = (unsigned long)parent;
+        if (depth != red_depth)
+                rb_set_black(node);
+        node->rb_left = __rb_build(nodes, lo, mid,
+                                   depth + 1, red_depth, node);
+        node->rb_right = __rb_build(nodes, mid + 1, hi,
+                                    depth + 1, red_depth, node);
+        node->rb_count = hi - lo;
+
+        return node;
+}
+
+void rb_build(struct rb_root *root, struct rb_node **nodes, size_t count)
+{
+        int height = 0;
+        size_t n;
+
+        for (n = count; n > 1; n >>= 1)
+                height++;
+
+        root->rb_node = __rb_build(nodes, 0, count, 0, height, NULL);
+        if (root->rb_node)
+                rb_set_black(root->rb_node);
+        root->size = count;
+        root->nmodified++;
+}
+EXPORT_SYMBOL(rb_build);
+
+struct rb_node *rb_nth(const struct rb_root *root, size_t n)
+{
+        struct rb_node *node = root->rb_node;
+
+        if (!node || n >= node->rb_count)
+                return NULL;
+
+        while (node) {
+                size_t left = __rb_count(node->rb_left);
+
+                if (n < left)
+                        node = node->rb_left;
+                else if (n == left)
+                        return node;
+                else {
+                        n -= left + 1;
+                        node = node->rb_right;
+                }
+        }
+        return NULL;
+}
+EXPORT_SYMBOL(rb_nth);
+
+size_t rb_rank(const struct rb_node *node)
+{
+        size_t rank = __rb_count(node->rb_left);
+        const struct rb_node *parent;
+
+        while ((parent = rb_parent(node)) != NULL) {
+                if (node == parent->rb_right)
+                        rank += __rb_count(parent->rb_left) + 1;
+                node = parent;
+        }
+        return rank;
+}
+EXPORT_SYMBOL(rb_rank);
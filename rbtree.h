@@ -96,6 +96,32 @@ static inline struct page * rb_insert_page_cache(struct inode * inode,
 
 #include <stddef.h>
 
+/*
+ * Note that this module is INTRUSIVE, like elist.h is for lists: the
+ * struct rb_node lives inside the caller's struct and the tree never
+ * allocates anything, so insertion and removal are allocation-free
+ * and the nodes stay wherever the caller put them (e.g. inside
+ * pool-allocated objects).  For example:
+ *
+ *   struct timer {
+ *     long expire;              -- the ordering key
+ *     struct rb_node rb;       -- the handle inside the tree
+ *     ...
+ *   };
+ *
+ *   #define CMP(a, b)  ((a) < (b) ? -1 : (a) > (b) ? 1 : 0)
+ *
+ *   struct rb_root root = RB_ROOT;
+ *   struct timer *t = ...;      -- from your pool, stack, whatever
+ *
+ *   RB_INSERT(&root, struct timer, expire, rb, CMP, t);
+ *   ...
+ *   RB_DELETE(&root, struct timer, rb, expire, CMP, deadline);
+ *
+ * Use rb_entry() (a.k.a. container_of()) to get back from a struct
+ * rb_node to the enclosing struct, as in the sample code below.
+ */
+
 
 #ifndef offsetof
 #ifdef GCC
@@ -119,6 +145,10 @@ struct rb_node
 #define RB_BLACK        1
         struct rb_node *rb_right;
         struct rb_node *rb_left;
+        size_t rb_count;        /* number of nodes in this subtree,
+                                   including this one; kept up to date
+                                   by link/rotate/erase so that
+                                   rb_nth()/rb_rank() run in O(log n) */
 } __attribute__((aligned(sizeof(long))));
     /* The alignment might seem pointless, but allegedly CRIS needs it */
 
@@ -158,6 +188,7 @@ static inline void rb_init_node(struct rb_node *rb)
         rb->rb_parent_color = 0;
         rb->rb_right = NULL;
         rb->rb_left = NULL;
+        rb->rb_count = 1;
         RB_CLEAR_NODE(rb);
 }
 
@@ -182,13 +213,40 @@ extern struct rb_node *rb_last(const struct rb_root *);
 extern void rb_replace_node(struct rb_node *victim, struct rb_node *new,
                             struct rb_root *root);
 
+/*
+ * Build a balanced tree over NODES[0..COUNT-1] in O(n).
+ *
+ * NODES must be sorted ascending in the caller's ordering; any
+ * previous content of ROOT is discarded.  This replaces COUNT calls
+ * of RB_INSERT() -- O(n log n) with rebalancing -- when loading
+ * pre-sorted records, and the resulting tree is perfectly balanced.
+ */
+extern void rb_build(struct rb_root *root, struct rb_node **nodes,
+                     size_t count);
+
+/*
+ * Order statistics, both O(log n) thanks to rb_node::rb_count.
+ *
+ * rb_nth() returns the N-th node (zero based) in sort order, or NULL
+ * if N is out of range.  rb_rank() returns the number of nodes that
+ * precede NODE in sort order, i.e. rb_rank(rb_nth(root, n)) == n.
+ */
+extern struct rb_node *rb_nth(const struct rb_root *root, size_t n);
+extern size_t rb_rank(const struct rb_node *node);
+
 static inline void rb_link_node(struct rb_node * node, struct rb_node * parent,
                                 struct rb_node ** rb_link)
 {
         node->rb_parent_color = (unsigned long )parent;
         node->rb_left = node->rb_right = NULL;
+        node->rb_count = 1;
 
         *rb_link = node;
+
+        while (parent) {
+                parent->rb_count++;
+                parent = rb_parent(parent);
+        }
 }
 
 #define RB_SEARCH(root, usertype, handle, userkey, compare, key)        ({ \
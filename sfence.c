@@ -24,6 +24,7 @@
 #include <pthread.h>
 
 #include <errno.h>
+#include <signal.h>
 
 #include <unistd.h>
 #include <sys/mman.h>
@@ -33,6 +34,8 @@
 
 #define THREAD_TABLE_PAGES      1
 
+#define GUARD_MAX 1024
+
 struct frame {
   void *func_ptr;
   void *base_ptr;
@@ -56,10 +59,36 @@ struct thread_info {
   struct thread_entry entries[0];
 };
 
+/*
+ * Guard-page mode.
+ *
+ * The canary check in __cyg_profile_func_exit() tells us that a frame
+ * was corrupted only after the function returns -- too late to say
+ * which write did it.  With SFENCE_GUARD=1 in the environment,
+ * sfence_guard_alloc() hands out buffers whose end abuts a PROT_NONE
+ * page (electric-fence style), so the overflowing store itself takes
+ * the SIGSEGV.  Our handler attributes the fault to the guarded
+ * allocation, dumps the instrumented call stack of the faulting
+ * thread, then chains to whatever SIGSEGV handler was installed
+ * before us -- e.g. xbacktrace_on_signals() from xerror.c, which adds
+ * the symbolized (or GDB) backtrace.
+ */
+struct guard_entry {
+  void *base;                   /* mmap base (page aligned) */
+  void *user;                   /* pointer handed to the caller */
+  size_t size;                  /* requested size */
+  size_t maplen;                /* whole mapping, guard included */
+};
+
 static struct thread_info *thread_table;
 static pthread_mutex_t frame_mutex = PTHREAD_MUTEX_INITIALIZER;
 static const char *sfence_version = "0.1";
 
+static struct guard_entry guard_table[GUARD_MAX];
+static pthread_mutex_t guard_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int guard_mode = 0;
+static struct sigaction guard_oldact;
+
 
 __attribute__((no_instrument_function)) static void
 banner(void)
@@ -155,6 +184,150 @@ sfence_dump_stack(void)
 }
 
 
+__attribute__((no_instrument_function)) static struct guard_entry *
+guard_lookup(void *addr)
+{
+  int i;
+  char *p = (char *)addr;
+
+  for (i = 0; i < GUARD_MAX; i++) {
+    struct guard_entry *g = guard_table + i;
+    if (g->base &&
+        p >= (char *)g->base && p < (char *)g->base + g->maplen)
+      return g;
+  }
+  return NULL;
+}
+
+
+__attribute__((no_instrument_function)) static void
+guard_sigsegv(int signo, siginfo_t *info, void *uctx)
+{
+  struct guard_entry *g;
+  pthread_t self = pthread_self();
+  int i;
+
+  g = guard_lookup(info->si_addr);
+  if (g) {
+    fprintf(stderr, "sfence: GUARD PAGE HIT at %p\n", info->si_addr);
+    fprintf(stderr, "sfence:   allocation %p, %lu byte(s), guard [%p, %p)\n",
+            g->user, (unsigned long)g->size,
+            (char *)g->user + g->size,
+            (char *)g->base + g->maplen);
+
+    for (i = 0; i < thread_table->current; i++) {
+      if (pthread_equal(thread_table->entries[i].tid, self) &&
+          thread_table->entries[i].frame != 0) {
+        dump_frame_info(thread_table->entries[i].frame);
+        break;
+      }
+    }
+  }
+
+  /* Chain: the handler installed before us (xbacktrace_on_signals()
+   * from xerror, typically) produces the symbolized backtrace and
+   * ends the process.  Without one, re-raise with the default
+   * disposition for the core dump. */
+  if (guard_oldact.sa_flags & SA_SIGINFO) {
+    if (guard_oldact.sa_sigaction) {
+      guard_oldact.sa_sigaction(signo, info, uctx);
+      return;
+    }
+  }
+  else if (guard_oldact.sa_handler != SIG_DFL &&
+           guard_oldact.sa_handler != SIG_IGN) {
+    guard_oldact.sa_handler(signo);
+    return;
+  }
+
+  signal(signo, SIG_DFL);
+  raise(signo);
+}
+
+
+/*
+ * Allocate SIZE bytes followed immediately by a PROT_NONE page.  The
+ * returned pointer is placed so that BUF + SIZE lands on the guard
+ * page boundary; writing one byte past the end faults on the spot.
+ * Release with sfence_guard_free().  Falls back to malloc(3) when
+ * guard mode is off or the guard table is full.
+ */
+__attribute__((no_instrument_function)) void *
+sfence_guard_alloc(size_t size)
+{
+  int pagesize = sysconf(_SC_PAGE_SIZE);
+  size_t maplen;
+  struct guard_entry *g = NULL;
+  char *base;
+  int i;
+
+  if (!guard_mode)
+    return malloc(size);
+
+  /* data pages + one guard page */
+  maplen = (size + pagesize - 1) / pagesize * pagesize + pagesize;
+
+  pthread_mutex_lock(&guard_mutex);
+  for (i = 0; i < GUARD_MAX; i++) {
+    if (guard_table[i].base == NULL) {
+      g = guard_table + i;
+      break;
+    }
+  }
+  if (!g) {
+    pthread_mutex_unlock(&guard_mutex);
+    fprintf(stderr, "sfence: guard table full; falling back to malloc\n");
+    return malloc(size);
+  }
+
+  base = mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    pthread_mutex_unlock(&guard_mutex);
+    fprintf(stderr, "sfence: mmap(2) failed: %s\n", strerror(errno));
+    return NULL;
+  }
+
+  if (mprotect(base + maplen - pagesize, pagesize, PROT_NONE) == -1) {
+    fprintf(stderr, "sfence: mprotect(2) failed: %s\n", strerror(errno));
+    munmap(base, maplen);
+    pthread_mutex_unlock(&guard_mutex);
+    return NULL;
+  }
+
+  g->base = base;
+  g->maplen = maplen;
+  g->size = size;
+  g->user = base + (maplen - pagesize - size);
+  pthread_mutex_unlock(&guard_mutex);
+
+  return g->user;
+}
+
+
+__attribute__((no_instrument_function)) void
+sfence_guard_free(void *ptr)
+{
+  struct guard_entry *g;
+
+  if (ptr == NULL)
+    return;
+
+  pthread_mutex_lock(&guard_mutex);
+  g = guard_lookup(ptr);
+  if (g) {
+    munmap(g->base, g->maplen);
+    g->base = g->user = NULL;
+    g->size = g->maplen = 0;
+    pthread_mutex_unlock(&guard_mutex);
+    return;
+  }
+  pthread_mutex_unlock(&guard_mutex);
+
+  free(ptr);                    /* not ours: the malloc fallback */
+}
+
+
 __attribute__((no_instrument_function,constructor)) static void
 sfence_init(void)
 {
@@ -184,6 +357,22 @@ sfence_init(void)
     fprintf(stderr, "sfence: mprotect(2) failed: %s\n", strerror(errno));
     exit(1);
   }
+
+  if (getenv("SFENCE_GUARD")) {
+    struct sigaction act;
+
+    memset(&act, 0, sizeof(act));
+    act.sa_sigaction = guard_sigsegv;
+    act.sa_flags = SA_SIGINFO;
+    sigemptyset(&act.sa_mask);
+
+    if (sigaction(SIGSEGV, &act, &guard_oldact) == -1) {
+      fprintf(stderr, "sfence: sigaction(2) failed: %s\n", strerror(errno));
+      exit(1);
+    }
+    guard_mode = 1;
+    fprintf(stderr, "sfence: guard-page mode enabled\n");
+  }
 }
 
 
@@ -27,10 +27,15 @@
 #include <stdarg.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <fnmatch.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sys/syscall.h>        /* SYS_getdents64 */
+#endif
+
 #include "sglob.h"
 
 #include <string.h>
@@ -90,36 +95,195 @@ sglob(const char *pattern, int flags, sglob_t *glob)
 }
 
 
+/* One getdents64(2) batch holds a few hundred entries, so enumerating
+ * a huge directory costs a syscall per buffer instead of the libc
+ * readdir(3) bookkeeping per entry. */
+#define SGLOB_DENTS_BUFSIZE     (1 << 16)
+
+static __inline__ void
+sglob_consider(sglob_t *glob, const char *dname, const char *name,
+               const sglob_pattern_t *pat)
+{
+  if (name[0] == '.' &&
+      (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+    return;
+
+  if (pat == NULL || sglob_match(pat, name))
+    sglob_push(glob, dname, name);
+}
+
+
 int
 sglob_(const char *directory, const char *pattern, int flags, sglob_t *glob)
 {
-  DIR *d;
   const char *dname = ".";
-  struct dirent *ent;
+  sglob_pattern_t *pat = NULL;
 
   sglob_init(glob, flags);
 
   if (directory)
     dname = directory;
 
-  d = opendir(dname);
-  if (!d) {
-    return -1;
+  if (pattern != NULL && pattern[0] != '\0') {
+    pat = sglob_compile(pattern);
+    if (!pat)
+      return -1;
+  }
+
+#ifdef __linux__
+  {
+    char *buf;
+    int fd, nread;
+
+    fd = open(dname, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+      sglob_patfree(pat);
+      return -1;
+    }
+    buf = malloc(SGLOB_DENTS_BUFSIZE);
+    if (!buf) {
+      close(fd);
+      sglob_patfree(pat);
+      return -1;
+    }
+
+    while ((nread = syscall(SYS_getdents64, fd,
+                            buf, SGLOB_DENTS_BUFSIZE)) > 0) {
+      int pos;
+
+      for (pos = 0; pos < nread; ) {
+        struct dirent64 *ent = (struct dirent64 *)(buf + pos);
+
+        sglob_consider(glob, dname, ent->d_name, pat);
+        pos += ent->d_reclen;
+      }
+    }
+    free(buf);
+    close(fd);
+    sglob_patfree(pat);
+    return nread == 0 ? 0 : -1;
   }
+#else  /* !__linux__ */
+  {
+    DIR *d;
+    struct dirent *ent;
+
+    d = opendir(dname);
+    if (!d) {
+      sglob_patfree(pat);
+      return -1;
+    }
 
-  while ((ent = readdir(d)) != NULL) {
-    if (strcmp(ent->d_name, ".") == 0 ||
-        strcmp(ent->d_name, "..") == 0)
-      continue;
+    while ((ent = readdir(d)) != NULL)
+      sglob_consider(glob, dname, ent->d_name, pat);
 
-    if (pattern == NULL || pattern[0] == '\0')
-      sglob_push(glob, dname, ent->d_name);
-    else if (fnmatch(pattern, ent->d_name, FNM_PERIOD) == 0)
-      sglob_push(glob, dname, ent->d_name);
+    closedir(d);
+    sglob_patfree(pat);
+    return 0;
   }
-  closedir(d);
+#endif  /* __linux__ */
+}
 
-  return 0;
+
+/* sglob_pattern_.kind values */
+#define SGLOB_PAT_EXACT         0 /* no wildcard; memcmp the whole name */
+#define SGLOB_PAT_STAR          1 /* PREFIX*SUFFIX; two memcmp()s */
+#define SGLOB_PAT_FNMATCH       2 /* memcmp prefilter, then fnmatch() */
+
+sglob_pattern_t *
+sglob_compile(const char *pattern)
+{
+  sglob_pattern_t *pat;
+  const char *first, *last;
+  const char *p;
+
+  pat = malloc(sizeof(*pat));
+  if (!pat)
+    return NULL;
+
+  pat->pattern = strdup(pattern);
+  if (!pat->pattern) {
+    free(pat);
+    return NULL;
+  }
+
+  first = strpbrk(pat->pattern, "*?[\\");
+  if (!first) {
+    pat->kind = SGLOB_PAT_EXACT;
+    pat->prefix_len = strlen(pat->pattern);
+    pat->suffix = pat->pattern + pat->prefix_len;
+    pat->suffix_len = 0;
+    pat->min_len = pat->prefix_len;
+    return pat;
+  }
+
+  if (strchr(pat->pattern, '\\')) {
+    /* escapes make the literal parts ambiguous; no prefilter */
+    pat->kind = SGLOB_PAT_FNMATCH;
+    pat->prefix_len = 0;
+    pat->suffix = pat->pattern + strlen(pat->pattern);
+    pat->suffix_len = 0;
+    pat->min_len = 0;
+    return pat;
+  }
+
+  last = first;
+  for (p = first + 1; *p != '\0'; p++)
+    if (*p == '*' || *p == '?' || *p == ']')
+      last = p;
+
+  pat->prefix_len = first - pat->pattern;
+  pat->suffix = last + 1;
+  pat->suffix_len = strlen(pat->suffix);
+  pat->min_len = pat->prefix_len + pat->suffix_len;
+
+  if (first == last && *first == '*')
+    pat->kind = SGLOB_PAT_STAR;
+  else
+    pat->kind = SGLOB_PAT_FNMATCH;
+
+  return pat;
+}
+
+
+int
+sglob_match(const sglob_pattern_t *pat, const char *name)
+{
+  size_t len = strlen(name);
+
+  if (len < pat->min_len)
+    return 0;
+
+  /* FNM_PERIOD: a leading dot only matches a literal dot */
+  if (name[0] == '.' && pat->prefix_len == 0 &&
+      pat->kind != SGLOB_PAT_EXACT)
+    return 0;
+
+  if (pat->kind == SGLOB_PAT_EXACT)
+    return len == pat->prefix_len &&
+      memcmp(name, pat->pattern, len) == 0;
+
+  if (memcmp(name, pat->pattern, pat->prefix_len) != 0)
+    return 0;
+  if (memcmp(name + len - pat->suffix_len, pat->suffix,
+             pat->suffix_len) != 0)
+    return 0;
+
+  if (pat->kind == SGLOB_PAT_STAR)
+    return 1;
+
+  return fnmatch(pat->pattern, name, FNM_PERIOD) == 0;
+}
+
+
+void
+sglob_patfree(sglob_pattern_t *pat)
+{
+  if (!pat)
+    return;
+
+  free(pat->pattern);
+  free(pat);
 }
 
 
@@ -92,6 +92,40 @@ extern int sglob_(const char *directory, const char *pattern, int flags,
  */
 extern void sglobfree(sglob_t *glob);
 
+/*
+ * Compiled pattern for repeated matching.
+ *
+ * When the same pattern is matched against many names -- a file
+ * watcher checking every incoming filename, say -- compile it once
+ * with sglob_compile() and test names with sglob_match(), which
+ * costs a couple of memcmp()s for most patterns instead of a full
+ * fnmatch() walk: a pattern without wildcards is compared literally,
+ * PREFIX*SUFFIX patterns need no fnmatch() at all, and anything more
+ * complex still rejects non-candidates on the literal prefix and
+ * suffix before falling back to fnmatch(3).
+ *
+ * Matching follows sglob(): fnmatch() semantics with FNM_PERIOD, so
+ * a leading dot must be matched explicitly.  Treat the struct as
+ * opaque and release it with sglob_patfree().
+ */
+struct sglob_pattern_ {
+  char *pattern;                /* private copy of the pattern */
+  size_t prefix_len;            /* literal prefix: pattern[0..prefix_len) */
+  const char *suffix;           /* literal suffix, points into pattern */
+  size_t suffix_len;
+  size_t min_len;               /* no name shorter than this can match */
+  int kind;                     /* internal; see sglob.c */
+};
+typedef struct sglob_pattern_ sglob_pattern_t;
+
+/*
+ * sglob_compile() returns NULL on allocation failure.
+ * sglob_match() returns 1 if NAME matches, 0 otherwise.
+ */
+extern sglob_pattern_t *sglob_compile(const char *pattern);
+extern int sglob_match(const sglob_pattern_t *pat, const char *name);
+extern void sglob_patfree(sglob_pattern_t *pat);
+
 END_C_DECLS
 
 #endif  /* SGLOB_H__ */
@@ -17,6 +17,7 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include "snprintx.h"
 
@@ -57,6 +58,77 @@ snprintx(char **buf, ssize_t *size, const char *format, ...)
 }
 
 
+#define XPRINTBUF_MINCAP        128
+
+int
+vasnprintx(struct xprintbuf *pb, const char *format, va_list ap)
+{
+  va_list aq;
+  size_t room = pb->cap - pb->len;
+  size_t ncap;
+  char *p;
+  int ret;
+
+  va_copy(aq, ap);
+  ret = vsnprintf(pb->buf + pb->len, room, format, aq);
+  va_end(aq);
+
+  if (ret < 0)
+    return -1;
+
+  if ((size_t)ret >= room) {
+    ncap = (pb->cap == 0) ? XPRINTBUF_MINCAP : pb->cap;
+    while (ncap < pb->len + ret + 1)
+      ncap *= 2;
+
+    p = realloc(pb->buf, ncap);
+    if (!p)
+      return -1;
+    pb->buf = p;
+    pb->cap = ncap;
+
+    ret = vsnprintf(pb->buf + pb->len, pb->cap - pb->len, format, ap);
+    if (ret < 0)
+      return -1;
+  }
+
+  pb->len += ret;
+  return ret;
+}
+
+
+int
+asnprintx(struct xprintbuf *pb, const char *format, ...)
+{
+  va_list ap;
+  int ret;
+
+  va_start(ap, format);
+  ret = vasnprintx(pb, format, ap);
+  va_end(ap);
+
+  return ret;
+}
+
+
+void
+xprintbuf_reset(struct xprintbuf *pb)
+{
+  pb->len = 0;
+  if (pb->buf)
+    pb->buf[0] = '\0';
+}
+
+
+void
+xprintbuf_free(struct xprintbuf *pb)
+{
+  free(pb->buf);
+  pb->buf = NULL;
+  pb->len = pb->cap = 0;
+}
+
+
 #ifdef TEST_SNPRINTX
 #include <string.h>
 
@@ -18,6 +18,7 @@
  */
 
 #ifndef SNPRINTX__
+#define SNPRINTX__
 
 #include <sys/types.h>
 
@@ -53,5 +54,42 @@ extern int vsnprintx(char **buf, ssize_t *size, const char *format, va_list ap)
   ATTR ((format (printf, 3, 0)));
 
 
+/*
+ * asnprintx: format into an auto-growing buffer
+ *
+ * Unlike `snprintx', the buffer grows on demand, so there is no
+ * truncation to handle and no need to size it conservatively.  The
+ * capacity is retained across xprintbuf_reset(), so a long-lived
+ * `struct xprintbuf' (one per thread, say) reuses the same warm
+ * allocation for every message it builds:
+ *
+ *   struct xprintbuf pb = XPRINTBUF_INITIALIZER;
+ *   ...
+ *   xprintbuf_reset(&pb);
+ *   asnprintx(&pb, "%s: ", name);
+ *   asnprintx(&pb, "%d bytes", len);
+ *   send(pb.buf, pb.len);
+ *
+ * BUF is always null-terminated; LEN is its length.  `asnprintx'
+ * appends at the end and returns the number of characters appended,
+ * or -1 if growing the buffer failed (the buffer is left intact).
+ * Call xprintbuf_free() when done with the struct for good.
+ */
+struct xprintbuf {
+  char *buf;
+  size_t len;
+  size_t cap;                   /* retained across resets */
+};
+
+#define XPRINTBUF_INITIALIZER   { 0, 0, 0 }
+
+extern int asnprintx(struct xprintbuf *pb, const char *format, ...)
+  ATTR ((format (printf, 2, 3)));
+extern int vasnprintx(struct xprintbuf *pb, const char *format, va_list ap)
+  ATTR ((format (printf, 2, 0)));
+extern void xprintbuf_reset(struct xprintbuf *pb);
+extern void xprintbuf_free(struct xprintbuf *pb);
+
+
 
 #endif  /* SNPRINTX__ */
@@ -4,11 +4,22 @@
  */
 #include <stream.h>
 #include <xassert.h>
+#include <snprintx.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
+#include <sys/mman.h>
+
+#ifdef _PTHREAD
+#include <pthread.h>
+#endif
+
+#include <ioprobe.h>
+
+#if 0   /* tiny buffer, for debugging the refill/flush paths */
 #define STREAM_BUFSIZ 3
+#endif
 
 #ifndef STREAM_BUFSIZ
 # ifdef BUFSIZ
@@ -40,6 +51,11 @@ struct stream_ {
   int fd;
   void *data;
 
+  char *map;                    /* mapped file contents (s_open_mmap) */
+  size_t map_size;              /* size of MAP */
+
+  struct ra_ctl *ra;            /* pipeline state (s_set_readahead) */
+
   unsigned eof:   1;            /* nonzero if EOF is reached */
   unsigned dirty: 1;            /* nonzero if BUF contains unwritten data */
 };
@@ -79,6 +95,11 @@ static int get_flags_from_type(int type);
 static int flush_buf(stream_t *s);
 static int get_buf_prepared(stream_t *s);
 
+#ifdef _PTHREAD
+static int ra_fill(stream_t *s, char *buf, size_t size);
+static int ra_put(stream_t *s, off_t pos, const char *data, size_t len);
+#endif
+
 
 stream_t *
 s_open(const struct stream_ops *ops, const char *pathname, const char *mode,
@@ -101,8 +122,22 @@ s_open(const struct stream_ops *ops, const char *pathname, const char *mode,
   }
   s->ungetc = -1;
 
+  s->map = 0;
+  s->map_size = 0;
+  s->ra = 0;
+
+  s->eof = 0;
+  s->vpos = s->ppos = 0;
   s->dirty = 0;
-  s_setvbuf(s, malloc(STREAM_BUFSIZ), STREAM_IOFBF, STREAM_BUFSIZ);
+  s->buf = s->cur = s->end = 0; /* so s_setvbuf won't free garbage */
+  {
+    /* size the buffer from what the fd's backing store prefers; the
+     * compiled-in size is only the fallback */
+    int bsz = ioprobe_best_bufsize(s->fd);
+    if (bsz < STREAM_BUFSIZ)
+      bsz = STREAM_BUFSIZ;
+    s_setvbuf(s, malloc(bsz), STREAM_IOFBF, bsz);
+  }
 
   /* if (!(s->flags & O_TRUNC) && get_buf_prepared(s) < 0) { */
   if (get_buf_prepared(s) < 0) {
@@ -118,17 +153,1021 @@ s_open(const struct stream_ops *ops, const char *pathname, const char *mode,
 }
 
 
+/*
+ * Backend for s_open_mmap().  All data is already in the mapping, so
+ * read(2) never has anything to add (hitting it just means EOF), and
+ * "seeking" only has to succeed; the real positioning is the pointer
+ * arithmetic in s_seek().
+ */
+static int
+mmap_stream_close(int fd, void *data)
+{
+  return close(fd);
+}
+
+
+static ssize_t
+mmap_stream_read(int fd, void *buf, size_t count, void *data)
+{
+  return 0;
+}
+
+
+static ssize_t
+mmap_stream_write(int fd, const void *buf, size_t count, void *data)
+{
+  errno = EBADF;
+  return -1;
+}
+
+
+static off_t
+mmap_stream_lseek(int fd, off_t offset, int whence, void *data)
+{
+  return offset;
+}
+
+
+static const struct stream_ops mmap_stream_ops = {
+  0,
+  0,
+  mmap_stream_close,
+  mmap_stream_read,
+  mmap_stream_write,
+  mmap_stream_lseek,
+};
+
+
+stream_t *
+s_open_mmap(const char *pathname)
+{
+  stream_t *s;
+  struct stat st;
+  char *map;
+  int fd;
+
+  fd = open(pathname, O_RDONLY);
+  if (fd == -1) {
+    stream_errno = errno;
+    return 0;
+  }
+  if (fstat(fd, &st) == -1) {
+    stream_errno = errno;
+    close(fd);
+    return 0;
+  }
+
+  map = mmap(0, st.st_size ? st.st_size : 1, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    stream_errno = errno;
+    close(fd);
+    return 0;
+  }
+#ifdef MADV_SEQUENTIAL
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+  s = malloc(sizeof(*s));
+  if (!s) {
+    munmap(map, st.st_size ? st.st_size : 1);
+    close(fd);
+    return 0;
+  }
+
+  memcpy(&s->op, &mmap_stream_ops, sizeof(s->op));
+  s->type = ST_READ;
+  s->flags = O_RDONLY;
+  s->data = 0;
+  s->fd = fd;
+  s->ungetc = -1;
+  s->dirty = 0;
+  s->eof = 0;
+
+  s->map = map;
+  s->map_size = st.st_size;
+  s->ra = 0;
+
+  /* The mapping IS the stream buffer: s_getc()/s_gets()/s_read()
+   * consume it in place, with no read(2) and no intermediate copy. */
+  s->buf = s->map;
+  s->size = s->map_size;
+  s->cur = s->buf;
+  s->end = s->buf + s->map_size;
+  s->b_mode = STREAM_IOFBF;
+  s->vpos = s->ppos = 0;
+
+  return s;
+}
+
+
+#ifdef _IOURING
+/*
+ * io_uring(7) backend (s_open_uring): the stream_ops submit SQEs
+ * instead of calling read(2)/write(2)/lseek(2).
+ *
+ * Two fixed buffers are registered with the kernel once at open time
+ * (IORING_REGISTER_BUFFERS), so the kernel pins the pages once
+ * instead of on every request.  The read op serves sequential
+ * requests from one buffer while the NEXT block is already submitted
+ * into the other, and the write op queues the block and returns
+ * without waiting, so submission overlaps the caller's parsing or
+ * formatting.  The lseek op only updates a cached offset -- every
+ * SQE carries its own file offset -- so the positioning syscalls the
+ * buffered layer issues cost nothing.
+ *
+ * Asynchronous write errors are sticky and surface from the next
+ * operation or from s_close(), like the readahead pipeline's.
+ */
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup     425
+#define __NR_io_uring_enter     426
+#define __NR_io_uring_register  427
+#endif
+
+#define UR_ENTRIES      8
+#define UR_NBUFS        2
+#define UR_BUFSZ        (64 * 1024)
+
+#define UR_FREE         0
+#define UR_BUSY         1       /* SQE submitted, CQE not seen yet */
+#define UR_FULL         2       /* completed read, data not consumed */
+
+struct ur_buf {
+  off_t pos;                    /* file offset of DATA */
+  size_t len;                   /* valid byte(s) in DATA */
+  size_t off;                   /* byte(s) already consumed */
+  int state;                    /* one of UR_* */
+  int write;                    /* nonzero: slot holds a write */
+  char *data;
+};
+
+struct ur_ctl {
+  int ring;                     /* io_uring fd */
+
+  unsigned *sq_head;            /* mapped submission queue */
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+
+  unsigned *cq_head;            /* mapped completion queue */
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ring;                /* the mappings, for munmap */
+  size_t sq_ring_sz;
+  void *cq_ring;                /* equals SQ_RING on single-mmap kernels */
+  size_t cq_ring_sz;
+  size_t sqes_sz;
+
+  int fd;                       /* the file itself */
+  off_t pos;                    /* position per the op.lseek contract */
+  off_t next;                   /* next offset worth reading ahead */
+  off_t eof_pos;                /* known end of file, or -1 */
+  int fixed;                    /* nonzero if buffers are registered */
+  int error;                    /* sticky errno from completions */
+  char *block;                  /* one block holds every slot */
+  struct ur_buf buf[UR_NBUFS];
+};
+
+
+static int
+ur_enter(struct ur_ctl *ctl, unsigned to_submit, unsigned min_complete,
+         unsigned flags)
+{
+  return syscall(__NR_io_uring_enter, ctl->ring, to_submit, min_complete,
+                 flags, (void *)0, 0);
+}
+
+
+/*
+ * Consume every pending CQE; completions update the slot named by
+ * their user_data.  Nonblocking.
+ */
+static void
+ur_reap(struct ur_ctl *ctl)
+{
+  unsigned head = *ctl->cq_head;
+  unsigned tail = __atomic_load_n(ctl->cq_tail, __ATOMIC_ACQUIRE);
+
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &ctl->cqes[head & *ctl->cq_mask];
+    struct ur_buf *b = &ctl->buf[cqe->user_data];
+
+    if (b->write) {
+      if (cqe->res != (int)b->len && !ctl->error)
+        ctl->error = cqe->res < 0 ? -cqe->res : EIO;
+      b->state = UR_FREE;
+    }
+    else if (cqe->res < 0) {
+      if (!ctl->error)
+        ctl->error = -cqe->res;
+      b->state = UR_FREE;
+    }
+    else if (cqe->res == 0) {
+      if (ctl->eof_pos == (off_t)-1 || b->pos < ctl->eof_pos)
+        ctl->eof_pos = b->pos;
+      b->state = UR_FREE;
+    }
+    else {
+      b->len = cqe->res;
+      b->off = 0;
+      b->state = UR_FULL;
+    }
+    head++;
+  }
+  __atomic_store_n(ctl->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+/* block until at least one completion arrives, then reap */
+static int
+ur_wait(struct ur_ctl *ctl)
+{
+  if (ur_enter(ctl, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+    if (!ctl->error)
+      ctl->error = errno;
+    return -1;
+  }
+  ur_reap(ctl);
+  return 0;
+}
+
+
+/* wait until no slot is in flight */
+static int
+ur_quiesce(struct ur_ctl *ctl)
+{
+  for (;;) {
+    int i, busy = 0;
+
+    ur_reap(ctl);
+    for (i = 0; i < UR_NBUFS; i++)
+      if (ctl->buf[i].state == UR_BUSY)
+        busy = 1;
+    if (!busy)
+      return 0;
+    if (ur_wait(ctl) < 0)
+      return -1;
+  }
+}
+
+
+/*
+ * Submit one SQE for slot I: a read of LEN byte(s) at POS into the
+ * slot's buffer, or a write of the LEN byte(s) already copied there.
+ */
+static int
+ur_submit(struct ur_ctl *ctl, int i, int write, off_t pos, size_t len)
+{
+  struct ur_buf *b = &ctl->buf[i];
+  unsigned tail = *ctl->sq_tail;
+  unsigned idx = tail & *ctl->sq_mask;
+  struct io_uring_sqe *sqe = &ctl->sqes[idx];
+
+  memset(sqe, 0, sizeof(*sqe));
+  if (ctl->fixed) {
+    sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->buf_index = i;
+  }
+  else
+    sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+  sqe->fd = ctl->fd;
+  sqe->off = pos;
+  sqe->addr = (unsigned long)b->data;
+  sqe->len = len;
+  sqe->user_data = i;
+
+  ctl->sq_array[idx] = idx;
+  __atomic_store_n(ctl->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  if (ur_enter(ctl, 1, 0, 0) < 0) {
+    if (!ctl->error)
+      ctl->error = errno;
+    return -1;
+  }
+  b->pos = pos;
+  b->len = len;
+  b->off = 0;
+  b->state = UR_BUSY;
+  b->write = write;
+  return 0;
+}
+
+
+/* read ahead into SLOT, unless the known EOF says it is pointless */
+static void
+ur_prefetch(struct ur_ctl *ctl, int i)
+{
+  if (ctl->error)
+    return;
+  if (ctl->eof_pos != (off_t)-1 && ctl->next >= ctl->eof_pos)
+    return;
+  if (ur_submit(ctl, i, 0, ctl->next, UR_BUFSZ) == 0)
+    ctl->next += UR_BUFSZ;
+}
+
+
+static int
+uring_stream_open(const char *pathname, int flags, void *data)
+{
+  struct ur_ctl *ctl = data;
+
+  ctl->fd = open(pathname, flags, 0666);
+  return ctl->fd;
+}
+
+
+static ssize_t
+uring_stream_read(int fd, void *buf, size_t count, void *data)
+{
+  struct ur_ctl *ctl = data;
+  struct ur_buf *b;
+  size_t n;
+  int i;
+
+  if (count == 0)
+    return 0;
+
+  for (;;) {
+    ur_reap(ctl);
+    if (ctl->error) {
+      errno = ctl->error;
+      return -1;
+    }
+
+    b = 0;
+    for (i = 0; i < UR_NBUFS; i++) {
+      struct ur_buf *p = &ctl->buf[i];
+
+      if (p->write)
+        continue;
+      if (p->state == UR_FULL && p->pos + (off_t)p->off == ctl->pos) {
+        b = p;
+        break;
+      }
+      if (p->state == UR_BUSY && p->pos == ctl->pos) {
+        b = p;
+        break;
+      }
+    }
+    if (b && b->state == UR_FULL)
+      break;
+    if (b) {                    /* the block we need is in flight */
+      if (ur_wait(ctl) < 0)
+        break;
+      continue;
+    }
+
+    if (ctl->eof_pos != (off_t)-1 && ctl->pos >= ctl->eof_pos)
+      return 0;
+
+    /* the reader moved (or this is the first read); start over here */
+    if (ur_quiesce(ctl) < 0)
+      break;
+    for (i = 0; i < UR_NBUFS; i++)
+      ctl->buf[i].state = UR_FREE;
+    ctl->next = ctl->pos;
+    ur_prefetch(ctl, 0);
+  }
+  if (ctl->error) {
+    errno = ctl->error;
+    return -1;
+  }
+
+  /* keep the disk busy while the caller parses this block */
+  for (i = 0; i < UR_NBUFS; i++)
+    if (ctl->buf[i].state == UR_FREE)
+      ur_prefetch(ctl, i);
+
+  n = b->len - b->off;
+  if (n > count)
+    n = count;
+  memcpy(buf, b->data + b->off, n);
+  b->off += n;
+  if (b->off == b->len) {
+    b->state = UR_FREE;
+    ur_prefetch(ctl, (int)(b - ctl->buf));
+  }
+  ctl->pos += n;
+  return n;
+}
+
+
+static ssize_t
+uring_stream_write(int fd, const void *buf, size_t count, void *data)
+{
+  struct ur_ctl *ctl = data;
+  const char *p = buf;
+  size_t done = 0;
+  int i;
+
+  /* in-flight or cached reads may overlap the range; drop them.
+   * Writes already queued stay in flight -- waiting for those here
+   * would serialize the writeback the slots exist to overlap. */
+  for (;;) {
+    int busy = 0;
+
+    ur_reap(ctl);
+    for (i = 0; i < UR_NBUFS; i++) {
+      if (ctl->buf[i].write)
+        continue;
+      if (ctl->buf[i].state == UR_BUSY)
+        busy = 1;
+      else if (ctl->buf[i].state == UR_FULL)
+        ctl->buf[i].state = UR_FREE;
+    }
+    if (!busy)
+      break;
+    if (ur_wait(ctl) < 0) {
+      errno = ctl->error;
+      return -1;
+    }
+  }
+
+  while (done < count) {
+    struct ur_buf *b = 0;
+    size_t n;
+
+    ur_reap(ctl);
+    if (ctl->error) {
+      errno = ctl->error;
+      return -1;
+    }
+    for (i = 0; i < UR_NBUFS; i++)
+      if (ctl->buf[i].state == UR_FREE) {
+        b = &ctl->buf[i];
+        break;
+      }
+    if (!b) {                   /* every slot in flight; wait for one */
+      if (ur_wait(ctl) < 0) {
+        errno = ctl->error;
+        return -1;
+      }
+      continue;
+    }
+
+    n = count - done;
+    if (n > UR_BUFSZ)
+      n = UR_BUFSZ;
+    memcpy(b->data, p + done, n);
+    if (ur_submit(ctl, (int)(b - ctl->buf), 1, ctl->pos + done, n) < 0) {
+      errno = ctl->error;
+      return -1;
+    }
+    done += n;
+  }
+
+  ctl->pos += count;
+  if (ctl->eof_pos != (off_t)-1 && ctl->pos > ctl->eof_pos)
+    ctl->eof_pos = ctl->pos;    /* the file grew under the old EOF */
+  return count;
+}
+
+
+static off_t
+uring_stream_lseek(int fd, off_t offset, int whence, void *data)
+{
+  struct ur_ctl *ctl = data;
+  struct stat st;
+
+  switch (whence) {
+  case SEEK_SET:
+    ctl->pos = offset;
+    break;
+  case SEEK_CUR:
+    ctl->pos += offset;
+    break;
+  case SEEK_END:
+    if (ur_quiesce(ctl) < 0) {  /* pending writes may extend the file */
+      errno = ctl->error;
+      return -1;
+    }
+    if (fstat(ctl->fd, &st) == -1)
+      return -1;
+    ctl->pos = st.st_size + offset;
+    break;
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+  return ctl->pos;
+}
+
+
+static void
+ur_teardown(struct ur_ctl *ctl)
+{
+  if (ctl->sq_ring)
+    munmap(ctl->sq_ring, ctl->sq_ring_sz);
+  if (ctl->cq_ring && ctl->cq_ring != ctl->sq_ring)
+    munmap(ctl->cq_ring, ctl->cq_ring_sz);
+  if (ctl->sqes)
+    munmap(ctl->sqes, ctl->sqes_sz);
+  if (ctl->ring != -1)
+    close(ctl->ring);
+  free(ctl->block);
+  free(ctl);
+}
+
+
+static int
+uring_stream_close(int fd, void *data)
+{
+  struct ur_ctl *ctl = data;
+  int err;
+
+  ur_quiesce(ctl);              /* drain the writeback */
+  err = ctl->error;
+  ur_teardown(ctl);
+  if (close(fd) == -1)
+    return -1;
+  if (err) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+
+static const struct stream_ops uring_stream_ops = {
+  uring_stream_open,
+  0,
+  uring_stream_close,
+  uring_stream_read,
+  uring_stream_write,
+  uring_stream_lseek,
+};
+
+
+/* set up the ring and register the slot buffers; -1 with errno set */
+static struct ur_ctl *
+ur_new(void)
+{
+  struct ur_ctl *ctl;
+  struct io_uring_params p;
+  struct iovec iov[UR_NBUFS];
+  int i;
+
+  ctl = calloc(1, sizeof(*ctl));
+  if (!ctl)
+    return 0;
+  ctl->ring = -1;
+  ctl->fd = -1;
+  ctl->eof_pos = (off_t)-1;
+
+  memset(&p, 0, sizeof(p));
+  ctl->ring = syscall(__NR_io_uring_setup, UR_ENTRIES, &p);
+  if (ctl->ring == -1)
+    goto err;
+
+  ctl->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ctl->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+#ifdef IORING_FEAT_SINGLE_MMAP
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ctl->cq_ring_sz > ctl->sq_ring_sz)
+      ctl->sq_ring_sz = ctl->cq_ring_sz;
+    ctl->cq_ring_sz = ctl->sq_ring_sz;
+  }
+#endif
+  ctl->sq_ring = mmap(0, ctl->sq_ring_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, ctl->ring, IORING_OFF_SQ_RING);
+  if (ctl->sq_ring == MAP_FAILED) {
+    ctl->sq_ring = 0;
+    goto err;
+  }
+#ifdef IORING_FEAT_SINGLE_MMAP
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    ctl->cq_ring = ctl->sq_ring;
+  else
+#endif
+  {
+    ctl->cq_ring = mmap(0, ctl->cq_ring_sz, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, ctl->ring, IORING_OFF_CQ_RING);
+    if (ctl->cq_ring == MAP_FAILED) {
+      ctl->cq_ring = 0;
+      goto err;
+    }
+  }
+  ctl->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+  ctl->sqes = mmap(0, ctl->sqes_sz, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, ctl->ring, IORING_OFF_SQES);
+  if (ctl->sqes == MAP_FAILED) {
+    ctl->sqes = 0;
+    goto err;
+  }
+
+  ctl->sq_head = (unsigned *)((char *)ctl->sq_ring + p.sq_off.head);
+  ctl->sq_tail = (unsigned *)((char *)ctl->sq_ring + p.sq_off.tail);
+  ctl->sq_mask = (unsigned *)((char *)ctl->sq_ring + p.sq_off.ring_mask);
+  ctl->sq_array = (unsigned *)((char *)ctl->sq_ring + p.sq_off.array);
+  ctl->cq_head = (unsigned *)((char *)ctl->cq_ring + p.cq_off.head);
+  ctl->cq_tail = (unsigned *)((char *)ctl->cq_ring + p.cq_off.tail);
+  ctl->cq_mask = (unsigned *)((char *)ctl->cq_ring + p.cq_off.ring_mask);
+  ctl->cqes = (struct io_uring_cqe *)((char *)ctl->cq_ring + p.cq_off.cqes);
+
+  if (posix_memalign((void **)&ctl->block, 4096,
+                     (size_t)UR_NBUFS * UR_BUFSZ) != 0) {
+    ctl->block = 0;
+    goto err;
+  }
+  for (i = 0; i < UR_NBUFS; i++) {
+    ctl->buf[i].data = ctl->block + (size_t)i * UR_BUFSZ;
+    ctl->buf[i].state = UR_FREE;
+    iov[i].iov_base = ctl->buf[i].data;
+    iov[i].iov_len = UR_BUFSZ;
+  }
+
+  /* registration can fail where locked memory is scarce; fall back
+   * to the unregistered opcodes rather than failing the open */
+  ctl->fixed = (syscall(__NR_io_uring_register, ctl->ring,
+                        IORING_REGISTER_BUFFERS, iov, UR_NBUFS) == 0);
+  return ctl;
+
+ err:
+  i = errno;
+  ur_teardown(ctl);
+  errno = i;
+  return 0;
+}
+#endif  /* _IOURING */
+
+
+stream_t *
+s_open_uring(const char *pathname, const char *mode)
+{
+#ifdef _IOURING
+  struct ur_ctl *ctl;
+  stream_t *s;
+
+  ctl = ur_new();
+  if (!ctl) {
+    stream_errno = errno;
+    return 0;
+  }
+  s = s_open(&uring_stream_ops, pathname, mode, ctl);
+  if (!s) {
+    if (ctl->fd == -1)          /* op.open failed; op.close never ran */
+      ur_teardown(ctl);
+    return 0;
+  }
+  return s;
+#else
+  stream_errno = ENOSYS;
+  return 0;
+#endif  /* _IOURING */
+}
+
+
+#ifdef _PTHREAD
+/*
+ * Pipelined I/O (s_set_readahead): a helper thread moves data
+ * between the file and a small ring of buffers, so that disk time
+ * overlaps the caller's CPU time.
+ *
+ * For a read-only stream the thread reads ahead sequentially and
+ * get_buf_prepared() consumes filled slots (ra_fill); for a
+ * write-only stream flush_buf() drops the dirty buffer into a free
+ * slot (ra_put) and the thread writes it behind the caller's back.
+ * Thread errors are sticky and reported on the next operation.
+ */
+#define RA_FREE         0
+#define RA_BUSY         1       /* being filled by the thread */
+#define RA_FULL         2
+
+struct ra_buf {
+  off_t pos;                    /* file offset of DATA */
+  size_t len;                   /* valid byte(s) in DATA */
+  size_t off;                   /* byte(s) already consumed */
+  int state;                    /* one of RA_* */
+  char *data;
+};
+
+struct ra_ctl {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  struct ra_buf *ring;
+  int nbufs;
+  size_t bufsz;
+  int head;                     /* next slot the producer uses */
+  int tail;                     /* next slot the consumer uses */
+
+  off_t next;                   /* next offset the thread reads */
+  unsigned gen;                 /* bumped on resync; drops stale reads */
+  int eof;
+  int error;                    /* sticky errno from the thread */
+  int stop;
+  int writer;                   /* nonzero: flush-behind mode */
+  stream_t *stream;
+};
+
+
+static void *
+ra_thread(void *arg)
+{
+  struct ra_ctl *ctl = arg;
+  stream_t *s = ctl->stream;
+
+  pthread_mutex_lock(&ctl->lock);
+  for (;;) {
+    struct ra_buf *b;
+
+    if (ctl->writer) {
+      b = &ctl->ring[ctl->tail];
+      if (b->state == RA_FULL) {
+        ssize_t w = -1;
+
+        pthread_mutex_unlock(&ctl->lock);
+        if (s->op.lseek(s->fd, b->pos, SEEK_SET, s->data) != (off_t)-1)
+          w = s->op.write(s->fd, b->data, b->len, s->data);
+        pthread_mutex_lock(&ctl->lock);
+
+        if (w != (ssize_t)b->len && !ctl->error)
+          ctl->error = errno ? errno : EIO;
+        b->state = RA_FREE;
+        ctl->tail = (ctl->tail + 1) % ctl->nbufs;
+        pthread_cond_broadcast(&ctl->cond);
+        continue;
+      }
+      if (ctl->stop)            /* all slots drained; we may leave */
+        break;
+    }
+    else {
+      b = &ctl->ring[ctl->head];
+      if (!ctl->stop && !ctl->eof && !ctl->error && b->state == RA_FREE) {
+        unsigned gen = ctl->gen;
+        off_t pos = ctl->next;
+        ssize_t r = -1;
+
+        b->state = RA_BUSY;
+        pthread_mutex_unlock(&ctl->lock);
+        if (s->op.lseek(s->fd, pos, SEEK_SET, s->data) != (off_t)-1)
+          r = s->op.read(s->fd, b->data, ctl->bufsz, s->data);
+        pthread_mutex_lock(&ctl->lock);
+
+        if (ctl->gen != gen) {  /* resynced under us; drop the result */
+          b->state = RA_FREE;
+          continue;
+        }
+        if (r < 0) {
+          ctl->error = errno ? errno : EIO;
+          b->state = RA_FREE;
+        }
+        else if (r == 0) {
+          ctl->eof = 1;
+          b->state = RA_FREE;
+        }
+        else {
+          b->pos = pos;
+          b->len = r;
+          b->off = 0;
+          b->state = RA_FULL;
+          ctl->next = pos + r;
+          ctl->head = (ctl->head + 1) % ctl->nbufs;
+        }
+        pthread_cond_broadcast(&ctl->cond);
+        continue;
+      }
+      if (ctl->stop)
+        break;
+    }
+    pthread_cond_wait(&ctl->cond, &ctl->lock);
+  }
+  pthread_mutex_unlock(&ctl->lock);
+  return 0;
+}
+
+
+/* restart reading ahead at POS; must be called with CTL locked */
+static void
+ra_resync(struct ra_ctl *ctl, off_t pos)
+{
+  int i;
+
+  ctl->gen++;
+  ctl->next = pos;
+  ctl->eof = 0;
+  for (i = 0; i < ctl->nbufs; i++)
+    if (ctl->ring[i].state == RA_FULL)
+      ctl->ring[i].state = RA_FREE;
+  ctl->head = ctl->tail = 0;
+}
+
+
+/*
+ * Copy up to SIZE byte(s) that the thread read ahead for the current
+ * position (stream_t::vpos) into BUF.  Returns the number of byte(s)
+ * copied, zero on EOF, or -1 on error.
+ */
+static int
+ra_fill(stream_t *s, char *buf, size_t size)
+{
+  struct ra_ctl *ctl = s->ra;
+  struct ra_buf *b;
+  size_t n;
+
+  pthread_mutex_lock(&ctl->lock);
+
+  for (;;) {
+    b = &ctl->ring[ctl->tail];
+
+    if (b->state == RA_FULL) {
+      if (b->pos + (off_t)b->off == s->vpos)
+        break;
+      ra_resync(ctl, s->vpos); /* the reader moved; start over */
+      pthread_cond_broadcast(&ctl->cond);
+      continue;
+    }
+    if (ctl->error) {
+      stream_errno = ctl->error;
+      pthread_mutex_unlock(&ctl->lock);
+      return -1;
+    }
+    if (ctl->eof || (b->state == RA_FREE && ctl->head == ctl->tail)) {
+      if (ctl->next != s->vpos) {
+        ra_resync(ctl, s->vpos);
+        pthread_cond_broadcast(&ctl->cond);
+        continue;
+      }
+      if (ctl->eof) {
+        pthread_mutex_unlock(&ctl->lock);
+        return 0;
+      }
+    }
+    pthread_cond_broadcast(&ctl->cond);
+    pthread_cond_wait(&ctl->cond, &ctl->lock);
+  }
+
+  n = b->len - b->off;
+  if (n > size)
+    n = size;
+  memcpy(buf, b->data + b->off, n);
+  b->off += n;
+  if (b->off == b->len) {
+    b->state = RA_FREE;
+    ctl->tail = (ctl->tail + 1) % ctl->nbufs;
+    pthread_cond_broadcast(&ctl->cond);
+  }
+
+  pthread_mutex_unlock(&ctl->lock);
+  return n;
+}
+
+
+/*
+ * Hand LEN byte(s) of DATA, belonging at offset POS, to the
+ * writeback thread.  Blocks only when every slot is in flight.
+ */
+static int
+ra_put(stream_t *s, off_t pos, const char *data, size_t len)
+{
+  struct ra_ctl *ctl = s->ra;
+  struct ra_buf *b;
+
+  pthread_mutex_lock(&ctl->lock);
+  while ((b = &ctl->ring[ctl->head])->state != RA_FREE && !ctl->error)
+    pthread_cond_wait(&ctl->cond, &ctl->lock);
+
+  if (ctl->error) {
+    stream_errno = ctl->error;
+    pthread_mutex_unlock(&ctl->lock);
+    return -1;
+  }
+
+  memcpy(b->data, data, len);
+  b->pos = pos;
+  b->len = len;
+  b->state = RA_FULL;
+  ctl->head = (ctl->head + 1) % ctl->nbufs;
+  pthread_cond_broadcast(&ctl->cond);
+  pthread_mutex_unlock(&ctl->lock);
+  return 0;
+}
+#endif  /* _PTHREAD */
+
+
+int
+s_set_readahead(stream_t *s, int nbufs, size_t bufsz)
+{
+#ifdef _PTHREAD
+  struct ra_ctl *ctl;
+  char *block;
+  int i, err = 0;
+
+  if (s->ra) {                  /* drain and tear down the pipeline */
+    ctl = s->ra;
+    pthread_mutex_lock(&ctl->lock);
+    ctl->stop = 1;
+    pthread_cond_broadcast(&ctl->cond);
+    pthread_mutex_unlock(&ctl->lock);
+    pthread_join(ctl->thread, 0);
+
+    err = ctl->error;
+    pthread_mutex_destroy(&ctl->lock);
+    pthread_cond_destroy(&ctl->cond);
+    free(ctl->ring[0].data);    /* one block holds every slot */
+    free(ctl->ring);
+    free(ctl);
+    s->ra = 0;
+    if (err) {
+      stream_errno = err;
+      return -1;
+    }
+  }
+
+  if (nbufs <= 0)
+    return 0;
+
+  if (s->map)                   /* the mapping already beats readahead */
+    return 0;
+
+  if (s->type != ST_READ && s->type != ST_WRITE && s->type != ST_APPEND) {
+    /* "+" streams mix both directions; one pipeline can't serve that */
+    stream_errno = EINVAL;
+    return -1;
+  }
+  if (bufsz == 0 || (s->type != ST_READ && bufsz < s->size)) {
+    stream_errno = EINVAL;
+    return -1;
+  }
+
+  ctl = malloc(sizeof(*ctl));
+  if (!ctl)
+    goto err;
+  ctl->ring = malloc(sizeof(*ctl->ring) * nbufs);
+  block = malloc(bufsz * nbufs);
+  if (!ctl->ring || !block)
+    goto err_ring;
+
+  for (i = 0; i < nbufs; i++) {
+    ctl->ring[i].data = block + (size_t)i * bufsz;
+    ctl->ring[i].state = RA_FREE;
+    ctl->ring[i].pos = 0;
+    ctl->ring[i].len = 0;
+    ctl->ring[i].off = 0;
+  }
+  ctl->nbufs = nbufs;
+  ctl->bufsz = bufsz;
+  ctl->head = ctl->tail = 0;
+  ctl->next = s->ppos;          /* first unread offset of the file */
+  ctl->gen = 0;
+  ctl->eof = 0;
+  ctl->error = 0;
+  ctl->stop = 0;
+  ctl->writer = (s->type != ST_READ);
+  ctl->stream = s;
+  pthread_mutex_init(&ctl->lock, 0);
+  pthread_cond_init(&ctl->cond, 0);
+
+  if (pthread_create(&ctl->thread, 0, ra_thread, ctl) != 0) {
+    pthread_mutex_destroy(&ctl->lock);
+    pthread_cond_destroy(&ctl->cond);
+    goto err_ring;
+  }
+  s->ra = ctl;
+  return 0;
+
+ err_ring:
+  if (ctl->ring)
+    free(ctl->ring[0].data);
+  free(ctl->ring);
+  free(ctl);
+ err:
+  stream_errno = errno;
+  return -1;
+#else
+  stream_errno = ENOSYS;
+  return -1;
+#endif  /* _PTHREAD */
+}
+
+
 int
 s_close(stream_t *s)
 {
+  int ret = 0;
+
   s_setvbuf(s, 0, STREAM_IONBF, 0);
 
+  if (s->ra && s_set_readahead(s, 0, 0) < 0)
+    ret = -1;
+
+  if (s->map)
+    munmap(s->map, s->map_size);
+
   if (s->op.close(s->fd, s->data) == -1) {
     stream_errno = errno;
     return -1;
   }
   free(s);
-  return 0;
+  return ret;
 }
 
 
@@ -148,7 +1187,7 @@ s_setvbuf(stream_t *s, char *buf, int mode, size_t size)
   if (mode == STREAM_IONBF) {
     if (s->dirty && flush_buf(s) < 0)
       return -1;
-    if (s->buf != stream_nbuf)
+    if (s->buf != stream_nbuf && s->buf != s->map)
       free(s->buf);
 
     buf = stream_nbuf;
@@ -163,7 +1202,7 @@ s_setvbuf(stream_t *s, char *buf, int mode, size_t size)
     if (s->dirty)
       flush_buf(s);
 
-    if (s->buf != stream_nbuf)
+    if (s->buf != stream_nbuf && s->buf != s->map)
       free(s->buf);
 
     s->buf = buf;
@@ -179,6 +1218,38 @@ s_setvbuf(stream_t *s, char *buf, int mode, size_t size)
 off_t
 s_seek(stream_t *s, off_t offset, int whence)
 {
+  /* For a mapped stream the whole file is the buffer, so seeking is
+   * just pointer arithmetic.  (Unless someone replaced the buffer
+   * with s_setvbuf(), in which case the fast path is gone.) */
+  if (s->map && s->buf == s->map) {
+    off_t pos;
+
+    switch (whence) {
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = s->vpos + offset;
+      break;
+    case SEEK_END:
+      pos = (off_t)s->map_size + offset;
+      break;
+    default:
+      stream_errno = EINVAL;
+      return -1;
+    }
+    if (pos < 0 || pos > (off_t)s->map_size) {
+      stream_errno = EINVAL;
+      return -1;
+    }
+
+    s->cur = s->map + pos;
+    s->end = s->map + s->map_size;
+    s->vpos = s->ppos = pos;
+    s->eof = 0;
+    return pos;
+  }
+
   /* TODO: not implemented yet */
   return -1;
 }
@@ -199,6 +1270,85 @@ s_getc(stream_t *s)
 }
 
 
+char *
+s_gets(stream_t *s, char *str, int size)
+{
+  char *d = str;
+
+  xassert(s->type != ST_WRITE && s->type != ST_APPEND,
+          "attempt to read from write-only stream");
+
+  if (size <= 0)
+    return 0;
+
+  while (size > 1) {
+    size_t avail, n;
+    char *nl;
+
+    if (s->cur >= s->end) {
+      if (get_buf_prepared(s) < 0)
+        return 0;
+      if (s->eof)
+        break;
+      continue;
+    }
+
+    avail = s->end - s->cur;
+    n = (size_t)(size - 1) < avail ? (size_t)(size - 1) : avail;
+    nl = memchr(s->cur, '\n', n);
+    if (nl)
+      n = nl - s->cur + 1;
+
+    memcpy(d, s->cur, n);
+    s->cur += n;
+    s->vpos += n;
+    d += n;
+    size -= n;
+
+    if (nl)
+      break;
+  }
+
+  if (d == str && s->eof)
+    return 0;
+
+  *d = '\0';
+  return str;
+}
+
+
+size_t
+s_read(stream_t *s, void *ptr, size_t size, size_t nmemb)
+{
+  char *d = ptr;
+  size_t total = size * nmemb;
+  size_t done = 0;
+
+  xassert(s->type != ST_WRITE && s->type != ST_APPEND,
+          "attempt to read from write-only stream");
+
+  while (done < total) {
+    size_t avail, n;
+
+    if (s->cur >= s->end) {
+      if (get_buf_prepared(s) < 0 || s->eof)
+        break;
+      continue;
+    }
+
+    avail = s->end - s->cur;
+    n = total - done < avail ? total - done : avail;
+
+    memcpy(d + done, s->cur, n);
+    s->cur += n;
+    s->vpos += n;
+    done += n;
+  }
+
+  return size ? done / size : 0;
+}
+
+
 int
 s_putc(stream_t *s, int c)
 {
@@ -220,6 +1370,128 @@ s_putc(stream_t *s, int c)
 }
 
 
+size_t
+s_write(stream_t *s, const void *ptr, size_t size, size_t nmemb)
+{
+  const char *p = ptr;
+  size_t total = size * nmemb;
+  size_t done = 0;
+
+  xassert(s->type != ST_READ, "attempt to write on read-only stream");
+
+  while (done < total) {
+    size_t room, n;
+
+    if (s->cur == s->buf + s->size) { /* buffer full; drain it */
+      if (get_buf_prepared(s) < 0)
+        break;
+    }
+
+    room = s->buf + s->size - s->cur;
+    n = total - done < room ? total - done : room;
+
+    memcpy(s->cur, p + done, n);
+    s->cur += n;
+    if (s->cur > s->end)
+      s->end = s->cur;
+    s->dirty = 1;
+    s->vpos += n;
+    done += n;
+  }
+
+  return size ? done / size : 0;
+}
+
+
+/*
+ * Format directly into the stream's internal buffer, so the common
+ * case is one vsnprintf into the final resting place instead of an
+ * snprintf into a stack temp plus an s_write() copy.
+ *
+ * The direct render is only attempted when CUR == END (nothing
+ * buffered beyond the write position, i.e. every plain write stream):
+ * vsnprintf scribbles its truncated output over the whole tail, which
+ * must not touch byte(s) a read-write stream still has buffered.
+ */
+int
+s_vprintf(stream_t *s, const char *format, va_list ap)
+{
+  char *p;
+  ssize_t room;
+  int needed, n;
+  va_list aq;
+
+  xassert(s->type != ST_READ, "attempt to write on read-only stream");
+
+  if (s->cur == s->end) {
+    p = s->cur;
+    room = s->buf + s->size - s->cur;
+
+    va_copy(aq, ap);
+    needed = vsnprintx(&p, &room, format, aq);
+    va_end(aq);
+
+    if (room < 0 && needed + 1 <= (int)s->size) {
+      /* no room at the tail, but it fits in a drained buffer */
+      if (flush_buf(s) < 0)
+        return -1;
+
+      p = s->cur;
+      room = s->size;
+      va_copy(aq, ap);
+      needed = vsnprintx(&p, &room, format, aq);
+      va_end(aq);
+    }
+
+    if (room >= 0) {            /* rendered in place */
+      n = p - s->cur;
+      if (n > 0) {
+        s->cur = s->end = p;
+        s->dirty = 1;
+        s->vpos += n;
+      }
+      return n;
+    }
+  }
+  else {
+    va_copy(aq, ap);            /* the sizing pass must not consume AP */
+    needed = vsnprintf(NULL, 0, format, aq);
+    va_end(aq);
+    if (needed < 0)
+      return -1;
+  }
+
+  /* the record is larger than the whole buffer (or the stream has
+   * buffered read data in the way); render once and s_write() it */
+  {
+    char *tmp = malloc(needed + 1);
+
+    if (!tmp) {
+      stream_errno = errno;
+      return -1;
+    }
+    n = vsnprintf(tmp, needed + 1, format, ap);
+    if (n > 0 && s_write(s, tmp, 1, n) != (size_t)n)
+      n = -1;
+    free(tmp);
+    return n;
+  }
+}
+
+
+int
+s_printf(stream_t *s, const char *format, ...)
+{
+  va_list ap;
+  int ret;
+
+  va_start(ap, format);
+  ret = s_vprintf(s, format, ap);
+  va_end(ap);
+  return ret;
+}
+
+
 /*
  * Get an internal type value for MODE string.
  */
@@ -264,6 +1536,19 @@ flush_buf(stream_t *s)
   xassert(s->cur != (char *)-1, "s->buf is not valid");
 
   pos = s->vpos - (s->cur - s->buf);
+
+#ifdef _PTHREAD
+  if (s->ra && s->ra->writer) {
+    /* hand the buffer to the writeback thread instead of write(2) */
+    if (ra_put(s, pos, s->buf, s->cur - s->buf) < 0)
+      return -1;
+    s->ppos = s->vpos;
+    s->dirty = 0;
+    s->cur = s->end = s->buf;
+    return 0;
+  }
+#endif
+
   if (s->ppos != pos)
     if (s->op.lseek(s->fd, pos, SEEK_SET, s->data) == (off_t)-1) {
       stream_errno = errno;
@@ -300,6 +1585,21 @@ get_buf_prepared(stream_t *s)
   if (s->dirty && flush_buf(s) < 0)
     return -1;
 
+#ifdef _PTHREAD
+  if (s->ra && !s->ra->writer) {
+    /* the readahead thread already positioned the fd; no lseek here */
+    chread = ra_fill(s, s->buf, s->size);
+    if (chread < 0)
+      return -1;
+    if (!chread)
+      s->eof = 1;
+    s->cur = s->buf;
+    s->end = s->buf + chread;
+    s->ppos = s->vpos + chread;
+    return 0;
+  }
+#endif
+
   if (s->ppos != s->vpos) {
     if (s->op.lseek(s->fd, s->vpos, SEEK_SET, s->data) == (off_t)-1) {
       stream_errno = errno;
@@ -108,8 +108,56 @@ extern int stream_errno;
 extern stream_t *s_open(const struct stream_ops *ops,
                         const char *pathname, const char *mode,
                         void *data);
+
+/*
+ * Open PATHNAME for reading, backed by a private file mapping
+ * instead of read(2).
+ *
+ * The mapping itself serves as the stream buffer (advised with
+ * MADV_SEQUENTIAL), so s_getc(), s_gets() and s_read() consume the
+ * file contents in place without copying them through an
+ * intermediate buffer, and s_seek() is mere pointer arithmetic.
+ * Only "r" semantics are provided; the writing functions fail.
+ */
+extern stream_t *s_open_mmap(const char *pathname);
+
+/*
+ * Open PATHNAME with the file I/O done through io_uring(7).
+ *
+ * The backend registers two fixed buffers with the kernel at open
+ * time and drives them as a pipeline: sequential reads are served
+ * from one buffer while the next block is already submitted into the
+ * other, and writes are queued and completed behind the caller's
+ * back, so submission overlaps parsing or formatting.  Seeking only
+ * updates a cached offset (every request carries its own file
+ * offset), so the positioning syscalls of the buffered layer cost
+ * nothing.  Asynchronous write errors are sticky and surface from
+ * the next stream operation or from s_close().
+ *
+ * Compile with -D_IOURING on a Linux with <linux/io_uring.h> to get
+ * this; otherwise (or when the running kernel lacks io_uring) it
+ * fails with stream_errno set (ENOSYS).
+ */
+extern stream_t *s_open_uring(const char *pathname, const char *mode);
+
 extern int s_close(stream_t *s);
 
+/*
+ * Run a helper thread that keeps NBUFS buffers of BUFSZ byte(s)
+ * ahead of a reading stream, or flushes them behind a writing one,
+ * so that the disk works while the caller computes.
+ *
+ * Only plain "r", "w" and "a" streams qualify; for a writer BUFSZ
+ * must be at least the stream buffer size.  Memory use is bounded by
+ * NBUFS * BUFSZ.  Passing zero for NBUFS stops the thread, draining
+ * any pending writeback; s_close() does this implicitly.  Thread
+ * errors are sticky and surface from the next stream operation.
+ *
+ * Compile with -D_PTHREAD and link with -lpthread to get this;
+ * otherwise it fails with ENOSYS.
+ */
+extern int s_set_readahead(stream_t *s, int nbufs, size_t bufsz);
+
 extern int s_setvbuf(stream_t *s, char *buf, int mode, size_t size);
 
 extern off_t s_seek(stream_t *s, off_t offset, int whence);
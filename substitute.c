@@ -2,6 +2,54 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_STREAM
+#include "stream.h"
+
+/*
+ * Chunk size for stream_substitute().  The retained tail (a possible
+ * needle prefix crossing the chunk boundary) must fit with room to
+ * spare, so the buffer is grown for outlandishly long needles.
+ */
+#define SUBST_CHUNK_SIZE        65536
+#endif  /* HAVE_STREAM */
+
+/*
+ * Build the Boyer-Moore-Horspool skip table for NEEDLE; SKIP[C] is
+ * how far the window advances when the byte under its last position
+ * is C.
+ */
+static void
+bmh_table(const char *needle, size_t len, size_t skip[256])
+{
+  size_t i;
+
+  for (i = 0; i < 256; i++)
+    skip[i] = len;
+  for (i = 0; i < len - 1; i++)
+    skip[(unsigned char)needle[i]] = len - 1 - i;
+}
+
+
+/*
+ * Find NEEDLE in the first HAYLEN byte(s) of HAY, sliding by SKIP.
+ * Returns the match position or NULL.
+ */
+static const char *
+bmh_search(const char *hay, size_t haylen,
+           const char *needle, size_t len, const size_t skip[256])
+{
+  size_t pos = 0;
+
+  while (pos + len <= haylen) {
+    if (hay[pos + len - 1] == needle[len - 1]
+        && memcmp(hay + pos, needle, len - 1) == 0)
+      return hay + pos;
+    pos += skip[(unsigned char)hay[pos + len - 1]];
+  }
+  return NULL;
+}
+
+
 /*
  * `str_substitute' replaces every occurrence of NEEDLE in SRC to
  * REPLACE.
@@ -17,45 +65,188 @@
  *
  * `str_substitute' returns the number of substitution.  It returns -1
  * when the allocation failed.
+ *
+ * Internally this runs in two passes: a Boyer-Moore-Horspool scan
+ * collects all match offsets, then (after at most one realloc to the
+ * exact final size) a single gather pass builds the result, forward
+ * when the replacement shrinks the string and backward when it grows
+ * it.  The tail is never shifted more than once, so the cost is
+ * O(length), not O(length * matches).
  */
 int
 str_substitute(char **src, size_t *size,
                const char *needle, const char *replace)
 {
-  char *p, *s, *t;
-  int len_rep, len_needle, len_src;
-  size_t siz;
-  int mul = 4;
-  int count = 0;
+  size_t skip[256];
+  size_t *ofs = NULL;
+  size_t nofs = 0, size_ofs = 0;
+  size_t len_rep, len_needle, len_src, len_out;
+  size_t prev, seg, i;
+  const char *p;
+  char *buf, *w;
+  int count;
 
   len_rep = strlen(replace);
   len_src = strlen(*src);
   len_needle = strlen(needle);
-  siz = *size;
-
-  s = *src;
-  while ((p = strstr(s, needle)) != NULL) {
-    if (*size < len_src + len_rep - len_needle + 1) {
-      siz = siz + mul * (len_rep - len_needle);
-      t = realloc(*src, siz);
-      if (!t)
+
+  if (len_needle == 0 || len_needle > len_src)
+    return 0;
+
+  /* pass 1: collect every match offset */
+  bmh_table(needle, len_needle, skip);
+  p = *src;
+  while ((p = bmh_search(p, len_src - (p - *src),
+                         needle, len_needle, skip)) != NULL) {
+    if (nofs == size_ofs) {
+      size_t nsize = size_ofs ? size_ofs * 2 : 64;
+      size_t *t = realloc(ofs, nsize * sizeof(*ofs));
+
+      if (!t) {
+        free(ofs);
         return -1;
-      p = p - *src + t;
-      s = s - *src + t;
-      *src = t;
-      *size = siz;
-      mul *= 2;
+      }
+      ofs = t;
+      size_ofs = nsize;
+    }
+    ofs[nofs++] = p - *src;
+    p += len_needle;
+  }
+
+  if (nofs == 0)
+    return 0;
+  count = nofs;
+
+  len_out = len_src + nofs * len_rep - nofs * len_needle;
+  if (*size < len_out + 1) {
+    buf = realloc(*src, len_out + 1);
+    if (!buf) {
+      free(ofs);
+      return -1;
+    }
+    *src = buf;
+    *size = len_out + 1;
+  }
+  buf = *src;
+
+  /* pass 2: one gather.  Writing forward is safe while the string
+   * shrinks (the write head trails the read head); when it grows,
+   * gather backward from the end instead. */
+  if (len_rep <= len_needle) {
+    w = buf + ofs[0];
+    for (i = 0; i < nofs; i++) {
+      memcpy(w, replace, len_rep);
+      w += len_rep;
+      prev = ofs[i] + len_needle;
+      seg = ((i + 1 < nofs) ? ofs[i + 1] : len_src + 1) - prev;
+      memmove(w, buf + prev, seg);
+      w += seg;
+    }
+  }
+  else {
+    w = buf + len_out + 1;
+    prev = len_src + 1;
+    for (i = nofs; i > 0; i--) {
+      seg = prev - (ofs[i - 1] + len_needle);
+      w -= seg;
+      memmove(w, buf + ofs[i - 1] + len_needle, seg);
+      w -= len_rep;
+      memcpy(w, replace, len_rep);
+      prev = ofs[i - 1];
+    }
+  }
+
+  free(ofs);
+  return count;
+}
+
+
+#ifdef HAVE_STREAM
+/*
+ * Like str_substitute(), but streaming: read IN chunk by chunk,
+ * replace every occurrence of NEEDLE with REPLACE, and write the
+ * result to OUT.  Only one chunk is ever resident, so the input may
+ * be arbitrarily large.  An occurrence crossing a chunk boundary is
+ * handled by retaining the last strlen(NEEDLE) - 1 byte(s) of each
+ * chunk for the next round.
+ *
+ * Returns the number of substitutions, or -1 on error (memory, or a
+ * stream error -- see stream_errno).
+ */
+int
+stream_substitute(stream_t *in, stream_t *out,
+                  const char *needle, const char *replace)
+{
+  size_t skip[256];
+  size_t len_rep, len_needle, bufsize;
+  size_t fill = 0, done, nread;
+  const char *p, *s;
+  char *buf;
+  int count = 0;
+  int eof = 0;
+
+  len_rep = strlen(replace);
+  len_needle = strlen(needle);
+  if (len_needle > 0)
+    bmh_table(needle, len_needle, skip);
+
+  bufsize = SUBST_CHUNK_SIZE;
+  while (bufsize < len_needle * 4)
+    bufsize *= 2;
+
+  buf = malloc(bufsize);
+  if (!buf)
+    return -1;
+
+  while (!eof) {
+    nread = s_read(in, buf + fill, 1, bufsize - fill);
+    if (nread == 0)
+      eof = 1;
+    fill += nread;
+
+    if (len_needle > 0 && len_needle <= fill) {
+      s = buf;
+      while ((p = bmh_search(s, fill - (s - buf),
+                             needle, len_needle, skip)) != NULL) {
+        if (p > s && s_write(out, s, 1, p - s) != (size_t)(p - s))
+          goto err;
+        if (len_rep > 0 && s_write(out, replace, 1, len_rep) != len_rep)
+          goto err;
+        count++;
+        s = p + len_needle;
+      }
+      done = s - buf;
     }
+    else
+      done = 0;
 
-    memmove(p + len_rep, p + len_needle,
-            len_src - (p + len_needle - *src) + 1);
-    memcpy(p, replace, len_rep);
-    count++;
-    s = p + len_rep;
-    len_src = len_src + len_rep - len_needle;
+    /* flush everything that can no longer be part of a match */
+    if (!eof && len_needle > 0 && fill - done > len_needle - 1) {
+      size_t keep = len_needle - 1;
+      size_t n = fill - done - keep;
+
+      if (s_write(out, buf + done, 1, n) != n)
+        goto err;
+      done += n;
+    }
+    else if (eof && fill > done) {
+      if (s_write(out, buf + done, 1, fill - done) != fill - done)
+        goto err;
+      done = fill;
+    }
+
+    memmove(buf, buf + done, fill - done);
+    fill -= done;
   }
+
+  free(buf);
   return count;
+
+ err:
+  free(buf);
+  return -1;
 }
+#endif  /* HAVE_STREAM */
 
 
 int
@@ -76,4 +267,3 @@ main(void)
   return 0;
 }
 
-
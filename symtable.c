@@ -17,8 +17,27 @@ struct symtable_ {
   struct snode **table;         /* bucket table */
   size_t size_table;            /* size of TABLE */
 
+  struct sslot *slots;          /* open-addressing array (SYMTABLE_FLAT) */
+  size_t size_slots;            /* size of SLOTS; power of two */
+  size_t used_slots;            /* used + deleted slots in SLOTS */
+
+  char *keys;                   /* interned key region for SLOTS */
+  size_t keys_len;              /* bytes used in KEYS */
+  size_t keys_size;             /* bytes allocated for KEYS */
+
   symtable_free_t free_func;    /* user-provided free function */
 
+  struct smemo **memo;          /* memoized substitution results */
+  unsigned long memo_gen;       /* bumped by register/unregister */
+  struct sdep *memo_deps;       /* deps gathered during an expansion */
+  int memo_recording;           /* nonzero while gathering MEMO_DEPS */
+  int memo_bad;                 /* nonzero if gathering hit OOM */
+
+  struct sver * volatile ver;   /* published version (SYMTABLE_RCU) */
+  struct sver *retired;         /* superseded versions, not yet freed */
+  volatile unsigned long epoch; /* bumped on every publish */
+  struct srcu_reader *readers;  /* announcement slots, one per thread */
+
   struct obstack _pool;
   struct obstack *pool;
 };
@@ -29,6 +48,10 @@ struct sframe {
   const char *name;             /* name of the current frame (optional?) */
   struct snode *link;           /* list of all (key, value) pair for
                                    the current frame */
+
+  struct obstack vpool;         /* value storage for this frame */
+  int vpool_ready;              /* nonzero once VPOOL is initialized */
+  void *vbase;                  /* marker into VPOOL taken on enter */
 };
 
 struct snode {
@@ -48,6 +71,108 @@ struct snode {
                                  * This points the malloc-ed memory area */
 };
 
+/*
+ * Slot for the open-addressing variant (SYMTABLE_FLAT).  The slots
+ * live in one flat array probed linearly, and the key strings are
+ * interned into symtable_t::keys, so a lookup walks consecutive
+ * cache lines instead of chasing per-node pointers.  Shadowed keys
+ * (same name, different frames) simply occupy several slots of the
+ * same probe run, and the lookup keeps the match of the deepest
+ * frame.  symtable_leave() turns the slots of the dying frame into
+ * tombstones, which keep their key offset so that the interned bytes
+ * can be reused.
+ */
+#define SLOT_EMPTY      0
+#define SLOT_USED       1
+#define SLOT_TOMB       2
+
+struct sslot {
+  unsigned hash;                /* cached symtable_hash() of the key */
+  unsigned char state;          /* one of SLOT_* */
+  int frame;                    /* depth of the owning frame */
+  int valid;                    /* same meaning as snode::valid */
+  unsigned key;                 /* offset into symtable_t::keys */
+  size_t size_val;              /* size of VAL */
+  void *val;                    /* malloc-ed value, as in snode */
+};
+
+/*
+ * Published version for concurrent readers (SYMTABLE_RCU).
+ *
+ * A version is one immutable malloc() block -- header, open-addressed
+ * slot array and a byte region holding key and value copies -- so a
+ * reader never follows a pointer into the mutable table, and freeing
+ * a version is one free().  rcu_publish() builds the next version
+ * from the live table after every mutation and swaps it in; the old
+ * one goes onto the retired list stamped with the new epoch.
+ *
+ * Readers announce the epoch they entered at in their slot of
+ * symtable_t::readers (one cache line each, so announcements do not
+ * bounce between cores); zero means quiescent.  A retired version is
+ * freed once every announced epoch is at least its retire stamp: a
+ * reader that announced E can only have loaded versions that were
+ * still current at E, and those are retired with a stamp above E.
+ *
+ * One writer at a time; see the SYMTABLE_RCU note in symtable.h.
+ */
+#define SYMTABLE_READERS_MAX    64
+
+struct srcu_reader {
+  volatile unsigned long epoch; /* 0 = outside any read section */
+  char pad_[64 - sizeof(unsigned long)];
+};
+
+struct svslot {
+  unsigned hash;                /* cached symtable_hash() of the key */
+  unsigned char state;          /* SLOT_EMPTY or SLOT_USED */
+  int frame;                    /* depth of the owning frame */
+  int has_val;                  /* nonzero if VAL is meaningful */
+  unsigned key;                 /* offset of the key in sver::bytes */
+  unsigned val;                 /* offset of the value in sver::bytes */
+  size_t size_val;              /* size of the value */
+};
+
+struct sver {
+  struct svslot *slots;         /* into the same block */
+  size_t size_slots;            /* power of two */
+  char *bytes;                  /* key and value copies */
+  int depth;                    /* writer's frame depth at publish */
+  unsigned long retire_epoch;   /* set when superseded */
+  struct sver *next;            /* retired list */
+};
+
+/*
+ * Memoized substitution (symtable_string_substitute_cached).
+ *
+ * Each expanded template is kept in a small chained hash table,
+ * together with the list of symbols its expansion touched (struct
+ * sdep).  A hit whose generation matches symtable_t::memo_gen costs
+ * one hash probe; when the generation moved on (some symbol was
+ * registered or unregistered since) the entry is revalidated by
+ * comparing the recorded value pointer and size of every dependency
+ * against the current table, so only templates whose chain actually
+ * changed are re-expanded.  The recorded pointers serve as identity
+ * only and are never dereferenced; since a frame's values are
+ * recycled wholesale on symtable_leave(), the whole memo is flushed
+ * there to avoid false matches on reused addresses.
+ */
+#define MEMO_BUCKETS    64
+
+struct sdep {
+  char *name;                   /* symbol looked up during expansion */
+  void *val;                    /* its value pointer at that time */
+  size_t size_val;              /* and its size; identity check only */
+  struct sdep *next;
+};
+
+struct smemo {
+  char *key;                    /* the template string */
+  char *value;                  /* its full expansion */
+  unsigned long gen;            /* memo_gen at last (re)validation */
+  struct sdep *deps;            /* symbols KEY's expansion depends on */
+  struct smemo *next;
+};
+
 /*
  * For maintainers:
  *
@@ -62,6 +187,15 @@ struct snode {
  *
  * Note that this bug fix may cause symtable module little bit slower.
  * I'll deal with it later -- cinsk
+ *
+ * Dealt with it: values are now carved from the obstack of the frame
+ * that OWNS the symbol (sframe::vpool), so re-setting a symbol of an
+ * outer frame allocates from the outer frame's pool and survives
+ * leaving the inner frame, which fixes the same bug without one
+ * malloc()/free() per entry.  symtable_leave() releases a whole
+ * frame's values with one OBSTACK_FREE().  Re-setting a value wastes
+ * the old bytes until its frame is left; that is bounded by the frame
+ * lifetime and is the price of the O(1) release.
  */
 #define symtable_hash(s)        symtable_hash_from_gcc(s)
 
@@ -69,6 +203,20 @@ static unsigned long symtable_hash_from_glib(const char *s);
 static unsigned int symtable_hash_from_gcc(const char *str);
 static struct snode *symtable_lookup_node(symtable_t *st,
                                           const char *key, unsigned flags);
+static struct sslot *flat_find(symtable_t *st, const char *key,
+                               unsigned flags);
+static int flat_register_frame(symtable_t *st, int frame, const char *name,
+                               const void *data, int len);
+static int flat_resize(symtable_t *st);
+static unsigned flat_intern(symtable_t *st, const char *key);
+static void *frame_value_alloc(symtable_t *st, int frame, size_t size);
+static void rcu_publish(symtable_t *st);
+static void rcu_reclaim(symtable_t *st);
+static void memo_record_dep(symtable_t *st, const char *name,
+                            void *val, size_t size_val);
+static int memo_deps_current(symtable_t *st, struct smemo *m);
+static void memo_free_deps(struct sdep *deps);
+static void memo_flush(symtable_t *st);
 
 
 symtable_t *
@@ -86,21 +234,64 @@ symtable_new(size_t table_size, size_t max_frame, unsigned flags)
     free(p);
     return NULL;
   }
+  p->table = NULL;
+  p->size_table = 0;
+  p->slots = NULL;
+  p->size_slots = 0;
+  p->used_slots = 0;
+  p->keys = NULL;
+  p->keys_len = 0;
+  p->keys_size = 0;
+
   p->frame = OBSTACK_ALLOC(p->pool, sizeof(*p->frame) * max_frame);
   if (!p->frame)
     goto err;
   for (i = 0; i < max_frame; i++) {
     p->frame[i].base = NULL;
     p->frame[i].link = NULL;
+    p->frame[i].vpool_ready = 0;
+    p->frame[i].vbase = NULL;
   }
   p->size_frame = max_frame;
 
-  p->table = OBSTACK_ALLOC(p->pool, sizeof(*p->table) * table_size);
-  if (!p->table)
-    goto err;
-  for (i = 0; i < table_size; i++)
-    p->table[i] = NULL;
-  p->size_table = table_size;
+  if (flags & SYMTABLE_FLAT) {
+    size_t n = 16;
+    while (n < table_size)
+      n <<= 1;
+    p->slots = calloc(n, sizeof(*p->slots));
+    if (!p->slots)
+      goto err;
+    p->size_slots = n;
+
+    p->keys_size = 256;
+    p->keys = malloc(p->keys_size);
+    if (!p->keys)
+      goto err;
+  }
+  else {
+    p->table = OBSTACK_ALLOC(p->pool, sizeof(*p->table) * table_size);
+    if (!p->table)
+      goto err;
+    for (i = 0; i < table_size; i++)
+      p->table[i] = NULL;
+    p->size_table = table_size;
+  }
+
+  p->memo = NULL;
+  p->memo_gen = 0;
+  p->memo_deps = NULL;
+  p->memo_recording = 0;
+  p->memo_bad = 0;
+
+  p->ver = NULL;
+  p->retired = NULL;
+  p->epoch = 1;
+  p->readers = NULL;
+  if (flags & SYMTABLE_RCU) {
+    p->readers = calloc(SYMTABLE_READERS_MAX, sizeof(*p->readers));
+    if (!p->readers)
+      goto err;
+  }
 
   p->flags = flags;
   p->depth = -1;
@@ -112,6 +303,9 @@ symtable_new(size_t table_size, size_t max_frame, unsigned flags)
   return p;
 
  err:
+  free(p->slots);
+  free(p->keys);
+  free(p->readers);
   OBSTACK_FREE(p->pool, 0);
   free(p);
   return NULL;
@@ -121,9 +315,29 @@ symtable_new(size_t table_size, size_t max_frame, unsigned flags)
 void
 symtable_delete(symtable_t *st)
 {
+  int i;
+
   while (symtable_leave(st) != -1)
     ;
 
+  for (i = 0; i < (int)st->size_frame; i++)
+    if (st->frame[i].vpool_ready)
+      OBSTACK_FREE(&st->frame[i].vpool, NULL);
+
+  memo_flush(st);
+  free(st->memo);
+
+  /* no reader may be inside a read section by now */
+  free(st->ver);
+  while (st->retired) {
+    struct sver *v = st->retired;
+    st->retired = v->next;
+    free(v);
+  }
+  free(st->readers);
+
+  free(st->slots);
+  free(st->keys);
   OBSTACK_FREE(st->pool, NULL);
   free(st);
 }
@@ -136,6 +350,16 @@ symtable_register_frame(symtable_t *st, int frame,
   int index;
   struct snode *p, *q, *r;
 
+  st->memo_gen++;
+
+  if (st->flags & SYMTABLE_FLAT) {
+    int ret = flat_register_frame(st, frame, name, data, len);
+
+    if (ret == 0)
+      rcu_publish(st);
+    return ret;
+  }
+
   if (frame < 0) {
     frame = st->depth;
     p = symtable_lookup_node(st, name, SYMTABLE_OPT_CFRAME);
@@ -147,7 +371,7 @@ symtable_register_frame(symtable_t *st, int frame,
       len = strlen(data) + 1;
 
     if (len > 0) {
-      p->val = realloc(p->val, len);
+      p->val = frame_value_alloc(st, p->frame, len);
       if (!p->val)
         return -1;
       memcpy(p->val, data, len);
@@ -155,6 +379,7 @@ symtable_register_frame(symtable_t *st, int frame,
     else
       p->val = NULL;
     p->size_val = len;
+    rcu_publish(st);
     return 0;
   }
 
@@ -178,7 +403,7 @@ symtable_register_frame(symtable_t *st, int frame,
     len = strlen(data) + 1;
 
   if (len > 0) {
-    p->val = malloc(len);
+    p->val = frame_value_alloc(st, frame, len);
     if (!p->val) {
       OBSTACK_FREE(st->pool, p);
       return -1;
@@ -212,6 +437,7 @@ symtable_register_frame(symtable_t *st, int frame,
 
   p->valid = 1;
 
+  rcu_publish(st);
   return 0;
 }
 
@@ -284,6 +510,32 @@ symtable_unregister_frame(symtable_t *st, int frame, const char *key)
 {
   struct snode *p;
 
+  st->memo_gen++;
+
+  if (st->flags & SYMTABLE_FLAT) {
+    struct sslot *s;
+
+    if (frame < 0)
+      s = flat_find(st, key, SYMTABLE_OPT_CFRAME);
+    else
+      s = flat_find(st, key, SYMTABLE_OPT_FRAME + frame);
+
+    if (!s)
+      return -1;
+
+    if (st->free_func)
+      st->free_func(st->keys + s->key, s->val, s->size_val);
+
+    s->valid = 0;
+
+    /* the bytes stay in the owning frame's vpool until leave */
+    s->val = 0;
+    s->size_val = 0;
+
+    rcu_publish(st);
+    return 0;
+  }
+
   if (frame < 0)
     p = symtable_lookup_node(st, key, SYMTABLE_OPT_CFRAME);
   else
@@ -297,10 +549,11 @@ symtable_unregister_frame(symtable_t *st, int frame, const char *key)
 
   p->valid = 0;
 
-  free(p->val);
+  /* the bytes stay in the owning frame's vpool until leave */
   p->val = 0;
   p->size_val = 0;
 
+  rcu_publish(st);
   return 0;
 }
 
@@ -343,11 +596,214 @@ symtable_lookup_node(symtable_t *st, const char *key, unsigned flags)
 }
 
 
+/*
+ * Find the slot for KEY in the open-addressing table.
+ *
+ * The whole probe run is scanned (it ends at the first empty slot),
+ * since shadowed keys may sit anywhere in it; without a frame
+ * restriction in FLAGS, the match of the deepest frame wins.
+ */
+static struct sslot *
+flat_find(symtable_t *st, const char *key, unsigned flags)
+{
+  unsigned hash = symtable_hash(key);
+  size_t mask = st->size_slots - 1;
+  size_t i = hash & mask;
+  struct sslot *best = NULL;
+  struct sslot *s;
+
+  while ((s = &st->slots[i])->state != SLOT_EMPTY) {
+    if (s->state == SLOT_USED && s->valid && s->hash == hash
+        && strcmp(st->keys + s->key, key) == 0) {
+      if (flags & SYMTABLE_OPT_CFRAME) {
+        if (s->frame == st->depth)
+          return s;
+      }
+      else if (flags & SYMTABLE_OPT_FRAME) {
+        if (s->frame == (int)(flags & SYMTABLE_OPT_FRAME_MASK))
+          return s;
+      }
+      else if (!best || s->frame > best->frame)
+        best = s;
+    }
+    i = (i + 1) & mask;
+  }
+
+  if (flags & (SYMTABLE_OPT_CFRAME | SYMTABLE_OPT_FRAME))
+    return NULL;
+  return best;
+}
+
+
+/*
+ * Copy KEY into the interned string region, returning its offset, or
+ * (unsigned)-1 on allocation failure.
+ */
+static unsigned
+flat_intern(symtable_t *st, const char *key)
+{
+  size_t len = strlen(key) + 1;
+  unsigned off;
+
+  if (st->keys_len + len > st->keys_size) {
+    size_t nsize = st->keys_size * 2;
+    char *p;
+
+    while (st->keys_len + len > nsize)
+      nsize *= 2;
+    p = realloc(st->keys, nsize);
+    if (!p)
+      return (unsigned)-1;
+    st->keys = p;
+    st->keys_size = nsize;
+  }
+
+  off = st->keys_len;
+  memcpy(st->keys + off, key, len);
+  st->keys_len += len;
+  return off;
+}
+
+
+static int
+flat_resize(symtable_t *st)
+{
+  size_t nsize = st->size_slots * 2;
+  struct sslot *nslots = calloc(nsize, sizeof(*nslots));
+  size_t i, j, mask = nsize - 1;
+  size_t used = 0;
+
+  if (!nslots)
+    return -1;
+
+  /* tombstones are dropped on the way */
+  for (i = 0; i < st->size_slots; i++) {
+    struct sslot *s = &st->slots[i];
+
+    if (s->state != SLOT_USED)
+      continue;
+    j = s->hash & mask;
+    while (nslots[j].state != SLOT_EMPTY)
+      j = (j + 1) & mask;
+    nslots[j] = *s;
+    used++;
+  }
+
+  free(st->slots);
+  st->slots = nslots;
+  st->size_slots = nsize;
+  st->used_slots = used;
+  return 0;
+}
+
+
+static int
+flat_register_frame(symtable_t *st, int frame,
+                    const char *name, const void *data, int len)
+{
+  struct sslot *s, *dst;
+  unsigned hash, koff;
+  size_t i, mask;
+  int have_key = 0;
+
+  if (frame < 0) {
+    frame = st->depth;
+    s = flat_find(st, name, SYMTABLE_OPT_CFRAME);
+  }
+  else
+    s = flat_find(st, name, SYMTABLE_OPT_FRAME + frame);
+
+  if (s) {
+    if (len < 0)
+      len = strlen(data) + 1;
+
+    if (len > 0) {
+      s->val = frame_value_alloc(st, s->frame, len);
+      if (!s->val)
+        return -1;
+      memcpy(s->val, data, len);
+    }
+    else
+      s->val = NULL;
+    s->size_val = len;
+    return 0;
+  }
+
+  if (frame != st->depth)
+    return -1;
+
+  if (st->used_slots * 4 >= st->size_slots * 3 && flat_resize(st) < 0)
+    return -1;
+
+  hash = symtable_hash(name);
+  mask = st->size_slots - 1;
+  dst = NULL;
+  koff = 0;
+
+  for (i = hash & mask; /* void */; i = (i + 1) & mask) {
+    s = &st->slots[i];
+    if (s->state == SLOT_EMPTY) {
+      if (!dst)
+        dst = s;
+      break;
+    }
+    if (s->state == SLOT_TOMB && !dst)
+      dst = s;
+    if (!have_key && s->hash == hash
+        && strcmp(st->keys + s->key, name) == 0) {
+      koff = s->key;            /* reuse the interned bytes */
+      have_key = 1;
+    }
+  }
+
+  if (!have_key) {
+    koff = flat_intern(st, name);
+    if (koff == (unsigned)-1)
+      return -1;
+  }
+
+  if (len < 0)
+    len = strlen(data) + 1;
+
+  if (len > 0) {
+    void *val = frame_value_alloc(st, frame, len);
+
+    if (!val)
+      return -1;
+    memcpy(val, data, len);
+    dst->val = val;
+  }
+  else
+    dst->val = NULL;
+
+  if (dst->state == SLOT_EMPTY)
+    st->used_slots++;
+  dst->state = SLOT_USED;
+  dst->hash = hash;
+  dst->frame = frame;
+  dst->key = koff;
+  dst->size_val = len;
+  dst->valid = 1;
+
+  return 0;
+}
+
+
 void *
 symtable_lookup(symtable_t *st, const char *key, size_t *size, unsigned flags)
 {
   struct snode *p;
 
+  if (st->flags & SYMTABLE_FLAT) {
+    struct sslot *s = flat_find(st, key, flags);
+
+    if (!s)
+      return NULL;
+    if (size)
+      *size = s->size_val;
+    return s->val;
+  }
+
   p = symtable_lookup_node(st, key, flags);
   if (!p)
     return NULL;
@@ -359,6 +815,256 @@ symtable_lookup(symtable_t *st, const char *key, size_t *size, unsigned flags)
 }
 
 
+/*
+ * Copy one visible binding into the version being built.  The slot
+ * array is oversized (load factor <= 1/2) and immutable, so plain
+ * linear probing with no tombstones suffices.
+ */
+static void
+rcu_build_insert(struct sver *v, size_t *off, const char *name, int frame,
+                 const void *val, size_t size_val)
+{
+  unsigned hash = symtable_hash(name);
+  size_t mask = v->size_slots - 1;
+  size_t klen = strlen(name) + 1;
+  size_t i;
+  struct svslot *s;
+
+  for (i = hash & mask; v->slots[i].state != SLOT_EMPTY; i = (i + 1) & mask)
+    ;
+  s = &v->slots[i];
+
+  s->key = *off;
+  memcpy(v->bytes + *off, name, klen);
+  *off += klen;
+
+  if (val) {
+    s->val = *off;
+    s->has_val = 1;
+    memcpy(v->bytes + *off, val, size_val);
+    *off += size_val;
+  }
+  else {
+    s->val = 0;
+    s->has_val = 0;
+  }
+  s->size_val = size_val;
+  s->hash = hash;
+  s->frame = frame;
+  s->state = SLOT_USED;
+}
+
+
+/*
+ * Build an immutable version of everything currently visible, in one
+ * malloc() block.  Returns NULL on allocation failure.
+ */
+static struct sver *
+rcu_build(symtable_t *st)
+{
+  struct sver *v;
+  size_t n = 0, nbytes = 0, nslots, i, off;
+
+  if (st->flags & SYMTABLE_FLAT) {
+    for (i = 0; i < st->size_slots; i++) {
+      struct sslot *s = &st->slots[i];
+
+      if (s->state == SLOT_USED && s->valid) {
+        n++;
+        nbytes += strlen(st->keys + s->key) + 1 + s->size_val;
+      }
+    }
+  }
+  else {
+    struct snode *p;
+    int f;
+
+    for (f = 0; f <= st->depth; f++)
+      for (p = st->frame[f].link; p != NULL; p = p->flnk)
+        if (p->valid) {
+          n++;
+          nbytes += strlen(p->name) + 1 + p->size_val;
+        }
+  }
+
+  nslots = 16;
+  while (nslots < n * 2)
+    nslots <<= 1;
+
+  v = malloc(sizeof(*v) + nslots * sizeof(struct svslot) + nbytes);
+  if (!v)
+    return NULL;
+  v->slots = (struct svslot *)(v + 1);
+  v->bytes = (char *)(v->slots + nslots);
+  v->size_slots = nslots;
+  v->depth = st->depth;
+  v->retire_epoch = 0;
+  v->next = NULL;
+  memset(v->slots, 0, nslots * sizeof(struct svslot));
+
+  off = 0;
+  if (st->flags & SYMTABLE_FLAT) {
+    for (i = 0; i < st->size_slots; i++) {
+      struct sslot *s = &st->slots[i];
+
+      if (s->state == SLOT_USED && s->valid)
+        rcu_build_insert(v, &off, st->keys + s->key, s->frame,
+                         s->val, s->size_val);
+    }
+  }
+  else {
+    struct snode *p;
+    int f;
+
+    for (f = 0; f <= st->depth; f++)
+      for (p = st->frame[f].link; p != NULL; p = p->flnk)
+        if (p->valid)
+          rcu_build_insert(v, &off, p->name, p->frame, p->val, p->size_val);
+  }
+
+  return v;
+}
+
+
+/*
+ * Free every retired version that no announced reader can still see.
+ * A reader that announced epoch E only ever loads versions that were
+ * current at E or later, and those carry a retire stamp above E.
+ */
+static void
+rcu_reclaim(symtable_t *st)
+{
+  unsigned long min = (unsigned long)-1;
+  struct sver *v, **vp;
+  int i;
+
+  for (i = 0; i < SYMTABLE_READERS_MAX; i++) {
+    unsigned long e = st->readers[i].epoch;
+
+    if (e != 0 && e < min)
+      min = e;
+  }
+
+  vp = &st->retired;
+  while ((v = *vp) != NULL) {
+    if (v->retire_epoch <= min) {
+      *vp = v->next;
+      free(v);
+    }
+    else
+      vp = &v->next;
+  }
+}
+
+
+/*
+ * Build the next version and swap it in.  On allocation failure the
+ * previous version simply stays published; readers lag behind until
+ * the next successful publish, which beats failing the mutation.
+ */
+static void
+rcu_publish(symtable_t *st)
+{
+  struct sver *nv, *old;
+
+  if (!(st->flags & SYMTABLE_RCU))
+    return;
+
+  nv = rcu_build(st);
+  if (!nv)
+    return;
+
+  old = st->ver;
+  __sync_synchronize();         /* NV's body happens-before the swap */
+  st->ver = nv;
+
+  if (old) {
+    old->retire_epoch = __sync_add_and_fetch(&st->epoch, 1);
+    old->next = st->retired;
+    st->retired = old;
+  }
+  rcu_reclaim(st);
+}
+
+
+static volatile int rcu_reader_ids;
+static __thread int rcu_reader_id = -1;
+
+
+int
+symtable_read_enter(symtable_t *st)
+{
+  if (!st->readers)
+    return -1;
+
+  if (rcu_reader_id < 0)
+    rcu_reader_id = __sync_fetch_and_add(&rcu_reader_ids, 1);
+  if (rcu_reader_id >= SYMTABLE_READERS_MAX)
+    return -1;
+
+  st->readers[rcu_reader_id].epoch = st->epoch;
+  __sync_synchronize();         /* announce before loading the version */
+  return 0;
+}
+
+
+void
+symtable_read_leave(symtable_t *st)
+{
+  if (!st->readers || rcu_reader_id < 0 ||
+      rcu_reader_id >= SYMTABLE_READERS_MAX)
+    return;
+
+  __sync_synchronize();         /* all reads of the version came first */
+  st->readers[rcu_reader_id].epoch = 0;
+}
+
+
+void *
+symtable_lookup_shared(symtable_t *st, const char *key, size_t *size,
+                       unsigned flags)
+{
+  struct sver *v = st->ver;
+  struct svslot *best, *s;
+  unsigned hash;
+  size_t i, mask;
+
+  if (!v)
+    return symtable_lookup(st, key, size, flags);
+
+  hash = symtable_hash(key);
+  mask = v->size_slots - 1;
+  best = NULL;
+
+  for (i = hash & mask; (s = &v->slots[i])->state != SLOT_EMPTY;
+       i = (i + 1) & mask) {
+    if (s->hash != hash || strcmp(v->bytes + s->key, key) != 0)
+      continue;
+
+    if (flags & SYMTABLE_OPT_CFRAME) {
+      if (s->frame == v->depth) {
+        best = s;
+        break;
+      }
+    }
+    else if (flags & SYMTABLE_OPT_FRAME) {
+      if (s->frame == (int)(flags & SYMTABLE_OPT_FRAME_MASK)) {
+        best = s;
+        break;
+      }
+    }
+    else if (!best || s->frame > best->frame)
+      best = s;
+  }
+
+  if (!best)
+    return NULL;
+  if (size)
+    *size = best->size_val;
+  return best->has_val ? v->bytes + best->val : NULL;
+}
+
+
 /* Enter new frame */
 int
 symtable_enter(symtable_t *st, const char *name)
@@ -376,10 +1082,33 @@ symtable_enter(symtable_t *st, const char *name)
 
   st->frame[st->depth].link = NULL;
 
+  if (!st->frame[st->depth].vpool_ready) {
+    if (OBSTACK_INIT(&st->frame[st->depth].vpool) < 0) {
+      st->depth--;
+      return -1;
+    }
+    st->frame[st->depth].vpool_ready = 1;
+  }
+  /* everything allocated past VBASE is released on leave */
+  st->frame[st->depth].vbase = OBSTACK_ALLOC(&st->frame[st->depth].vpool, 1);
+
+  rcu_publish(st);              /* the CFRAME depth moved */
   return st->depth;
 }
 
 
+/*
+ * Allocate SIZE byte(s) for a value owned by FRAME.  The chunks stay
+ * cached in the frame's obstack across enter/leave cycles, so this is
+ * normally just a pointer bump.
+ */
+static void *
+frame_value_alloc(symtable_t *st, int frame, size_t size)
+{
+  return OBSTACK_ALLOC(&st->frame[frame].vpool, size);
+}
+
+
 int
 symtable_leave(symtable_t *st)
 {
@@ -389,6 +1118,39 @@ symtable_leave(symtable_t *st)
   if (st->depth < -1)
     return -1;
 
+  /* the dying frame's value bytes will be recycled; a stale memo
+   * could then compare equal against a reused address. */
+  memo_flush(st);
+
+  if (st->flags & SYMTABLE_FLAT) {
+    size_t i;
+
+    for (i = 0; i < st->size_slots; i++) {
+      struct sslot *s = &st->slots[i];
+
+      if (s->state != SLOT_USED || s->frame != st->depth)
+        continue;
+
+      if (s->valid) {
+        if (st->free_func)
+          st->free_func(st->keys + s->key, s->val, s->size_val);
+
+        s->valid = 0;
+        s->val = NULL;
+        s->size_val = 0;
+      }
+      s->state = SLOT_TOMB;     /* keeps the key offset for reuse */
+    }
+
+    /* one shot releases every value of this frame */
+    OBSTACK_FREE(&st->frame[st->depth].vpool, st->frame[st->depth].vbase);
+    OBSTACK_FREE(st->pool, st->frame[st->depth].base);
+
+    st->depth--;
+    rcu_publish(st);
+    return st->depth;
+  }
+
   for (p = st->frame[st->depth].link; p != NULL; p = p->flnk) {
     index = symtable_hash(p->name) % st->size_table;
 
@@ -397,8 +1159,6 @@ symtable_leave(symtable_t *st)
         st->free_func(p->name, p->val, p->size_val);
 
       p->valid = 0;
-
-      free(p->val);
       p->val = NULL;
       p->size_val = 0;
     }
@@ -412,9 +1172,12 @@ symtable_leave(symtable_t *st)
       p->next->prev = p->prev;
   }
 
+  /* one shot releases every value of this frame */
+  OBSTACK_FREE(&st->frame[st->depth].vpool, st->frame[st->depth].vbase);
   OBSTACK_FREE(st->pool, st->frame[st->depth].base);
 
   st->depth--;
+  rcu_publish(st);
   return st->depth;
 }
 
@@ -493,7 +1256,13 @@ symtable_var_substitute(symtable_t *st)
         s[j] = '\0';
 
         name = s + i + 2;
-        val = symtable_lookup(st, name, NULL, 0);
+        if (st->memo_recording) {
+          size_t val_size = 0;
+          val = symtable_lookup(st, name, &val_size, 0);
+          memo_record_dep(st, name, val, val_size);
+        }
+        else
+          val = symtable_lookup(st, name, NULL, 0);
 
         if (!val)
           strcpy(s + i, s + j + 1);
@@ -582,22 +1351,49 @@ symtable_register_substitute_frame(symtable_t *st, int frame,
   struct snode *snptr;
   int size;
   char *p;
+  int *validp;
+  void **valp;
+  size_t *sizep;
+  int vframe;
 
   assert(OBSTACK_OBJECT_SIZE(st->pool) == 0);
 
   if (symtable_register_frame(st, frame, name, 0, 0) < 0)
     return -1;
 
-  if (frame < 0)
-    snptr = symtable_lookup_node(st, name, SYMTABLE_OPT_CFRAME);
-  else
-    snptr = symtable_lookup_node(st, name, SYMTABLE_OPT_FRAME + frame);
+  if (st->flags & SYMTABLE_FLAT) {
+    struct sslot *slot;
 
-  if (!snptr) {
-    /* huh? */
-    return 0;
+    if (frame < 0)
+      slot = flat_find(st, name, SYMTABLE_OPT_CFRAME);
+    else
+      slot = flat_find(st, name, SYMTABLE_OPT_FRAME + frame);
+
+    if (!slot) {
+      /* huh? */
+      return 0;
+    }
+    validp = &slot->valid;
+    valp = &slot->val;
+    sizep = &slot->size_val;
+    vframe = slot->frame;
+  }
+  else {
+    if (frame < 0)
+      snptr = symtable_lookup_node(st, name, SYMTABLE_OPT_CFRAME);
+    else
+      snptr = symtable_lookup_node(st, name, SYMTABLE_OPT_FRAME + frame);
+
+    if (!snptr) {
+      /* huh? */
+      return 0;
+    }
+    validp = &snptr->valid;
+    valp = &snptr->val;
+    sizep = &snptr->size_val;
+    vframe = snptr->frame;
   }
-  snptr->valid = 0;
+  *validp = 0;
 
   size = strlen(data) + 1;
   OBSTACK_GROW(st->pool, data, size);
@@ -605,18 +1401,19 @@ symtable_register_substitute_frame(symtable_t *st, int frame,
     return -1;
   }
 
-  snptr->size_val = OBSTACK_OBJECT_SIZE(st->pool);
+  *sizep = OBSTACK_OBJECT_SIZE(st->pool);
   p = OBSTACK_FINISH(st->pool);
 
-  snptr->val = realloc(snptr->val, snptr->size_val);
-  if (!snptr->val) {
+  *valp = frame_value_alloc(st, vframe, *sizep);
+  if (!*valp) {
     OBSTACK_FREE(st->pool, p);
     return -1;
   }
-  memcpy(snptr->val, p, snptr->size_val);
+  memcpy(*valp, p, *sizep);
 
-  snptr->valid = 1;
+  *validp = 1;
 
+  rcu_publish(st);
   return 0;
 }
 
@@ -650,6 +1447,179 @@ symtable_string_substitute(symtable_t *st, const char *data)
 }
 
 
+/*
+ * Remember that the running expansion looked NAME up and saw
+ * (VAL, SIZE_VAL).  Duplicates are folded; the `again' re-scan in
+ * symtable_var_substitute() visits the same name many times.
+ */
+static void
+memo_record_dep(symtable_t *st, const char *name, void *val, size_t size_val)
+{
+  struct sdep *d;
+
+  for (d = st->memo_deps; d != NULL; d = d->next)
+    if (strcmp(d->name, name) == 0)
+      return;
+
+  d = malloc(sizeof(*d));
+  if (!d) {
+    st->memo_bad = 1;
+    return;
+  }
+  d->name = strdup(name);
+  if (!d->name) {
+    free(d);
+    st->memo_bad = 1;
+    return;
+  }
+  d->val = val;
+  d->size_val = size_val;
+  d->next = st->memo_deps;
+  st->memo_deps = d;
+}
+
+
+/*
+ * Nonzero if every dependency of M still resolves to the value it had
+ * when M was expanded.  An entry without dependencies (no "${...}" in
+ * the template) is current forever.
+ */
+static int
+memo_deps_current(symtable_t *st, struct smemo *m)
+{
+  struct sdep *d;
+
+  for (d = m->deps; d != NULL; d = d->next) {
+    size_t size = 0;
+    void *val = symtable_lookup(st, d->name, &size, 0);
+
+    if (val != d->val)
+      return 0;
+    if (val && size != d->size_val)
+      return 0;
+  }
+  return 1;
+}
+
+
+static void
+memo_free_deps(struct sdep *deps)
+{
+  struct sdep *d;
+
+  while ((d = deps) != NULL) {
+    deps = d->next;
+    free(d->name);
+    free(d);
+  }
+}
+
+
+static void
+memo_flush(symtable_t *st)
+{
+  int i;
+  struct smemo *m;
+
+  if (!st->memo)
+    return;
+
+  for (i = 0; i < MEMO_BUCKETS; i++) {
+    while ((m = st->memo[i]) != NULL) {
+      st->memo[i] = m->next;
+      memo_free_deps(m->deps);
+      free(m->key);
+      free(m->value);
+      free(m);
+    }
+  }
+}
+
+
+char *
+symtable_string_substitute_cached(symtable_t *st, const char *data)
+{
+  struct smemo *m, **mp;
+  char *p, *q;
+  int size;
+
+  if (!st->memo) {
+    st->memo = calloc(MEMO_BUCKETS, sizeof(*st->memo));
+    if (!st->memo)
+      return NULL;
+  }
+
+  mp = &st->memo[symtable_hash(data) % MEMO_BUCKETS];
+  for (m = *mp; m != NULL; mp = &m->next, m = m->next)
+    if (strcmp(m->key, data) == 0)
+      break;
+
+  if (m && m->value) {
+    if (m->gen == st->memo_gen)
+      return m->value;
+    if (memo_deps_current(st, m)) {
+      m->gen = st->memo_gen;    /* hits are one probe again */
+      return m->value;
+    }
+    /* a symbol in the chain changed; re-expand below */
+    free(m->value);
+    m->value = NULL;
+    memo_free_deps(m->deps);
+    m->deps = NULL;
+  }
+  else if (!m) {
+    m = malloc(sizeof(*m));
+    if (!m)
+      return NULL;
+    m->key = strdup(data);
+    if (!m->key) {
+      free(m);
+      return NULL;
+    }
+    m->value = NULL;
+    m->deps = NULL;
+    m->next = NULL;
+    *mp = m;
+  }
+
+  assert(OBSTACK_OBJECT_SIZE(st->pool) == 0);
+
+  size = strlen(data) + 1;
+  OBSTACK_GROW(st->pool, data, size);
+
+  st->memo_bad = 0;
+  st->memo_recording = 1;
+  if (symtable_var_substitute(st) < 0) {
+    st->memo_recording = 0;
+    goto err;
+  }
+  st->memo_recording = 0;
+
+  q = OBSTACK_FINISH(st->pool);
+  p = strdup(q);
+  OBSTACK_FREE(st->pool, q);
+  if (!p || st->memo_bad) {
+    free(p);
+    goto err;
+  }
+
+  m->value = p;
+  m->deps = st->memo_deps;
+  st->memo_deps = NULL;
+  m->gen = st->memo_gen;
+
+  return m->value;
+
+ err:
+  memo_free_deps(st->memo_deps);
+  st->memo_deps = NULL;
+  *mp = m->next;                /* drop the half-built entry */
+  free(m->key);
+  free(m);
+  return NULL;
+}
+
+
 char *
 symtable_esc_substitute(symtable_t *st, const char *key)
 {
@@ -755,6 +1725,22 @@ symtable_enumerate(symtable_t *sp, int frame,
   struct snode *node;
   int count = 0;
 
+  if (sp->flags & SYMTABLE_FLAT) {
+    size_t n;
+
+    for (n = 0; n < sp->size_slots; n++) {
+      struct sslot *s = &sp->slots[n];
+
+      if (s->state != SLOT_USED || s->frame < frame)
+        continue;
+      ret = proc(sp->keys + s->key, s->val, s->size_val, s->frame, data);
+      if (ret < 0)
+        return ret;
+      count++;
+    }
+    return count;
+  }
+
   for (i = frame; i <= sp->depth; i++) {
     for (node = sp->frame[i].link; node != NULL; node = node->flnk) {
       ret = proc(node->name, node->val, node->size_val, node->frame, data);
@@ -804,6 +1790,23 @@ symtable_dump(symtable_t *p)
     printf("    %2d: base(%p), link(%p) name(%s)\n", i,
            p->frame[i].base, p->frame[i].link, p->frame[i].name);
 
+  if (p->flags & SYMTABLE_FLAT) {
+    size_t n;
+
+    printf("  slots: size(%u) used(%u)\n",
+           (unsigned)p->size_slots, (unsigned)p->used_slots);
+    for (n = 0; n < p->size_slots; n++) {
+      struct sslot *s = &p->slots[n];
+
+      if (s->state == SLOT_EMPTY)
+        continue;
+      printf("    %2u: [%d:%c:%s]%s\n", (unsigned)n, s->frame,
+             s->valid ? 'V' : 'D', p->keys + s->key,
+             s->state == SLOT_TOMB ? " (deleted)" : "");
+    }
+    return;
+  }
+
   printf("  table: size(%u)\n", p->size_table);
   for (i = 0; i < p->size_table; i++) {
     printf("    %2d: ", i);
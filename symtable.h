@@ -22,6 +22,35 @@
 
 #include <obsutil.h>
 
+/*
+ * FLAGS for symtable_new():
+ *
+ * With SYMTABLE_FLAT, the table uses open addressing (linear probing
+ * over one flat slot array) instead of chained buckets, and the key
+ * strings are interned into a contiguous region.  A lookup then
+ * touches one or two consecutive cache lines rather than chasing
+ * per-node pointers, which is considerably faster for lookup-heavy
+ * work.  TABLE_SIZE is rounded up to a power of two and the array
+ * grows as needed.  The public behavior is unchanged.
+ */
+#define SYMTABLE_FLAT           0x0001
+
+/*
+ * With SYMTABLE_RCU, every symtable_register*()/symtable_unregister*()
+ * and frame change additionally builds an immutable copy of the
+ * visible bindings and publishes it with one atomic pointer swap.
+ * Reader threads then use symtable_lookup_shared() between
+ * symtable_read_enter() and symtable_read_leave(), entirely without
+ * locks; superseded copies are reclaimed once every reader that could
+ * still see them has left its read section (epoch-based reclamation).
+ *
+ * The writer side is NOT serialized by the table: mutate from one
+ * thread, or put your own mutex around the mutators.  That is the
+ * classic RCU shape, and the right trade when reads outnumber writes
+ * by orders of magnitude.
+ */
+#define SYMTABLE_RCU            0x0002
+
 #define SYMTABLE_OPT_CFRAME     0x8000
 
 #define SYMTABLE_OPT_FRAME_MASK 0x00FF
@@ -105,6 +134,31 @@ extern int symtable_unregister_frame(symtable_t *st, int frame, const char *key)
 extern void *symtable_lookup(symtable_t *st, const char *key, size_t *size,
                              unsigned flags);
 
+/*
+ * Like symtable_lookup(), but against the last published version of
+ * an SYMTABLE_RCU table: no lock, no store, no atomic instruction on
+ * the reader path.  Call it between symtable_read_enter() and
+ * symtable_read_leave(); the returned pointer (a copy owned by the
+ * published version) is valid until symtable_read_leave().
+ *
+ * SYMTABLE_OPT_CFRAME resolves against the writer's frame depth at
+ * publish time.  On a table created without SYMTABLE_RCU this falls
+ * back to symtable_lookup().
+ */
+extern void *symtable_lookup_shared(symtable_t *st, const char *key,
+                                    size_t *size, unsigned flags);
+
+/*
+ * Enter/leave a read-side critical section of an SYMTABLE_RCU table.
+ *
+ * Sections must not nest on the same table.  Each reading thread
+ * occupies one announcement slot, of which there are a fixed number;
+ * symtable_read_enter() returns 0 on success and -1 when the slots
+ * are exhausted (the caller must then fall back to its own locking).
+ */
+extern int symtable_read_enter(symtable_t *st);
+extern void symtable_read_leave(symtable_t *st);
+
 /*
  * Enter new frame.
  *
@@ -134,6 +188,23 @@ char *symtable_strdup(symtable_t *table, const char *s);
 
 extern char *symtable_string_substitute(symtable_t *st, const char *data);
 
+/*
+ * Like symtable_string_substitute(), but the expansion is memoized.
+ *
+ * The first call on a given DATA expands it and records which symbols
+ * the expansion used; repeated calls return the cached result with a
+ * single hash probe.  Registering or unregistering a symbol that one
+ * of the cached chains depends on re-expands exactly those entries on
+ * their next use; unrelated updates leave them cached.
+ *
+ * The returned string is owned by ST.  It stays valid until the next
+ * symtable_register*()/symtable_unregister*()/symtable_leave() call
+ * on ST; copy it if you need it longer.  Do not free() it.  Returns
+ * NULL on error, like symtable_string_substitute().
+ */
+extern char *symtable_string_substitute_cached(symtable_t *st,
+                                               const char *data);
+
 extern int symtable_current_frame(symtable_t *table);
 extern const char *symtable_get_frame_name(symtable_t *table, int frame_id);
 
@@ -2,8 +2,10 @@
 #define TIMEDMAP_HH__
 
 #include <map>
+#include <vector>
 #include <stdexcept>
-#include <boost/shared_ptr.hpp>
+#include <memory>
+#include <functional>
 #include <pthread.h>
 #include <errno.h>
 #include <unistd.h>
@@ -59,6 +61,31 @@
 // TMAP_GET() macro is implemented using 'for' statement.  So use
 // 'break' statement inside of TMAP_GET() macro block actually make
 // the control to escape from TMAP_GET() macro.
+//
+// Internally the map is split into TMAP_NSHARD sub-maps ("shards"),
+// each with its own mutex; a key is hashed (std::hash) to one shard,
+// so threads working on different shards never touch the same lock.
+// Each shard also keeps a hashed timing wheel -- TMAP_WHEEL slots,
+// one second per slot, keyed by expiration time modulo TMAP_WHEEL --
+// so the reaper thread only visits the keys whose slot just came due
+// instead of scanning the whole map.  Eviction is O(1) amortized per
+// entry, and an expiry pass only stalls one shard at a time.
+//
+// The reaper sleeps until the earliest filed deadline (set() signals
+// it when an earlier one arrives) and goes fully dormant on an empty
+// map, so an idle map costs no wakeups and holds no dead entries.
+// Within a shard it evicts at most TMAP_REAP_BATCH entries per
+// critical section, reopening the lock between batches so writers
+// are never stalled behind a long purge.  evicted() reports how many
+// entries have been removed by expiry (by the reaper or on access).
+//
+// For caches backed by an expensive recomputation, get_or_load()
+// provides read-through loading with single-flight misses: the first
+// caller that misses a key runs the loader, and every concurrent
+// caller for the same key blocks on that one in-flight result
+// instead of recomputing it, so an expiry wakes the backing store
+// once rather than once per request.  See the method comment for the
+// optional stale-while-revalidate behavior.
 
 template <class K, class V>
 class timedmap {
@@ -107,10 +134,10 @@ class timedmap {
     }
   };
 
-  // This is the actual value type of the internal map, timedmap::map_;
+  // This is the actual value type of the internal maps, SHARD::map_;
   struct TMENT {
     V val_;                     // user provided value
-    boost::shared_ptr<Mutex> mtx_;
+    std::shared_ptr<Mutex> mtx_;
     time_t exp_;                // TMENT is invalid after exp_ (absolute time)
 
     TMENT(const TMENT &ent)
@@ -123,25 +150,113 @@ class timedmap {
     }
   };
 
-  boost::shared_ptr<Mutex> mtx_; // mutex that protects timedmap::map_
-  std::map<K,TMENT> map_;
-  int duration_;                // default lifetime of new element in seconds
+  // One in-flight loader run (get_or_load).  Everyone interested
+  // holds a shared_ptr, so the record outlives its loads_ slot.
+  struct FLIGHT {
+    pthread_mutex_t lck_;
+    pthread_cond_t cond_;
+    bool done_;
+    bool failed_;               // the loader threw
+    V val_;                     // valid once done_ && !failed_
+
+    FLIGHT() : done_(false), failed_(false), val_() {
+      pthread_mutex_init(&lck_, 0);
+      pthread_cond_init(&cond_, 0);
+    }
+    ~FLIGHT() {
+      pthread_cond_destroy(&cond_);
+      pthread_mutex_destroy(&lck_);
+    }
+  private:
+    FLIGHT(const FLIGHT &);
+    FLIGHT &operator=(const FLIGHT &);
+  };
 
   typedef typename std::map<K, TMENT> impl_type;
   typedef typename std::map<K, TMENT>::iterator impl_iter_type;
   typedef typename std::map<K, TMENT>::const_iterator impl_const_iter_type;
 
+  enum {
+    TMAP_NSHARD = 16,           // independently locked sub-maps
+    TMAP_WHEEL = 256,           // timing wheel slots (one second each)
+    TMAP_REAP_BATCH = 32,       // max evictions per critical section
+  };
+
+  // One independently locked slice of the key space, with its own
+  // expiry wheel.  wheel_[t % TMAP_WHEEL] holds the keys expiring at
+  // time T; stale wheel entries (erased or refreshed keys) are
+  // dropped or re-filed lazily when their slot comes due.
+  struct SHARD {
+    std::shared_ptr<Mutex> mtx_; // mutex that protects map_ and wheel_
+    std::map<K, TMENT> map_;
+    std::map<K, std::shared_ptr<FLIGHT> > loads_; // in-flight loaders
+    std::vector<K> wheel_[TMAP_WHEEL];
+    time_t wpos_;               // last wheel slot the reaper processed
+    unsigned long evicted_;     // entries removed by expiry
+
+    SHARD() : mtx_(new Mutex), map_(), loads_(), wpos_(time(0)), evicted_(0) {}
+  };
+
+  SHARD shards_[TMAP_NSHARD];
+  int duration_;                // default lifetime of new element in seconds
+
+  SHARD &shard_of(const K &k) {
+    return shards_[std::hash<K>()(k) % TMAP_NSHARD];
+  }
+  const SHARD &shard_of(const K &k) const {
+    return shards_[std::hash<K>()(k) % TMAP_NSHARD];
+  }
+
   timedmap(const timedmap &);
 
   template<typename K2, typename V2> friend class timedmap_getter;
 
   static void *reaper_main(void *arg);
+  static void reaper_unlock(void *arg) {
+    pthread_mutex_unlock((pthread_mutex_t *)arg);
+  }
+  bool reap_shard(SHARD &sh, time_t now, int budget);
   pthread_t reaper_;
 
+  pthread_mutex_t reap_lck_;    // protects next_exp_, pairs with reap_cond_
+  pthread_cond_t reap_cond_;
+  time_t next_exp_;             // earliest filed deadline; 0 = map idle
+
+  // Tell the reaper about a freshly filed deadline; wake it when the
+  // deadline beats whatever it is sleeping toward.
+  void note_deadline(time_t exp) {
+    pthread_mutex_lock(&reap_lck_);
+    if (next_exp_ == 0 || exp < next_exp_) {
+      next_exp_ = exp;
+      pthread_cond_signal(&reap_cond_);
+    }
+    pthread_mutex_unlock(&reap_lck_);
+  }
+
+  // Publish the outcome of a flight (V == 0 means the loader threw),
+  // wake the waiters and retire its loads_ slot.
+  void flight_finish(SHARD &sh, const K &k, std::shared_ptr<FLIGHT> fl,
+                     const V *v) {
+    pthread_mutex_lock(&fl->lck_);
+    if (v)
+      fl->val_ = *v;
+    else
+      fl->failed_ = true;
+    fl->done_ = true;
+    pthread_cond_broadcast(&fl->cond_);
+    pthread_mutex_unlock(&fl->lck_);
+
+    sh.mtx_->lock();
+    sh.loads_.erase(k);
+    sh.mtx_->unlock();
+  }
+
 public:
 
   explicit timedmap(int duration = 5)
-    : mtx_(new Mutex), map_(), duration_(duration) {
+    : duration_(duration), next_exp_(0) {
+    pthread_mutex_init(&reap_lck_, 0);
+    pthread_cond_init(&reap_cond_, 0);
 #ifndef NOREAP
     int ret = pthread_create(&reaper_, 0, reaper_main, (void *)this);
     if (ret != 0)
@@ -160,27 +275,131 @@ public:
     if (ret != 0)
       xerror(0, ret, "pthread_join failed");
 #endif  // NOREAP
+    pthread_cond_destroy(&reap_cond_);
+    pthread_mutex_destroy(&reap_lck_);
   }
 
   int duration() const { return duration_; }
 
   void set(const K &k, const V &v, int duration = 0) {
-    mtx_->lock();
+    SHARD &sh = shard_of(k);
+    time_t exp;
 
-    impl_iter_type i = map_.find(k);
+    sh.mtx_->lock();
 
-    if (i == map_.end()) {
-      map_[k] = TMENT(v, duration_);
+    impl_iter_type i = sh.map_.find(k);
 
-      mtx_->unlock();
+    if (i == sh.map_.end()) {
+      sh.map_[k] = TMENT(v, duration ? duration : duration_);
+
+      exp = sh.map_[k].exp_;
+      sh.wheel_[exp % TMAP_WHEEL].push_back(k);
+      sh.mtx_->unlock();
     }
     else {
       (*i).second.mtx_->lock();
-      mtx_->unlock();
 
       (*i).second.val_ = v;
       (*i).second.exp_ = time(0) + (duration ? duration : duration_);
+      exp = (*i).second.exp_;
+
+      // file the key under the new deadline, too; the old wheel
+      // entry becomes stale and is skipped when its slot comes due.
+      sh.wheel_[exp % TMAP_WHEEL].push_back(k);
+
       (*i).second.mtx_->unlock();
+      sh.mtx_->unlock();
+    }
+
+    note_deadline(exp);
+  }
+
+
+  // Read-through access with single-flight misses.
+  //
+  // A fresh hit returns a copy of the cached value.  On a miss the
+  // first caller registers the load and runs LOADER(key) outside
+  // every lock; concurrent callers for the same key block on that
+  // in-flight result instead of recomputing it.  The loaded value is
+  // stored with set(key, value, DURATION) before the waiters are
+  // released, so the dogpile after an expiry costs one loader run.
+  //
+  // If STALE is positive, an entry keeps serving for that many
+  // seconds past its expiry while a reload is in flight: the caller
+  // that notices the expiry runs the loader, and everyone arriving
+  // meanwhile is handed the stale value immediately instead of
+  // blocking (best effort -- the reaper may evict the stale entry
+  // first, in which case latecomers wait like ordinary missers).
+  //
+  // If the loader throws, the exception propagates to the caller
+  // that ran it; blocked waiters get std::runtime_error and may
+  // retry.  LOADER must not call back into this map with the same
+  // key, or it will deadlock behind its own flight.
+  template <class Loader>
+  V get_or_load(const K &k, Loader loader, int duration = 0, int stale = 0) {
+    SHARD &sh = shard_of(k);
+    time_t now = time(0);
+    bool have_stale = false;
+    V stale_val;
+
+    sh.mtx_->lock();
+
+    impl_iter_type i = sh.map_.find(k);
+    if (i != sh.map_.end()) {
+      TMENT &ent = (*i).second;
+
+      ent.mtx_->lock();
+      if (!(ent.exp_ < now)) {  // fresh hit; the common case
+        V v = ent.val_;
+        ent.mtx_->unlock();
+        sh.mtx_->unlock();
+        return v;
+      }
+      if (stale > 0 && !(ent.exp_ + stale < now)) {
+        have_stale = true;
+        stale_val = ent.val_;
+      }
+      ent.mtx_->unlock();
+      // the expired entry is left in place: it may still serve stale
+      // readers until the reload lands (or the reaper evicts it).
+    }
+
+    typename std::map<K, std::shared_ptr<FLIGHT> >::iterator fi
+      = sh.loads_.find(k);
+    if (fi != sh.loads_.end()) {
+      std::shared_ptr<FLIGHT> fl = (*fi).second;
+      sh.mtx_->unlock();
+
+      if (have_stale)           // a reload is already on its way
+        return stale_val;
+
+      pthread_mutex_lock(&fl->lck_);
+      while (!fl->done_)
+        pthread_cond_wait(&fl->cond_, &fl->lck_);
+      bool failed = fl->failed_;
+      V v = fl->val_;
+      pthread_mutex_unlock(&fl->lck_);
+
+      if (failed)
+        throw std::runtime_error("timedmap: loader failed");
+      return v;
+    }
+
+    // we are the first misser; the load is ours to run
+    std::shared_ptr<FLIGHT> fl(new FLIGHT);
+    sh.loads_[k] = fl;
+    sh.mtx_->unlock();
+
+    try {
+      V v = loader(k);
+
+      set(k, v, duration);      // waiters released only after this lands
+      flight_finish(sh, k, fl, &v);
+      return v;
+    }
+    catch (...) {
+      flight_finish(sh, k, fl, (const V *)0);
+      throw;
     }
   }
 
@@ -198,25 +417,29 @@ public:
   public:
     explicit timedmap_getter(timedmap<K, V> &tmap, const K &key, int duration)
       : ent_(0), once_(true), duration_(duration) {
-      tmap.mtx_->lock();
-      iter_ = tmap.map_.find(key);
+      SHARD &sh = tmap.shard_of(key);
 
-      if (iter_ != tmap.map_.end()) {
+      sh.mtx_->lock();
+      iter_ = sh.map_.find(key);
+
+      if (iter_ != sh.map_.end()) {
         ent_ = &((*iter_).second);
         ent_->mtx_->lock();
 
         if (ent_->exp_ < time(0)) {
-          // remove the entry;
+          // remove the entry; the stale wheel entry is dropped when
+          // its slot comes due.
           ent_->mtx_->unlock();
-          tmap.map_.erase(iter_);
+          sh.map_.erase(iter_);
+          sh.evicted_++;
 
           ent_ = 0;
         }
 
-        tmap.mtx_->unlock();
+        sh.mtx_->unlock();
       }
       else {
-        tmap.mtx_->unlock();
+        sh.mtx_->unlock();
       }
     }
 
@@ -262,30 +485,50 @@ public:
   typedef typename impl_type::size_type size_type;
 
   size_type size() const {
-    mtx_->lock();
-    size_type sz = map_.size();
-    mtx_->unlock();
+    size_type sz = 0;
+
+    for (int n = 0; n < TMAP_NSHARD; n++) {
+      shards_[n].mtx_->lock();
+      sz += shards_[n].map_.size();
+      shards_[n].mtx_->unlock();
+    }
     return sz;
   }
 
+  // Total number of entries removed because their life-time expired,
+  // whether by the reaper or on access.
+  unsigned long evicted() const {
+    unsigned long n = 0;
+
+    for (int i = 0; i < TMAP_NSHARD; i++) {
+      shards_[i].mtx_->lock();
+      n += shards_[i].evicted_;
+      shards_[i].mtx_->unlock();
+    }
+    return n;
+  }
+
   void erase(const K &k) {
-    mtx_->lock();
-    impl_iter_type i = map_.find(k);
-    if (i != map_.end()) {
+    SHARD &sh = shard_of(k);
+
+    sh.mtx_->lock();
+    impl_iter_type i = sh.map_.find(k);
+    if (i != sh.map_.end()) {
       TMENT &ent = (*i).second;
       ent.mtx_->lock();
       ent.mtx_->unlock();
-      map_.erase(i);
+      sh.map_.erase(i);
     }
-    mtx_->unlock();
+    sh.mtx_->unlock();
   }
 
   bool exist(const K &k) const {
     bool ret = false;
+    const SHARD &sh = shard_of(k);
 
-    mtx_->lock();
-    impl_const_iter_type i = map_.find(k);
-    if (i != map_.end()) {
+    sh.mtx_->lock();
+    impl_const_iter_type i = sh.map_.find(k);
+    if (i != sh.map_.end()) {
       const TMENT &ent = (*i).second;
       ent.mtx_->lock();
 
@@ -293,11 +536,11 @@ public:
         ret = true;
 
       ent.mtx_->unlock();
-      mtx_->unlock();
+      sh.mtx_->unlock();
 
       return ret;
     }
-    mtx_->unlock();
+    sh.mtx_->unlock();
 
     return ret;
   }
@@ -310,6 +553,67 @@ public:
 };
 
 
+// Process the wheel slots of SH that came due since the last pass,
+// evicting at most BUDGET entries.  Only the keys filed in those
+// slots are visited; everything else in the shard is left untouched.
+// Returns true when the budget ran out with due work remaining, so
+// the caller can reopen the lock between batches.  SH's mutex must
+// be held.
+template <class K, class V>
+bool
+timedmap<K, V>::reap_shard(SHARD &sh, time_t now, int budget)
+{
+  if (now - sh.wpos_ > TMAP_WHEEL)
+    sh.wpos_ = now - TMAP_WHEEL; // a full turn covers every slot once
+
+  while (sh.wpos_ < now) {
+    sh.wpos_++;
+
+    std::vector<K> &slot = sh.wheel_[sh.wpos_ % TMAP_WHEEL];
+    std::vector<K> keep;
+
+    for (size_t n = 0; n < slot.size(); n++) {
+      if (budget <= 0) {
+        // batch is full; keep the unprocessed tail and park on this
+        // slot so the next batch resumes where we stopped.
+        for (size_t m = n; m < slot.size(); m++)
+          keep.push_back(slot[m]);
+        slot.swap(keep);
+        sh.wpos_--;
+        return true;
+      }
+
+      impl_iter_type i = sh.map_.find(slot[n]);
+
+      if (i == sh.map_.end())
+        continue;               // stale; erased in the meantime
+
+      TMENT &ent = (*i).second;
+
+      if (ent.exp_ > now) {
+        // refreshed, or a full wheel turn away; re-file it.
+        time_t dst = ent.exp_ % TMAP_WHEEL;
+        if (dst == sh.wpos_ % TMAP_WHEEL)
+          keep.push_back(slot[n]);
+        else
+          sh.wheel_[dst].push_back(slot[n]);
+      }
+      else if (ent.mtx_->trylock()) {
+        ent.mtx_->unlock();
+        xdebug(0, "reaper: remove key, %d", (*i).first);
+        sh.map_.erase(i);
+        sh.evicted_++;
+        budget--;
+      }
+      else                      // locked elsewhere; retry next tick
+        sh.wheel_[(sh.wpos_ + 1) % TMAP_WHEEL].push_back(slot[n]);
+    }
+    slot.swap(keep);
+  }
+  return false;
+}
+
+
 template <class K, class V>
 void *
 timedmap<K, V>::reaper_main(void *arg)
@@ -324,34 +628,60 @@ timedmap<K, V>::reaper_main(void *arg)
     xerror(0, ret, "pthread_setcanceltype failed");
 
   while (1) {
-    // TODO: cancel state
+    time_t now = time(0);
+    time_t wake;
+    struct timespec ts;
+
+    // Sleep toward the earliest filed deadline.  With an idle map
+    // (next_exp_ == 0) wait until set() signals a new deadline; the
+    // TMAP_WHEEL cap merely bounds the nap.
+    pthread_mutex_lock(&tmap->reap_lck_);
+    if (tmap->next_exp_ == 0)
+      wake = now + TMAP_WHEEL;
+    else if (tmap->next_exp_ > now)
+      wake = tmap->next_exp_;
+    else
+      wake = now + 1;           // due work; stay on one-slot cadence
+    ts.tv_sec = wake;
+    ts.tv_nsec = 0;
+
     pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &cstate);
-    sleep(tmap->duration_ * 2);
+    pthread_cleanup_push(reaper_unlock, (void *)&tmap->reap_lck_);
+    pthread_cond_timedwait(&tmap->reap_cond_, &tmap->reap_lck_, &ts);
+    pthread_cleanup_pop(1);     // unlocks reap_lck_
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cstate);
 
-    if (tmap->mtx_->trylock()) {
-      // this loop will traverse all elements in timedmap::map_,
-      // since, the traversal will be done with the mutex locked, it
-      // should be finished ASAP.
-      xdebug(0, "reaper: harvesting begin");
-      typename timedmap::impl_iter_type i = tmap->map_.begin();
-      while (i != tmap->map_.end()) {
-        TMENT &ent = (*i).second;
-        if (ent.mtx_->trylock()) {
-          if (ent.exp_ < time(0)) {
-            ent.mtx_->unlock();
-            xdebug(0, "reaper: remove key, %d", (*i).first);
-            tmap->map_.erase(i++);
-          }
-          else
-            ent.mtx_->unlock();
+    now = time(0);
+    bool idle = true;
+    time_t serviced;            // deadline this pass is acting on
+
+    pthread_mutex_lock(&tmap->reap_lck_);
+    serviced = tmap->next_exp_;
+    pthread_mutex_unlock(&tmap->reap_lck_);
+
+    for (int n = 0; n < TMAP_NSHARD; n++) {
+      SHARD &sh = tmap->shards_[n];
+
+      if (sh.mtx_->trylock()) {
+        while (tmap->reap_shard(sh, now, TMAP_REAP_BATCH)) {
+          // reopen the shard so writers can slip in between batches
+          sh.mtx_->unlock();
+          sh.mtx_->lock();
         }
-        else           // the element is locked in elsewhere, skipped.
-          i++;
+        if (!sh.map_.empty())
+          idle = false;
+        sh.mtx_->unlock();
       }
-      tmap->mtx_->unlock();
-      xdebug(0, "reaper: harvesting end");
+      else
+        idle = false;           // busy shard; assume it has entries
     }
+
+    pthread_mutex_lock(&tmap->reap_lck_);
+    if (idle && tmap->next_exp_ == serviced)
+      tmap->next_exp_ = 0;      // dormant until the next set()
+    else if (!idle && tmap->next_exp_ <= now)
+      tmap->next_exp_ = now + 1; // live entries remain; keep ticking
+    pthread_mutex_unlock(&tmap->reap_lck_);
   }
   return 0;
 }
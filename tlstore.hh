@@ -7,7 +7,13 @@
 #include <string.h>
 #include "xerror.h"
 
-const std::string error_string(int errnum)
+#if __cplusplus >= 201103L
+// With C++11, get() reads a compiled thread_local slot -- one
+// TLS-relative load -- instead of calling pthread_getspecific().
+# define TLSTORE_HAVE_TLS       1
+#endif
+
+static inline const std::string error_string(int errnum)
 {
   char buf[BUFSIZ];
   if (strerror_r(errnum, buf, BUFSIZ) == 0)
@@ -24,35 +30,190 @@ class tlstore {
   pthread_key_t key_;
   T *tls_;
 
+#ifdef TLSTORE_HAVE_TLS
+  // Each tlstore<T> instance owns one slot of a fixed thread_local
+  // array, so get() is just slots_[id_].  The pthread key is still
+  // registered on every reset(), but only so that delete_key() runs
+  // at thread exit; it is never consulted on the fast path.  If more
+  // than TLSTORE_MAX instances of one T exist, the extra ones fall
+  // back to pthread_getspecific().
+  enum { TLSTORE_MAX = 64 };
+  int id_;
+  static int nslots_;
+  static thread_local T *slots_[TLSTORE_MAX];
+#endif
+
   static void delete_key(void *p) {
     T *tlsp = (T *)p;
     delete tlsp;
   }
 
+  // Registry mode (enable_registry): every thread's instance is also
+  // linked on this list, so a reader thread can visit all of them
+  // (for_each) without signaling the owners -- the usual shape for
+  // per-thread statistics counters.  In this mode the pthread key
+  // holds the NODE instead of the bare T; the key destructor unlinks
+  // the node at thread exit, folds the dying instance into the
+  // accumulator if one was given, and then deletes the T as before.
+  struct NODE {
+    tlstore *owner_;
+    T *val_;
+    NODE *prev_;
+    NODE *next_;
+  };
+
+  bool reg_;
+  NODE *head_;                  // live per-thread instances
+  T *acc_;                      // where exited threads' values fold into
+  void (*fold_)(T &acc, const T &dying);
+  pthread_mutex_t reg_lck_;     // guards head_ and acc_
+
+  static void delete_key_reg(void *p) {
+    NODE *n = (NODE *)p;
+    n->owner_->retire(n);
+  }
+
+  // Unlink N, fold its value into the accumulator, release it.
+  void retire(NODE *n) {
+    pthread_mutex_lock(&reg_lck_);
+    if (n->prev_)
+      n->prev_->next_ = n->next_;
+    else
+      head_ = n->next_;
+    if (n->next_)
+      n->next_->prev_ = n->prev_;
+    if (acc_ && fold_)
+      fold_(*acc_, *n->val_);
+    pthread_mutex_unlock(&reg_lck_);
+
+    delete n->val_;
+    delete n;
+  }
+
+  void reset_reg(T *newval) {
+    NODE *old = (NODE *)pthread_getspecific(key_);
+    NODE *n = 0;
+
+    if (newval) {
+      n = new NODE;
+      n->owner_ = this;
+      n->val_ = newval;
+
+      pthread_mutex_lock(&reg_lck_);
+      n->prev_ = 0;
+      n->next_ = head_;
+      if (head_)
+        head_->prev_ = n;
+      head_ = n;
+      pthread_mutex_unlock(&reg_lck_);
+    }
+
+#ifdef TLSTORE_HAVE_TLS
+    if (id_ >= 0)
+      slots_[id_] = newval;
+#endif
+
+    int ret = pthread_setspecific(key_, (void *)n);
+    if (ret)
+      throw std::runtime_error(error_string(ret));
+
+    if (old)
+      retire(old);              // a replaced instance folds like an exit
+  }
+
   tlstore(const tlstore &);
 
 public:
-  tlstore() {
+  tlstore() : reg_(false), head_(0), acc_(0), fold_(0) {
     int ret = pthread_key_create(&key_, delete_key);
     if (ret)
       throw std::runtime_error(error_string(ret));
+    pthread_mutex_init(&reg_lck_, 0);
+
+#ifdef TLSTORE_HAVE_TLS
+    id_ = __sync_fetch_and_add(&nslots_, 1);
+    if (id_ >= (int)TLSTORE_MAX)
+      id_ = -1;                 // out of slots; use the key only
+#endif
   }
 
   ~tlstore() {
     int ret = pthread_key_delete(key_);
     if (ret)
       xerror(0, ret, "pthread_key_delete() failed");
+    pthread_mutex_destroy(&reg_lck_);
+  }
+
+  // Turn on registry mode.  Must be called once, before any thread
+  // calls reset() on this store; reset() then registers the thread's
+  // instance so that for_each() can reach it.
+  //
+  // If ACC and FOLD are given, FOLD(*ACC, dying) runs whenever a
+  // registered thread exits (or replaces its instance), so counts
+  // from exited threads are retained; ACC stays owned by the caller
+  // and is visited last by for_each().  Without an accumulator an
+  // exiting thread simply takes its values with it.
+  void enable_registry(T *acc = 0, void (*fold)(T &, const T &) = 0) {
+    int ret = pthread_key_delete(key_);
+    if (ret)
+      throw std::runtime_error(error_string(ret));
+    ret = pthread_key_create(&key_, delete_key_reg);
+    if (ret)
+      throw std::runtime_error(error_string(ret));
+
+    reg_ = true;
+    acc_ = acc;
+    fold_ = fold;
+  }
+
+  // Visit every live thread's instance, then the accumulator (if
+  // any), calling F on each; the registry lock is held throughout,
+  // so instances cannot disappear mid-walk.  The owners keep
+  // mutating their instances unsynchronized while F reads them --
+  // that is the point (no stop-the-world) -- so sums over word-sized
+  // counters are approximate-but-consistent-enough, the usual
+  // statistics contract.  Returns F, like std::for_each, so a
+  // summing functor gets its totals back to the caller.
+  template <class F>
+  F for_each(F f) {
+    pthread_mutex_lock(&reg_lck_);
+    for (NODE *n = head_; n != 0; n = n->next_)
+      f(*(const T *)n->val_);
+    if (acc_)
+      f(*(const T *)acc_);
+    pthread_mutex_unlock(&reg_lck_);
+    return f;
   }
 
   T *get() {
+#ifdef TLSTORE_HAVE_TLS
+    if (id_ >= 0)
+      return slots_[id_];
+#endif
+    if (reg_) {
+      NODE *n = (NODE *)pthread_getspecific(key_);
+      return n ? n->val_ : 0;
+    }
     return (T *)pthread_getspecific(key_);
   }
 
   void reset(T *newval) {
-    void *p = pthread_getspecific(key_);
+    if (reg_) {
+      reset_reg(newval);
+      return;
+    }
+
+    T *p = get();
     if (p)
       delete_key(p);
 
+#ifdef TLSTORE_HAVE_TLS
+    if (id_ >= 0)
+      slots_[id_] = newval;
+#endif
+
+    // still recorded in the key, so that delete_key() runs on
+    // thread exit.
     int ret = pthread_setspecific(key_, (void *)newval);
     if (ret)
       throw std::runtime_error(error_string(ret));
@@ -68,4 +229,12 @@ public:
   const T &operator*() const  { return *get(); }
 };
 
+#ifdef TLSTORE_HAVE_TLS
+template <class T>
+int tlstore<T>::nslots_ = 0;
+
+template <class T>
+thread_local T *tlstore<T>::slots_[tlstore<T>::TLSTORE_MAX];
+#endif
+
 #endif  /* TLSTORE_HH__ */
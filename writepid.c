@@ -94,6 +94,7 @@ writepid(const char *pathname, pid_t pid)
 #include <errno.h>
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <libgen.h>
 
@@ -139,15 +140,18 @@ writepid_unlink(void)
 }
 
 
-int
-writepid(const char *pidfile, pid_t pid, int no_atexit)
+/*
+ * Create the directory component of PIDFILE via
+ * writepid_mkdir_template.  Returns zero, or -1 with errno set.
+ */
+static int
+writepid_mkdirs(const char *pidfile)
 {
   // Warning: PIDFILE must be canonicalized pathname.
   int ret = -1;
-  int saved_errno;
+  int saved_errno = errno;
   char *cmdline = 0;
   char *dname, *dname_ = strdup(pidfile);
-  FILE *fp;
 
   if (!dname_)
     return -1;
@@ -164,13 +168,15 @@ writepid(const char *pidfile, pid_t pid, int no_atexit)
   }
 
   ret = system(cmdline);
+  free(cmdline);
   if (ret == -1 || ret == 127) {
     saved_errno = errno;
-    free(cmdline);
     goto err;
   }
-  else if (WIFEXITED(ret) && WEXITSTATUS(ret) == 0)
-    ;                           /* pass */
+  else if (WIFEXITED(ret) && WEXITSTATUS(ret) == 0) {
+    free(dname_);
+    return 0;
+  }
   else {
 #ifdef XERROR
     if (WIFSIGNALED(ret))
@@ -178,14 +184,25 @@ writepid(const char *pidfile, pid_t pid, int no_atexit)
     else if (WIFEXITED(ret))
       xdebug(errno, "system(3): nonzero exit status %d", WEXITSTATUS(ret));
 #endif  /* XERROR */
-
     saved_errno = errno;
-    free(cmdline);
     goto err;
   }
 
+ err:
+  free(dname_);
+  errno = saved_errno;
+  return -1;
+}
 
-  free(cmdline);
+
+int
+writepid(const char *pidfile, pid_t pid, int no_atexit)
+{
+  int saved_errno;
+  FILE *fp;
+
+  if (writepid_mkdirs(pidfile) == -1)
+    return -1;
 
   fp = fopen(pidfile, "w");
   if (!fp) {
@@ -223,12 +240,118 @@ writepid(const char *pidfile, pid_t pid, int no_atexit)
   return 0;
 
  err:
-  free(dname_);
   errno = saved_errno;
   return -1;
 }
 
 
+int
+writepid_lock(const char *pathname, pid_t pid)
+{
+  struct flock fl;
+  char buf[32];
+  int fd, len, saved_errno;
+
+  if (writepid_mkdirs(pathname) == -1)
+    return -1;
+
+  fd = open(pathname, O_RDWR | O_CREAT | O_CLOEXEC,
+            S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd == -1)
+    return -1;
+
+  memset(&fl, 0, sizeof(fl));
+  fl.l_type = F_WRLCK;
+  fl.l_whence = SEEK_SET;
+
+  if (fcntl(fd, F_SETLK, &fl) == -1) {
+    saved_errno = (errno == EACCES || errno == EAGAIN) ? EBUSY : errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+
+  /* the lock is the source of truth; the contents are for humans and
+   * legacy readers */
+  if (pid == (pid_t)-1)
+    pid = getpid();
+  len = snprintf(buf, sizeof(buf), "%d\n", (int)pid);
+
+  if (ftruncate(fd, 0) == -1 || write(fd, buf, len) != len) {
+    saved_errno = errno;
+    close(fd);                  /* releases the lock, too */
+    errno = saved_errno;
+    return -1;
+  }
+
+  return fd;
+}
+
+
+pid_t
+writepid_check(const char *pathname)
+{
+  struct flock fl;
+  int fd, saved_errno;
+
+  fd = open(pathname, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return (errno == ENOENT) ? 0 : -1;
+
+  memset(&fl, 0, sizeof(fl));
+  fl.l_type = F_WRLCK;
+  fl.l_whence = SEEK_SET;
+
+  if (fcntl(fd, F_GETLK, &fl) == -1) {
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+  close(fd);
+
+  return (fl.l_type == F_UNLCK) ? 0 : fl.l_pid;
+}
+
+
+int
+writepid_lock_slot(const char *format, int nslots, pid_t pid, int *fdp)
+{
+  char *pathname;
+  int i, fd, start;
+
+  if (nslots <= 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* starting at a pid-derived slot spreads a restarting fleet over
+   * the slot space, so N workers do not all fight over slot 0 */
+  start = (int)(getpid() % nslots);
+
+  for (i = 0; i < nslots; i++) {
+    int slot = (start + i) % nslots;
+
+    if (asprintf(&pathname, format, slot) == -1)
+      return -1;
+
+    fd = writepid_lock(pathname, pid);
+    free(pathname);
+
+    if (fd != -1) {
+      if (fdp)
+        *fdp = fd;
+      return slot;
+    }
+    if (errno != EBUSY)
+      return -1;
+  }
+
+  errno = EBUSY;
+  return -1;
+}
+
+
 #ifdef TEST_WRITEPID
 #define SLEEP_INTERVAL  5
 
@@ -237,12 +360,32 @@ char *writepid_mkdir_template = "echo Ahhhhhhhhh";
 int
 main(int argc, char *argv[])
 {
-  if (argc != 2) {
-    fprintf(stderr, "usage: %s PIDFILE\n", argv[0]);
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s PIDFILE [lock|check|slot NSLOTS]\n", argv[0]);
     return 1;
   }
 
-  fprintf(stderr, "writepid returns %d\n", writepid(argv[1], -1, 0));
+  if (argc >= 3 && strcmp(argv[2], "lock") == 0) {
+    int fd = writepid_lock(argv[1], -1);
+    fprintf(stderr, "writepid_lock returns %d\n", fd);
+    if (fd == -1)
+      return 1;
+  }
+  else if (argc >= 3 && strcmp(argv[2], "check") == 0) {
+    fprintf(stderr, "writepid_check returns %d\n",
+            (int)writepid_check(argv[1]));
+    return 0;
+  }
+  else if (argc >= 4 && strcmp(argv[2], "slot") == 0) {
+    int fd = -1;
+    int slot = writepid_lock_slot(argv[1], atoi(argv[3]), -1, &fd);
+    fprintf(stderr, "writepid_lock_slot returns %d (fd %d)\n", slot, fd);
+    if (slot == -1)
+      return 1;
+  }
+  else
+    fprintf(stderr, "writepid returns %d\n", writepid(argv[1], -1, 0));
+
   fprintf(stderr, "sleeping %d second(s)...\n", SLEEP_INTERVAL);
   sleep(SLEEP_INTERVAL);
   return 0;
@@ -77,6 +77,53 @@ extern void writepid_unlink(void);
  */
 extern char *writepid_mkdir_template;
 
+/*
+ * Lock-based pidfile.
+ *
+ * writepid() above records liveness only as file contents; a checker
+ * has to parse the pid and signal it, which costs a file parse per
+ * check and races against pid reuse.  writepid_lock() records it as
+ * an fcntl(2) write lock instead: the holder keeps the lock for its
+ * whole life (the kernel drops it on any kind of exit), and a checker
+ * learns liveness from a single lock query -- O(1) and race-free.
+ * The pid is still written into the file for humans and legacy
+ * readers.
+ *
+ * On success it returns the locked file descriptor, which must stay
+ * open for the lifetime of the process (closing it releases the
+ * lock).  If another process holds the lock, it returns -1 with
+ * errno set to EBUSY; other failures return -1 with errno from the
+ * failing call.  If PID is -1, the current process ID is used.
+ *
+ * No atexit(3) unlink is registered: with the lock as the source of
+ * truth, a leftover file is harmless.
+ */
+extern int writepid_lock(const char *pathname, pid_t pid);
+
+/*
+ * Return the pid of the process holding the lock on PATHNAME, zero
+ * if no process holds it (or the file does not exist), or -1 with
+ * errno set on error.  Costs one open(2) and one fcntl(2).
+ */
+extern pid_t writepid_check(const char *pathname);
+
+/*
+ * Claim one of NSLOTS slot files for an identical-worker fleet.
+ *
+ * FORMAT is a printf(3) format with one %d/%u conversion for the slot
+ * number (e.g. "/var/run/worker.%d.pid"); slots are numbered 0 ..
+ * NSLOTS-1.  Each slot is tried with one non-blocking
+ * writepid_lock(), starting at a pid-derived offset so that N workers
+ * restarting together spread over the slots instead of all colliding
+ * on slot 0 and retrying.
+ *
+ * On success, the claimed slot number is returned and *FDP (if
+ * non-null) receives the locked descriptor, to be kept open for life.
+ * If every slot is held, it returns -1 with errno set to EBUSY.
+ */
+extern int writepid_lock_slot(const char *format, int nslots, pid_t pid,
+                              int *fdp);
+
 END_C_DECLS
 
 #endif  /* WRITEPID_H__ */
@@ -34,6 +34,7 @@
 #include <stdint.h>
 
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -75,6 +76,7 @@
 
 #ifdef __linux__
 #include <sys/syscall.h>
+#include <link.h>
 #endif
 
 #define BACKTRACE_MAX   16
@@ -104,11 +106,23 @@ pthread_mutex_t xerror_mutex = PTHREAD_MUTEX_INITIALIZER;
 #define UNLOCK()        ((void)0)
 #endif  /* _PTHREAD */
 
-static int xerror_bt_filep = 0;
 static char *xerror_bt_filename = 0;
 static char *xerror_bt_command = 0;
+
+/*
+ * Crash fast path: the dump fd is opened and the header line is
+ * formatted at registration time, so bt_handler() only does
+ * backtrace(3) into a static buffer and raw write(2)s -- no open(2)
+ * on the crash path, no allocation, no stdio.
+ */
+static int xerror_bt_fd = -1;
+static char xerror_bt_header[128];
+static size_t xerror_bt_header_len = 0;
 static void bt_handler(int signo, siginfo_t *info, void *uctx_void);
 static void bt_handler_gdb(int signo, siginfo_t *info, void *uctx_void);
+#ifdef __linux__
+static void btsym_init(void);
+#endif
 
 static int get_tid(void);
 
@@ -121,6 +135,72 @@ static void ign_free(void);
 static void xerror_finalize(void) __attribute__((destructor));
 static char *find_executable(const char *exe);
 
+/*
+ * Asynchronous mode: producers format the whole line and push it into
+ * ASYNC_RING, a bounded MPSC ring with per-slot sequence numbers, so
+ * they never touch stdio.  A flusher thread drains the ring in
+ * batches.  When the ring is full the record is counted in
+ * ASYNC_DROPPED and discarded; memory stays bounded.
+ */
+#ifdef _PTHREAD
+#define ASYNC_SLOTS     256     /* power of two */
+#define ASYNC_RECMAX    512
+
+struct async_rec {
+  unsigned seq;
+  unsigned short len;
+  char data[ASYNC_RECMAX];
+};
+
+static struct async_rec async_ring[ASYNC_SLOTS];
+static unsigned async_epos;     /* enqueue ticket */
+static unsigned async_dpos;     /* dequeue ticket (flusher only) */
+static unsigned long async_dropped;
+static int async_mode;
+static int async_stop;
+static pthread_t async_flusher_thread;
+
+static int async_push(const char *buf, size_t len);
+static void async_flush(void);
+static void *async_flusher(void *unused);
+#endif  /* _PTHREAD */
+
+static size_t xmessage_format(char *buf, size_t size, int progname, int code,
+                              int show_tid, const char *format, va_list ap);
+static void xmessage_raw(const char *buf, size_t len);
+
+/*
+ * Duplicate suppression: a small direct-mapped table of recently seen
+ * records, keyed by a hash of the fully rendered line (so the
+ * arguments take part, not just the format).  Every distinct record
+ * owns a token bucket holding SUP_BURST tokens refilled over
+ * SUP_WINDOW msec; a record with tokens left is printed immediately
+ * (first occurrences are never delayed), one without is counted and
+ * dropped, and the count is flushed as "last message repeated N
+ * times" as soon as its record is printable again (or at exit).
+ * Token arithmetic is kept in window-msec units to stay integral.
+ */
+#define SUP_SLOTS       64      /* power of two */
+#define SUP_RECMAX      512
+#define SUP_REPMAX      160
+
+struct sup_ent {
+  unsigned long hash;           /* 0 = empty slot */
+  unsigned pending;             /* suppressed since the last print */
+  long avail;                   /* tokens, in units of sup_window msec */
+  long stamp;                   /* last refill, msec */
+};
+
+static struct sup_ent sup_tab[SUP_SLOTS];
+static int sup_window;          /* msec; zero = suppression disabled */
+static int sup_burst = 1;
+static unsigned long sup_total;
+static int sup_lck;
+
+static int sup_allow(const char *buf, size_t len,
+                     char *rep, size_t repsize, size_t *replen);
+static void sup_flush(void);
+
 
 static __inline__ FILE *
 xerror_redirect_unlocked(FILE *fp)
@@ -243,19 +323,37 @@ xbacktrace_on_signals(int signo, ...)
   if (getenv("XBACKTRACE") == 0)
     return 0;
 
+#ifdef __linux__
+  /* in case the caller skipped xerror_init() */
+  btsym_init();
+#endif
+
   free(xerror_bt_filename);
   free(xerror_bt_command);
 
-  if (file) {
+  if (file)
     asprintf(&xerror_bt_filename, "%s.%d", file, (int)getpid());
-    xerror_bt_filep = 1;
-  }
   else
     asprintf(&xerror_bt_filename, "backtrace.%d", (int)getpid());
 
   asprintf(&xerror_bt_command, "backtrace -w -o %s %d",
            xerror_bt_filename, (int)getpid());
 
+  /* pre-open the dump file and pre-format the header so that the
+   * handler needs nothing but write(2). */
+  if (xerror_bt_fd != -1)
+    close(xerror_bt_fd);
+  xerror_bt_fd = open(xerror_bt_filename,
+                      O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  if (xerror_bt_fd == -1)
+    xerror(0, errno, "can't pre-open the backtrace file, %s",
+           xerror_bt_filename);
+
+  xerror_bt_header_len = snprintf(xerror_bt_header, sizeof(xerror_bt_header),
+                                  "%s (pid %d) ",
+                                  program_name ? program_name : "?",
+                                  (int)getpid());
+
 #ifdef USE_ALTSTACK
   /* Why uses SIGSTKSZ * 2? -- Don't know why, but segfault.c in glibc
    * uses it -- cinsk */
@@ -313,8 +411,10 @@ xerror(int status, int code, const char *format, ...)
   xmessage(!printtid_mode, code, 0, printtid_mode, format, ap);
   va_end(ap);
 
-  if (status)
+  if (status) {
+    xerror_async(0);            /* drain any pending async records */
     exit(status);
+  }
 }
 
 
@@ -361,6 +461,37 @@ xmessage(int progname, int code, int ignore, int show_tid,
       return;
   }
 
+  if (sup_window) {
+    char out[SUP_RECMAX], rep[SUP_REPMAX];
+    size_t len, replen = 0;
+    va_list aq;
+
+    va_copy(aq, ap);
+    len = xmessage_format(out, sizeof(out), progname, code, show_tid,
+                          format, aq);
+    va_end(aq);
+
+    if (!sup_allow(out, len, rep, sizeof(rep), &replen)) {
+      errno = saved_errno;
+      return;
+    }
+    if (replen)
+      xmessage_raw(rep, replen);
+  }
+
+#ifdef _PTHREAD
+  if (__atomic_load_n(&async_mode, __ATOMIC_ACQUIRE)) {
+    char out[ASYNC_RECMAX];
+    size_t len;
+
+    len = xmessage_format(out, sizeof(out), progname, code, show_tid,
+                          format, ap);
+    async_push(out, len);
+    errno = saved_errno;
+    return;
+  }
+#endif  /* _PTHREAD */
+
   LOCK();
 
 #ifdef _PTHREAD
@@ -428,6 +559,381 @@ xmessage(int progname, int code, int ignore, int show_tid,
 }
 
 
+/*
+ * Render the same line xmessage() would print into BUF, returning the
+ * number of byte(s) used (including the trailing newline, excluding
+ * any null character).  Long messages are truncated.
+ */
+static size_t
+xmessage_format(char *buf, size_t size, int progname, int code,
+                int show_tid, const char *format, va_list ap)
+{
+  char errbuf[BUFSIZ];
+  size_t off = 0;
+  int n;
+
+  if (progname) {
+    if (program_name)
+      off += snprintf(buf + off, size - off, "%s: ", program_name);
+  }
+  else if (show_tid) {
+    const char *tname = xthread_get_name(errbuf, BUFSIZ);
+    if (!tname || tname[0] == '\0')
+      tname = "T";
+    off += snprintf(buf + off, size - off, "%s-%u: ", tname, get_tid());
+  }
+  if (off >= size)
+    off = size - 1;
+
+  n = vsnprintf(buf + off, size - off, format, ap);
+  if (n > 0)
+    off += n;
+  if (off >= size)
+    off = size - 1;
+
+  if (code) {
+#if defined(_GNU_SOURCE) && !defined(__APPLE__)
+    off += snprintf(buf + off, size - off, ": (errno=%d) %s",
+                    code, strerror_r(code, errbuf, BUFSIZ));
+#else
+    errno = 0;
+    if (strerror_r(code, errbuf, BUFSIZ) == 0)
+      off += snprintf(buf + off, size - off, ": (errno=%d) %s", code, errbuf);
+    else if (errno == ERANGE)
+      off += snprintf(buf + off, size - off, ": [xerror] invalid error code");
+    else
+      off += snprintf(buf + off, size - off,
+                      ": [xerror] strerror_r(3) failed (errno=%d)", errno);
+#endif  /* _GNU_SOURCE */
+    if (off >= size)
+      off = size - 1;
+  }
+
+  if (off >= size)
+    off = size - 1;
+  buf[off++] = '\n';
+
+  return off;
+}
+
+
+/*
+ * Emit an already-rendered record through whatever path is active:
+ * the async ring in asynchronous mode, the output stream otherwise.
+ */
+static void
+xmessage_raw(const char *buf, size_t len)
+{
+#ifdef _PTHREAD
+  if (__atomic_load_n(&async_mode, __ATOMIC_ACQUIRE)) {
+    async_push(buf, len);
+    return;
+  }
+#endif  /* _PTHREAD */
+
+  LOCK();
+  if (xerror_stream == (FILE *)-1) {
+    if (stderr != NULL)
+      xerror_redirect_unlocked(stderr);
+    else {
+      UNLOCK();
+      return;
+    }
+  }
+  if (xerror_stream)
+    fwrite(buf, 1, len, xerror_stream);
+  UNLOCK();
+}
+
+
+static __inline__ long
+sup_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+
+static size_t
+sup_repline(char *buf, size_t size, unsigned count)
+{
+  size_t off = 0;
+
+  if (program_name)
+    off += snprintf(buf, size, "%s: ", program_name);
+  off += snprintf(buf + off, size - off,
+                  "last message repeated %u times\n", count);
+  return off;
+}
+
+
+/*
+ * Decide whether the rendered record (BUF, LEN) may be printed.
+ * Returns nonzero if so; if a "repeated N times" line must be printed
+ * first, it is rendered into REP and *REPLEN is set.
+ */
+static int
+sup_allow(const char *buf, size_t len,
+          char *rep, size_t repsize, size_t *replen)
+{
+  unsigned long h = 2166136261UL;
+  struct sup_ent *e;
+  long now, full;
+  size_t i;
+  int allowed;
+
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char)buf[i];
+    h *= 16777619UL;
+  }
+  if (h == 0)
+    h = 1;
+
+  while (__atomic_exchange_n(&sup_lck, 1, __ATOMIC_ACQUIRE))
+    ;
+
+  e = &sup_tab[h & (SUP_SLOTS - 1)];
+  now = sup_now();
+  full = (long)sup_burst * sup_window;
+
+  if (e->hash != h) {
+    /* evicting a colliding record; don't lose its count */
+    if (e->hash != 0 && e->pending)
+      *replen = sup_repline(rep, repsize, e->pending);
+
+    e->hash = h;
+    e->pending = 0;
+    e->avail = full - sup_window; /* this print spends one token */
+    e->stamp = now;
+    allowed = 1;
+  }
+  else {
+    e->avail += (now - e->stamp) * sup_burst;
+    if (e->avail > full)
+      e->avail = full;
+    e->stamp = now;
+
+    if (e->avail >= sup_window) {
+      e->avail -= sup_window;
+      if (e->pending) {
+        *replen = sup_repline(rep, repsize, e->pending);
+        e->pending = 0;
+      }
+      allowed = 1;
+    }
+    else {
+      e->pending++;
+      sup_total++;
+      allowed = 0;
+    }
+  }
+
+  __atomic_store_n(&sup_lck, 0, __ATOMIC_RELEASE);
+  return allowed;
+}
+
+
+/* Flush every pending "repeated N times" count (exit, or suppression
+ * being turned off). */
+static void
+sup_flush(void)
+{
+  char rep[SUP_REPMAX];
+  size_t replen;
+  int i;
+
+  while (__atomic_exchange_n(&sup_lck, 1, __ATOMIC_ACQUIRE))
+    ;
+
+  for (i = 0; i < SUP_SLOTS; i++) {
+    if (sup_tab[i].pending) {
+      replen = sup_repline(rep, sizeof(rep), sup_tab[i].pending);
+      sup_tab[i].pending = 0;
+
+      __atomic_store_n(&sup_lck, 0, __ATOMIC_RELEASE);
+      xmessage_raw(rep, replen);
+      while (__atomic_exchange_n(&sup_lck, 1, __ATOMIC_ACQUIRE))
+        ;
+    }
+    sup_tab[i].hash = 0;
+  }
+
+  __atomic_store_n(&sup_lck, 0, __ATOMIC_RELEASE);
+}
+
+
+int
+xerror_suppress(int window_ms, int burst)
+{
+  if (window_ms < 0 || burst < 0)
+    return -1;
+
+  if (window_ms == 0)           /* disable; report what is still held */
+    sup_flush();
+
+  while (__atomic_exchange_n(&sup_lck, 1, __ATOMIC_ACQUIRE))
+    ;
+  sup_burst = burst > 0 ? burst : 1;
+  sup_window = window_ms;
+  __atomic_store_n(&sup_lck, 0, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+
+unsigned long
+xerror_suppressed(void)
+{
+  return __atomic_load_n(&sup_total, __ATOMIC_RELAXED);
+}
+
+
+#ifdef _PTHREAD
+static int
+async_push(const char *buf, size_t len)
+{
+  struct async_rec *r;
+  unsigned pos, seq;
+
+  if (len > ASYNC_RECMAX)
+    len = ASYNC_RECMAX;
+
+  pos = __atomic_load_n(&async_epos, __ATOMIC_RELAXED);
+  for (;;) {
+    r = &async_ring[pos & (ASYNC_SLOTS - 1)];
+    seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+
+    if (seq == pos) {
+      if (__atomic_compare_exchange_n(&async_epos, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    else if ((int)(seq - pos) < 0) {
+      /* ring full: drop, keep memory bounded */
+      __atomic_fetch_add(&async_dropped, 1, __ATOMIC_RELAXED);
+      return -1;
+    }
+    else
+      pos = __atomic_load_n(&async_epos, __ATOMIC_RELAXED);
+  }
+
+  memcpy(r->data, buf, len);
+  r->len = len;
+  __atomic_store_n(&r->seq, pos + 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+
+/* Drain the ring.  Only the flusher (or the thread that just stopped
+ * the flusher) may call this; there is a single consumer. */
+static void
+async_flush(void)
+{
+  struct async_rec *r;
+  unsigned pos, seq;
+  int wrote = 0;
+
+  LOCK();
+
+  if (xerror_stream == (FILE *)-1)
+    xerror_redirect_unlocked(stderr);
+
+  for (;;) {
+    pos = async_dpos;
+    r = &async_ring[pos & (ASYNC_SLOTS - 1)];
+    seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+
+    if (seq != pos + 1)
+      break;                    /* empty */
+
+    if (xerror_stream)
+      fwrite_unlocked(r->data, 1, r->len, xerror_stream);
+
+    __atomic_store_n(&r->seq, pos + ASYNC_SLOTS, __ATOMIC_RELEASE);
+    async_dpos = pos + 1;
+    wrote = 1;
+  }
+
+  if (wrote && xerror_stream)
+    fflush(xerror_stream);
+
+  UNLOCK();
+}
+
+
+static void *
+async_flusher(void *unused)
+{
+  struct timespec ts;
+
+  (void)unused;
+
+  while (!__atomic_load_n(&async_stop, __ATOMIC_ACQUIRE)) {
+    async_flush();
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = 2000000;       /* 2 msec between batches */
+    nanosleep(&ts, NULL);
+  }
+  async_flush();
+
+  return NULL;
+}
+#endif  /* _PTHREAD */
+
+
+int
+xerror_async(int enable)
+{
+#ifdef _PTHREAD
+  int i;
+
+  if (enable) {
+    if (__atomic_load_n(&async_mode, __ATOMIC_ACQUIRE))
+      return 0;
+
+    for (i = 0; i < ASYNC_SLOTS; i++)
+      async_ring[i].seq = i;
+    async_epos = async_dpos = 0;
+    async_stop = 0;
+
+    if (pthread_create(&async_flusher_thread, NULL, async_flusher, NULL) != 0)
+      return -1;
+
+    __atomic_store_n(&async_mode, 1, __ATOMIC_RELEASE);
+    return 0;
+  }
+
+  if (!__atomic_load_n(&async_mode, __ATOMIC_ACQUIRE))
+    return 0;
+
+  /* stop producers first, then the flusher; it drains on the way out */
+  __atomic_store_n(&async_mode, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&async_stop, 1, __ATOMIC_RELEASE);
+  pthread_join(async_flusher_thread, NULL);
+
+  return 0;
+#else
+  (void)enable;
+  return -1;
+#endif  /* _PTHREAD */
+}
+
+
+unsigned long
+xerror_async_dropped(void)
+{
+#ifdef _PTHREAD
+  return __atomic_load_n(&async_dropped, __ATOMIC_RELAXED);
+#else
+  return 0;
+#endif
+}
+
+
 static char *
 long2str(char *buf, size_t bufsize, long l, int base)
 {
@@ -474,10 +980,224 @@ long2str(char *buf, size_t bufsize, long l, int base)
 
 #define WRITE_STR(fd, s)        write((fd), (s), strlen(s))
 
+
+#ifdef __linux__
+/*
+ * Symbolization cache: xerror_init() walks the dynamic symbol table
+ * of every loaded object via dl_iterate_phdr(3) and keeps the
+ * function symbols in one array sorted by address.  bt_handler() then
+ * resolves each PC with a binary search plus raw write(2)s -- no
+ * malloc, no stdio -- so emitting a backtrace is async-signal-safe
+ * and cheap enough to dump traces periodically.  The names point into
+ * the objects' mapped string tables, so the cache itself is just the
+ * array.
+ */
+struct btsym {
+  unsigned long addr;
+  unsigned long size;
+  const char *name;
+};
+
+static struct btsym *btsym_table;
+static size_t btsym_count;
+static size_t btsym_capacity;
+
+static int
+btsym_add(unsigned long addr, unsigned long size, const char *name)
+{
+  if (btsym_count >= btsym_capacity) {
+    size_t ncap = btsym_capacity ? btsym_capacity * 2 : 1024;
+    struct btsym *p = realloc(btsym_table, ncap * sizeof(*p));
+    if (!p)
+      return -1;
+    btsym_table = p;
+    btsym_capacity = ncap;
+  }
+  btsym_table[btsym_count].addr = addr;
+  btsym_table[btsym_count].size = size;
+  btsym_table[btsym_count].name = name;
+  btsym_count++;
+  return 0;
+}
+
+
+static int
+btsym_cmp(const void *lhs, const void *rhs)
+{
+  const struct btsym *l = (const struct btsym *)lhs;
+  const struct btsym *r = (const struct btsym *)rhs;
+
+  if (l->addr < r->addr)
+    return -1;
+  if (l->addr > r->addr)
+    return 1;
+  return 0;
+}
+
+
+/*
+ * Return the number of entries in the dynamic symbol table.  DT_HASH
+ * records it directly (nchain); DT_GNU_HASH does not, so we take the
+ * highest bucket and follow its chain to the terminator.
+ */
+static size_t
+dynsym_count(const ElfW(Word) *hash, const uint32_t *gnu_hash)
+{
+  if (hash)
+    return hash[1];
+
+  if (gnu_hash) {
+    uint32_t nbuckets = gnu_hash[0];
+    uint32_t symoffset = gnu_hash[1];
+    uint32_t bloom_size = gnu_hash[2];
+    const uint32_t *buckets =
+      gnu_hash + 4 + bloom_size * (sizeof(ElfW(Addr)) / sizeof(uint32_t));
+    const uint32_t *chain = buckets + nbuckets;
+    uint32_t i, last = 0;
+
+    for (i = 0; i < nbuckets; i++)
+      if (buckets[i] > last)
+        last = buckets[i];
+    if (last < symoffset)
+      return symoffset;
+    while ((chain[last - symoffset] & 1) == 0)
+      last++;
+    return last + 1;
+  }
+  return 0;
+}
+
+
+static int
+btsym_scan_object(struct dl_phdr_info *info, size_t size, void *unused)
+{
+  const ElfW(Sym) *symtab = 0;
+  const char *strtab = 0;
+  const ElfW(Word) *hash = 0;
+  const uint32_t *gnu_hash = 0;
+  ElfW(Addr) ptr;
+  size_t i, nsyms;
+
+  (void)size;
+  (void)unused;
+
+  for (i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+    const ElfW(Dyn) *dyn;
+
+    if (ph->p_type != PT_DYNAMIC)
+      continue;
+
+    for (dyn = (const ElfW(Dyn) *)(info->dlpi_addr + ph->p_vaddr);
+         dyn->d_tag != DT_NULL; dyn++) {
+      /* The loader relocates these d_ptr values on most systems; if
+       * one still looks like an object-relative offset, rebase it. */
+      ptr = dyn->d_un.d_ptr;
+      if (ptr < info->dlpi_addr)
+        ptr += info->dlpi_addr;
+
+      switch (dyn->d_tag) {
+      case DT_SYMTAB:
+        symtab = (const ElfW(Sym) *)ptr;
+        break;
+      case DT_STRTAB:
+        strtab = (const char *)ptr;
+        break;
+      case DT_HASH:
+        hash = (const ElfW(Word) *)ptr;
+        break;
+      case DT_GNU_HASH:
+        gnu_hash = (const uint32_t *)ptr;
+        break;
+      }
+    }
+  }
+
+  if (!symtab || !strtab)
+    return 0;
+
+  nsyms = dynsym_count(hash, gnu_hash);
+  for (i = 0; i < nsyms; i++) {
+    const ElfW(Sym) *sym = &symtab[i];
+
+    if (sym->st_value == 0 || sym->st_name == 0)
+      continue;
+    /* ELF32_ST_TYPE and ELF64_ST_TYPE share one definition */
+    if (ELF32_ST_TYPE(sym->st_info) != STT_FUNC)
+      continue;
+    if (btsym_add(info->dlpi_addr + sym->st_value, sym->st_size,
+                  strtab + sym->st_name) != 0)
+      return 1;                 /* out of memory; keep what we have */
+  }
+  return 0;
+}
+
+
+static void
+btsym_init(void)
+{
+  if (btsym_table)
+    return;
+  dl_iterate_phdr(btsym_scan_object, 0);
+  if (btsym_count)
+    qsort(btsym_table, btsym_count, sizeof(*btsym_table), btsym_cmp);
+}
+
+
+static const struct btsym *
+btsym_lookup(unsigned long pc)
+{
+  size_t lo = 0, hi = btsym_count;
+  const struct btsym *sym;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (btsym_table[mid].addr <= pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0)
+    return 0;
+
+  sym = &btsym_table[lo - 1];
+  if (sym->size != 0 && pc >= sym->addr + sym->size)
+    return 0;
+  return sym;
+}
+
+
+static void
+btsym_write_frames(int fd, void *const *trace, int count)
+{
+  int i;
+
+  for (i = 0; i < count; i++) {
+    unsigned long pc = (unsigned long)trace[i];
+    const struct btsym *sym = btsym_lookup(pc);
+
+    WRITE_STR(fd, "[0x");
+    WRITE_NUM(fd, pc, 16);
+    WRITE_STR(fd, "] ");
+    if (sym) {
+      WRITE_STR(fd, sym->name);
+      WRITE_STR(fd, "+0x");
+      WRITE_NUM(fd, pc - sym->addr, 16);
+    }
+    else
+      WRITE_STR(fd, "??");
+    WRITE_STR(fd, "\n");
+  }
+}
+#endif  /* __linux__ */
+
+
 static void
 bt_handler(int signo, siginfo_t *info, void *uctx_void)
 {
-  void *trace[BACKTRACE_MAX];
+  /* static: keeps the frame buffer off the (possibly exhausted)
+   * crash stack; the handler is SA_RESETHAND so it cannot recurse. */
+  static void *trace[BACKTRACE_MAX];
   int ret;
   int bt_fd;
 
@@ -488,7 +1208,9 @@ bt_handler(int signo, siginfo_t *info, void *uctx_void)
 
   __sync_synchronize();
 
-  bt_fd = open(xerror_bt_filename, O_WRONLY | O_APPEND | O_CREAT, 0644);
+  bt_fd = xerror_bt_fd;
+  if (bt_fd == -1)              /* the pre-open failed; last resort */
+    bt_fd = open(xerror_bt_filename, O_WRONLY | O_APPEND | O_CREAT, 0644);
   if (bt_fd == -1) {
     bt_fd = xerror_fd;
     WRITE_STR(bt_fd, "Can't open the backtrace file, ");
@@ -496,6 +1218,9 @@ bt_handler(int signo, siginfo_t *info, void *uctx_void)
     WRITE_STR(bt_fd, "\n");
   }
 
+  if (xerror_bt_header_len > 0)
+    write(bt_fd, xerror_bt_header, xerror_bt_header_len);
+
   {
 #ifndef NO_MCONTEXT
 # ifdef __APPLE__
@@ -552,7 +1277,8 @@ bt_handler(int signo, siginfo_t *info, void *uctx_void)
 
   /* WARNING!
    *
-   * None of functions that used below are async signal-safe.
+   * When the symbolization cache is empty we fall back to
+   * backtrace_symbols_fd(3), which is not async signal-safe.
    * Thus, this is not a portable code. -- cinsk
    */
 
@@ -563,19 +1289,14 @@ bt_handler(int signo, siginfo_t *info, void *uctx_void)
   ret = backtrace(trace, BACKTRACE_MAX);
   /* TODO: error check on backtrace(3)? */
 
-  // fflush(xerror_stream);
-
-  if (!xerror_bt_filep)
+  /* BT_FD already points at the dump file (XBACKTRACE_FILE or the
+   * default), so the frames go straight there -- no re-open. */
+#ifdef __linux__
+  if (btsym_count)
+    btsym_write_frames(bt_fd, trace, ret);
+  else
+#endif
     backtrace_symbols_fd(trace, ret, bt_fd);
-  else {
-    int fd;
-    fd = open(xerror_bt_filename, O_CREAT | O_WRONLY, 0600);
-    if (fd != -1) {
-      backtrace_symbols_fd(trace, ret, fd);
-      close(fd);
-    }
-  }
-  // fflush(xerror_stream);
 
   /* http://tldp.org/LDP/abs/html/exitcodes.html */
   // _exit(128 + signo);
@@ -764,7 +1485,11 @@ ign_free(void)
 static void
 xerror_finalize(void)
 {
+  sup_flush();                  /* report still-suppressed duplicates */
+  xerror_async(0);              /* drain and stop the flusher if any */
   ign_free();
+  if (xerror_bt_fd != -1)
+    close(xerror_bt_fd);
   free(xerror_bt_filename);
   free(xerror_bt_command);
 }
@@ -812,6 +1537,10 @@ xerror_init(const char *prog_name, const char *ignore_search_dir)
   if (ign_load(ignore_search_dir) != 0)
     return -1;
 
+#ifdef __linux__
+  btsym_init();
+#endif
+
 #ifdef _PTHREAD
   {
     pthread_mutexattr_t attr;
@@ -141,9 +141,66 @@ extern void xmessage(int progname, int code, int ignore, int show_tid,
  */
 extern FILE *xerror_redirect(FILE *fp);
 
+/*
+ * Enable (nonzero) or disable (zero) asynchronous logging.
+ *
+ * In asynchronous mode, xerror()/xdebug_() format the message into a
+ * record and append it to a bounded lock-free MPSC ring; a background
+ * flusher thread writes the records out in batches.  Producers never
+ * block on the output stream, which keeps hot paths with debug
+ * categories enabled from stalling on stdio.
+ *
+ * Memory is bounded: if the ring is full the record is dropped and a
+ * counter is incremented (see xerror_async_dropped()).  A fatal
+ * xerror() (nonzero STATUS) drains the ring before exiting, and so
+ * does disabling asynchronous mode.  xerror_redirect() keeps working;
+ * records are written to whatever the output stream is at flush time.
+ *
+ * Asynchronous mode requires -D_PTHREAD and -lpthread; without
+ * _PTHREAD this function fails with -1.  Returns 0 on success.
+ */
+extern int xerror_async(int enable);
+
+/*
+ * Return the number of records dropped so far because the
+ * asynchronous ring was full.
+ */
+extern unsigned long xerror_async_dropped(void);
+
+/*
+ * Enable (or reconfigure) duplicate-message suppression.
+ *
+ * Records are hashed on their fully rendered line -- error code,
+ * format AND arguments -- so only true duplicates coalesce.  Every
+ * distinct record may be printed up to BURST times per WINDOW_MS
+ * msec (a token bucket, so short bursts pass intact and the first
+ * occurrence is never delayed); further repeats are counted and
+ * reported later as "last message repeated N times", when the record
+ * becomes printable again, when its table slot is reclaimed, or at
+ * exit.  A flapping dependency logging the identical error 50k
+ * times/s thus costs a couple of lines per window instead of making
+ * the logging itself the denial of service.
+ *
+ * xerror_suppress(0, 0) disables suppression (the default) and
+ * flushes any pending repeat counts.  Returns 0 on success, -1 on
+ * invalid arguments.
+ */
+extern int xerror_suppress(int window_ms, int burst);
+
+/*
+ * Return the total number of records suppressed so far.
+ */
+extern unsigned long xerror_suppressed(void);
+
 /*
  * Register one or more signals to generate backtrace if the program
  * receives signals.  Note that the last argument should be zero.
+ *
+ * On Linux, xerror_init() builds a symbolization cache (the dynamic
+ * symbols of every loaded object, sorted by address) so that the
+ * signal handler resolves frames with binary searches and raw
+ * write(2)s only.  Without the cache the handler falls back to
+ * backtrace_symbols_fd(3), which is not async-signal-safe.
  */
 extern int xbacktrace_on_signals(int signo, ...);
 
@@ -18,6 +18,7 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
@@ -43,14 +44,33 @@ struct xmlelement_ {
 };
 
 
+/* One interned element name.  NS/NAME live on the context's ipool and
+ * are allocated once per distinct qualified name; every XMLELEMENT
+ * with that name borrows the same pair, so pushing an element no
+ * longer copies its strings.  A catalog feed with a hundred distinct
+ * tags thus does a hundred string allocations total, not two per
+ * start-tag. */
+struct xmlintern_ {
+  unsigned long hash;
+  char *ns;                     /* NULL when the name has no namespace */
+  char *name;
+};
+
+#define INTERN_INITCAP  256     /* must be a power of two */
+
+
 int xp_node_equal(XMLELEMENT *elem, const char *espec);
 
 static char *basename(const char *filename);
+static unsigned long elm_hash(const char *s);
+static void elm_intern_grow(XMLCONTEXT *context);
+static struct xmlintern_ *elm_intern(XMLCONTEXT *context, const char *name);
 static void elm_push(XMLCONTEXT *context, const char *name);
 static void elm_pop(XMLCONTEXT *context);
 static void start_handler(void *data, const char *name, const char **attrs);
 static void end_handler(void *data, const char *name);
 static void char_handler(void *data, const char *s, int len);
+static void flush_cdata(XMLCONTEXT *context);
 
 
 void
@@ -116,23 +136,101 @@ basename(const char *filename)
 }
 
 
+/* FNV-1a over the expat-expanded qualified name. */
+static unsigned long
+elm_hash(const char *s)
+{
+  unsigned long h = 2166136261UL;
+
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+
 static void
-elm_push(XMLCONTEXT *context, const char *name)
+elm_intern_grow(XMLCONTEXT *context)
 {
-  XMLELEMENT *p;
-  char *q;
+  struct xmlintern_ *ntab, *e;
+  unsigned ncap, mask, i, j;
+
+  ncap = context->itab_cap * 2;
+  ntab = calloc(ncap, sizeof(*ntab));
+  if (!ntab)
+    return;                     /* denser but still correct */
+
+  mask = ncap - 1;
+  for (i = 0; i < context->itab_cap; i++) {
+    e = context->itab + i;
+    if (!e->name)
+      continue;
+    for (j = e->hash & mask; ntab[j].name; j = (j + 1) & mask)
+      ;
+    ntab[j] = *e;
+  }
+  free(context->itab);
+  context->itab = ntab;
+  context->itab_cap = ncap;
+}
 
-  p = OBSTACK_ALLOC(context->pool, sizeof(*p));
 
-  q = strchr(name, XML_NS_SEP);
-  if (!q) {
-    p->ns = NULL;
-    p->name = OBSTACK_STR_COPY(context->pool, name);
+/* Return the interned NS/NAME pair for the qualified NAME, creating
+ * it on the first encounter.  Open addressing with linear probing;
+ * the table doubles at 3/4 load, so lookups stay at a slot or two. */
+static struct xmlintern_ *
+elm_intern(XMLCONTEXT *context, const char *name)
+{
+  unsigned long hash = elm_hash(name);
+  const char *sep = strchr(name, XML_NS_SEP);
+  struct xmlintern_ *e;
+  unsigned i, mask;
+
+  if (context->itab_len * 4 >= context->itab_cap * 3)
+    elm_intern_grow(context);
+
+  mask = context->itab_cap - 1;
+  for (i = hash & mask; ; i = (i + 1) & mask) {
+    e = context->itab + i;
+    if (!e->name)
+      break;
+    if (e->hash != hash)
+      continue;
+    if (sep) {
+      if (e->ns && memcmp(e->ns, name, sep - name) == 0 &&
+          e->ns[sep - name] == '\0' && strcmp(e->name, sep + 1) == 0)
+        return e;
+    }
+    else if (!e->ns && strcmp(e->name, name) == 0)
+      return e;
+  }
+
+  e->hash = hash;
+  if (sep) {
+    e->ns = OBSTACK_COPY0(context->ipool, name, sep - name);
+    e->name = OBSTACK_STR_COPY(context->ipool, sep + 1);
   }
   else {
-    p->ns = OBSTACK_COPY0(context->pool, name, q - name);
-    p->name = OBSTACK_STR_COPY(context->pool, q + 1);
+    e->ns = NULL;
+    e->name = OBSTACK_STR_COPY(context->ipool, name);
   }
+  context->itab_len++;
+  return e;
+}
+
+
+static void
+elm_push(XMLCONTEXT *context, const char *name)
+{
+  XMLELEMENT *p;
+  struct xmlintern_ *in;
+
+  p = OBSTACK_ALLOC(context->pool, sizeof(*p));
+
+  in = elm_intern(context, name);
+  p->ns = in->ns;
+  p->name = in->name;
   p->lev = context->lev;
   p->grab = 0;
 
@@ -166,6 +264,7 @@ start_handler(void *data, const char *name, const char **attrs)
 {
   XMLCONTEXT *context = (XMLCONTEXT *)data;
 
+  flush_cdata(context);
   elm_push(context, name);
 
   if (context->lev <= context->ignore_lev) {
@@ -181,6 +280,8 @@ end_handler(void *data, const char *name)
 {
   XMLCONTEXT *context = (XMLCONTEXT *)data;
 
+  flush_cdata(context);
+
   if (context->stack->grab) {
     OBSTACK_1GROW(context->tpool, '\0');
     context->stack->text = OBSTACK_FINISH(context->tpool);
@@ -196,6 +297,26 @@ end_handler(void *data, const char *name)
 }
 
 
+/*
+ * Hand the pending character-data run to the user's char handler.
+ *
+ * char_handler() below does not deliver right away: expat chops
+ * character data at entity references, CDATA edges and buffer seams,
+ * and runs that are adjacent in the input buffer are glued back
+ * together by pointer arithmetic alone.  The user thus sees one call
+ * per text region, with a pointer into the input buffer -- no copy.
+ */
+static void
+flush_cdata(XMLCONTEXT *context)
+{
+  if (context->cdata_len > 0 && context->cb_char)
+    context->cb_char(context, context->cdata_run, context->cdata_len);
+
+  context->cdata_run = NULL;
+  context->cdata_len = 0;
+}
+
+
 static void
 char_handler(void *data, const char *s, int len)
 {
@@ -207,10 +328,22 @@ char_handler(void *data, const char *s, int len)
     //printf("grabbing %d bytes\n", len);
     OBSTACK_GROW(context->tpool, s, len);
   }
-#if 0
-  if (context->cb_char && context->lev <= context->ignore_lev)
-    context->cb_char(context, s, len);
-#endif  /* 0 */
+
+  if (context->cb_char && context->lev <= context->ignore_lev) {
+    if (context->cdata_len > 0 &&
+        s == context->cdata_run + context->cdata_len)
+      context->cdata_len += len;  /* contiguous; extend the run */
+    else if (context->cdata_len > 0 && len == 1 && s[0] == '\n' &&
+             context->cdata_run[context->cdata_len] == '\n')
+      /* expat reports a newline from its own buffer, but the byte
+       * after the run is that very newline; keep the run in place. */
+      context->cdata_len += 1;
+    else {
+      flush_cdata(context);
+      context->cdata_run = s;
+      context->cdata_len = len;
+    }
+  }
 }
 
 
@@ -370,7 +503,7 @@ xp_open(const char *pathname)
   p = malloc(sizeof(*p));
   if (!p)
     return NULL;
-  memset(p, 0, sizeof(p));
+  memset(p, 0, sizeof(*p));
 
   p->tpool = &p->tpool_;
   if (OBSTACK_INIT(p->tpool) < 0)
@@ -380,6 +513,16 @@ xp_open(const char *pathname)
   if (OBSTACK_INIT(p->pool) < 0)
     goto err;
 
+  p->ipool = &p->ipool_;
+  if (OBSTACK_INIT(p->ipool) < 0)
+    goto err;
+
+  p->itab_cap = INTERN_INITCAP;
+  p->itab_len = 0;
+  p->itab = calloc(p->itab_cap, sizeof(struct xmlintern_));
+  if (!p->itab)
+    goto err;
+
   p->filename = OBSTACK_STR_COPY(p->pool, basename(pathname));
   if (!p->filename)
     goto err;
@@ -400,6 +543,7 @@ xp_open(const char *pathname)
   return p;
 
  err:
+  free(p->itab);
   OBSTACK_FREE(p->pool, NULL);
   free(p);
   return NULL;
@@ -418,6 +562,10 @@ xp_close(XMLCONTEXT *context)
   if (context->tpool)
     OBSTACK_FREE(context->tpool, NULL);
 
+  free(context->itab);
+  if (context->ipool)
+    OBSTACK_FREE(context->ipool, NULL);
+
   free(context);
 }
 
@@ -460,6 +608,11 @@ xp_perform(XMLCONTEXT *context, int fd)
     }
 
     ret = XML_ParseBuffer(context->parser, readch, (readch == 0));
+
+    /* the buffer may move on the next XML_GetBuffer(); a pending
+     * character-data run must not outlive it. */
+    flush_cdata(context);
+
     if (ret != XML_STATUS_OK) {
       fprintf(stderr, "%s: %lu: error: %s\n", context->filename,
               XML_GetCurrentLineNumber(context->parser),
@@ -478,6 +631,57 @@ xp_perform(XMLCONTEXT *context, int fd)
 }
 
 
+int
+xp_perform_mmap(XMLCONTEXT *context, int fd)
+{
+  struct stat sbuf;
+  char *volatile map = MAP_FAILED;
+  volatile size_t mapsize = 0;
+  size_t off;
+  int chunk, ret, jret;
+
+  if (fstat(fd, &sbuf) < 0) {
+    fprintf(stderr, "error: fstat(2) failed: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (sbuf.st_size > 0)
+    map = mmap(NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)        /* a pipe or a socket, perhaps */
+    return xp_perform(context, fd);
+
+  mapsize = sbuf.st_size;
+  madvise(map, mapsize, MADV_SEQUENTIAL);
+
+  jret = sigsetjmp(context->jmp, 1);
+  if (jret) {
+    fprintf(stderr, "warning: callback cancels xp_perform().\n");
+    munmap(map, mapsize);
+    return -2;
+  }
+
+  /* One XML_Parse() call per window, straight from the mapping; the
+   * window only exists because XML_Parse() takes an int length. */
+  ret = 0;
+  for (off = 0; off < mapsize; off += chunk) {
+    chunk = MIN(mapsize - off, (size_t)(INT_MAX / 2));
+
+    if (XML_Parse(context->parser, map + off, chunk,
+                  off + chunk >= mapsize) != XML_STATUS_OK) {
+      fprintf(stderr, "%s: %lu: error: %s\n", context->filename,
+              XML_GetCurrentLineNumber(context->parser),
+              XML_ErrorString(XML_GetErrorCode(context->parser)));
+      ret = -1;
+      break;
+    }
+    flush_cdata(context);
+  }
+
+  munmap(map, mapsize);
+  return ret;
+}
+
+
 int
 xp_qnamecmp(const char *spec1, const char *spec2)
 {
@@ -51,6 +51,8 @@ typedef struct xmlcontext_ XMLCONTEXT;
 struct xmlelement_;
 typedef struct xmlelement_ XMLELEMENT;
 
+struct xmlintern_;              /* interned element name; xmlparse.c */
+
 typedef void (*xp_start_handler)(XMLCONTEXT *, const char *, const char **);
 typedef void (*xp_end_handler)(XMLCONTEXT *, const char *, const char *);
 typedef void (*xp_char_handler)(XMLCONTEXT *, const char *, int);
@@ -73,6 +75,19 @@ struct xmlcontext_ {
 
   sigjmp_buf jmp;
 
+  /* pending zero-copy character-data run; see xp_set_char_handler() */
+  const char *cdata_run;
+  int cdata_len;
+
+  /* interned element names (see elm_intern() in xmlparse.c); their
+   * storage lives on ipool, never released before xp_close(). */
+  struct xmlintern_ *itab;
+  unsigned itab_cap;
+  unsigned itab_len;
+
+  struct obstack *ipool;
+  struct obstack ipool_;
+
   struct obstack *tpool;
   struct obstack tpool_;
 
@@ -120,6 +135,19 @@ void xp_close(XMLCONTEXT *context);
  */
 int xp_perform(XMLCONTEXT *context, int fd);
 
+/*
+ * Like xp_perform(), but mmap(2) FD and hand the mapping to the
+ * parser in place, instead of copying the document through small
+ * read(2) chunks.  The character-data pointers seen by the char
+ * handler then point straight into the mapped file.
+ *
+ * If FD cannot be mapped (a pipe or a socket, say), this silently
+ * falls back to xp_perform().
+ *
+ * The return value convention is that of xp_perform().
+ */
+int xp_perform_mmap(XMLCONTEXT *context, int fd);
+
 /*
  * Simple wrappers for XML_SetStartElementHandler,
  * XML_SetEndElementHandler, and XML_SetCharacterDataHandler.
@@ -128,6 +156,14 @@ int xp_perform(XMLCONTEXT *context, int fd);
  * XML_SetEndElementHandler, and XML_SetCharacterDataHandler.  Other
  * handlers of expat library are safe to use directly with expat
  * functions.
+ *
+ * The char handler is zero-copy: the (pointer, length) pair it
+ * receives points into the parser's input buffer (into the mapped
+ * file itself under xp_perform_mmap()), and adjacent runs are
+ * coalesced, so one call covers a whole character-data region
+ * instead of one call per expat-internal chunk.  The pointer is only
+ * valid for the duration of the call; copy the bytes out if you need
+ * them afterwards.
  */
 void xp_set_start_handler(XMLCONTEXT *context, xp_start_handler callback);
 void xp_set_end_handler(XMLCONTEXT *context, xp_end_handler callback);
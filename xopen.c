@@ -5,9 +5,13 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdarg.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
+#include "xopen.h"
+
 
 /*
  * eXtended open(2)
@@ -20,22 +24,127 @@
  * - If it refers a FIFO, xopen() opens the FIFO.  Unnecessary flags
  *   such as O_CREAT, O_TRUNC, or O_EXCL are removed from FLAGS in
  *   this case.
- * - If it refers to a socket file, xopen() connect(2)s to it.  Since
- *   xopen() does not know whether the socket file is a datagram
- *   socket or a stream socket, it tries one after another.  FLAGS are
- *   ignored in this case.
+ * - If it refers to a socket file, xopen() connect(2)s to it.  A
+ *   datagram connect is tried first (it is a pure address check and
+ *   can never block); EPROTOTYPE from that single cheap probe means
+ *   the file is a stream socket, which is then connected
+ *   non-blocking.  Except for O_NONBLOCK, FLAGS are ignored in this
+ *   case.
  * - If PATHNAME refers to other type of special file, it just call
  *   open(2).
  *
+ * xopen_t() is identical but bounds the stream connect by a deadline;
+ * see xopen.h.
  */
-int
-xopen(const char *pathname, int flags, ...)
+
+static long long
+now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static int
+sock_connect(const char *pathname, int flags, int timeout)
+{
+  struct sockaddr_un addr;
+  struct pollfd pfd;
+  long long deadline = 0;
+  int fd, saved_errno;
+
+  if (strlen(pathname) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_LOCAL;
+  strcpy(addr.sun_path, pathname);
+
+  /* Probe the socket type with one datagram connect: it never blocks,
+   * succeeds if the file is a datagram socket, and fails immediately
+   * with EPROTOTYPE if it is a stream socket.  (The type is not in
+   * stat(2); this is the cheapest single check there is.) */
+  fd = socket(AF_LOCAL, SOCK_DGRAM, 0);
+  if (fd == -1)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    return fd;
+  saved_errno = errno;
+  close(fd);
+  if (saved_errno != EPROTOTYPE) {
+    errno = saved_errno;
+    return -1;
+  }
+
+  if (timeout >= 0)
+    deadline = now_ms() + timeout;
+
+  fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd == -1)
+    return -1;
+
+  while (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    if (errno == EINPROGRESS) {
+      socklen_t len = sizeof(saved_errno);
+
+      pfd.fd = fd;
+      pfd.events = POLLOUT;
+      if (poll(&pfd, 1, timeout) == 0) {
+        close(fd);
+        errno = ETIMEDOUT;
+        return -1;
+      }
+      if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &saved_errno, &len) == -1)
+        saved_errno = errno;
+      if (saved_errno != 0) {
+        close(fd);
+        errno = saved_errno;
+        return -1;
+      }
+      break;
+    }
+    else if (errno == EAGAIN) {
+      /* unix stream sockets report a full listen backlog as EAGAIN
+       * rather than EINPROGRESS; back off and retry until the
+       * deadline. */
+      int slice = 10;
+
+      if (timeout >= 0) {
+        long long left = deadline - now_ms();
+        if (left <= 0) {
+          close(fd);
+          errno = ETIMEDOUT;
+          return -1;
+        }
+        if (slice > left)
+          slice = left;
+      }
+      poll(NULL, 0, slice);
+    }
+    else if (errno != EINTR) {
+      saved_errno = errno;
+      close(fd);
+      errno = saved_errno;
+      return -1;
+    }
+  }
+
+  if (!(flags & O_NONBLOCK)) {
+    int fl = fcntl(fd, F_GETFL, 0);
+    if (fl != -1)
+      fcntl(fd, F_SETFL, fl & ~O_NONBLOCK);
+  }
+  return fd;
+}
+
+
+static int
+xopen_i(const char *pathname, int flags, int timeout, mode_t mode)
 {
   struct stat statbuf;
   int fd;
-  mode_t mode = 0;
-  va_list ap;
-  int saved_errno;
 
   if (stat(pathname, &statbuf) == -1) {
     if (errno == ENOENT)
@@ -45,12 +154,8 @@ xopen(const char *pathname, int flags, ...)
 
   if (S_ISREG(statbuf.st_mode) ) {
   do_create:
-    if (flags & O_CREAT) {
-      va_start(ap, flags);
-      mode = (mode_t)va_arg(ap, mode_t);
-      va_end(ap);
+    if (flags & O_CREAT)
       fd = open(pathname, flags, mode);
-    }
     else
       fd = open(pathname, flags);
     return fd;
@@ -61,42 +166,11 @@ xopen(const char *pathname, int flags, ...)
     return fd;
   }
   else if (S_ISSOCK(statbuf.st_mode)) {
-    struct sockaddr_un addr;
-    if (strlen(pathname) >= sizeof(addr.sun_path)) {
-      errno = ENAMETOOLONG;
-      return -1;
-    }
-    fd = socket(AF_LOCAL, SOCK_STREAM, 0);
-    if (fd == -1)
-      return -1;
-    memset(&addr, 0, sizeof(addr));
-    addr.sun_family = AF_LOCAL;
-    strcpy(addr.sun_path, pathname);
-    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
-      close(fd);
-      if (errno != EPROTOTYPE)
-        return -1;
-
-      fd = socket(AF_LOCAL, SOCK_DGRAM, 0);
-      if (fd == -1)
-        return -1;
-      if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
-        saved_errno = errno;
-        close(fd);
-        errno = saved_errno;
-        return -1;
-      }
-    }
-    return fd;
+    return sock_connect(pathname, flags, timeout);
   }
   else {
-    if (flags & O_CREAT) {
-      va_start(ap, flags);
-      mode = (mode_t)va_arg(ap, mode_t);
-      va_end(ap);
-
+    if (flags & O_CREAT)
       fd = open(pathname, flags, mode);
-    }
     else
       fd = open(pathname, flags);
     return fd;
@@ -104,6 +178,36 @@ xopen(const char *pathname, int flags, ...)
 }
 
 
+int
+xopen(const char *pathname, int flags, ...)
+{
+  mode_t mode = 0;
+  va_list ap;
+
+  if (flags & O_CREAT) {
+    va_start(ap, flags);
+    mode = (mode_t)va_arg(ap, mode_t);
+    va_end(ap);
+  }
+  return xopen_i(pathname, flags, -1, mode);
+}
+
+
+int
+xopen_t(const char *pathname, int flags, int timeout, ...)
+{
+  mode_t mode = 0;
+  va_list ap;
+
+  if (flags & O_CREAT) {
+    va_start(ap, timeout);
+    mode = (mode_t)va_arg(ap, mode_t);
+    va_end(ap);
+  }
+  return xopen_i(pathname, flags, timeout, mode);
+}
+
+
 #ifndef TEST_XOPEN
 #include <stdio.h>
 
@@ -0,0 +1,24 @@
+#ifndef XOPEN_H__
+#define XOPEN_H__
+
+/*
+ * eXtended open(2).  See the comment in xopen.c for the full story:
+ * regular files and unknown specials go through open(2), FIFOs are
+ * opened with the creation flags stripped, and unix socket files are
+ * connect(2)ed transparently.
+ */
+extern int xopen(const char *pathname, int flags, ...);
+
+/*
+ * Like xopen(), but a connect(2) on a socket file gives up after
+ * TIMEOUT milliseconds (-1 means wait forever, like xopen()).  The
+ * connect is performed non-blocking with poll(2), so a wedged peer
+ * daemon costs at most TIMEOUT instead of the kernel's connect
+ * timeout.  On timeout it returns -1 with errno set to ETIMEDOUT.
+ *
+ * TIMEOUT only bounds the socket case; open(2) itself is not
+ * interrupted.
+ */
+extern int xopen_t(const char *pathname, int flags, int timeout, ...);
+
+#endif  /* XOPEN_H__ */